@@ -6,6 +6,7 @@
 
 #include "vmmconfig.h"
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -14,6 +15,79 @@ extern "C"
 
 namespace voltek
 {
+	// Счётчики кеша больших блоков (больше 128 кб).
+	struct scalable_large_stats
+	{
+		// Выполнено обращений к системе за страницами (резервирование, выделение, освобождение).
+		uint64_t os_calls;
+		// Столько вызовов понадобилось бы без кеша, разница - сбережённые вызовы.
+		uint64_t baseline_calls;
+		// Блоков выдано из кеша.
+		uint64_t cache_hits;
+		// Блоков выдано новых.
+		uint64_t cache_misses;
+		// Блоков, изменивших размер на месте без копирования.
+		uint64_t resize_in_place;
+		// Зарезервировано памяти участками в кеше.
+		uint64_t cached_bytes;
+		// Выделено памяти участками в кеше.
+		uint64_t cached_committed_bytes;
+	};
+
+	// Счётчики страниц пулов (блоки до 128 кб).
+	// Скорость (страниц в секунду) считается по разнице двух снимков.
+	struct scalable_pool_stats
+	{
+		// Создано страниц.
+		uint64_t pages_created;
+		// Удалено страниц.
+		uint64_t pages_destroyed;
+		// Пустых страниц оставлено про запас.
+		uint64_t pages_retained;
+		// Память пустых страниц, оставленных про запас.
+		uint64_t retained_bytes;
+	};
+
+	// Кол-во классов размера в статистике: пулы по лестнице размеров и последним - большие блоки.
+	constexpr static size_t SCALABLE_STATS_CLASSES = 49;
+
+	// Статистика одного класса размера.
+	struct scalable_class_stats
+	{
+		// Размер блока класса, 0 у больших блоков.
+		uint64_t block_size;
+		// Выделено блоков.
+		uint64_t allocs;
+		// Освобождено блоков.
+		uint64_t frees;
+		// Блоков сейчас занято.
+		uint64_t live_blocks;
+		// Блоков выдано из кешей без блокировки.
+		uint64_t cache_hits;
+		// Блоков взято из пула под блокировкой, кеши были пусты.
+		uint64_t cache_misses;
+		// Пополнений кеша пачкой блоков.
+		uint64_t refills;
+		// Страниц (сегментов, участков) выделено у системы.
+		uint64_t committed_pages;
+		// Память этих страниц.
+		uint64_t committed_bytes;
+	};
+
+	// Статистика менеджера.
+	// Счётчики только растут, скорость считается по разнице двух снимков.
+	struct scalable_stats
+	{
+		// По классам размера, последний - большие блоки (больше 128 кб).
+		scalable_class_stats classes[SCALABLE_STATS_CLASSES];
+		// Сумма по всем классам.
+		scalable_class_stats total;
+		// Выделено памяти выданными большими блоками.
+		uint64_t large_bytes;
+		// Памяти на больших страницах (только гарантированно, совет системе не считается).
+		uint64_t large_page_bytes;
+	};
+
 	// Инициализация менеджера памяти.
 	VOLTEK_MM_API void scalable_memory_manager_initialize();
 	// Освобождение менеджера памяти.
@@ -30,7 +104,8 @@ namespace voltek
 	// При ошибке вернёт nullptr, это если size равен более 4 гб.
 	// Также вернёт nullptr если память физически кончилась.
 	// Вернёт постоянный адрес при затребовании памяти равной 0.
-	// Память всегда выровнена и обнулена.
+	// Память всегда выровнена и обнулена. Память больших блоков, что свежая от системы,
+	// уже обнулена и повторно не трогается, поэтому не становится резидентной раньше времени.
 	VOLTEK_MM_API void* scalable_calloc(size_t count, size_t size);
 	// Выделение памяти нужного размера из прошлого указателя на память.
 	// При ошибке вернёт nullptr, это если size равен 0 или более 4 гб.
@@ -46,9 +121,60 @@ namespace voltek
 	// Освобождает память выделенную под указатель.
 	// Вернёт ложь, если произошла ошибка.
 	VOLTEK_MM_API bool scalable_free(const void* ptr);
+	// Освобождает память выделенную под указатель, size - размер, что запрашивался при выделении.
+	// Зная размер, менеджер отдаёт блок сразу нужному пулу, минуя разбор выравнивания.
+	// Чужой указатель не читается и даёт ложь. Если размер не совпал, то это обычный scalable_free.
+	// Вернёт ложь, если произошла ошибка.
+	VOLTEK_MM_API bool scalable_free_sized(const void* ptr, size_t size);
+	// Выделение памяти сразу под count блоков одного размера, указатели пишутся в ptrs.
+	// Блоки нарезаются из страницы пула за одну блокировку, это быстрее, чем по одному.
+	// Возвращает кол-во выделенных блоков, меньше count, если память физически кончилась.
+	VOLTEK_MM_API size_t scalable_alloc_batch(void** ptrs, size_t count, size_t size);
+	// Освобождает count блоков одного размера из ptrs, size - размер, что запрашивался при выделении.
+	// Нулевые указатели пропускаются.
+	// Вернёт ложь, если произошла ошибка хоть с одним указателем.
+	VOLTEK_MM_API bool scalable_free_batch(void* const* ptrs, size_t count, size_t size);
 	// Возвращает размер памяти выделенной под указатель.
 	// Вернёт 0 при ошибке, что значит, указатель на память не пренадлежит менеджеру.
 	VOLTEK_MM_API size_t scalable_msize(const void* ptr);
+	// Выделение памяти нужного размера, выровненной по alignment.
+	// Выравнивание должно быть степенью двойки, иначе вернёт nullptr.
+	// Также вернёт nullptr если память физически кончилась.
+	// Освобождается через scalable_free, размер возвращает scalable_msize.
+	VOLTEK_MM_API void* scalable_aligned_alloc(size_t size, size_t alignment);
+	// Выделение памяти нужного размера из прошлого указателя на память, выровненной по alignment.
+	// При ошибке вернёт nullptr, это если size равен 0 или выравнивание не степень двойки.
+	// Адрес памяти может быть изменён.
+	VOLTEK_MM_API void* scalable_aligned_realloc(const void* ptr, size_t size, size_t alignment);
+	// Задаёт приоритет (THREAD_PRIORITY_*) и маску ядер для фонового потока, что пополняет кеши пулов.
+	// Поток спит, пока кеш какого-нибудь пула не опустеет ниже порога.
+	// Маска 0 означает, что поток может работать на любом ядре.
+	VOLTEK_MM_API void scalable_memory_manager_set_refill_thread(int priority, uint64_t affinity_mask);
+	// Возвращает счётчики кеша больших блоков.
+	// Вернёт ложь, если менеджер не инициализирован.
+	VOLTEK_MM_API bool scalable_get_large_stats(scalable_large_stats* stats);
+	// Задаёт, сколько пустых страниц (не больше, чем на bytes байт) каждый пул держит про запас,
+	// и через сколько мс простоя они возвращаются системе. 0 страниц - удалять сразу.
+	VOLTEK_MM_API void scalable_memory_manager_set_page_retention(size_t pages, size_t bytes, uint32_t idle_ms);
+	// Возвращает системе свободную память, что менеджер держит у себя: кеш больших блоков,
+	// пустые страницы пулов и пустые сегменты мелких блоков, пока не освободится budget байт
+	// (0 - всё, что можно).
+	// Работает долго, вызывать там, где задержка не заметна (например, на экране загрузки).
+	// Возвращает кол-во освобождённых байт.
+	VOLTEK_MM_API size_t scalable_trim(size_t budget);
+	// Переносит мелкие блоки (до 64 байт) на большие страницы, первые bytes байт выделяются сразу
+	// и не возвращаются системе. Меньше промахов TLB на самых частых выделениях.
+	// Вызывать сразу после инициализации, до первых выделений.
+	// Для Windows нужна привилегия SeLockMemoryPrivilege, без неё, как и при нехватке больших страниц,
+	// вернёт ложь и всё останется на обычных страницах (где умеет, система попросит держать их на больших).
+	VOLTEK_MM_API bool scalable_memory_manager_set_large_pages(size_t bytes);
+	// Возвращает счётчики страниц пулов.
+	// Вернёт ложь, если менеджер не инициализирован.
+	VOLTEK_MM_API bool scalable_get_pool_stats(scalable_pool_stats* stats);
+	// Возвращает статистику по классам размера.
+	// Потоки считают сами за себя без блокировки, поэтому значения приблизительные.
+	// Вернёт ложь, если менеджер не инициализирован.
+	VOLTEK_MM_API bool scalable_get_stats(scalable_stats* stats);
 }
 
 #ifdef __cplusplus
@@ -103,7 +229,7 @@ namespace voltek
 		// Не совсем понимаю, почему сразу необъявить одну функцию как конст,
 		// он не изменяет свой объект.
 		// В стандарте нет упоминания, что память должна быть обнулена.
-		__declspec(allocator) inline pointer allocate(size_type n) const
+		VOLTEK_MM_ALLOCATOR inline pointer allocate(size_type n) const
 		{
 			pointer new_ptr = (pointer)scalable_alloc(n * sizeof(value_type));
 			if (!new_ptr) throw std::bad_alloc();
@@ -123,10 +249,8 @@ namespace voltek
 		// Функция освобождает память.
 		inline void deallocate(const pointer ptr, size_type size) const
 		{
-			// На size плевать, он нас не интересует.
-			// Так же всё равно на заведомо плохой указатель, для
-			// Windows встроенна защита SEH.
-			scalable_free((void*)ptr);
+			// Размер известен, блок вернётся в пул напрямую.
+			scalable_free_sized((void*)ptr, size * sizeof(value_type));
 		}
 		// Возвращает максимально возможный размер для одного указателя.
 		inline size_type max_size() const
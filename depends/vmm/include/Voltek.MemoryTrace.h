@@ -0,0 +1,82 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace voltek
+{
+	// Формат файла трассы выделений памяти.
+	// Файл начинается с заголовка, дальше идут записи по 32 байта. Записи пишутся пачками
+	// из буферов потоков, поэтому в файле они не упорядочены, порядок задаёт время.
+	// Указатели хранятся как есть и служат лишь номером блока: выделение с тем же номером,
+	// что и освобождение до него, - это тот же блок.
+
+	// Сигнатура 'XCMT'.
+	constexpr static uint32_t MEMORY_TRACE_MAGIC = 0x544D4358;
+	// Версия формата.
+	constexpr static uint32_t MEMORY_TRACE_VERSION = 1;
+
+	// Вид операции.
+	// Выделение, block - новый блок.
+	constexpr static uint8_t MEMORY_TRACE_ALLOC = 1;
+	// Освобождение, block - освобождаемый блок.
+	constexpr static uint8_t MEMORY_TRACE_FREE = 2;
+	// Изменение размера, prev - старый блок, block - новый блок.
+	constexpr static uint8_t MEMORY_TRACE_REALLOC = 3;
+
+	// Откуда пришёл запрос.
+	// CRT (malloc, free и прочие).
+	constexpr static uint8_t MEMORY_TRACE_SOURCE_CRT = 0;
+	// Менеджер памяти игры.
+	constexpr static uint8_t MEMORY_TRACE_SOURCE_GAME = 1;
+	// Черновая куча игры (ScrapHeap).
+	constexpr static uint8_t MEMORY_TRACE_SOURCE_SCRAP = 2;
+
+	// Заголовок файла трассы.
+	struct memory_trace_header
+	{
+		// Сигнатура MEMORY_TRACE_MAGIC.
+		uint32_t magic;
+		// Версия формата MEMORY_TRACE_VERSION.
+		uint32_t version;
+		// Размер записи в байтах.
+		uint32_t record_size;
+		// Зарезервировано.
+		uint32_t reserved;
+		// Кол-во тактов времени в секунду.
+		uint64_t frequency;
+	};
+
+	static_assert(sizeof(memory_trace_header) == 24, "sizeof(memory_trace_header) == 24");
+
+	// Запись трассы.
+	struct memory_trace_record
+	{
+		// Время в тактах.
+		uint64_t time;
+		// Номер блока (указатель).
+		uint64_t block;
+		// Номер старого блока при изменении размера, иначе 0.
+		uint64_t prev;
+		// Запрошенный размер, у освобождения 0.
+		uint32_t size;
+		// Номер потока в трассе.
+		uint16_t thread;
+		// Вид операции в младших 4 битах, откуда запрос - в старших.
+		uint8_t op;
+		// Степень двойки выравнивания, 0 - без выравнивания.
+		uint8_t align_shift;
+	};
+
+	static_assert(sizeof(memory_trace_record) == 32, "sizeof(memory_trace_record) == 32");
+
+	// Собирает поле op записи.
+	constexpr static uint8_t make_memory_trace_op(uint8_t kind, uint8_t source)
+	{
+		return (uint8_t)((source << 4) | (kind & 0xF));
+	}
+}
@@ -5,11 +5,22 @@
 #pragma once
 
 #ifndef VOLTEK_LIB_BUILD
-#	ifdef VMM_EXPORTS
-#		define VOLTEK_MM_API __declspec(dllexport)
+#	if (defined(_WIN32) || defined(_WIN64))
+#		ifdef VMM_EXPORTS
+#			define VOLTEK_MM_API __declspec(dllexport)
+#		else
+#			define VOLTEK_MM_API __declspec(dllimport)
+#		endif // VOLTEK_DLL_BUILD
 #	else
-#		define VOLTEK_MM_API __declspec(dllimport)
-#	endif // VOLTEK_DLL_BUILD
+#		define VOLTEK_MM_API __attribute__((visibility("default")))
+#	endif
 #else
 #	define VOLTEK_MM_API
 #endif // !VOLTEK_LIB_BUILD
+
+// Помечает функции, возвращающие новую память, для отладчика MSVC.
+#if defined(_MSC_VER)
+#	define VOLTEK_MM_ALLOCATOR __declspec(allocator)
+#else
+#	define VOLTEK_MM_ALLOCATOR
+#endif
@@ -5,11 +5,13 @@
 #include "valloc.h"
 #include "vmapper.h"
 #include "vsimplelock.h"
+#include "vplatform.h"
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
-
-#include <Windows.h>
-#include <comdef.h>
+#if defined(_M_X64) || defined(__x86_64__)
+#	include <emmintrin.h>
+#endif
 
 #define VOLTEK_DEFAULT_HEAP_SIZE ((uint64_t)8ull * 1024 * 1024 * 1024)
 
@@ -309,6 +311,65 @@ namespace voltek
 				pointer_handle* handle = (pointer_handle*)((size_t)ptr - sizeof(pointer_handle));
 				return handle->alloc_size;
 			}
+
+			void* virtual_alloc(size_t size)
+			{
+				return platform::page_reserve_commit(size);
+			}
+
+			void virtual_free(void* ptr, size_t size)
+			{
+				if (ptr) platform::page_release(ptr, size);
+			}
+
+			void* virtual_reserve(size_t size)
+			{
+				return platform::page_reserve(size);
+			}
+
+			bool virtual_commit(void* ptr, size_t size)
+			{
+				return ptr && platform::page_commit(ptr, size);
+			}
+
+			bool virtual_decommit(void* ptr, size_t size)
+			{
+				return ptr && platform::page_decommit(ptr, size);
+			}
+
+			// С какого размера память обнуляется в обход кеша, примерно размер кеша второго уровня.
+			constexpr static size_t ZERO_NON_TEMPORAL_SIZE = 512 * 1024;
+
+			void zero_memory(void* ptr, size_t size)
+			{
+#if defined(_M_X64) || defined(__x86_64__)
+				if (size >= ZERO_NON_TEMPORAL_SIZE)
+				{
+					// Начало и конец до выравнивания на 64 байта обычным способом.
+					char* begin = (char*)ptr;
+					char* end = begin + size;
+					char* aligned_begin = (char*)(((uintptr_t)begin + 63) & ~(uintptr_t)63);
+					char* aligned_end = (char*)((uintptr_t)end & ~(uintptr_t)63);
+
+					memset(begin, 0, aligned_begin - begin);
+
+					__m128i zero = _mm_setzero_si128();
+					for (char* line = aligned_begin; line < aligned_end; line += 64)
+					{
+						_mm_stream_si128((__m128i*)line, zero);
+						_mm_stream_si128((__m128i*)(line + 16), zero);
+						_mm_stream_si128((__m128i*)(line + 32), zero);
+						_mm_stream_si128((__m128i*)(line + 48), zero);
+					}
+					// Записи в обход кеша не упорядочены с остальными.
+					_mm_sfence();
+
+					memset(aligned_end, 0, end - aligned_end);
+					return;
+				}
+#endif
+				memset(ptr, 0, size);
+			}
 		}
 	}
 }
\ No newline at end of file
@@ -20,6 +20,20 @@ namespace voltek
 			void* aligned_recalloc(void* ptr, size_t count, size_t size, size_t alignment);
 			void aligned_free(void* ptr);
 			size_t aligned_msize(const void* ptr);
+			// Выделяет память напрямую у системы, начало выровнено на 64 кб, память обнулена.
+			void* virtual_alloc(size_t size);
+			// Освобождает память, выделенную virtual_alloc, размер тот же, что был при выделении.
+			void virtual_free(void* ptr, size_t size);
+			// Резервирует у системы адреса без памяти, начало выровнено на 64 кб.
+			// Память выделяется через virtual_commit, освобождается участок через virtual_free.
+			void* virtual_reserve(size_t size);
+			// Выделяет память в участке, зарезервированном virtual_reserve, новая память обнулена.
+			bool virtual_commit(void* ptr, size_t size);
+			// Отдаёт системе память участка, адреса остаются, до virtual_commit доступа к ним нет.
+			bool virtual_decommit(void* ptr, size_t size);
+			// Обнуляет память. Большие участки пишутся в обход кеша процессора, чтобы
+			// не вытеснять из него рабочие данные, всё равно в кеш они бы не поместились.
+			void zero_memory(void* ptr, size_t size);
 
 			template<typename _type> inline _type* aligned_talloc(size_t count, size_t alignment)
 			{
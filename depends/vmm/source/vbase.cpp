@@ -2,13 +2,18 @@
 // Contacts: <email:timencevaleksej@gmail.com>
 // License: https://www.gnu.org/licenses/lgpl-3.0.html
 
-#include "..\iw\iw.h"
 #include "vbase.h"
 #include "valloc.h"
 #include "vassert.h"
-#include <intrin.h>
 #include <string>
 
+#if (defined(_WIN32) || defined(_WIN64))
+#	include "../iw/iw.h"
+#	include <intrin.h>
+#else
+#	include <unistd.h>
+#endif
+
 namespace voltek
 {
 	namespace core
@@ -29,6 +34,7 @@ namespace voltek
 
 			initialize_success = true;
 
+#if (defined(_WIN32) || defined(_WIN64))
 			auto info = iw::cpu::cpu_info();
 			sse41_supported = iw::cpu::is_support_SSE41(&info);
 			avx2_supported = iw::cpu::is_support_AVX2(&info);
@@ -47,6 +53,15 @@ namespace voltek
 						avx2_supported = false;
 				}
 			}
+#else
+			// Без iw, сведения о Hyper недоступны, поэтому AVX2 выключен, как и на Windows без Hyper.
+#	if defined(__x86_64__) || defined(__i386__)
+			__builtin_cpu_init();
+			sse41_supported = __builtin_cpu_supports("sse4.1");
+#	endif
+			long cores = sysconf(_SC_NPROCESSORS_ONLN);
+			logical_cores = (unsigned char)((cores > 0) ? ((cores < 255) ? cores : 255) : 1);
+#endif
 		}
 
 		void* base::operator new (size_t size)
@@ -24,19 +24,22 @@ namespace voltek
 	namespace core
 	{
 		// Конструктор по умолчанию.
-		bits::bits() : base(), _mem(nullptr), _count(0), _sets(0)
+		bits::bits() : base(), _mem(nullptr), _count(0), _sets(0), _summary(nullptr), _summary_top(nullptr),
+			_summary_top_count(0)
 		{
 			//initialize();
 		}
 		// Конструктор.
 		// В качестве параметра указывается кол-во желаемых битов.
-		bits::bits(size_t count) : base(), _mem(nullptr), _count(0), _sets(0)
+		bits::bits(size_t count) : base(), _mem(nullptr), _count(0), _sets(0), _summary(nullptr), _summary_top(nullptr),
+			_summary_top_count(0)
 		{
 			//initialize();
 			resize(count);
 		}
 		// Конструктор копий.
-		bits::bits(const bits& ob) : base(), _mem(nullptr), _count(0), _sets(0)
+		bits::bits(const bits& ob) : base(), _mem(nullptr), _count(0), _sets(0), _summary(nullptr), _summary_top(nullptr),
+			_summary_top_count(0)
 		{
 			//initialize();
 			// Типо вызов присвоения
@@ -54,25 +57,31 @@ namespace voltek
 			if (_mem)
 			{
 				memcpy(_mem, ob._mem, size());
+				memcpy(_summary, ob._summary, _internal::aligned_msize(_summary));
 				_sets = ob._sets;
 			}
 			return *this;
 		}
 		// Установить все биты равно 1.
-		inline void bits::all_set() 
+		void bits::all_set()
 		{ 
 			if (_mem)
 			{
 				memset(_mem, -1, size());
+				// Биты за пределами карты должны оставаться 0, иначе их найдёт поиск.
+				if (_count & 63)
+					((uint64_t*)_mem)[_count >> 6] &= (1ull << (_count & 63)) - 1;
 				_sets = _count;
+				update_summary();
 			}
 		}
 		// Установить все биты равно 0.
-		inline void bits::all_unset() 
+		void bits::all_unset() 
 		{ 
 			if (_mem)
 			{
 				memset(_mem, 0, size());
+				memset(_summary, 0, _internal::aligned_msize(_summary));
 				_sets = 0;
 			}
 		}
@@ -84,33 +93,53 @@ namespace voltek
 		{
 			if (count > 0)
 			{
-				size_t need_size = count >> 3;
-				// Проверка кратности кол-ва к 8 (в байте 8 бит, а память выделяется только в байтах)
-				if ((need_size << 3) != count)
-					need_size++;
+				// Память выделяется целыми 64 битными словами, поиск идёт по словам.
+				size_t words = (count + 63) >> 6;
+				size_t need_size = words << 3;
+				size_t summary_words = (words + 63) >> 6;
+				size_t summary_top_words = (summary_words + 63) >> 6;
 
 				if (_mem)
 				{
 					size_t old_count = _count;
 					_mem = (char*)_internal::aligned_recalloc(_mem, need_size, 1, 0x10);
 					if (_mem && (old_count > count))
+					{
+						// Хвост последнего слова за пределами карты обнуляется.
+						if (count & 63)
+							((uint64_t*)_mem)[count >> 6] &= (1ull << (count & 63)) - 1;
+						_count = count;
 						// Ситуация неопределённая, требуется перерасчёт всех битов
 						update_sets();
+					}
+					_internal::aligned_free(_summary);
 				}
 				else
 					_mem = (char*)_internal::aligned_calloc(need_size, 1, 0x10);
 
+				_summary = (uint64_t*)_internal::aligned_calloc(summary_words + summary_top_words, sizeof(uint64_t), 0x10);
+
 				_vassert(_mem != nullptr);
+				_vassert(_summary != nullptr);
 
-				if (_mem)
+				if (_mem && _summary)
+				{
 					_count = count;
+					_summary_top = _summary + summary_words;
+					_summary_top_count = summary_top_words;
+					update_summary();
+				}
 			}
 			else
 			{
 				if (_mem)
 				{
 					_internal::aligned_free(_mem);
+					_internal::aligned_free(_summary);
 					_mem = nullptr;
+					_summary = nullptr;
+					_summary_top = nullptr;
+					_summary_top_count = 0;
 					_count = 0;
 					_sets = 0;
 				}
@@ -128,10 +157,13 @@ namespace voltek
 		bool bits::unset(size_t bit_index)
 		{
 			_vassert(_count > bit_index);
-			if (is_set(bit_index))
+			uint64_t& word = ((uint64_t*)_mem)[bit_index >> 6];
+			uint64_t mask = 1ull << (bit_index & 63);
+			if (word & mask)
 			{
 				_vassert(_sets > 0);
-				_mem[index_from_bit_index(bit_index)] &= ~((char)1 << (bit_index - ((bit_index >> 3) << 3)));
+				word &= ~mask;
+				if (!word) unmark_word(bit_index >> 6);
 				_sets--;
 				return true;
 			}
@@ -145,10 +177,13 @@ namespace voltek
 		bool bits::set(size_t bit_index)
 		{
 			_vassert(_count > bit_index);
-			if (is_unset(bit_index))
+			uint64_t& word = ((uint64_t*)_mem)[bit_index >> 6];
+			uint64_t mask = 1ull << (bit_index & 63);
+			if (!(word & mask))
 			{
 				_vassert(_sets != _count);
-				_mem[index_from_bit_index(bit_index)] |= ((char)1 << (bit_index - ((bit_index >> 3) << 3)));
+				if (!word) mark_word(bit_index >> 6);
+				word |= mask;
 				_sets++;
 				return true;
 			}
@@ -162,9 +197,25 @@ namespace voltek
 		void bits::update_sets()
 		{
 			_sets = 0;
-			for (size_t i = 0; i < _count; i++)
+			uint64_t* u64p = (uint64_t*)_mem;
+			size_t words = (_count + 63) >> 6;
+			for (size_t i = 0; i < words; i++)
+				_sets += std::popcount(u64p[i]);
+		}
+
+		// Перестраивает сводку по словам карты.
+		void bits::update_summary()
+		{
+			if (!_summary)
+				return;
+
+			memset(_summary, 0, _internal::aligned_msize(_summary));
+
+			uint64_t* u64p = (uint64_t*)_mem;
+			size_t words = (_count + 63) >> 6;
+			for (size_t i = 0; i < words; i++)
 			{
-				if (is_set(i)) _sets++;
+				if (u64p[i]) mark_word(i);
 			}
 		}
 
@@ -176,228 +227,104 @@ namespace voltek
 #endif //!VMMDLL_EXPORTS
 		}
 
-		// Поиск первого установленного бита в памяти
-		// Возвращает истину, тогда "index" содержит индекс бита, который установлен как 1.
-		// Если ложь, то значит все биты установлены как 0.
-		bool bits::find_first_set_bit(size_t& index) const
+		// Возвращает номер первого слова карты, в котором есть установленный бит, начиная с "start_word".
+		// Спуск по сводке: верхнее слово -> слово сводки -> слово карты, по tzcnt на уровень.
+		// Возвращает ложь, если таких слов нет.
+		bool bits::find_first_set_word(size_t& word, size_t start_word) const
 		{
-			if (is_all_unsets())
+			size_t words = (_count + 63) >> 6;
+			if (start_word >= words)
 				return false;
 
-			if (_count >= 32)
+			// Сначала остаток слова сводки, куда попадает "start_word".
+			size_t summary_index = start_word >> 6;
+			uint64_t value = _summary[summary_index] & (~0ull << (start_word & 63));
+			if (value)
 			{
-				if (_count >= 2048)
-				{
-					if (avx2_supported)
-						// AVX2
-						return find_first_set_bit_avx2(index);
-					if (sse41_supported)
-						// SSE4.1
-						return find_first_set_bit_sse41(index);
-					else
-						return find_first_set_bit_none(index);
-				}
-
-				uint32_t* u32p = (uint32_t*)_mem;
-				size_t cnt = (_count >> 5) << 5;
-				size_t end_cnt = cnt >> 5;
-
-				for (size_t i = 0; i < end_cnt; i++)
-				{
-					// 0 - ничего нет
-					if (!u32p[i]) continue;
-
-					index = (i << 5) + voltek::ctzl(u32p[i]);
-					goto quit_label_find_bit;
-				}
-
-				for (size_t i = cnt; i < _count; i++)
-				{
-					if (is_set(i))
-					{
-						index = i;
-						break;
-					}
-				}
-			}
-			else
-			{
-				// Самое простое и медленное, но на малых данных самое то.
-
-				for (size_t i = 0; i < _count; i++)
-				{
-					if (is_set(i))
-					{
-						index = i;
-						break;
-					}
-				}
+				word = (summary_index << 6) + voltek::ctzll(value);
+				return true;
 			}
-		quit_label_find_bit:
-			return true;
-		}
-
-		// Поиск первого установленного бита AVX2 инструкциями
-		bool bits::find_first_set_bit_avx2(size_t& index) const
-		{
-			uint64_t* u64p = (uint64_t*)_mem;
-			size_t cnt = (_count >> 6) << 6;
-			size_t end_cnt = cnt >> 6;
-
-			int mask = 0;
-
-			__m256i zero = { 0 };	// Всратая студия хочет инициализации локальной переменной, окей
-			zero = _mm256_xor_si256(zero, zero);
 
-			// Сравниваем по 2048 бит или 256 байт за итерацию
-			for (size_t i = 0; end_cnt > i; i += 32)
+			// Дальше по верхнему уровню, начиная со следующего слова сводки.
+			summary_index++;
+			for (size_t i = summary_index >> 6; i < _summary_top_count; i++)
 			{
-				__m256i mask1 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i]), zero);
-				__m256i mask2 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i + 4]), zero);
-				__m256i mask3 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i + 8]), zero);
-				__m256i mask4 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i + 12]), zero);
-
-				mask  = _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask1)));
-				mask |= _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask2))) << 4;
-				mask |= _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask3))) << 8;
-				mask |= _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask4))) << 12;
-
-				// Для производительности
-				// Если маска != 65535, то значит в первых 1024 битах есть поднятый бит
-				// Оказывается это даёт буст в 10%, скорее всего, загрузка дополнительных данных
-				// существенно затратно по времени.
-				if (mask == 65535)
-				{
-					__m256i mask5 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i + 16]), zero);
-					__m256i mask6 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i + 20]), zero);
-					__m256i mask7 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i + 24]), zero);
-					__m256i mask8 = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)&u64p[i + 28]), zero);
-
-					mask |= _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask5))) << 16;
-					mask |= _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask6))) << 20;
-					mask |= _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask7))) << 24;
-					mask |= _mm256_movemask_pd(*(reinterpret_cast<__m256d*>(&mask8))) << 28;
-				}
-
-				mask = ~mask;
-				// 0 - ничего нет
-				if (!mask) continue;
-
-				size_t array_index = (size_t)i + voltek::ctzl(mask);
-				index = (array_index << 6) + voltek::ctzll((unsigned long long)(u64p[array_index]));
-
-				// Сбросить, чтобы не было пиналити
-				_mm256_zeroupper();
+				value = _summary_top[i];
+				if (i == (summary_index >> 6))
+					value &= (summary_index & 63) ? (~0ull << (summary_index & 63)) : ~0ull;
+				if (!value) continue;
 
+				size_t index = (i << 6) + voltek::ctzll(value);
+				word = (index << 6) + voltek::ctzll(_summary[index]);
 				return true;
 			}
 
-			for (size_t i = cnt; i < _count; i++)
-			{
-				if (is_set(i))
-				{
-					index = i;
-					return true;
-				}
-			}
-
 			return false;
 		}
 
-		// Поиск первого установленного бита SSE4.1 инструкциями
-		bool bits::find_first_set_bit_sse41(size_t& index) const
+		// Поиск первого установленного бита в памяти
+		// Возвращает истину, тогда "index" содержит индекс бита, который установлен как 1.
+		// Если ложь, то значит все биты установлены как 0.
+		bool bits::find_first_set_bit(size_t& index) const
 		{
-			uint64_t* u64p = (uint64_t*)_mem;
-			size_t cnt = (_count >> 6) << 6;
-			size_t end_cnt = cnt >> 6;
-			int mask = 0;
-
-			__m128i zero = { 0 };	// Всратая студия хочет инициализации локальной переменной, окей
-			zero = _mm_xor_si128(zero, zero);
-
-			// Сравниваем по 1024 бит или 128 байт за итерацию
-			for (size_t i = 0; end_cnt > i; i += 16)
-			{
-				__m128i mask1 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i]), zero);
-				__m128i mask2 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i + 2]), zero);
-				__m128i mask3 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i + 4]), zero);
-				__m128i mask4 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i + 6]), zero);
-
-				mask = _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask1)));
-				mask |= _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask2))) << 2;
-				mask |= _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask3))) << 4;
-				mask |= _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask4))) << 6;
-
-				// Для производительности
-				// Если маска != 255, то значит в первых 512 битах есть поднятый бит
-				// Оказывается это даёт буст в 7%, скорее всего, загрузка дополнительных данных
-				// существенно затратно по времени.
-				if (mask == 255)
-				{
-					__m128i mask5 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i + 8]), zero);
-					__m128i mask6 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i + 10]), zero);
-					__m128i mask7 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i + 12]), zero);
-					__m128i mask8 = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)&u64p[i + 14]), zero);
-
-					mask |= _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask5))) << 8;
-					mask |= _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask6))) << 10;
-					mask |= _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask7))) << 12;
-					mask |= _mm_movemask_pd(*(reinterpret_cast<__m128d*>(&mask8))) << 14;
-				}
-
-				mask = ~mask & 65535;
-				// 0 - ничего нет
-				if (!mask) continue;
-
-				size_t array_index = i + voltek::ctzl(mask);
-				index = (array_index << 6) + voltek::ctzll(u64p[array_index]);
-				return true;
-			}
+			if (is_all_unsets())
+				return false;
 
-			for (size_t i = cnt; i < _count; i++)
+			size_t word = 0;
+			if (!find_first_set_word(word, 0))
 			{
-				if (is_set(i))
-				{
-					index = i;
-					return true;
-				}
+				// Сводка расходится с картой.
+				_vassert(false);
+				return false;
 			}
 
-			return false;
+			index = (word << 6) + voltek::ctzll(((uint64_t*)_mem)[word]);
+			return true;
 		}
 
-		bool bits::find_first_set_bit_none(size_t& index, size_t start) const
+		size_t bits::take_set_bits(size_t* indices, size_t count)
 		{
+			size_t taken = 0;
+			if (!indices || !count || is_all_unsets())
+				return 0;
+
 			uint64_t* u64p = (uint64_t*)_mem;
-			size_t cnt = (_count >> 6) << 6;
-			size_t end_cnt = cnt >> 6;
+			size_t word = 0;
 
-			for (size_t i = start; end_cnt > i; i++)
+			// Только слова, отмеченные в сводке.
+			while ((taken < count) && find_first_set_word(word, word))
 			{
-				size_t search_index = voltek::ctzll(u64p[i]);
-				if (search_index != 64)
+				uint64_t value = u64p[word];
+
+				// Снимаем младшие установленные биты слова, пока нужно.
+				while (value && (taken < count))
 				{
-					index = (i << 6) + search_index;
-					return true;
+					indices[taken++] = (word << 6) + voltek::ctzll(value);
+					value &= value - 1;
 				}
+
+				_sets -= std::popcount(u64p[word]) - std::popcount(value);
+				u64p[word] = value;
+				if (!value) unmark_word(word);
+				word++;
 			}
 
-			return false;
+			return taken;
 		}
 
 		/////////////////////////////////////
 
 		// Конструктор по умолчанию.
-		bits_regions::bits_regions() : base(), _region_map(0), _count(0), _sets(0), _distance(0)
+		bits_regions::bits_regions() : base(), _count(0), _sets(0), _distance(0), _region_map(0)
 		{}
 		// Конструктор.
 		// В качестве параметра указывается кол-во желаемых битов.
-		bits_regions::bits_regions(size_t count) : base(), _region_map(0), _count(0), _sets(0), _distance(0)
+		bits_regions::bits_regions(size_t count) : base(), _count(0), _sets(0), _distance(0), _region_map(0)
 		{
 			resize(count);
 		}
 		// Конструктор копий.
-		bits_regions::bits_regions(const bits_regions& ob) : base(), _region_map(0), _count(0), _sets(0), _distance(0)
+		bits_regions::bits_regions(const bits_regions& ob) : base(), _count(0), _sets(0), _distance(0), _region_map(0)
 		{
 			*this = ob;
 		}
@@ -582,6 +509,32 @@ namespace voltek
 			if (ret) index = _regions[region_id].start + index;
 			return ret;
 		}
+
+		size_t bits_regions::take_set_bits(size_t* indices, size_t count)
+		{
+			size_t taken = 0;
+			if (!indices || !count)
+				return 0;
+
+			// Только регионы, где есть установленные биты.
+			while (_region_map && (taken < count))
+			{
+				size_t region_id = (size_t)voltek::ctzll((unsigned long)_region_map);
+				size_t region_taken = _region_bits[region_id].take_set_bits(indices + taken, count - taken);
+				if (!region_taken) break;
+
+				for (size_t i = 0; i < region_taken; i++)
+					indices[taken + i] += _regions[region_id].start;
+
+				taken += region_taken;
+				_sets -= region_taken;
+
+				if (_region_bits[region_id].is_all_unsets())
+					_region_map &= ~((region_id > 0) ? (uint16_t)1 << region_id : (uint16_t)1);
+			}
+
+			return taken;
+		}
 	}
 }
 
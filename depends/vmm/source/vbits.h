@@ -23,6 +23,12 @@ namespace voltek
 		// В данном примере создаётся карта мз 100.000 битов,
 		// где 9090 бит устанавливается как 1, а после чего
 		// сохраняем дамп памяти в файл.
+		//
+		// Над картой держится двухуровневая сводка: бит сводки на каждое 64 битное слово
+		// карты, где есть установленный бит, и верхний бит на каждое слово сводки.
+		// Поиск первого установленного бита спускается по уровням через tzcnt и не
+		// просматривает пустые слова. "set" и "unset" поддерживают сводку сами, поэтому
+		// менять память напрямую через "data" нельзя.
 		class bits : public base
 		{
 		public:
@@ -54,8 +60,6 @@ namespace voltek
 			inline size_t count() const { return _count; }
 			// Возвращает указатель на память, константа.
 			inline const char* c_data() const { return _mem; }
-			// Возвращает указатель на память, не константа.
-			inline char* data() { return _mem; }
 			// Возвращает размер выделенной памяти под этот объект класса.
 			size_t size() const;
 			// Возвращает истину, если бит за заданным индексом "bit_index" бит равен 0.
@@ -76,6 +80,8 @@ namespace voltek
 			// Очень неоптимизированный способ восстановления кол-ва установленных бит.
 			// Не рекомендуется.
 			void update_sets();
+			// Перестраивает сводку по словам карты.
+			void update_summary();
 			// Возвращает кол-во установленных битов на 1.
 			inline size_t get_sets_count() const { return _sets; }
 			// Возвращает кол-во установленных битов на 0.
@@ -90,6 +96,10 @@ namespace voltek
 			// Возвращает истину, тогда "index" содержит индекс бита, который установлен как 1.
 			// Если ложь, то значит все биты установлены как 0.
 			bool find_first_set_bit(size_t& index) const;
+			// Находит за один проход до "count" установленных битов, сбрасывает их в 0
+			// и передаёт их индексы в "indices" по возрастанию.
+			// Возвращает кол-во найденных битов.
+			size_t take_set_bits(size_t* indices, size_t count);
 		protected:
 			// Возвращает индекс в массиве данных из индекса бита.
 			// Все данные выделяются в байтах, а смещение в массиве в зависимости от типа данных, но не меньше байта.
@@ -97,12 +107,23 @@ namespace voltek
 			// Например: В байте 8 бит, поэтому нам нужно индекс бита логически сдвинуть в право на 3, короче говоря поделить на 8.
 			inline size_t index_from_bit_index(size_t bit_index) const { return bit_index >> 3; }
 		private:
-			// Поиск первого установленного бита AVX2 инструкциями
-			bool find_first_set_bit_avx2(size_t& index) const;
-			// Поиск первого установленного бита SSE4.1 инструкциями
-			bool find_first_set_bit_sse41(size_t& index) const;
-			// Поиск первого установленного бита для самых древних ЦПУ
-			bool find_first_set_bit_none(size_t& index, size_t start = 0) const;
+			// Отмечает в сводке, что в слове карты появился установленный бит.
+			inline void mark_word(size_t word)
+			{
+				uint64_t& summary = _summary[word >> 6];
+				if (!summary) _summary_top[word >> 12] |= 1ull << ((word >> 6) & 63);
+				summary |= 1ull << (word & 63);
+			}
+			// Снимает отметку в сводке, когда слово карты стало пустым.
+			inline void unmark_word(size_t word)
+			{
+				uint64_t& summary = _summary[word >> 6];
+				summary &= ~(1ull << (word & 63));
+				if (!summary) _summary_top[word >> 12] &= ~(1ull << ((word >> 6) & 63));
+			}
+			// Возвращает номер первого слова карты, в котором есть установленный бит, начиная с "start_word".
+			// Возвращает ложь, если таких слов нет.
+			bool find_first_set_word(size_t& word, size_t start_word) const;
 		private:
 			// Память
 			char* _mem;
@@ -110,6 +131,12 @@ namespace voltek
 			size_t _count;
 			// Кол-во установленных битов
 			size_t _sets;
+			// Сводка, бит на каждое слово карты, где есть установленный бит.
+			uint64_t* _summary;
+			// Верхний уровень сводки, бит на каждое непустое слово сводки (в той же памяти).
+			uint64_t* _summary_top;
+			// Кол-во слов верхнего уровня.
+			size_t _summary_top_count;
 		};
 
 		// Класс для битовых манипуляций.
@@ -187,6 +214,10 @@ namespace voltek
 			// Возвращает истину, тогда "index" содержит индекс бита, который установлен как 1.
 			// Если ложь, то значит все биты установлены как 0.
 			bool find_first_set_bit(size_t& index) const;
+			// Находит за один проход до "count" установленных битов, сбрасывает их в 0
+			// и передаёт их индексы в "indices" по возрастанию.
+			// Возвращает кол-во найденных битов.
+			size_t take_set_bits(size_t* indices, size_t count);
 		private:
 			// Информация о начальных и конечных битов в регионе.
 			struct region
@@ -4,7 +4,9 @@
 
 #pragma once
 
-#include <intrin.h>
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
 
 namespace voltek
 {
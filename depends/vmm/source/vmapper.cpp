@@ -4,13 +4,8 @@
 
 #include "vmapper.h"
 #include "vassert.h"
-
-#if (defined(_WIN32) || defined(_WIN64))	
-#	pragma warning (disable : 6250)
-#	pragma warning (disable : 6333)
-#	pragma warning (disable : 28160)
-#	include <windows.h>
-#endif
+#include "vplatform.h"
+#include <string.h>
 
 #include <iostream>
 
@@ -45,7 +40,7 @@ namespace voltek
 			if (!empty())
 			{
 				memcpy(_mem, ob._mem, ob._size);
-				memcpy(_mask->data(), ob._mask->c_data(), ob._mask->size());
+				*_mask = *ob._mask;
 				_freesize = ob._freesize;
 			}
 			return *this;
@@ -57,7 +52,7 @@ namespace voltek
 
 			if (size)
 			{
-				_mem = (char*)VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE);
+				_mem = (char*)platform::page_reserve(size);
 				if (_mem)
 				{
 					_size = size;
@@ -70,7 +65,7 @@ namespace voltek
 			}
 			else if (_mem)
 			{
-				VirtualFree(_mem, _size, MEM_RELEASE);
+				platform::page_release(_mem, _size);
 				_mem = nullptr;
 				_size = 0;
 				_freesize = 0;
@@ -92,8 +87,8 @@ namespace voltek
 			if (!_mask->find_first_set_bit(id))
 				return nullptr;
 
-			auto ret = VirtualAlloc(_mem + (id * _blocksize), _blocksize, MEM_COMMIT, PAGE_READWRITE);
-			if (ret)
+			auto ret = _mem + (id * _blocksize);
+			if (platform::page_commit(ret, _blocksize))
 			{
 				_mask->unset(id);
 				_freesize -= _blocksize;
@@ -109,7 +104,7 @@ namespace voltek
 				return false;
 			
 			auto id = (size_t)((char*)ptr - _mem) / _blocksize;
-			if (VirtualFree(const_cast<void*>(ptr), _blocksize, MEM_DECOMMIT))
+			if (platform::page_decommit(const_cast<void*>(ptr), _blocksize))
 			{
 				_mask->set(id);
 				_freesize += _blocksize;
@@ -33,10 +33,10 @@ namespace voltek
 
 	VOLTEK_MM_API void* scalable_calloc(size_t count, size_t size)
 	{
-		size_t need_size = count * size;
-		void* ptr = scalable_alloc(need_size);
-		if (ptr) memset(ptr, 0, need_size);
-		return ptr;
+		if (!memory_manager::global_memory_manager) return nullptr;
+		// Переполнение.
+		if (size && (count > (~(size_t)0 / size))) return nullptr;
+		return memory_manager::global_memory_manager->calloc(count * size);
 	}
 
 	VOLTEK_MM_API void* scalable_realloc(const void* ptr, size_t size)
@@ -48,13 +48,15 @@ namespace voltek
 	VOLTEK_MM_API void* scalable_recalloc(const void* ptr, size_t count, size_t size)
 	{
 		if (!ptr || !memory_manager::global_memory_manager) return nullptr;
+		// Переполнение, блок остаётся как был.
+		if (size && (count > (~(size_t)0 / size))) return nullptr;
 		// Получение размера памяти, что было ранее.
 		size_t old_size = memory_manager::global_memory_manager->msize(ptr);
 		// Новый требуемый размер памяти.
 		size_t need_size = count * size;
 		void* new_ptr = memory_manager::global_memory_manager->realloc(ptr, need_size);
 		if (new_ptr && (old_size < need_size)) 
-			memset((void*)((char*)new_ptr + old_size), 0, need_size - old_size);
+			voltek::core::_internal::zero_memory((char*)new_ptr + old_size, need_size - old_size);
 		return new_ptr;
 	}
 
@@ -64,9 +66,113 @@ namespace voltek
 		return memory_manager::global_memory_manager->free(ptr);
 	}
 
+	VOLTEK_MM_API bool scalable_free_sized(const void* ptr, size_t size)
+	{
+		if (!memory_manager::global_memory_manager) return false;
+		return memory_manager::global_memory_manager->free_sized(ptr, size);
+	}
+
+	VOLTEK_MM_API size_t scalable_alloc_batch(void** ptrs, size_t count, size_t size)
+	{
+		if (!memory_manager::global_memory_manager) return 0;
+		return memory_manager::global_memory_manager->alloc_batch(ptrs, count, size);
+	}
+
+	VOLTEK_MM_API bool scalable_free_batch(void* const* ptrs, size_t count, size_t size)
+	{
+		if (!memory_manager::global_memory_manager) return false;
+		return memory_manager::global_memory_manager->free_batch(ptrs, count, size);
+	}
+
 	VOLTEK_MM_API size_t scalable_msize(const void* ptr)
 	{
 		if (!memory_manager::global_memory_manager) return 0;
 		return memory_manager::global_memory_manager->msize(ptr);
 	}
+
+	VOLTEK_MM_API void* scalable_aligned_alloc(size_t size, size_t alignment)
+	{
+		if (!memory_manager::global_memory_manager) return nullptr;
+		return memory_manager::global_memory_manager->aligned_alloc(size, alignment);
+	}
+
+	VOLTEK_MM_API void* scalable_aligned_realloc(const void* ptr, size_t size, size_t alignment)
+	{
+		if (!memory_manager::global_memory_manager) return nullptr;
+		return memory_manager::global_memory_manager->aligned_realloc(ptr, size, alignment);
+	}
+
+	VOLTEK_MM_API void scalable_memory_manager_set_refill_thread(int priority, uint64_t affinity_mask)
+	{
+		if (memory_manager::global_memory_manager)
+			memory_manager::global_memory_manager->set_refill_thread(priority, affinity_mask);
+	}
+
+	VOLTEK_MM_API bool scalable_get_large_stats(scalable_large_stats* stats)
+	{
+		if (!stats || !memory_manager::global_memory_manager) return false;
+
+		memory_manager::large_heap_stats large_stats;
+		memory_manager::global_memory_manager->get_large_stats(large_stats);
+
+		stats->os_calls = large_stats.os_calls;
+		stats->baseline_calls = large_stats.baseline_calls;
+		stats->cache_hits = large_stats.cache_hits;
+		stats->cache_misses = large_stats.cache_misses;
+		stats->resize_in_place = large_stats.resize_in_place;
+		stats->cached_bytes = large_stats.cached_bytes;
+		stats->cached_committed_bytes = large_stats.cached_committed_bytes;
+		return true;
+	}
+
+	VOLTEK_MM_API void scalable_memory_manager_set_page_retention(size_t pages, size_t bytes, uint32_t idle_ms)
+	{
+		if (memory_manager::global_memory_manager)
+			memory_manager::global_memory_manager->set_page_retention(pages, bytes, idle_ms);
+	}
+
+	VOLTEK_MM_API size_t scalable_trim(size_t budget)
+	{
+		if (!memory_manager::global_memory_manager) return 0;
+		return memory_manager::global_memory_manager->trim(budget);
+	}
+
+	VOLTEK_MM_API bool scalable_memory_manager_set_large_pages(size_t bytes)
+	{
+		if (!memory_manager::global_memory_manager) return false;
+		return memory_manager::global_memory_manager->set_large_pages(bytes);
+	}
+
+	VOLTEK_MM_API bool scalable_get_pool_stats(scalable_pool_stats* stats)
+	{
+		if (!stats || !memory_manager::global_memory_manager) return false;
+
+		memory_manager::pool_page_stats pool_stats;
+		memory_manager::global_memory_manager->get_pool_stats(pool_stats);
+
+		stats->pages_created = pool_stats.pages_created;
+		stats->pages_destroyed = pool_stats.pages_destroyed;
+		stats->pages_retained = pool_stats.pages_retained;
+		stats->retained_bytes = pool_stats.retained_bytes;
+		return true;
+	}
+
+	static_assert(SCALABLE_STATS_CLASSES == memory_manager::STATS_CLASS_MAX, "SCALABLE_STATS_CLASSES matches the size classes");
+	static_assert(sizeof(scalable_class_stats) == sizeof(memory_manager::class_stats), "scalable_class_stats matches class_stats");
+
+	VOLTEK_MM_API bool scalable_get_stats(scalable_stats* stats)
+	{
+		if (!stats || !memory_manager::global_memory_manager) return false;
+
+		memory_manager::memory_stats manager_stats;
+		memory_manager::global_memory_manager->get_stats(manager_stats);
+
+		// Поля идут в том же порядке.
+		for (size_t i = 0; i < SCALABLE_STATS_CLASSES; i++)
+			memcpy(&stats->classes[i], &manager_stats.classes[i], sizeof(scalable_class_stats));
+		memcpy(&stats->total, &manager_stats.total, sizeof(scalable_class_stats));
+		stats->large_bytes = manager_stats.large_bytes;
+		stats->large_page_bytes = manager_stats.large_page_bytes;
+		return true;
+	}
 }
\ No newline at end of file
@@ -25,6 +25,14 @@ namespace voltek
 			// Для проверки на валидность блока, от иной памяти выделенной, чем-то иным.
 			uint32_t prologue;
 
+			// Заголовок блока по умолчанию.
+			// Объявлен вне объединения, в безымянном объединении можно лишь поля.
+			struct ssize_union
+			{
+				// Размер полезных данных.
+				uint64_t size;
+			};
+
 			union
 			{
 				struct
@@ -34,14 +42,12 @@ namespace voltek
 					// Номер страницы.
 					uint16_t page_id;
 					// Номер блока в странице.
-					uint32_t block_id;
+					uint32_t block_id : 24;
+					// Номер потока-владельца очереди удалённого освобождения (0 - нет владельца).
+					uint32_t owner_id : 8;
 				};
 
-				struct ssize_union
-				{
-					// Размер полезных данных.
-					uint64_t size;
-				} default_block;
+				ssize_union default_block;
 			};
 
 			// Флаги (состояния, доп. инфа).
@@ -51,7 +57,6 @@ namespace voltek
 		};
 #pragma pack(pop)
 
-		static_assert(sizeof(block_base) == 0x10, "sizeof(block_base) == 0x10");
 #elif VOLTEK_MM_BLOCK_VERSION == 2
 #pragma pack(push, 1)
 		// Заголовок блока
@@ -69,12 +74,13 @@ namespace voltek
 			uint16_t pool_id;
 			// Размер полезных данных.
 			uint64_t size;
+			// Номер потока-владельца очереди удалённого освобождения (0 - нет владельца).
+			uint32_t owner_id;
 			// Зарезервировано
-			uint64_t reserved;
+			uint32_t reserved;
 		};
 #pragma pack(pop)
 
-		static_assert(sizeof(block_base) == 0x20, "sizeof(block_base) == 0x20");
 #endif
 
 		// Шаблонный фиксируемый блок
@@ -88,64 +94,13 @@ namespace voltek
 		// Фиксируемый блок на 8 байт.
 		// На самом деле его размер равен 16 байт,
 		// Это нужно для выравненной памяти.
+		// Блоки пулов порождаются по лестнице размеров, см. vmmsizeclass.h.
 		typedef block_base_t<16> block8_t;
-		// Фиксируемый блок на 16 байт.
-		typedef block_base_t<16> block16_t;
-		// Фиксируемый блок на 32 байт.
-		typedef block_base_t<32> block32_t;
-		// Фиксируемый блок на 64 байт.
-		typedef block_base_t<64> block64_t;
-		// Фиксируемый блок на 128 байт.
-		typedef block_base_t<128> block128_t;
-		// Фиксируемый блок на 256 байт.
-		typedef block_base_t<256> block256_t;
-		// Фиксируемый блок на 512 байт.
-		typedef block_base_t<512> block512_t;
-		// Фиксируемый блок на 1024 байт.
-		typedef block_base_t<1024> block1024_t;
-		// Фиксируемый блок на 4096 байт.
-		typedef block_base_t<4096> block4096_t;
-		// Фиксируемый блок на 8192 байт.
-		typedef block_base_t<8192> block8192_t;
-		// Фиксируемый блок на 16384 байт.
-		typedef block_base_t<16384> block16384_t;
-		// Фиксируемый блок на 32768 байт.
-		typedef block_base_t<32768> block32768_t;
-		// Фиксируемый блок на 65536 байт.
-		typedef block_base_t<65536> block65536_t;
-		// Фиксируемый блок на 131072 байт.
-		typedef block_base_t<131072> block131072_t;
 
 #if VOLTEK_MM_BLOCK_VERSION == 1
 		static_assert(sizeof(block8_t) == 0x20, "sizeof(block8_t) == 0x20");
-		static_assert(sizeof(block16_t) == 0x20, "sizeof(block16_t) == 0x20");
-		static_assert(sizeof(block32_t) == 0x30, "sizeof(block32_t) == 0x30");
-		static_assert(sizeof(block64_t) == 0x50, "sizeof(block64_t) == 0x50");
-		static_assert(sizeof(block128_t) == 0x90, "sizeof(block128_t) == 0x90");
-		static_assert(sizeof(block256_t) == 0x110, "sizeof(block256_t) == 0x110");
-		static_assert(sizeof(block512_t) == 0x210, "sizeof(block512_t) == 0x210");
-		static_assert(sizeof(block1024_t) == 0x410, "sizeof(block1024_t) == 0x410");
-		static_assert(sizeof(block4096_t) == 0x1010, "sizeof(block4096_t) == 0x1010");
-		static_assert(sizeof(block8192_t) == 0x2010, "sizeof(block8192_t) == 0x2010");
-		static_assert(sizeof(block16384_t) == 0x4010, "sizeof(block16384_t) == 0x4010");
-		static_assert(sizeof(block32768_t) == 0x8010, "sizeof(block32768_t) == 0x8010");
-		static_assert(sizeof(block65536_t) == 0x10010, "sizeof(block65536_t) == 0x10010");
-		static_assert(sizeof(block131072_t) == 0x20010, "sizeof(block131072_t) == 0x20010");
 #elif VOLTEK_MM_BLOCK_VERSION == 2
 		static_assert(sizeof(block8_t) == 0x30, "sizeof(block8_t) == 0x30");
-		static_assert(sizeof(block16_t) == 0x30, "sizeof(block16_t) == 0x30");
-		static_assert(sizeof(block32_t) == 0x40, "sizeof(block32_t) == 0x40");
-		static_assert(sizeof(block64_t) == 0x60, "sizeof(block64_t) == 0x60");
-		static_assert(sizeof(block128_t) == 0xA0, "sizeof(block128_t) == 0xA0");
-		static_assert(sizeof(block256_t) == 0x120, "sizeof(block256_t) == 0x120");
-		static_assert(sizeof(block512_t) == 0x220, "sizeof(block512_t) == 0x220");
-		static_assert(sizeof(block1024_t) == 0x420, "sizeof(block1024_t) == 0x420");
-		static_assert(sizeof(block4096_t) == 0x1020, "sizeof(block4096_t) == 0x1020");
-		static_assert(sizeof(block8192_t) == 0x2020, "sizeof(block8192_t) == 0x2020");
-		static_assert(sizeof(block16384_t) == 0x4020, "sizeof(block16384_t) == 0x4020");
-		static_assert(sizeof(block32768_t) == 0x8020, "sizeof(block32768_t) == 0x8020");
-		static_assert(sizeof(block65536_t) == 0x10020, "sizeof(block65536_t) == 0x10020");
-		static_assert(sizeof(block131072_t) == 0x20020, "sizeof(block131072_t) == 0x20020");
 #endif
 
 		// Для проверки на валидность блока, от иной памяти выделенной, чем-то иным.
@@ -155,11 +110,19 @@ namespace voltek
 		static constexpr uint8_t flag_block_pool_used = 0x1;
 		// Флаг, который говорит, что блок выделен просто и его нет в пулах.
 		static constexpr uint8_t flag_block_default_used = 0x2;
+		// Флаг, который говорит, что пуловский блок свободен и лежит в кеше потока или в очереди удалённого освобождения.
+		static constexpr uint8_t flag_block_cached = 0x4;
+		// Флаг, который говорит, что это заголовок выровненной памяти, а сам блок лежит раньше.
+		static constexpr uint8_t flag_block_aligned = 0x8;
 #elif VOLTEK_MM_BLOCK_VERSION == 2
 		// Флаг, который говорит, что блок используется каким-то пулом.
 		static constexpr uint16_t flag_block_pool_used = 0x1;
 		// Флаг, который говорит, что блок выделен просто и его нет в пулах.
 		static constexpr uint16_t flag_block_default_used = 0x2;
+		// Флаг, который говорит, что пуловский блок свободен и лежит в кеше потока или в очереди удалённого освобождения.
+		static constexpr uint16_t flag_block_cached = 0x4;
+		// Флаг, который говорит, что это заголовок выровненной памяти, а сам блок лежит раньше.
+		static constexpr uint16_t flag_block_aligned = 0x8;
 #endif
 
 		// Возвращает истину, если блок правильный и пренадлежит менеджеру.
@@ -180,6 +143,18 @@ namespace voltek
 			return (block->flags & flag_block_default_used) == flag_block_default_used;
 		}
 
+		// Возвращает истину, если блок свободен и лежит в кеше потока.
+		inline static bool is_cached_block(const block_base* block)
+		{
+			return (block->flags & flag_block_cached) == flag_block_cached;
+		}
+
+		// Возвращает истину, если это заголовок выровненной памяти.
+		inline static bool is_aligned_block(const block_base* block)
+		{
+			return (block->flags & flag_block_aligned) == flag_block_aligned;
+		}
+
 #if VOLTEK_MM_BLOCK_VERSION == 1
 		// Возвращает размер памяти указанный в блоке или 0, если он неправильный.
 		inline static size_t get_size_from_block(const block_base* block)
@@ -349,6 +324,7 @@ namespace voltek
 			dst->pool_id = pool_id;
 			dst->page_id = page_id;
 			dst->block_id = block_id;
+			dst->owner_id = 0;
 			dst->size = size;
 			dst->flags = flag_block_pool_used;
 			return dst;
@@ -362,5 +338,37 @@ namespace voltek
 			dst->flags = flag_block_default_used;
 			return dst;
 		}
+
+		// Функция инициализации заголовка выровненной памяти.
+		// offset - смещение от полезных данных настоящего блока до выровненных данных.
+		inline static block_base* create_aligned_block(block_base* dst, size_t offset)
+		{
+			dst->prologue = prologue_block;
+#if VOLTEK_MM_BLOCK_VERSION == 1
+			dst->default_block.size = offset;
+#elif VOLTEK_MM_BLOCK_VERSION == 2
+			dst->size = offset;
+#endif
+			dst->flags = flag_block_aligned;
+			return dst;
+		}
+
+		// Возвращает смещение выровненных данных от полезных данных настоящего блока.
+		inline static size_t get_offset_from_aligned_block(const block_base* block)
+		{
+#if VOLTEK_MM_BLOCK_VERSION == 1
+			return (size_t)block->default_block.size;
+#elif VOLTEK_MM_BLOCK_VERSION == 2
+			return (size_t)block->size;
+#endif
+		}
+
+		// Возвращает указатель на полезные данные настоящего блока.
+		// Если память не выровненная, то вернёт тот же указатель.
+		inline static const void* get_origin_ptr(const void* ptr)
+		{
+			const block_base* block = get_block_handle_from_ptr(ptr);
+			return is_aligned_block(block) ? (const void*)((const char*)ptr - get_offset_from_aligned_block(block)) : ptr;
+		}
 	}
 }
@@ -0,0 +1,340 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#include "vmmlarge.h"
+#include "vassert.h"
+#include "vplatform.h"
+#include <string.h>
+#include <bit>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		namespace platform = voltek::core::platform;
+
+		// Округляет вверх до кратности.
+		inline static size_t round_up(size_t size, size_t alignment)
+		{
+			return (size + alignment - 1) & ~(alignment - 1);
+		}
+
+		large_heap::large_heap(page_map* address_map) : _address_map(address_map), _buckets{},
+			_lru_head(nullptr), _lru_tail(nullptr), _cached_spans(0), _stats{}
+		{}
+
+		large_heap::~large_heap()
+		{
+			trim(0, true);
+		}
+
+		size_t large_heap::get_bucket(size_t granules)
+		{
+			if (granules <= LARGE_BUCKET_EXACT)
+				return granules - 1;
+
+			// Номер старшего бита определяет степень двойки, два следующих бита - четверть в ней.
+			size_t value = granules - 1;
+			size_t msb = std::bit_width(value) - 1;
+			return LARGE_BUCKET_EXACT + (msb - 4) * 4 + ((value >> (msb - 2)) & 3);
+		}
+
+		size_t large_heap::get_bucket_granules(size_t bucket)
+		{
+			if (bucket < LARGE_BUCKET_EXACT)
+				return bucket + 1;
+
+			size_t base = LARGE_BUCKET_EXACT << ((bucket - LARGE_BUCKET_EXACT) >> 2);
+			return base + ((bucket - LARGE_BUCKET_EXACT) % 4 + 1) * (base >> 2);
+		}
+
+		large_heap::span_t* large_heap::new_span(size_t reserved, size_t committed, size_t bucket)
+		{
+			span_t* span = nullptr;
+
+			if (reserved == committed)
+			{
+				span = (span_t*)platform::page_reserve_commit(reserved);
+				_stats.os_calls++;
+			}
+			else
+			{
+				span = (span_t*)platform::page_reserve(reserved);
+				_stats.os_calls++;
+				if (span)
+				{
+					_stats.os_calls++;
+					if (!platform::page_commit(span, committed))
+					{
+						platform::page_release(span, reserved);
+						_stats.os_calls++;
+						span = nullptr;
+					}
+				}
+			}
+
+			if (!span)
+				return nullptr;
+
+			if (!_address_map->set(span, reserved, { PAGE_MAP_DEFAULT, 0, 0 }))
+			{
+				platform::page_release(span, reserved);
+				_stats.os_calls++;
+				return nullptr;
+			}
+
+			memset(span, 0, sizeof(span_t));
+			span->reserved = reserved;
+			span->committed = committed;
+			span->bucket = (uint32_t)bucket;
+			return span;
+		}
+
+		void large_heap::release_span(span_t* span)
+		{
+			_address_map->clear(span, span->reserved);
+			platform::page_release(span, span->reserved);
+			_stats.os_calls++;
+		}
+
+		void large_heap::decommit_span(span_t* span)
+		{
+			// Заголовок остаётся, без него участок не найти в кеше.
+			if (span->committed <= LARGE_COMMIT_SIZE)
+				return;
+
+			platform::page_decommit((char*)span + LARGE_COMMIT_SIZE, span->committed - LARGE_COMMIT_SIZE);
+			_stats.os_calls++;
+			_stats.cached_committed_bytes -= span->committed - LARGE_COMMIT_SIZE;
+			span->committed = LARGE_COMMIT_SIZE;
+		}
+
+		void large_heap::unlink_span(span_t* span)
+		{
+			if (span->prev) span->prev->next = span->next;
+			else _buckets[span->bucket] = span->next;
+			if (span->next) span->next->prev = span->prev;
+
+			if (span->lru_prev) span->lru_prev->lru_next = span->lru_next;
+			else _lru_head = span->lru_next;
+			if (span->lru_next) span->lru_next->lru_prev = span->lru_prev;
+			else _lru_tail = span->lru_prev;
+
+			span->next = span->prev = span->lru_next = span->lru_prev = nullptr;
+			_cached_spans.fetch_sub(1, std::memory_order_relaxed);
+			_stats.cached_bytes -= span->reserved;
+			_stats.cached_committed_bytes -= span->committed;
+		}
+
+		void* large_heap::alloc(size_t size, size_t* dirty)
+		{
+			size_t committed = round_up(LARGE_SPAN_HEADER_SIZE + size, LARGE_COMMIT_SIZE);
+			size_t granules = round_up(committed, LARGE_GRANULE_SIZE) >> LARGE_GRANULE_SHIFT;
+			if (committed < size)
+				return nullptr;
+
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(_lock);
+
+			_stats.baseline_calls += 2;
+
+			span_t* span = nullptr;
+			size_t bucket = LARGE_BUCKET_MAX;
+			size_t reserved = (granules << LARGE_GRANULE_SHIFT) * LARGE_GROW_FACTOR;
+
+			if (granules <= LARGE_CACHE_MAX_GRANULES)
+			{
+				bucket = get_bucket(granules);
+				reserved = (get_bucket_granules(bucket) << LARGE_GRANULE_SHIFT) * LARGE_GROW_FACTOR;
+
+				span = _buckets[bucket];
+				if (span)
+				{
+					unlink_span(span);
+
+					// Выделенная прежде память хранит старые данные, дорощенная - нет.
+					if (dirty)
+						*dirty = ((span->committed < committed) ? span->committed : committed) - LARGE_SPAN_HEADER_SIZE;
+
+					// Дорастаем выделенную память до требуемой.
+					if (span->committed < committed)
+					{
+						_stats.os_calls++;
+						if (!platform::page_commit(span, committed))
+						{
+							release_span(span);
+							return nullptr;
+						}
+						span->committed = committed;
+					}
+
+					_stats.cache_hits++;
+				}
+			}
+
+			if (!span)
+			{
+				span = new_span(reserved, committed, bucket);
+				if (!span)
+					return nullptr;
+
+				if (dirty)
+					*dirty = 0;
+
+				_stats.cache_misses++;
+			}
+
+			span->in_use = 1;
+			_stats.used_spans++;
+			_stats.used_bytes += span->committed;
+			return (char*)span + LARGE_SPAN_HEADER_SIZE;
+		}
+
+		bool large_heap::free(void* ptr)
+		{
+			span_t* span = (span_t*)((char*)ptr - LARGE_SPAN_HEADER_SIZE);
+
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(_lock);
+
+			// Повторное освобождение.
+			_vassert(span->in_use);
+			if (!span->in_use)
+				return false;
+
+			span->in_use = 0;
+			_stats.used_spans--;
+			_stats.used_bytes -= span->committed;
+
+			if (span->bucket >= LARGE_BUCKET_MAX)
+			{
+				release_span(span);
+				return true;
+			}
+
+			// Недавние участки в начало корзины, чтобы их память была ещё горячей.
+			span->free_time = platform::tick_count_ms();
+			span->prev = nullptr;
+			span->next = _buckets[span->bucket];
+			if (span->next) span->next->prev = span;
+			_buckets[span->bucket] = span;
+
+			span->lru_next = nullptr;
+			span->lru_prev = _lru_tail;
+			if (_lru_tail) _lru_tail->lru_next = span;
+			else _lru_head = span;
+			_lru_tail = span;
+			_cached_spans.fetch_add(1, std::memory_order_relaxed);
+
+			_stats.cached_bytes += span->reserved;
+			_stats.cached_committed_bytes += span->committed;
+
+			enforce_budget();
+			return true;
+		}
+
+		bool large_heap::resize(void* ptr, size_t size)
+		{
+			span_t* span = (span_t*)((char*)ptr - LARGE_SPAN_HEADER_SIZE);
+			size_t committed = round_up(LARGE_SPAN_HEADER_SIZE + size, LARGE_COMMIT_SIZE);
+
+			_vassert(span->in_use);
+			if (!span->in_use || (committed < size) || (committed > span->reserved))
+				return false;
+
+			// Участок принадлежит вызывающему, блокировка нужна лишь для счётчиков.
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(_lock);
+
+			if (committed > span->committed)
+			{
+				// Дорастаем выделенную память до требуемой, адреса за блоком уже наши.
+				_stats.os_calls++;
+				if (!platform::page_commit((char*)span + span->committed, committed - span->committed))
+					return false;
+
+				_stats.used_bytes += committed - span->committed;
+				span->committed = committed;
+			}
+			else if ((span->committed - committed) >= LARGE_GRANULE_SIZE)
+			{
+				// Блок сильно уменьшился, хвост больше не нужен.
+				_stats.os_calls++;
+				platform::page_decommit((char*)span + committed, span->committed - committed);
+				_stats.used_bytes -= span->committed - committed;
+				span->committed = committed;
+			}
+
+			_stats.resize_in_place++;
+			return true;
+		}
+
+		void large_heap::enforce_budget()
+		{
+			// Начиная с давно освобождённых.
+			span_t* span = _lru_head;
+			while (span && (_stats.cached_committed_bytes > LARGE_CACHE_COMMIT_BUDGET))
+			{
+				decommit_span(span);
+				span = span->lru_next;
+			}
+
+			while (_lru_head && (_stats.cached_bytes > LARGE_CACHE_RESERVE_BUDGET))
+			{
+				span = _lru_head;
+				unlink_span(span);
+				release_span(span);
+			}
+		}
+
+		void large_heap::trim(uint64_t now_ms, bool force)
+		{
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(_lock);
+
+			// Список упорядочен по времени освобождения.
+			span_t* span = _lru_head;
+			while (span)
+			{
+				span_t* next = span->lru_next;
+				uint64_t idle = now_ms - span->free_time;
+
+				if (force || (idle >= LARGE_CACHE_RELEASE_MS))
+				{
+					unlink_span(span);
+					release_span(span);
+				}
+				else if (idle >= LARGE_CACHE_DECOMMIT_MS)
+					decommit_span(span);
+				else
+					break;
+
+				span = next;
+			}
+		}
+
+		size_t large_heap::release_cache(size_t budget)
+		{
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(_lock);
+
+			size_t released = 0;
+			for (span_t* span = _lru_head; span && (released < budget); span = span->lru_next)
+			{
+				uint64_t before = _stats.cached_committed_bytes;
+				decommit_span(span);
+				released += (size_t)(before - _stats.cached_committed_bytes);
+			}
+
+			return released;
+		}
+
+		void large_heap::get_stats(large_heap_stats& stats) const
+		{
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(_lock);
+			stats = _stats;
+		}
+	}
+}
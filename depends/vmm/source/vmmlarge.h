@@ -0,0 +1,163 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#pragma once
+
+#include "vbase.h"
+#include "vsimplelock.h"
+#include "vmmpagemap.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		// Гранулярность резервирования памяти системой.
+		constexpr static size_t LARGE_GRANULE_SHIFT = 16;
+		constexpr static size_t LARGE_GRANULE_SIZE = 1ull << LARGE_GRANULE_SHIFT;
+		// Гранулярность выделения памяти системой.
+		constexpr static size_t LARGE_COMMIT_SIZE = 4096;
+		// Место под заголовок участка в начале участка, полезные данные выровнены на 128 байт.
+		constexpr static size_t LARGE_SPAN_HEADER_SIZE = 0x70;
+		// Кол-во корзин кеша: до 1 мб по 64 кб, дальше по 4 размера на каждую степень двойки до 64 мб.
+		constexpr static size_t LARGE_BUCKET_EXACT = 16;
+		constexpr static size_t LARGE_BUCKET_MAX = LARGE_BUCKET_EXACT + 24;
+		// Участки больше не кешируются, они возвращаются системе сразу.
+		constexpr static size_t LARGE_CACHE_MAX_GRANULES = 1024;
+		// Во сколько раз адресного пространства резервируется больше, чем размер корзины.
+		// Запас позволяет блоку расти на месте, выделяя память дальше в своём участке.
+		constexpr static size_t LARGE_GROW_FACTOR = 2;
+		// Сколько зарезервированной памяти может лежать в кеше, лишнее возвращается системе.
+		constexpr static size_t LARGE_CACHE_RESERVE_BUDGET = 256ull * 1024 * 1024 * LARGE_GROW_FACTOR;
+		// Сколько выделенной памяти может лежать в кеше, лишнее освобождается (decommit).
+		constexpr static size_t LARGE_CACHE_COMMIT_BUDGET = 64ull * 1024 * 1024;
+		// Через сколько мс простоя память участка в кеше освобождается (decommit).
+		constexpr static uint64_t LARGE_CACHE_DECOMMIT_MS = 1000;
+		// Через сколько мс простоя участок возвращается системе.
+		constexpr static uint64_t LARGE_CACHE_RELEASE_MS = 10000;
+		// Как часто фоновый поток проверяет простой участков, пока кеш не пуст.
+		constexpr static uint32_t LARGE_TRIM_PERIOD_MS = 500;
+
+		// Счётчики обращений к системе.
+		struct large_heap_stats
+		{
+			// Выполнено обращений к системе за страницами (резервирование, выделение, освобождение).
+			uint64_t os_calls;
+			// Столько вызовов понадобилось бы без кеша (выделение и освобождение на каждый блок).
+			uint64_t baseline_calls;
+			// Блоков выдано из кеша.
+			uint64_t cache_hits;
+			// Блоков выдано новых.
+			uint64_t cache_misses;
+			// Блоков, изменивших размер на месте без копирования.
+			uint64_t resize_in_place;
+			// Участков выдано и не освобождено.
+			uint64_t used_spans;
+			// Выделено памяти выданными участками.
+			uint64_t used_bytes;
+			// Зарезервировано памяти участками в кеше.
+			uint64_t cached_bytes;
+			// Выделено памяти участками в кеше.
+			uint64_t cached_committed_bytes;
+		};
+
+		// Куча больших блоков.
+		// Каждый блок лежит в своём участке адресного пространства, выровненном на 64 кб.
+		// Участок резервируется по размеру корзины, а память выделяется лишь под требуемый
+		// размер и дорастает при повторном использовании. Освобождённый участок кладётся
+		// в кеш своей корзины и отдаётся следующему запросу того же размера без обращения
+		// к системе. Память участков, что лежат без дела, освобождается отложенно:
+		// по бюджету в байтах сразу, а по времени простоя - фоновым потоком через trim.
+		class large_heap : public voltek::core::base
+		{
+		public:
+			// Конструктор.
+			// Участки отмечаются в указанной карте адресов.
+			large_heap(page_map* address_map);
+			// Деструктор.
+			virtual ~large_heap();
+			// Выделяет память под указанное кол-во байт, вернёт nullptr, если память кончилась.
+			// Если dirty задан, то в него пишется, сколько байт от начала памяти могут быть не нулевыми,
+			// остальная память свежая от системы и уже обнулена.
+			void* alloc(size_t size, size_t* dirty = nullptr);
+			// Освобождает память, вернёт ложь, если память уже свободна.
+			bool free(void* ptr);
+			// Меняет размер памяти на месте, дорастая выделенную память в пределах участка.
+			// При сильном уменьшении хвост участка освобождается (decommit).
+			// Вернёт ложь, если участок не вмещает требуемый размер.
+			bool resize(void* ptr, size_t size);
+			// Освобождает память участков, что лежат в кеше дольше порогов.
+			// Если force, то возвращает системе весь кеш.
+			void trim(uint64_t now_ms, bool force);
+			// Освобождает память участков в кеше (decommit), начиная с давно освобождённых,
+			// пока не освободится budget байт. Адреса остаются в кеше.
+			// Возвращает кол-во освобождённых байт.
+			size_t release_cache(size_t budget);
+			// Возвращает истину, если кеш пуст.
+			// Без блокировки, значение приблизительное: годится лишь как подсказка, будить ли поток.
+			inline bool empty_cache() const { return !_cached_spans.load(std::memory_order_relaxed); }
+			// Возвращает счётчики.
+			void get_stats(large_heap_stats& stats) const;
+		private:
+			// Конструктор копий - НЕДОСТУПЕН.
+			large_heap(const large_heap& ob) = delete;
+			// Оператор присвоения - НЕДОСТУПЕН.
+			large_heap& operator=(const large_heap& ob) = delete;
+		private:
+			// Заголовок участка.
+			struct span_t
+			{
+				// Зарезервировано байт.
+				size_t reserved;
+				// Выделено байт от начала участка.
+				size_t committed;
+				// Соседи в корзине.
+				span_t* next;
+				span_t* prev;
+				// Соседи в общем списке кеша, от давно освобождённых к недавним.
+				span_t* lru_next;
+				span_t* lru_prev;
+				// Время освобождения в мс.
+				uint64_t free_time;
+				// Номер корзины или LARGE_BUCKET_MAX, если участок не кешируется.
+				uint32_t bucket;
+				// Участок выдан.
+				uint32_t in_use;
+			};
+
+			static_assert(sizeof(span_t) <= LARGE_SPAN_HEADER_SIZE, "sizeof(span_t) <= LARGE_SPAN_HEADER_SIZE");
+
+			// Возвращает номер корзины для кол-ва гранул.
+			static size_t get_bucket(size_t granules);
+			// Возвращает кол-во гранул корзины.
+			static size_t get_bucket_granules(size_t bucket);
+			// Резервирует новый участок и выделяет память под требуемый размер.
+			span_t* new_span(size_t reserved, size_t committed, size_t bucket);
+			// Возвращает участок системе.
+			void release_span(span_t* span);
+			// Освобождает память участка, кроме заголовка.
+			void decommit_span(span_t* span);
+			// Убирает участок из кеша.
+			void unlink_span(span_t* span);
+			// Возвращает системе лишнее сверх бюджетов.
+			void enforce_budget();
+		private:
+			// Карта адресов менеджера.
+			page_map* _address_map;
+			// Блокировщик кеша.
+			voltek::core::_internal::simple_lock _lock;
+			// Корзины кеша.
+			span_t* _buckets[LARGE_BUCKET_MAX];
+			// Общий список кеша.
+			span_t* _lru_head;
+			span_t* _lru_tail;
+			// Участков в кеше. Меняется под блокировкой, а читается без неё (empty_cache).
+			std::atomic<size_t> _cached_spans;
+			// Счётчики.
+			large_heap_stats _stats;
+		};
+	}
+}
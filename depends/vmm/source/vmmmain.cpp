@@ -2,16 +2,20 @@
 // Contacts: <email:timencevaleksej@gmail.com>
 // License: https://www.gnu.org/licenses/lgpl-3.0.html
 
-#pragma warning(disable : 6333)
-#pragma warning(disable : 26819)
-#pragma warning(disable : 28160)
+#if defined(_MSC_VER)
+#	pragma warning(disable : 6333)
+#	pragma warning(disable : 26819)
+#	pragma warning(disable : 28160)
+#endif
 
 #include "vmapper.h"
 #include "vmmmain.h"
 #include "vmmpool.h"
+#include "vplatform.h"
 #include <limits.h>
 #include <string.h>
-#include <windows.h>
+#include <array>
+#include <utility>
 
 #define USE_MULTITHREADS 1
 
@@ -28,138 +32,158 @@ namespace voltek
 
 	namespace memory_manager
 	{
+		namespace platform = voltek::core::platform;
+
 		memory_manager* global_memory_manager = nullptr;
 
-		constexpr size_t MAX_BLOCK_SIZE = 1ull * 1024 * 1024 * 1024;
-
-		typedef page_t<block8_t> page8_t;
-		typedef page_t<block16_t> page16_t;
-		typedef page_t<block32_t> page32_t;
-		typedef page_t<block64_t> page64_t;
-		typedef page_t<block128_t> page128_t;
-		typedef page_t<block256_t> page256_t;
-		typedef page_t<block512_t> page512_t;
-		typedef page_t<block1024_t> page1024_t;
-		typedef page_t<block4096_t> page4096_t;
-		typedef page_t<block8192_t> page8192_t;
-		typedef page_t<block16384_t, __VMM_PAGE_CONFIG_SMALL_SIZE> page16384_t;
-		typedef page_t<block32768_t, __VMM_PAGE_CONFIG_SMALL_SIZE> page32768_t;
-		typedef page_t<block65536_t, __VMM_PAGE_CONFIG_LOW_SIZE> page65536_t;
-		typedef page_t<block131072_t, __VMM_PAGE_CONFIG_LOW_SIZE> page131072_t;
-		typedef pool_t<block8_t, page8_t, __VMM_POOL_CONFIG_BIG_SIZE> pool8_t;
-		typedef pool_t<block16_t, page16_t, __VMM_POOL_CONFIG_BIG_SIZE> pool16_t;
-		typedef pool_t<block32_t, page32_t, __VMM_POOL_CONFIG_BIG_SIZE> pool32_t;
-		typedef pool_t<block64_t, page64_t, __VMM_POOL_CONFIG_LARGE_SIZE> pool64_t;
-		typedef pool_t<block128_t, page128_t, __VMM_POOL_CONFIG_LARGE_SIZE> pool128_t;
-		typedef pool_t<block256_t, page256_t> pool256_t;
-		typedef pool_t<block512_t, page512_t> pool512_t;
-		typedef pool_t<block1024_t, page1024_t> pool1024_t;
-		typedef pool_t<block4096_t, page4096_t> pool4096_t;
-		typedef pool_t<block8192_t, page8192_t> pool8192_t;
-		typedef pool_t<block16384_t, page16384_t, __VMM_POOL_CONFIG_SMALL_SIZE> pool16384_t;
-		typedef pool_t<block32768_t, page32768_t, __VMM_POOL_CONFIG_SMALL_SIZE> pool32768_t;
-		typedef pool_t<block65536_t, page65536_t, __VMM_POOL_CONFIG_LOW_SIZE> pool65536_t;
-		typedef pool_t<block131072_t, page131072_t, __VMM_POOL_CONFIG_LOW_SIZE> pool131072_t;
-
-
-		// Проверка на допустимость памяти
-		// Только Windows: Если произошло исключение, то вернёт false, иначе true.
-		bool is_valid_pointer(const void* ptr)
-		{
-			if (!ptr) return false;
+//		static FILE* file_dbg_sniffer;
 
-#if (defined(_WIN32) || defined(_WIN64))	
-			__try
-			{
-				// Попытка что-то разыменовать и записать...
-				if (*((char*)(ptr)) != 0)
-					*(char*)(ptr) = *(char*)(ptr);
+#define _fsniff(fmt, ...) \
+	{ fprintf(file_dbg_sniffer, fmt "\n", ##__VA_ARGS__); fflush(file_dbg_sniffer); }
 
-				return true;
-			}
-			__except (1)
+		static size_t POOL_SIZE = 64 * 1024;
+
+		// Кеш свободных блоков текущего потока.
+		static thread_local thread_cache local_cache;
+		// Очереди удалённого освобождения, по одной на поток-владелец.
+		static remote_queue remote_queues[TCACHE_OWNER_MAX];
+		// Счётчики статистики, по набору на очередь удалённого освобождения.
+		static thread_stats stats_slots[TCACHE_OWNER_MAX];
+
+		static_assert(POOL_MAX < 61, "refill_mask has a bit for each pool");
+
+		// Порог, ниже которого кеш пула пополняется фоновым потоком.
+		constexpr static size_t REFILL_LOW_WATERMARK = __VMM_POOL_CONFIG_CACHE_SIZE >> 2;
+		// Сколько блоков фоновый поток кладёт в кеш пула за одну блокировку.
+		constexpr static size_t REFILL_CHUNK_SIZE = 256;
+		// Запрос на разбор очередей удалённого освобождения без владельца.
+		constexpr static uint64_t REFILL_ORPHAN_QUEUES = 1ull << 63;
+		// Запрос на применение приоритета и привязки к ядрам.
+		constexpr static uint64_t REFILL_APPLY_SETTINGS = 1ull << 62;
+		// В кеше больших блоков или в пулах появилась простаивающая память, пора следить за её простоем.
+		constexpr static uint64_t REFILL_IDLE_TRIM = 1ull << 61;
+		// Сколько пустых страниц каждый пул держит про запас по умолчанию и не больше скольких байт.
+		constexpr static size_t POOL_RETAIN_PAGES = 2;
+		constexpr static size_t POOL_RETAIN_BYTES = 128ull * 1024 * 1024;
+		// Через сколько мс простоя пустая страница про запас удаляется.
+		constexpr static uint64_t POOL_RETAIN_IDLE_MS = 3000;
+
+		// Возвращает в пулы блоки из очередей, чьи потоки завершились.
+		// Вызывать только под блокировкой.
+		static void drain_orphan_remote_queues(pool_base** pools)
+		{
+			for (size_t i = 1; i < TCACHE_OWNER_MAX; i++)
 			{
-				return false;
+				if (!remote_queues[i].acquire(remote_queue::state_draining))
+					continue;
+
+				block_base* block = remote_queues[i].take_all();
+				while (block)
+				{
+					block_base* next = get_cache_next_block(block);
+					block->flags &= ~flag_block_cached;
+					pools[block->pool_id]->release_block_base(block->page_id, block->block_id);
+					block = next;
+				}
+
+				remote_queues[i].release();
 			}
-#else
-			return true;
-#endif
 		}
 
-//		static FILE* file_dbg_sniffer;
+		thread_cache::~thread_cache()
+		{
+			if (global_memory_manager)
+				global_memory_manager->release_thread_cache(*this);
+		}
 
-#define _fsniff(fmt, ...) \
-	{ fprintf(file_dbg_sniffer, fmt "\n", ##__VA_ARGS__); fflush(file_dbg_sniffer); }
+		// Создаёт пул для указанного номера.
+		// Страница любого размера блоков занимает примерно одинаково, кол-во блоков в ней
+		// выводится из размера блока, вид карты блоков - из их кол-ва.
+		template<size_t _pool_id>
+		static pool_base* create_pool_impl(page_map* address_map)
+		{
+			constexpr size_t data_size = pool_data_size[_pool_id];
+			typedef block_base_t<(int)data_size> block_t;
+			constexpr size_t blocks_in_page = get_pool_page_blocks<sizeof(block_t)>();
 
-		static size_t POOL_SIZE = 64 * 1024;
+			static_assert(blocks_in_page >= 16, "page must hold a few blocks");
+			static_assert(blocks_in_page <= (1ull << 24), "block_id must fit in 24 bits");
+
+			if constexpr (blocks_in_page >= 65536)
+				return new pool_t<block_t, page_t<block_t>, blocks_in_page>(POOL_SIZE, (uint8_t)_pool_id, address_map);
+			else
+				return new pool_t<block_t, page_t<block_t, __VMM_PAGE_CONFIG_SMALL_SIZE>, blocks_in_page>(POOL_SIZE,
+					(uint8_t)_pool_id, address_map);
+		}
+
+		typedef pool_base* (*create_pool_func_t)(page_map* address_map);
+
+		template<size_t... _index>
+		constexpr static std::array<create_pool_func_t, sizeof...(_index)> make_create_pool_table(
+			std::index_sequence<_index...>)
+		{
+			return { &create_pool_impl<_index>... };
+		}
+
+		// Таблица создания пулов, генерируется по лестнице размеров.
+		constexpr static std::array<create_pool_func_t, POOL_MAX> create_pool_table =
+			make_create_pool_table(std::make_index_sequence<POOL_MAX>{});
+
+		// Создаёт пул по номеру.
+		static pool_base* create_pool(size_t pool_id, page_map* address_map)
+		{
+			return (pool_id < POOL_MAX) ? create_pool_table[pool_id](address_map) : nullptr;
+		}
 
-		memory_manager::memory_manager() : pools(nullptr), thread(nullptr)
+		memory_manager::memory_manager() : large_blocks(&address_map), pools(nullptr), retain_pages(POOL_RETAIN_PAGES),
+			retain_bytes(POOL_RETAIN_BYTES), retain_idle_ms(POOL_RETAIN_IDLE_MS), refill_mask(0),
+			refill_priority(platform::THREAD_PRIORITY_DEFAULT), refill_affinity(0), thread(nullptr)
 		{
 			core::initialize();
 			create_default_block(&zero_size_request_block, 0);
 			
-			event_close = CreateEventA(nullptr, true, false, nullptr);
-			event_close_w = CreateEventA(nullptr, true, false, nullptr);
-			if (!event_close || !event_close_w)
+			event_close = platform::event_create(true);
+			event_close_w = platform::event_create(true);
+			event_refill = platform::event_create(false);
+			if (!event_close || !event_close_w || !event_refill)
 			{
-				_vassert(!new_block);
+				_vassert_msg(false, "Failed to create memory manager events");
 				return;
 			}
 			
-			ResetEvent((HANDLE)event_close);
-			ResetEvent((HANDLE)event_close_w);
+			platform::event_reset(event_close);
+			platform::event_reset(event_close_w);
 
 			//file_dbg_sniffer = fopen("vmm.log", "w+");
 
 			// Вся технология ускорения зависит от новых инструкций, если их нет, незачем
 			// это создавать.
-			pools = voltek::core::_internal::aligned_talloc<void*>(POOL_MAX, 0x10);
+			pools = voltek::core::_internal::aligned_talloc<pool_base*>(POOL_MAX, 0x10);
 			if (pools)
 			{
-				pools[POOL_8] = new pool8_t(POOL_SIZE);
-				pools[POOL_16] = new pool16_t(POOL_SIZE);
-				pools[POOL_32] = new pool32_t(POOL_SIZE);
-				pools[POOL_64] = new pool64_t(POOL_SIZE);
-			}
+				for (size_t i = 0; i < POOL_MAX; i++)
+					pools[i] = nullptr;
 
-#if USE_MULTITHREADS
-			thread = new std::thread([](HANDLE* ev_close, HANDLE* ev_close_w, void** pools, 
-				voltek::core::_internal::simple_lock* lock) {
-				while (1)
+				// Самые ходовые пулы, до 64 байт, нужны, только если нет кучи мелких блоков.
+				if (small_blocks.empty())
 				{
+					for (size_t i = 0; i < POOL_SMALL_CLASSES; i++)
 					{
-						// Блокируем. Снятие блокировки будет заботить компилятор.
-						voltek::core::_internal::simple_scope_lock scope_lock(*lock);
-
-						if (pools[POOL_8]) { ((pool8_t*)pools[POOL_8])->push_free_block_to_cache(); }
-						if (pools[POOL_16]) { ((pool16_t*)pools[POOL_16])->push_free_block_to_cache(); }
-						if (pools[POOL_32]) { ((pool32_t*)pools[POOL_32])->push_free_block_to_cache(); }
-						if (pools[POOL_64]) { ((pool64_t*)pools[POOL_64])->push_free_block_to_cache(); }
-						if (pools[POOL_128]) { ((pool128_t*)pools[POOL_128])->push_free_block_to_cache(); }
-						if (pools[POOL_256]) { ((pool256_t*)pools[POOL_256])->push_free_block_to_cache(); }
-						if (pools[POOL_512]) { ((pool512_t*)pools[POOL_512])->push_free_block_to_cache(); }
-						if (pools[POOL_1024]) { ((pool1024_t*)pools[POOL_1024])->push_free_block_to_cache(); }
-						if (pools[POOL_4096]) { ((pool4096_t*)pools[POOL_4096])->push_free_block_to_cache(); }
-						if (pools[POOL_8192]) { ((pool8192_t*)pools[POOL_8192])->push_free_block_to_cache(); }
-						if (pools[POOL_16384]) { ((pool16384_t*)pools[POOL_16384])->push_free_block_to_cache(); }
-						if (pools[POOL_32768]) { ((pool32768_t*)pools[POOL_32768])->push_free_block_to_cache(); }
-						if (pools[POOL_65536]) { ((pool65536_t*)pools[POOL_65536])->push_free_block_to_cache(); }
-						if (pools[POOL_131072]) { ((pool131072_t*)pools[POOL_131072])->push_free_block_to_cache(); }
-					}
-
-					if (WaitForSingleObject(*ev_close, 10) == WAIT_OBJECT_0)
-					{
-						SetEvent(*ev_close_w);
-						break;
+						pools[i] = create_pool(i, &address_map);
+						if (pools[i]) pools[i]->set_retention(retain_pages, retain_bytes);
 					}
-
-					Sleep(1);
 				}
-			}, (HANDLE*)&event_close, (HANDLE*)&event_close_w, pools, &lock);
-			_vassert(!thread);
-			SetThreadPriority(thread->native_handle(), THREAD_PRIORITY_HIGHEST);
-			_vassert(!SetThreadAffinityMask(thread->native_handle(), 1llu << (thread->hardware_concurrency() - 1)));
+			}
+
+#if USE_MULTITHREADS
+			// Поток спит, пока кеш какого-нибудь пула не опустеет ниже порога.
+			thread = new std::thread(&memory_manager::refill_thread_proc, this);
+			_vassert(thread);
 			thread->detach();
+
+			// Первоначально заполним кеши созданных пулов.
+			for (size_t i = 0; i < POOL_SMALL_CLASSES; i++)
+				if (pools && pools[i]) request_refill(1ull << i);
 #endif
 		}
 
@@ -168,25 +192,13 @@ namespace voltek
 #if USE_MULTITHREADS
 			if (thread)
 			{
-				SetEvent((HANDLE)event_close);
-				WaitForSingleObject((HANDLE)event_close_w, INFINITE);
+				platform::event_set(event_close);
+				platform::event_wait(&event_close_w, 1, platform::WAIT_INFINITE);
 
 				if (pools)
 				{
-					if (pools[POOL_8]) delete ((pool8_t*)pools[POOL_8]);
-					if (pools[POOL_16]) delete ((pool16_t*)pools[POOL_16]);
-					if (pools[POOL_32]) delete ((pool32_t*)pools[POOL_32]);
-					if (pools[POOL_64]) delete ((pool64_t*)pools[POOL_64]);
-					if (pools[POOL_128]) delete ((pool128_t*)pools[POOL_128]);
-					if (pools[POOL_256]) delete ((pool256_t*)pools[POOL_256]);
-					if (pools[POOL_512]) delete ((pool512_t*)pools[POOL_512]);
-					if (pools[POOL_1024]) delete ((pool1024_t*)pools[POOL_1024]);
-					if (pools[POOL_4096]) delete ((pool4096_t*)pools[POOL_4096]);
-					if (pools[POOL_8192]) delete ((pool8192_t*)pools[POOL_8192]);
-					if (pools[POOL_16384]) delete ((pool16384_t*)pools[POOL_16384]);
-					if (pools[POOL_32768]) delete ((pool32768_t*)pools[POOL_32768]);
-					if (pools[POOL_65536]) delete ((pool65536_t*)pools[POOL_65536]);
-					if (pools[POOL_131072]) delete ((pool131072_t*)pools[POOL_131072]);
+					for (size_t i = 0; i < POOL_MAX; i++)
+						if (pools[i]) delete pools[i];
 
 					voltek::core::_internal::aligned_free(pools);
 					pools = nullptr;
@@ -196,727 +208,1107 @@ namespace voltek
 				thread = nullptr;
 			}
 #endif
+
+			platform::event_destroy(event_close);
+			platform::event_destroy(event_close_w);
+			platform::event_destroy(event_refill);
 		}
 
-		void* memory_manager::alloc(size_t size)
+		void memory_manager::set_refill_thread(int priority, uint64_t affinity_mask)
 		{
-			//if (ULONG_MAX < size)
-			//	return nullptr;
+#if USE_MULTITHREADS
+			if (!thread) return;
 
-			if (!size)
-				return get_ptr_from_block_handle(&zero_size_request_block);
+			// Поток применит настройки сам, когда проснётся.
+			refill_priority.store(priority, std::memory_order_relaxed);
+			refill_affinity.store(affinity_mask, std::memory_order_relaxed);
+			request_refill(REFILL_APPLY_SETTINGS);
+#endif
+		}
+
+		void memory_manager::request_refill(uint64_t bit)
+		{
+			// Запрос уже есть, поток ещё не проснулся.
+			if (refill_mask.load(std::memory_order_relaxed) & bit)
+				return;
+
+			if (!(refill_mask.fetch_or(bit, std::memory_order_acq_rel) & bit))
+				platform::event_set(event_refill);
+		}
+
+		inline void memory_manager::count_stats(size_t class_id, size_t counter, uint64_t value)
+		{
+			// Набор счётчиков закреплён за очередью удалённого освобождения потока.
+			if (!local_cache.is_owner_claimed())
+				claim_remote_queue(local_cache);
 
+			uint8_t owner_id = local_cache.get_owner_id();
+			stats_slots[owner_id].add(class_id, counter, value, !owner_id);
+		}
+
+		void memory_manager::check_pool_watermark(pool_base* pool, size_t pool_id)
+		{
+			if (pool->cached_count() < REFILL_LOW_WATERMARK)
+				request_refill(1ull << pool_id);
+		}
+
+		bool memory_manager::has_retained_pages() const
+		{
+			if (!pools) return false;
+
+			for (size_t i = 0; i < POOL_MAX; i++)
+				if (pools[i] && pools[i]->retained_count())
+					return true;
+
+			return false;
+		}
+
+		bool memory_manager::release_pool_block(size_t pool_id, uint16_t page_id, uint32_t block_id)
+		{
+			pool_base* pool = pools[pool_id];
+			size_t retained = pool->retained_count();
+			bool ret = pool->release_block_base(page_id, block_id);
+
+			// Пул оставил пустую страницу про запас, поток кеширования удалит её после простоя.
+			if (pool->retained_count() > retained)
+				request_refill(REFILL_IDLE_TRIM);
+
+			return ret;
+		}
+
+		void memory_manager::set_page_retention(size_t pages, size_t bytes, uint32_t idle_ms)
+		{
 			// Блокируем. Снятие блокировки будет заботить компилятор.
-			//voltek::core::_internal::simple_scope_lock scope_lock(lock);
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
 
-			//_fsniff("The beginning of the allocation of a memory block of %llu sizes", size);
+			retain_pages = pages;
+			retain_bytes = bytes;
+			retain_idle_ms = idle_ms;
 
-			// Проблемы с пулами? или размер больше фиксируемых блоков?
-			// Тогда выделим память простым способом.
-			if (!pools || (size > 131072))
+			if (!pools) return;
+
+			// Лишние страницы про запас удаляются сразу.
+			uint64_t now_ms = platform::tick_count_ms();
+			for (size_t i = 0; i < POOL_MAX; i++)
 			{
-			alloc_default_ptr_label:
-				block_base* new_block;
-				
-				if (size >= MAX_BLOCK_SIZE)
-					new_block = (block_base*)VirtualAlloc(NULL, size + sizeof(block_base), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-				else
-					new_block = (block_base*)voltek::core::_internal::aligned_malloc(size + sizeof(block_base), 0x10);
-	
-				if (new_block)
-				{
-					//_fsniff("Default block allocated: %p", new_block);
+				if (!pools[i]) continue;
+				pools[i]->set_retention(pages, bytes);
+				pools[i]->trim(now_ms, retain_idle_ms, false);
+			}
+		}
 
-					create_default_block(new_block, size);
-					return get_ptr_from_block_handle(new_block);
-				}
+		bool memory_manager::set_large_pages(size_t bytes)
+		{
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
 
-				_vassert(!new_block);
-				return nullptr;
-			}
+			return small_blocks.set_large_pages(bytes);
+		}
+
+		size_t memory_manager::trim(size_t budget)
+		{
+			if (!budget)
+				budget = ~(size_t)0;
 
-			void* new_ptr = nullptr;
+			// Блоки в кеше потока держат свои страницы занятыми. Кеши других потоков не трогаем,
+			// но свой можно вернуть, очередь удалённого освобождения остаётся за потоком.
+			drain_remote_queue(local_cache);
+			for (size_t i = 0; pools && (i < TCACHE_POOL_MAX); i++)
+				if (local_cache.count(i))
+					flush_thread_cache(local_cache, i, local_cache.count(i));
+			for (size_t i = 0; i < SMALL_HEAP_CLASSES; i++)
+				if (local_cache.count_small(i))
+					flush_small_cache(local_cache, i, local_cache.count_small(i));
+
+			size_t released = large_blocks.release_cache(budget);
+
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
+
+			for (size_t i = 0; pools && (i < POOL_MAX) && (released < budget); i++)
+				if (pools[i])
+					released += pools[i]->release_free_pages(budget - released);
+
+			if (released < budget)
+				released += small_blocks.release_empty_segments(budget - released);
+
+			return released;
+		}
+
+		void memory_manager::get_pool_stats(pool_page_stats& stats) const
+		{
+			memset(&stats, 0, sizeof(stats));
 
-#if USE_MULTITHREADS
 			// Блокируем. Снятие блокировки будет заботить компилятор.
 			voltek::core::_internal::simple_scope_lock scope_lock(lock);
-#endif
-	
-			if (size > 65536)
-			{
-				if (!pools[POOL_131072])
-					pools[POOL_131072] = (void*)(new pool131072_t(POOL_SIZE));
 
-				pool131072_t* pool = (pool131072_t*)pools[POOL_131072];
-				page131072_t* page = nullptr;
-				block131072_t* block = nullptr;
-				size_t index_block = 0;
+			if (!pools) return;
 
-				if (pool->get_free_block(block, page, index_block))
+			for (size_t i = 0; i < POOL_MAX; i++)
+				if (pools[i]) pools[i]->add_stats(stats);
+		}
+
+		void memory_manager::get_stats(memory_stats& stats) const
+		{
+			memset(&stats, 0, sizeof(stats));
+
+			// Суммируем наборы счётчиков всех потоков.
+			for (size_t i = 0; i < STATS_CLASS_MAX; i++)
+			{
+				class_stats& class_stat = stats.classes[i];
+				class_stat.block_size = (i < POOL_MAX) ? pool_data_size[i] : 0;
+
+				for (size_t j = 0; j < TCACHE_OWNER_MAX; j++)
 				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_131072);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <131072>: %p %llu", new_ptr, size);
+					class_stat.allocs += stats_slots[j].get(i, STATS_ALLOCS);
+					class_stat.frees += stats_slots[j].get(i, STATS_FREES);
+					class_stat.cache_misses += stats_slots[j].get(i, STATS_CACHE_MISSES);
+					class_stat.refills += stats_slots[j].get(i, STATS_REFILLS);
 				}
 			}
-			else if (size > 32768)
+
+			// Мелкие блоки лежат в сегментах своей кучи.
+			for (size_t i = 0; i < SMALL_HEAP_CLASSES; i++)
 			{
-				if (!pools[POOL_65536])
-					pools[POOL_65536] = (void*)(new pool65536_t(POOL_SIZE));
+				size_t segments = small_blocks.get_segment_count(i);
+				stats.classes[i].committed_pages += segments;
+				stats.classes[i].committed_bytes += segments * SMALL_SEGMENT_SIZE;
+			}
 
-				pool65536_t* pool = (pool65536_t*)pools[POOL_65536];
-				page65536_t* page = nullptr;
-				block65536_t* block = nullptr;
-				size_t index_block = 0;
+			{
+				// Блокируем. Снятие блокировки будет заботить компилятор.
+				voltek::core::_internal::simple_scope_lock scope_lock(lock);
 
-				if (pool->get_free_block(block, page, index_block))
+				for (size_t i = 0; pools && (i < POOL_MAX); i++)
 				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_65536);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <65536>: %p %llu", new_ptr, size);
+					if (!pools[i]) continue;
+
+					pool_page_stats pool_stats = {};
+					pools[i]->add_stats(pool_stats);
+					stats.classes[i].committed_pages += pool_stats.pages_created - pool_stats.pages_destroyed;
+					stats.classes[i].committed_bytes += pool_stats.committed_bytes;
 				}
 			}
-			else if (size > 16384)
-			{
-				if (!pools[POOL_32768])
-					pools[POOL_32768] = (void*)(new pool32768_t(POOL_SIZE));
 
-				pool32768_t* pool = (pool32768_t*)pools[POOL_32768];
-				page32768_t* page = nullptr;
-				block32768_t* block = nullptr;
-				size_t index_block = 0;
+			// У больших блоков свой кеш участков.
+			large_heap_stats large_stats;
+			large_blocks.get_stats(large_stats);
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_32768);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <32768>: %p %llu", new_ptr, size);
-				}
+			class_stats& large_stat = stats.classes[STATS_LARGE_CLASS];
+			large_stat.cache_misses = large_stats.cache_misses;
+			large_stat.committed_pages = large_stats.used_spans;
+			large_stat.committed_bytes = large_stats.used_bytes + large_stats.cached_committed_bytes;
+			stats.large_bytes = large_stats.used_bytes;
+			stats.large_page_bytes = small_blocks.get_large_page_bytes();
+
+			for (size_t i = 0; i < STATS_CLASS_MAX; i++)
+			{
+				class_stats& class_stat = stats.classes[i];
+
+				// Наборы читаются не разом, разность может уйти в минус.
+				class_stat.live_blocks = (class_stat.allocs > class_stat.frees) ? class_stat.allocs - class_stat.frees : 0;
+				class_stat.cache_hits = (class_stat.allocs > class_stat.cache_misses) ?
+					class_stat.allocs - class_stat.cache_misses : 0;
+
+				stats.total.allocs += class_stat.allocs;
+				stats.total.frees += class_stat.frees;
+				stats.total.live_blocks += class_stat.live_blocks;
+				stats.total.cache_hits += class_stat.cache_hits;
+				stats.total.cache_misses += class_stat.cache_misses;
+				stats.total.refills += class_stat.refills;
+				stats.total.committed_pages += class_stat.committed_pages;
+				stats.total.committed_bytes += class_stat.committed_bytes;
 			}
-			else if (size > 8192)
+		}
+
+		void memory_manager::refill_thread_proc()
+		{
+			void* events[2] = { event_close, event_refill };
+
+			while (1)
 			{
-				if (!pools[POOL_16384])
-					pools[POOL_16384] = (void*)(new pool16384_t(POOL_SIZE));
+				// Спим, пока не попросят. Пока в кеше больших блоков или в пулах про запас что-то лежит,
+				// просыпаемся периодически, чтобы освободить память простаивающих участков и страниц.
+				size_t wait = platform::event_wait(events, 2,
+					(large_blocks.empty_cache() && !has_retained_pages()) ? platform::WAIT_INFINITE : LARGE_TRIM_PERIOD_MS);
+				if (wait == platform::WAIT_TIMEOUT_INDEX)
+				{
+					uint64_t now_ms = platform::tick_count_ms();
+					large_blocks.trim(now_ms, false);
 
-				pool16384_t* pool = (pool16384_t*)pools[POOL_16384];
-				page16384_t* page = nullptr;
-				block16384_t* block = nullptr;
-				size_t index_block = 0;
+					// Блокируем. Снятие блокировки будет заботить компилятор.
+					voltek::core::_internal::simple_scope_lock scope_lock(lock);
+
+					// Кеш больших блоков будит поток и без пулов, если их массив не выделился.
+					if (pools)
+					{
+						for (size_t i = 0; i < POOL_MAX; i++)
+							if (pools[i] && pools[i]->retained_count())
+								pools[i]->trim(now_ms, retain_idle_ms, false);
+					}
+					continue;
+				}
 
-				if (pool->get_free_block(block, page, index_block))
+				if (wait != 1)
 				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_16384);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <16384>: %p %llu", new_ptr, size);
+					platform::event_set(event_close_w);
+					break;
 				}
-			}
-			else if (size > 4096)
-			{
-				if (!pools[POOL_8192])
-					pools[POOL_8192] = (void*)(new pool8192_t(POOL_SIZE));
 
-				pool8192_t* pool = (pool8192_t*)pools[POOL_8192];
-				page8192_t* page = nullptr;
-				block8192_t* block = nullptr;
-				size_t index_block = 0;
+				uint64_t mask = refill_mask.exchange(0, std::memory_order_acq_rel);
 
-				if (pool->get_free_block(block, page, index_block))
+				if (mask & REFILL_APPLY_SETTINGS)
 				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_8192);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <8192>: %p %llu", new_ptr, size);
+					platform::thread_set_priority(refill_priority.load(std::memory_order_relaxed));
+					uint64_t affinity_mask = refill_affinity.load(std::memory_order_relaxed);
+					if (affinity_mask)
+						platform::thread_set_affinity(affinity_mask);
 				}
-			}
-			else if (size > 1024)
-			{
-				if (!pools[POOL_4096])
-					pools[POOL_4096] = (void*)(new pool4096_t(POOL_SIZE));
 
-				pool4096_t* pool = (pool4096_t*)pools[POOL_4096];
-				page4096_t* page = nullptr;
-				block4096_t* block = nullptr;
-				size_t index_block = 0;
+				if (mask & REFILL_ORPHAN_QUEUES)
+				{
+					// Блокируем. Снятие блокировки будет заботить компилятор.
+					voltek::core::_internal::simple_scope_lock scope_lock(lock);
+					drain_orphan_remote_queues(pools);
+				}
 
-				if (pool->get_free_block(block, page, index_block))
+				for (size_t i = 0; i < POOL_MAX; i++)
 				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_4096);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <4096>: %p %llu", new_ptr, size);
+					if (!(mask & (1ull << i)) || !pools || !pools[i])
+						continue;
+
+					// Заполняем кеш порциями, чтобы не держать блокировку подолгу.
+					bool filled = false;
+					while (!filled)
+					{
+						// Блокируем. Снятие блокировки будет заботить компилятор.
+						voltek::core::_internal::simple_scope_lock scope_lock(lock);
+
+						for (size_t j = 0; j < REFILL_CHUNK_SIZE; j++)
+						{
+							if (!pools[i]->push_free_block_to_cache())
+							{
+								filled = true;
+								break;
+							}
+						}
+
+						count_stats(i, STATS_REFILLS);
+					}
 				}
 			}
-			else if (size > 512)
+		}
+
+		void* memory_manager::alloc_default(size_t size, bool zeroed)
+		{
+			// Блок занимает свой участок адресного пространства в куче больших блоков,
+			// участок отмечен в карте адресов.
+			size_t dirty = 0;
+			block_base* new_block = (block_base*)large_blocks.alloc(size + sizeof(block_base), zeroed ? &dirty : nullptr);
+
+			if (new_block)
 			{
-				if (!pools[POOL_1024])
-					pools[POOL_1024] = (void*)(new pool1024_t(POOL_SIZE));
+				//_fsniff("Default block allocated: %p", new_block);
 
-				pool1024_t* pool = (pool1024_t*)pools[POOL_1024];
-				page1024_t* page = nullptr;
-				block1024_t* block = nullptr;
-				size_t index_block = 0;
+				create_default_block(new_block, size);
+				count_stats(STATS_LARGE_CLASS, STATS_ALLOCS);
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_1024);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <1024>: %p %llu", new_ptr, size);
-				}
+				void* ptr = get_ptr_from_block_handle(new_block);
+				// Заголовок блока уже перезаписан.
+				dirty = (dirty > sizeof(block_base)) ? dirty - sizeof(block_base) : 0;
+				if (dirty)
+					voltek::core::_internal::zero_memory(ptr, (dirty < size) ? dirty : size);
+				return ptr;
 			}
-			else if (size > 256)
-			{
-				if (!pools[POOL_512])
-					pools[POOL_512] = (void*)(new pool512_t(POOL_SIZE));
 
-				pool512_t* pool = (pool512_t*)pools[POOL_512];
-				page512_t* page = nullptr;
-				block512_t* block = nullptr;
-				size_t index_block = 0;
+			_vassert(!new_block);
+			return nullptr;
+		}
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_512);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <512>: %p %llu", new_ptr, size);
-				}
+		pool_base* memory_manager::get_pool(size_t pool_id)
+		{
+			if (!pools[pool_id])
+			{
+				pools[pool_id] = create_pool(pool_id, &address_map);
+				if (pools[pool_id]) pools[pool_id]->set_retention(retain_pages, retain_bytes);
 			}
-			else if (size > 128)
+
+			return pools[pool_id];
+		}
+
+		block_base* memory_manager::refill_thread_cache(thread_cache& cache, size_t pool_id)
+		{
+			const size_t batch = get_tcache_batch(pool_data_size[pool_id]);
+			block_base* ret = nullptr;
+
+			if (!cache.is_owner_claimed())
+				claim_remote_queue(cache);
+
+			// Сначала кеш пула, он без блокировки.
+			pool_base* pool = pools[pool_id];
+			if (pool)
 			{
-				if (!pools[POOL_256])
-					pools[POOL_256] = (void*)(new pool256_t(POOL_SIZE));
+				for (size_t i = 0; i < batch; i++)
+				{
+					uint16_t page_id = 0;
+					uint32_t block_id = 0;
+
+					block_base* block = pool->pop_cached_block_base(page_id, block_id);
+					if (!block) break;
 
-				pool256_t* pool = (pool256_t*)pools[POOL_256];
-				page256_t* page = nullptr;
-				block256_t* block = nullptr;
-				size_t index_block = 0;
+					create_pool_block(block, 0, page_id, block_id, (uint8_t)pool_id);
+					block->owner_id = cache.get_owner_id();
+
+					if (!ret)
+						ret = block;
+					else
+						cache.push(pool_id, block);
+				}
 
-				if (pool->get_free_block(block, page, index_block))
+				check_pool_watermark(pool, pool_id);
+				if (ret)
 				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_256);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <256>: %p %llu", new_ptr, size);
+					count_stats(pool_id, STATS_REFILLS);
+					return ret;
 				}
 			}
-			else if (size > 64)
+
+#if USE_MULTITHREADS
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+			pool = get_pool(pool_id);
+			if (!pool) return nullptr;
+
+			for (size_t i = 0; i < batch; i++)
 			{
-				if (!pools[POOL_128])
-					pools[POOL_128] = (void*)(new pool128_t(POOL_SIZE));
+				uint16_t page_id = 0;
+				uint32_t block_id = 0;
 
-				pool128_t* pool = (pool128_t*)pools[POOL_128];
-				page128_t* page = nullptr;
-				block128_t* block = nullptr;
-				size_t index_block = 0;
+				block_base* block = pool->get_free_block_base(page_id, block_id);
+				if (!block) break;
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_128);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <128>: %p %llu", new_ptr, size);
-				}
+				create_pool_block(block, 0, page_id, block_id, (uint8_t)pool_id);
+				block->owner_id = cache.get_owner_id();
+
+				// Первый блок отдаём сразу, остальные в кеш.
+				if (!ret)
+					ret = block;
+				else
+					cache.push(pool_id, block);
 			}
-			else if (size > 32)
-			{
-				pool64_t* pool = (pool64_t*)pools[POOL_64];
-				page64_t* page = nullptr;
-				block64_t* block = nullptr;
-				size_t index_block = 0;
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_64);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <64>: %p %llu", new_ptr, size);
-				}
+			if (ret)
+			{
+				count_stats(pool_id, STATS_REFILLS);
+				count_stats(pool_id, STATS_CACHE_MISSES);
 			}
-			else if (size > 16)
+
+			return ret;
+		}
+
+		void memory_manager::flush_thread_cache(thread_cache& cache, size_t pool_id, size_t count)
+		{
+#if USE_MULTITHREADS
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+			for (size_t i = 0; i < count; i++)
 			{
-				pool32_t* pool = (pool32_t*)pools[POOL_32];
-				page32_t* page = nullptr;
-				block32_t* block = nullptr;
-				size_t index_block = 0;
+				block_base* block = cache.pop(pool_id);
+				if (!block) break;
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_32);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <32>: %p %llu", new_ptr, size);
-				}
+				release_pool_block(pool_id, block->page_id, block->block_id);
 			}
-			else if (size > 8)
+		}
+
+		void* memory_manager::refill_small_cache(thread_cache& cache, size_t class_id)
+		{
+			const size_t batch = get_tcache_batch(pool_data_size[class_id]);
+			void* ret = nullptr;
+
+#if USE_MULTITHREADS
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+			for (size_t i = 0; i < batch; i++)
 			{
-				pool16_t* pool = (pool16_t*)pools[POOL_16];
-				page16_t* page = nullptr;
-				block16_t* block = nullptr;
-				size_t index_block = 0;
+				void* ptr = small_blocks.pop(class_id);
+				if (!ptr) break;
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_16);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <16>: %p %llu", new_ptr, size);
-				}
+				// Первый блок отдаём сразу, остальные в кеш.
+				if (!ret)
+					ret = ptr;
+				else
+					cache.push_small(class_id, ptr);
 			}
-			else
-			{
-				pool8_t* pool = (pool8_t*)pools[POOL_8];
-				page8_t* page = nullptr;
-				block8_t* block = nullptr;
-				size_t index_block = 0;
 
-				if (pool->get_free_block(block, page, index_block))
-				{
-					create_pool_block(block, (uint32_t)size, (uint16_t)page->get_user_data(),
-						(uint32_t)index_block, (uint16_t)POOL_8);
-					new_ptr = get_ptr_from_block_handle(block);
-					//_fsniff("Pool block allocated <8>: %p %llu", new_ptr, size);
-				}
+			if (ret)
+			{
+				count_stats(class_id, STATS_REFILLS);
+				count_stats(class_id, STATS_CACHE_MISSES);
 			}
 
-			// Если каким-то чудом память не выделена, то выделим память простым способом.
-			if (!new_ptr)
-				goto alloc_default_ptr_label;
-			
-			return new_ptr;
+			return ret;
 		}
 
-		void* memory_manager::realloc(const void* ptr, size_t size)
+		void memory_manager::flush_small_cache(thread_cache& cache, size_t class_id, size_t count)
 		{
-			if (!ptr || !is_valid_ptr(ptr) || !is_valid_pointer(ptr) || !size /*|| (ULONG_MAX < size)*/)
-				return nullptr;
-
-			void* new_ptr = nullptr;	
-
 #if USE_MULTITHREADS
 			// Блокируем. Снятие блокировки будет заботить компилятор.
 			voltek::core::_internal::simple_scope_lock scope_lock(lock);
 #endif
 
-			// Если память выделена ранее как обычный, то тут выделение новой памяти неизбежно.
-			if (is_used_default_ptr(ptr))
+			for (size_t i = 0; i < count; i++)
 			{
-			realloc_def_label:
-				size_t old_size = msize(ptr);
-				new_ptr = alloc(size);
-				if (new_ptr && (old_size > 0)) memcpy(new_ptr, ptr, old_size > size ? size : old_size);
-				free(ptr);
+				void* ptr = cache.pop_small(class_id);
+				if (!ptr) break;
+
+				small_blocks.push(class_id, ptr);
 			}
-			else
-			{
-				new_ptr = const_cast<void*>(ptr);
-				block_base* block = get_block_handle_from_ptr(new_ptr);
-				uint8_t pool_id = block->pool_id;
+		}
 
-				switch (pool_id)
-				{
-				case POOL_131072:
+		void memory_manager::free_small(const void* ptr)
+		{
+			void* block = small_blocks.get_block_start(ptr);
+			size_t class_id = small_blocks.get_class_id(block);
+
+			small_blocks.debug_set_freed(block);
+			local_cache.push_small(class_id, block);
+			count_stats(class_id, STATS_FREES);
+
+			// Кеш разросся, вернём пачку блоков в кучу.
+			const size_t batch = get_tcache_batch(pool_data_size[class_id]);
+			if (local_cache.count_small(class_id) >= (batch << 1))
+				flush_small_cache(local_cache, class_id, batch);
+		}
+
+		void memory_manager::claim_remote_queue(thread_cache& cache)
+		{
+			for (size_t i = 1; i < TCACHE_OWNER_MAX; i++)
+			{
+				if (remote_queues[i].acquire(remote_queue::state_owned))
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 131072)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+					cache.set_owner_id((uint8_t)i);
+					// Очередь могла остаться от завершённого потока.
+					drain_remote_queue(cache);
+					return;
 				}
-				break;
-				case POOL_65536:
+			}
+
+			// Все очереди заняты, блоки этого потока освобождаются по-старому.
+			cache.set_owner_id(0);
+		}
+
+		bool memory_manager::drain_remote_queue(thread_cache& cache)
+		{
+			if (!cache.get_owner_id()) return false;
+
+			block_base* block = remote_queues[cache.get_owner_id()].take_all();
+			if (!block) return false;
+
+			while (block)
+			{
+				block_base* next = get_cache_next_block(block);
+				cache.push(block->pool_id, block);
+				block = next;
+			}
+
+			// Кеш мог разрастись, вернём лишнее в пулы.
+			for (size_t i = 0; i < TCACHE_POOL_MAX; i++)
+			{
+				const size_t batch = get_tcache_batch(pool_data_size[i]);
+				if (cache.count(i) >= (batch << 1))
+					flush_thread_cache(cache, i, cache.count(i) - batch);
+			}
+
+			return true;
+		}
+
+		void memory_manager::release_thread_cache(thread_cache& cache)
+		{
+			if (!pools) return;
+
+			if (cache.get_owner_id())
+			{
+				// Сначала отпускаем очередь, всё, что в неё попадёт после, разберёт фоновый поток.
+				uint8_t owner_id = cache.get_owner_id();
+				remote_queues[owner_id].release();
+				block_base* block = remote_queues[owner_id].take_all();
+				while (block)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 65536)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+					block_base* next = get_cache_next_block(block);
+					cache.push(block->pool_id, block);
+					block = next;
 				}
-				break;
-				case POOL_32768:
-				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 32768)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
-				}
-				break;
-				case POOL_16384:
+
+				cache.set_owner_id(0);
+				request_refill(REFILL_ORPHAN_QUEUES);
+			}
+
+			for (size_t i = 0; i < TCACHE_POOL_MAX; i++)
+			{
+				if (cache.count(i))
+					flush_thread_cache(cache, i, cache.count(i));
+			}
+
+			for (size_t i = 0; i < SMALL_HEAP_CLASSES; i++)
+			{
+				if (cache.count_small(i))
+					flush_small_cache(cache, i, cache.count_small(i));
+			}
+		}
+
+		void* memory_manager::calloc(size_t size)
+		{
+			if (!size)
+				return get_ptr_from_block_handle(&zero_size_request_block);
+
+			// Блоки пулов проходят через кеши, которые пишут в них ссылки, поэтому свежими не бывают.
+			if (!pools || (size > POOL_MAX_BLOCK_SIZE))
+				return alloc_default(size, true);
+
+			void* ptr = alloc(size);
+			if (ptr) voltek::core::_internal::zero_memory(ptr, size);
+			return ptr;
+		}
+
+		void* memory_manager::alloc(size_t size)
+		{
+			//if (ULONG_MAX < size)
+			//	return nullptr;
+
+			if (!size)
+				return get_ptr_from_block_handle(&zero_size_request_block);
+
+			//_fsniff("The beginning of the allocation of a memory block of %llu sizes", size);
+
+			// Проблемы с пулами? или размер больше фиксируемых блоков?
+			// Тогда выделим память простым способом.
+			if (!pools || (size > POOL_MAX_BLOCK_SIZE))
+				return alloc_default(size);
+
+			size_t pool_id = get_pool_id_from_size(size);
+			block_base* block = nullptr;
+
+			if (pool_id < SMALL_HEAP_CLASSES)
+			{
+				// Мелкие блоки без заголовка, размер известен по адресу.
+				void* ptr = local_cache.pop_small(pool_id);
+				if (!ptr) ptr = refill_small_cache(local_cache, pool_id);
+				if (ptr)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 16384)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+					small_blocks.debug_set_allocated(ptr);
+					count_stats(pool_id, STATS_ALLOCS);
+					return ptr;
 				}
-				break;
-				case POOL_8192:
-				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 8192)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
-				}
-				break;
-				case POOL_4096:
+				// Область исчерпана, дальше обычные пулы.
+			}
+
+			if (pool_id < TCACHE_POOL_MAX)
+			{
+				// Сначала кеш потока, он без блокировки, если пуст, то берём из пула сразу пачку.
+				// Перед походом в пул забираем блоки, освобождённые для нас другими потоками.
+				block = local_cache.pop(pool_id);
+				if (!block && drain_remote_queue(local_cache)) block = local_cache.pop(pool_id);
+				if (!block) block = refill_thread_cache(local_cache, pool_id);
+				if (block)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 4096)
-						goto realloc_def_label;
-					// Новый размер для памяти.
 					block->size = (uint32_t)size;
+					block->owner_id = local_cache.get_owner_id();
 				}
-				break;
-				case POOL_1024:
+			}
+			else
+			{
+				uint16_t page_id = 0;
+				uint32_t block_id = 0;
+
+				// Сначала кеш пула, он без блокировки.
+				pool_base* pool = pools[pool_id];
+				block = pool ? pool->pop_cached_block_base(page_id, block_id) : nullptr;
+
+				if (!block)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 1024)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+#if USE_MULTITHREADS
+					// Блокируем. Снятие блокировки будет заботить компилятор.
+					voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+					pool = get_pool(pool_id);
+					block = pool ? pool->get_free_block_base(page_id, block_id) : nullptr;
+					if (block) count_stats(pool_id, STATS_CACHE_MISSES);
 				}
-				break;
-				case POOL_512:
+
+				if (block) create_pool_block(block, (uint32_t)size, page_id, block_id, (uint8_t)pool_id);
+			}
+
+			// Если каким-то чудом память не выделена, то выделим память простым способом.
+			if (!block)
+				return alloc_default(size);
+
+			count_stats(pool_id, STATS_ALLOCS);
+
+			//_fsniff("Pool block allocated <%llu>: %p %llu", pool_data_size[pool_id], block, size);
+			return get_ptr_from_block_handle(block);
+		}
+
+		size_t memory_manager::alloc_batch(void** ptrs, size_t count, size_t size)
+		{
+			if (!ptrs || !count)
+				return 0;
+
+			size_t allocated = 0;
+
+			// Размер не указывает на пул, выделяем по одному.
+			if (!size || !pools || (size > POOL_MAX_BLOCK_SIZE))
+			{
+				for (; allocated < count; allocated++)
+					if (!(ptrs[allocated] = alloc(size))) break;
+				return allocated;
+			}
+
+			size_t pool_id = get_pool_id_from_size(size);
+
+			if (pool_id < SMALL_HEAP_CLASSES)
+			{
+				// Мелкие блоки без заголовка, сначала из кеша потока, остальное из кучи за одну блокировку.
+				for (; allocated < count; allocated++)
+					if (!(ptrs[allocated] = local_cache.pop_small(pool_id))) break;
+
+				if (allocated < count)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 512)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+#if USE_MULTITHREADS
+					// Блокируем. Снятие блокировки будет заботить компилятор.
+					voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+					size_t cached = allocated;
+					for (; allocated < count; allocated++)
+						if (!(ptrs[allocated] = small_blocks.pop(pool_id))) break;
+
+					count_stats(pool_id, STATS_CACHE_MISSES, allocated - cached);
 				}
-				break;
-				case POOL_256:
+
+				for (size_t i = 0; i < allocated; i++)
+					small_blocks.debug_set_allocated(ptrs[i]);
+
+				// Область исчерпана, дальше обычные пулы.
+				if (allocated == count)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 256)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+					count_stats(pool_id, STATS_ALLOCS, allocated);
+					return allocated;
 				}
-				break;
-				case POOL_128:
+			}
+
+			uint8_t owner_id = 0;
+			if (pool_id < TCACHE_POOL_MAX)
+			{
+				if (!local_cache.is_owner_claimed())
+					claim_remote_queue(local_cache);
+
+				owner_id = local_cache.get_owner_id();
+
+				// Сначала кеш потока, он без блокировки.
+				for (; allocated < count; allocated++)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 128)
-						goto realloc_def_label;
-					// Новый размер для памяти.
+					block_base* block = local_cache.pop(pool_id);
+					if (!block) break;
+
 					block->size = (uint32_t)size;
+					block->owner_id = owner_id;
+					ptrs[allocated] = get_ptr_from_block_handle(block);
 				}
-				break;
-				case POOL_64:
+			}
+
+			if (allocated < count)
+			{
+				// Остаток нарезается из страниц пула за одну блокировку.
+				// Заголовки блоков временно лежат в самом массиве указателей.
+				block_base** blocks = (block_base**)(ptrs + allocated);
+				size_t taken = 0;
+
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 64)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+#if USE_MULTITHREADS
+					// Блокируем. Снятие блокировки будет заботить компилятор.
+					voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+					pool_base* pool = get_pool(pool_id);
+					if (pool) taken = pool->get_free_blocks_base(blocks, count - allocated);
 				}
-				break;
-				case POOL_32:
+
+				for (size_t i = 0; i < taken; i++)
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 32)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
+					block_base* block = blocks[i];
+					create_pool_block(block, (uint32_t)size, block->page_id, block->block_id, (uint8_t)pool_id);
+					block->owner_id = owner_id;
+					ptrs[allocated + i] = get_ptr_from_block_handle(block);
 				}
-				break;
-				case POOL_16:
+
+				allocated += taken;
+				count_stats(pool_id, STATS_CACHE_MISSES, taken);
+			}
+
+			count_stats(pool_id, STATS_ALLOCS, allocated);
+
+			// Если каким-то чудом память пула кончилась, то остаток выделим по одному.
+			for (; allocated < count; allocated++)
+				if (!(ptrs[allocated] = alloc(size))) break;
+
+			return allocated;
+		}
+
+		void* memory_manager::realloc(const void* ptr, size_t size)
+		{
+			if (!ptr || !size)
+				return nullptr;
+
+			if (small_blocks.contains(ptr))
+			{
+				// Мелкий блок вмещает требуемую память, менять нечего.
+				if ((small_blocks.get_block_start(ptr) == ptr) && (size <= small_blocks.get_usable_size(ptr)))
+					return const_cast<void*>(ptr);
+			}
+			else
+			{
+				if (!is_owned_ptr(ptr) /*|| (ULONG_MAX < size)*/)
+					return nullptr;
+
+				block_base* block = get_block_handle_from_ptr(ptr);
+
+				// Блок принадлежит вызывающему, поэтому блокировка не нужна.
+				// Если блок пула вмещает требуемую память, то меняем лишь размер.
+				if (is_used_pool_block(block) && !is_cached_block(block) &&
+					(block->pool_id < POOL_MAX) && (size <= pool_data_size[block->pool_id]))
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 16)
-						goto realloc_def_label;
 					// Новый размер для памяти.
 					block->size = (uint32_t)size;
+					return const_cast<void*>(ptr);
 				}
-				break;
-				default:
+
+				// Большой блок меняет размер на месте в пределах своего участка, пока остаётся большим.
+				// За блоком зарезервирован запас адресов, растущие массивы не копируются каждый раз.
+				if ((size > POOL_MAX_BLOCK_SIZE) && is_used_default_block(block) &&
+					(address_map.lookup(ptr).kind == PAGE_MAP_DEFAULT) &&
+					large_blocks.resize(block, size + sizeof(block_base)))
 				{
-					// Если требуемая память больше, чем может позволить блок,
-					// то выделение новой памяти неизбежно.
-					if (size > 8)
-						goto realloc_def_label;
-					// Новый размер для памяти.
-					block->size = (uint32_t)size;
-				}
-				break;
+					set_size_from_block(block, size);
+					return const_cast<void*>(ptr);
 				}
 			}
 
+			// Иначе выделение новой памяти неизбежно.
+			size_t old_size = msize(ptr);
+			void* new_ptr = alloc(size);
+			if (new_ptr)
+			{
+				if (old_size > 0) memcpy(new_ptr, ptr, old_size > size ? size : old_size);
+				free(ptr);
+			}
+
 			return new_ptr;
 		}
 
 		bool memory_manager::free(const void* ptr)
 		{
-			if (!ptr || !is_valid_ptr(ptr) || !is_valid_pointer(ptr))
+			if (!ptr)
 				return false;
 
-			bool ret = true;
+			// Мелкий блок узнаётся по адресу, заголовка у него нет.
+			if (small_blocks.contains(ptr))
+			{
+				free_small(ptr);
+				return true;
+			}
+
+			// Чужой указатель определяется по карте адресов, не обращаясь к памяти.
+			page_map_entry entry = address_map.lookup(ptr);
+			if (entry.kind == PAGE_MAP_NONE)
+			{
+				// Блок для нулевого размера освобождать не нужно, всё остальное чужое.
+				return is_owned_ptr(ptr);
+			}
+
+			_vassert(is_valid_ptr(ptr));
 
-#if USE_MULTITHREADS
-			// Блокируем. Снятие блокировки будет заботить компилятор.
-			voltek::core::_internal::simple_scope_lock scope_lock(lock);
-#endif
 			//_fsniff("The beginning of memory release: %p", ptr);
 
-			if (is_used_default_ptr(ptr))
+			// Для выровненной памяти освобождается настоящий блок.
+			ptr = get_origin_ptr(ptr);
+			block_base* block = get_block_handle_from_ptr(ptr);
+
+			// Обычный блок никак не связан с пулами, блокировка не нужна.
+			if (entry.kind == PAGE_MAP_DEFAULT)
 			{
-				auto block = get_block_handle_from_ptr(ptr);
-				if (block->size > 0)
-				{
-					if (block->size >= MAX_BLOCK_SIZE)
-						VirtualFree((LPVOID)block, (SIZE_T)block->size, MEM_RELEASE);
-					else 
-						voltek::core::_internal::aligned_free(block);
-				}
+				bool was_empty = large_blocks.empty_cache();
+				bool ret = large_blocks.free(block);
+				if (ret) count_stats(STATS_LARGE_CLASS, STATS_FREES);
+				// Поток кеширования спит без срока, пока кеш пуст, разбудим его.
+				if (was_empty && !large_blocks.empty_cache())
+					request_refill(REFILL_IDLE_TRIM);
 				//_fsniff("Default memory block released");
+				return ret;
 			}
-			else
-			{
-				block_base* block = get_block_handle_from_ptr(ptr);
-				uint8_t pool_id = block->pool_id;
-				uint16_t page_id = block->page_id;
-				uint32_t block_id = block->block_id;
 
-				switch (pool_id)
-				{
-				case POOL_131072:
-				{
-					pool131072_t* pool = (pool131072_t*)(pools[POOL_131072]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <131072> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_65536:
-				{
-					pool65536_t* pool = (pool65536_t*)(pools[POOL_65536]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <65536> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_32768:
-				{
-					pool32768_t* pool = (pool32768_t*)(pools[POOL_32768]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <32768> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_16384:
-				{
-					pool16384_t* pool = (pool16384_t*)(pools[POOL_16384]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <16384> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_8192:
-				{
-					pool8192_t* pool = (pool8192_t*)(pools[POOL_8192]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <8192> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_4096:
-				{
-					pool4096_t* pool = (pool4096_t*)(pools[POOL_4096]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <4096> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_1024:
-				{
-					pool1024_t* pool = (pool1024_t*)(pools[POOL_1024]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <1024> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_512:
-				{
-					pool512_t* pool = (pool512_t*)(pools[POOL_512]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <512> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_256:
-				{
-					pool256_t* pool = (pool256_t*)(pools[POOL_256]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <256> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_128:
-				{
-					pool128_t* pool = (pool128_t*)(pools[POOL_128]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <128> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_64:
-				{
-					pool64_t* pool = (pool64_t*)(pools[POOL_64]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <64> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_32:
-				{
-					pool32_t* pool = (pool32_t*)(pools[POOL_32]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <32> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				case POOL_16:
-				{
-					pool16_t* pool = (pool16_t*)(pools[POOL_16]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <16> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				default:
-				{
-					pool8_t* pool = (pool8_t*)(pools[POOL_8]);
-					ret = pool->release_block((*pool)[page_id], block_id);
-					//_fsniff("Pool memory block <8> released [%s]", (ret ? "SUCCESS" : "FAILED"));
-				}
-				break;
-				}
-			}
+			// Блок уже свободен и лежит в кеше потока, повторное освобождение.
+			_vassert(!is_cached_block(block));
+			if (is_cached_block(block))
+				return false;
 
-			return ret;
+			// Пул известен по карте адресов.
+			_vassert(block->pool_id == entry.pool_id);
+			return free_pool_block(block, entry.pool_id, entry.page_id);
 		}
 
-		size_t memory_manager::msize(const void* ptr) const
+		bool memory_manager::free_sized(const void* ptr, size_t size)
 		{
-			if (!ptr || !is_valid_pointer(ptr)) return 0;
-			// Блокируем. Снятие блокировки будет заботить компилятор.
-			voltek::core::_internal::simple_scope_lock scope_lock(lock);
-			// Получение размера.
-			return (size_t)get_size_from_ptr(ptr);
+			// Размер не указывает на пул, обычный путь.
+			if (!ptr || !pools || !size || (size > POOL_MAX_BLOCK_SIZE))
+				return free(ptr);
+
+			// У мелкого блока заголовка нет, класс и так известен по адресу.
+			if (small_blocks.contains(ptr))
+			{
+				free_small(ptr);
+				return true;
+			}
+
+			// Чужой указатель (от CRT или выданный до запуска менеджера) заголовка не имеет, поэтому
+			// сперва проверка по карте адресов, сама память не читается. Если блок занят пулом
+			// того размера, что указан, и не выровнен, то он отдаётся пулу напрямую. Всё прочее
+			// (чужой указатель, блок менял размер, выровненная память, обычный блок) уходит
+			// обычным путём.
+			if (!is_owned_ptr(ptr))
+				return free(ptr);
+
+			block_base* block = get_block_handle_from_ptr(ptr);
+			size_t pool_id = get_pool_id_from_size(size);
+			if ((block->flags != flag_block_pool_used) || (block->pool_id != pool_id))
+				return free(ptr);
+
+			_vassert(is_valid_block(block));
+			_vassert(address_map.lookup(ptr).kind == PAGE_MAP_POOL);
+
+			return free_pool_block(block, pool_id, block->page_id);
 		}
 
-		void memory_manager::dump_map(size_t pool_id, const char* filename) const
+		bool memory_manager::free_batch(void* const* ptrs, size_t count, size_t size)
 		{
-#ifndef VMMDLL_EXPORTS
-			if ((POOL_MAX >= pool_id) || !filename)
-				return;
+			if (!ptrs)
+				return false;
 
+			bool ret = true;
+			size_t pool_id = (size && (size <= POOL_MAX_BLOCK_SIZE)) ? get_pool_id_from_size(size) : POOL_MAX;
+
+			// Кеш потока есть только у малых пулов, блоки крупных пулов возвращаются за одну блокировку.
+			if (pools && (pool_id >= TCACHE_POOL_MAX) && (pool_id < POOL_MAX) && pools[pool_id])
+			{
 #if USE_MULTITHREADS
-			// Блокируем. Снятие блокировки будет заботить компилятор.
-			voltek::core::_internal::simple_scope_lock scope_lock(lock);
+				// Блокируем. Снятие блокировки будет заботить компилятор.
+				voltek::core::_internal::simple_scope_lock scope_lock(lock);
 #endif
 
-			switch (pool_id)
-			{
-			case POOL_131072:
-			{
-				pool131072_t* pool = (pool131072_t*)(pools[POOL_131072]);
-				pool->dump_map(filename);
-			}
-			break;
-			case POOL_65536:
-			{
-				pool65536_t* pool = (pool65536_t*)(pools[POOL_65536]);
-				pool->dump_map(filename);
-			}
-			break;
-			case POOL_32768:
-			{
-				pool32768_t* pool = (pool32768_t*)(pools[POOL_32768]);
-				pool->dump_map(filename);
-			}
-			break;
-			case POOL_16384:
-			{
-				pool16384_t* pool = (pool16384_t*)(pools[POOL_16384]);
-				pool->dump_map(filename);
-			}
-			break;
-			case POOL_8192:
-			{
-				pool8192_t* pool = (pool8192_t*)(pools[POOL_8192]);
-				pool->dump_map(filename);
-			}
-			break;
-			case POOL_4096:
-			{
-				pool4096_t* pool = (pool4096_t*)(pools[POOL_4096]);
-				pool->dump_map(filename);
+				size_t released = 0;
+				for (size_t i = 0; i < count; i++)
+				{
+					if (!ptrs[i]) continue;
+
+					// Заголовок читается только у своих указателей.
+					block_base* block = is_owned_ptr(ptrs[i]) ? get_block_handle_from_ptr(ptrs[i]) : nullptr;
+					if (block && (block->flags == flag_block_pool_used) && (block->pool_id == pool_id))
+					{
+						_vassert(address_map.lookup(ptrs[i]).kind == PAGE_MAP_POOL);
+						ret = release_pool_block(pool_id, block->page_id, block->block_id) && ret;
+						released++;
+					}
+					else
+						ret = free(ptrs[i]) && ret;
+				}
+
+				count_stats(pool_id, STATS_FREES, released);
+				return ret;
 			}
-			break;
-			case POOL_1024:
+
+			for (size_t i = 0; i < count; i++)
 			{
-				pool1024_t* pool = (pool1024_t*)(pools[POOL_1024]);
-				pool->dump_map(filename);
+				if (ptrs[i])
+					ret = free_sized(ptrs[i], size) && ret;
 			}
-			break;
-			case POOL_512:
+
+			return ret;
+		}
+
+		bool memory_manager::free_pool_block(block_base* block, size_t pool_id, size_t page_id)
+		{
+			if (!pools || (pool_id >= POOL_MAX) || !pools[pool_id])
+				return false;
+
+			count_stats(pool_id, STATS_FREES);
+
+			if (pool_id < TCACHE_POOL_MAX)
 			{
-				pool512_t* pool = (pool512_t*)(pools[POOL_512]);
-				pool->dump_map(filename);
+				// Блок выделен другим потоком, отдаём его владельцу одной атомарной операцией.
+				uint8_t owner_id = (uint8_t)block->owner_id;
+				if (owner_id && (owner_id != local_cache.get_owner_id()))
+				{
+					remote_queues[owner_id].push(block);
+					// Владелец уже завершился, блок вернёт фоновый поток.
+					if (remote_queues[owner_id].is_free())
+						request_refill(REFILL_ORPHAN_QUEUES);
+					return true;
+				}
+
+				local_cache.push(pool_id, block);
+
+				// Кеш разросся, вернём пачку блоков в пул, чтобы память не застревала в потоке.
+				const size_t batch = get_tcache_batch(pool_data_size[pool_id]);
+				if (local_cache.count(pool_id) >= (batch << 1))
+					flush_thread_cache(local_cache, pool_id, batch);
+
+				return true;
 			}
-			break;
-			case POOL_256:
+
+#if USE_MULTITHREADS
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+			bool ret = release_pool_block(pool_id, (uint16_t)page_id, block->block_id);
+			//_fsniff("Pool memory block <%llu> released [%s]", pool_data_size[pool_id], (ret ? "SUCCESS" : "FAILED"));
+			return ret;
+		}
+
+		size_t memory_manager::msize(const void* ptr) const
+		{
+			if (!ptr) return 0;
+			// Размер мелкого блока известен по адресу.
+			if (small_blocks.contains(ptr)) return small_blocks.get_usable_size(ptr);
+			// Чужой указатель определяется по карте адресов, не обращаясь к памяти.
+			if (!is_owned_ptr(ptr)) return 0;
+			// Размер хранится в заголовке блока, который принадлежит вызывающему, блокировка не нужна.
+			const void* origin_ptr = get_origin_ptr(ptr);
+			if (origin_ptr != ptr)
 			{
-				pool256_t* pool = (pool256_t*)(pools[POOL_256]);
-				pool->dump_map(filename);
+				size_t offset = (const char*)ptr - (const char*)origin_ptr;
+				size_t size = (size_t)get_size_from_ptr(origin_ptr);
+				return size > offset ? size - offset : 0;
 			}
-			break;
-			case POOL_128:
+			return (size_t)get_size_from_ptr(ptr);
+		}
+
+		void* memory_manager::aligned_alloc(size_t size, size_t alignment)
+		{
+			// Блоки и так выровнены на 16 байт.
+			if (alignment <= 0x10)
+				return alloc(size);
+
+			// Выравнивание должно быть степенью двойки.
+			if (alignment & (alignment - 1))
+				return nullptr;
+
+			if (!size) size = 1;
+
+			// Запас в alignment байт гарантирует, что перед выровненными данными поместится заголовок.
+			void* ptr = alloc(size + alignment);
+			if (!ptr) return nullptr;
+
+			void* aligned_ptr = ptr;
+			size_t offset = 0;
+
+			// Начало мелкого блока вычисляется по адресу, заголовок со смещением не нужен.
+			if (small_blocks.contains(ptr))
 			{
-				pool128_t* pool = (pool128_t*)(pools[POOL_128]);
-				pool->dump_map(filename);
+				if ((uintptr_t)ptr & (alignment - 1))
+					aligned_ptr = (void*)(((uintptr_t)ptr + alignment) & ~((uintptr_t)alignment - 1));
+				return aligned_ptr;
 			}
-			break;
-			case POOL_64:
+
+			if ((uintptr_t)ptr & (alignment - 1))
 			{
-				pool64_t* pool = (pool64_t*)(pools[POOL_64]);
-				pool->dump_map(filename);
+				aligned_ptr = (void*)(((uintptr_t)ptr + alignment) & ~((uintptr_t)alignment - 1));
+				offset = (char*)aligned_ptr - (char*)ptr;
+				create_aligned_block(get_block_handle_from_ptr(aligned_ptr), offset);
 			}
-			break;
-			case POOL_32:
+
+			// Запоминаем в блоке пула ровно запрошенный размер, чтобы msize вернул его.
+			// У обычного блока размер не трогаем, по нему освобождается память.
+			block_base* block = get_block_handle_from_ptr(ptr);
+			if (is_used_pool_block(block))
+				block->size = (uint32_t)(offset + size);
+
+			return aligned_ptr;
+		}
+
+		void* memory_manager::aligned_realloc(const void* ptr, size_t size, size_t alignment)
+		{
+			if (!ptr)
+				return aligned_alloc(size, alignment);
+
+			bool is_small = small_blocks.contains(ptr);
+			if ((!is_small && !is_owned_ptr(ptr)) || !size)
+				return nullptr;
+
+			if (alignment <= 0x10)
+				return realloc(ptr, size);
+
+			if (alignment & (alignment - 1))
+				return nullptr;
+
+			if (is_small)
 			{
-				pool32_t* pool = (pool32_t*)(pools[POOL_32]);
-				pool->dump_map(filename);
+				// Мелкий блок вмещает требуемую память, менять нечего.
+				if (!((uintptr_t)ptr & (alignment - 1)) && (size <= small_blocks.get_usable_size(ptr)))
+					return const_cast<void*>(ptr);
 			}
-			break;
-			case POOL_16:
+			// Если память уже выровнена как надо и блок пула вмещает требуемую память, то меняем лишь размер.
+			else if (!((uintptr_t)ptr & (alignment - 1)))
 			{
-				pool16_t* pool = (pool16_t*)(pools[POOL_16]);
-				pool->dump_map(filename);
+				const void* origin_ptr = get_origin_ptr(ptr);
+				block_base* block = get_block_handle_from_ptr(origin_ptr);
+				size_t offset = (const char*)ptr - (const char*)origin_ptr;
+
+				if (is_used_pool_block(block) && !is_cached_block(block) &&
+					(block->pool_id < POOL_MAX) && ((offset + size) <= pool_data_size[block->pool_id]))
+				{
+					block->size = (uint32_t)(offset + size);
+					return const_cast<void*>(ptr);
+				}
 			}
-			break;
-			default:
+
+			size_t old_size = msize(ptr);
+			void* new_ptr = aligned_alloc(size, alignment);
+			if (new_ptr)
 			{
-				pool8_t* pool = (pool8_t*)(pools[POOL_8]);
-				pool->dump_map(filename);
-			}
-			break;
+				if (old_size > 0) memcpy(new_ptr, ptr, old_size > size ? size : old_size);
+				free(ptr);
 			}
+
+			return new_ptr;
+		}
+
+		void memory_manager::dump_map(size_t pool_id, const char* filename) const
+		{
+#ifndef VMMDLL_EXPORTS
+			if (!pools || (pool_id >= POOL_MAX) || !filename)
+				return;
+
+#if USE_MULTITHREADS
+			// Блокируем. Снятие блокировки будет заботить компилятор.
+			voltek::core::_internal::simple_scope_lock scope_lock(lock);
+#endif
+
+			if (pools[pool_id])
+				pools[pool_id]->dump_map(filename);
 #endif // !VMMDLL_EXPORTS
 		}
 
 		void memory_manager::dump(size_t pool_id, const char* filename) const
 		{
 #ifndef VMMDLL_EXPORTS
-			if ((POOL_MAX >= pool_id) || !filename)
+			if (!pools || (pool_id >= POOL_MAX) || !filename)
 				return;
 
 #if USE_MULTITHREADS
@@ -924,97 +1316,12 @@ namespace voltek
 			voltek::core::_internal::simple_scope_lock scope_lock(lock);
 #endif
 
-			switch (pool_id)
-			{
-			case POOL_131072:
-			{
-				pool131072_t* pool = (pool131072_t*)(pools[POOL_131072]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_65536:
-			{
-				pool65536_t* pool = (pool65536_t*)(pools[POOL_65536]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_32768:
-			{
-				pool32768_t* pool = (pool32768_t*)(pools[POOL_32768]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_16384:
-			{
-				pool16384_t* pool = (pool16384_t*)(pools[POOL_16384]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_8192:
-			{
-				pool8192_t* pool = (pool8192_t*)(pools[POOL_8192]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_4096:
-			{
-				pool4096_t* pool = (pool4096_t*)(pools[POOL_4096]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_1024:
-			{
-				pool1024_t* pool = (pool1024_t*)(pools[POOL_1024]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_512:
-			{
-				pool512_t* pool = (pool512_t*)(pools[POOL_512]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_256:
-			{
-				pool256_t* pool = (pool256_t*)(pools[POOL_256]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_128:
-			{
-				pool128_t* pool = (pool128_t*)(pools[POOL_128]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_64:
-			{
-				pool64_t* pool = (pool64_t*)(pools[POOL_64]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_32:
-			{
-				pool32_t* pool = (pool32_t*)(pools[POOL_32]);
-				pool->dump(filename);
-			}
-			break;
-			case POOL_16:
-			{
-				pool16_t* pool = (pool16_t*)(pools[POOL_16]);
-				pool->dump(filename);
-			}
-			break;
-			default:
-			{
-				pool8_t* pool = (pool8_t*)(pools[POOL_8]);
-				pool->dump(filename);
-			}
-			break;
-			}
+			if (pools[pool_id])
+				pools[pool_id]->dump(filename);
 #endif // !VMMDLL_EXPORTS
 		}
 
-		memory_manager::memory_manager(const memory_manager& ob) : pools(nullptr)
+		memory_manager::memory_manager(const memory_manager& ob) : large_blocks(&address_map), pools(nullptr)
 		{
 			memset(&zero_size_request_block, 0, sizeof(zero_size_request_block));
 		}
@@ -1026,4 +1333,6 @@ namespace voltek
 	}
 }
 
-#pragma warning(default : 26819)
\ No newline at end of file
+#if defined(_MSC_VER)
+#	pragma warning(default : 26819)
+#endif
\ No newline at end of file
@@ -7,6 +7,12 @@
 #include "vbase.h"
 #include "vmmblock.h"
 #include "vsimplelock.h"
+#include "vmmtcache.h"
+#include "vmmsizeclass.h"
+#include "vmmsmall.h"
+#include "vmmpagemap.h"
+#include "vmmlarge.h"
+#include "vmmpool.h"
 #include <stddef.h>
 #include <thread>
 
@@ -14,21 +20,43 @@ namespace voltek
 {
 	namespace memory_manager
 	{
-		constexpr static size_t POOL_8 = 0;
-		constexpr static size_t POOL_16 = 1;
-		constexpr static size_t POOL_32 = 2;
-		constexpr static size_t POOL_64 = 3;
-		constexpr static size_t POOL_128 = 4;
-		constexpr static size_t POOL_256 = 5;
-		constexpr static size_t POOL_512 = 6;
-		constexpr static size_t POOL_1024 = 7;
-		constexpr static size_t POOL_4096 = 8;
-		constexpr static size_t POOL_8192 = 9;
-		constexpr static size_t POOL_16384 = 10;
-		constexpr static size_t POOL_32768 = 11;
-		constexpr static size_t POOL_65536 = 12;
-		constexpr static size_t POOL_131072 = 13;
-		constexpr static size_t POOL_MAX = POOL_131072 + 1;
+		static_assert(get_pool_class_size(TCACHE_POOL_MAX - 1) == 8192, "TCACHE_POOL_MAX covers classes up to 8192");
+
+		// Статистика одного класса размера.
+		struct class_stats
+		{
+			// Размер блока класса, 0 у больших блоков.
+			uint64_t block_size;
+			// Выделено блоков.
+			uint64_t allocs;
+			// Освобождено блоков.
+			uint64_t frees;
+			// Блоков сейчас занято.
+			uint64_t live_blocks;
+			// Блоков выдано из кешей без блокировки.
+			uint64_t cache_hits;
+			// Блоков взято из пула под блокировкой, кеши были пусты.
+			uint64_t cache_misses;
+			// Пополнений кеша пачкой блоков.
+			uint64_t refills;
+			// Страниц (сегментов, участков) выделено у системы.
+			uint64_t committed_pages;
+			// Память этих страниц.
+			uint64_t committed_bytes;
+		};
+
+		// Статистика менеджера.
+		struct memory_stats
+		{
+			// По классам размера, последний - большие блоки.
+			class_stats classes[STATS_CLASS_MAX];
+			// Сумма по всем классам.
+			class_stats total;
+			// Выделено памяти выданными большими блоками.
+			uint64_t large_bytes;
+			// Памяти на больших страницах.
+			uint64_t large_page_bytes;
+		};
 
 		// Менеджер памяти.
 		class memory_manager : public voltek::core::base
@@ -43,6 +71,9 @@ namespace voltek
 			// Вернёт nullptr, если память физически закончилась.
 			// Также если размер требуемый объявлен как 0.
 			void* alloc(size_t size);
+			// Выделяет обнулённую память требуемого размера.
+			// Память, что свежая от системы, уже обнулена и повторно не трогается.
+			void* calloc(size_t size);
 			// Выделяет память требуемого размера из предыдущего указателя на память.
 			// Память всегда выровнена.
 			// Вернёт nullptr, если память физически закончилась.
@@ -52,13 +83,59 @@ namespace voltek
 			// Освобождает память.
 			// Вернёт ложь, если указатель не пренадлежит менеджеру.
 			bool free(const void* ptr);
+			// Освобождает память, размер которой известен вызывающему (тот, что запрашивался).
+			// Блок пула отдаётся сразу в пул по размеру, минуя разбор выравнивания. Карта адресов
+			// лишь подтверждает, что указатель свой, до чтения заголовка.
+			// Если размер не совпадает с блоком, то освобождение идёт обычным путём.
+			// Вернёт ложь, если указатель не пренадлежит менеджеру.
+			bool free_sized(const void* ptr, size_t size);
+			// Выделяет "count" блоков одного размера в массив "ptrs".
+			// Блоки пула нарезаются из страницы за один проход по битовой карте и одну блокировку.
+			// Возвращает кол-во выделенных блоков, меньше "count", если память кончилась.
+			size_t alloc_batch(void** ptrs, size_t count, size_t size);
+			// Освобождает "count" блоков одного размера из массива "ptrs", нулевые указатели пропускаются.
+			// Вернёт ложь, если хоть один указатель не пренадлежит менеджеру.
+			bool free_batch(void* const* ptrs, size_t count, size_t size);
 			// Возвращает размер выделенной памяти под указатель.
 			// Вернёт 0, что значит ошибка.
 			size_t msize(const void* ptr) const;
+			// Выделяет память требуемого размера, выровненную по alignment (степень двойки).
+			// Перед выровненными данными пишется заголовок со смещением до настоящего блока,
+			// поэтому free и msize работают с такой памятью как с обычной.
+			// Вернёт nullptr, если память физически закончилась или выравнивание не степень двойки.
+			void* aligned_alloc(size_t size, size_t alignment);
+			// Выделяет память требуемого размера из предыдущего указателя на память,
+			// выровненную по alignment (степень двойки). Адрес памяти может быть изменён.
+			void* aligned_realloc(const void* ptr, size_t size, size_t alignment);
 			// Вывод дампа битовой карты указанного пула
 			void dump_map(size_t pool_id, const char* filename) const;
 			// Вывод дампа памяти указанного пула
 			void dump(size_t pool_id, const char* filename) const;
+			// Возвращает все блоки из кеша потока в пулы.
+			void release_thread_cache(thread_cache& cache);
+			// Задаёт приоритет и привязку к ядрам для потока пополнения кешей пулов.
+			// Маска 0 означает, что поток может работать на любом ядре.
+			void set_refill_thread(int priority, uint64_t affinity_mask);
+			// Возвращает счётчики кучи больших блоков.
+			inline void get_large_stats(large_heap_stats& stats) const { large_blocks.get_stats(stats); }
+			// Задаёт, сколько пустых страниц (не больше, чем на bytes байт) каждый пул держит про запас,
+			// и через сколько мс простоя они удаляются. Так память не гоняется туда-сюда, если
+			// нагрузка колеблется около границы страницы.
+			void set_page_retention(size_t pages, size_t bytes, uint32_t idle_ms);
+			// Переносит кучу мелких блоков на большие страницы, первые bytes байт её области
+			// выделяются ими сразу и не возвращаются системе. Только до первого выделения мелкого блока.
+			// Вернёт ложь, если большие страницы недоступны, тогда куча остаётся на обычных.
+			bool set_large_pages(size_t bytes);
+			// Возвращает системе свободную память: память участков в кеше больших блоков,
+			// блоки кешей пулов, пустые страницы пулов и пустые сегменты кучи мелких блоков,
+			// пока не освободится budget байт (0 - всё).
+			// Из кешей потоков возвращается лишь кеш вызывающего. Возвращает кол-во освобождённых байт.
+			size_t trim(size_t budget);
+			// Возвращает счётчики страниц всех пулов.
+			void get_pool_stats(pool_page_stats& stats) const;
+			// Возвращает статистику по классам размера.
+			// Счётчики потоков читаются без блокировки, значения приблизительные.
+			void get_stats(memory_stats& stats) const;
 		private:
 			// Конструктор копий - НЕДОСТУПЕН.
 			// Менеджер один и уникален.
@@ -66,16 +143,79 @@ namespace voltek
 			// Оператор присвоения - НЕДОСТУПЕН.
 			// Менеджер один и уникален.
 			memory_manager& operator=(const memory_manager& ob);
+			// Выделяет память простым способом, минуя пулы.
+			// Если zeroed, то память обнуляется, кроме свежей от системы.
+			void* alloc_default(size_t size, bool zeroed = false);
+			// Возвращает истину, если указатель выдан менеджером.
+			// Проверка идёт по карте адресов, сама память не читается.
+			inline bool is_owned_ptr(const void* ptr) const
+			{
+				return (address_map.lookup(ptr).kind != PAGE_MAP_NONE) ||
+					(ptr == get_ptr_from_block_handle(const_cast<block8_t*>(&zero_size_request_block)));
+			}
+			// Возвращает пул по номеру, если его нет, то создаёт.
+			// Вызывать только под блокировкой.
+			pool_base* get_pool(size_t pool_id);
+			// Заполняет кеш потока блоками из пула за одну блокировку.
+			// Возвращает один блок сразу для использования или nullptr, если память кончилась.
+			block_base* refill_thread_cache(thread_cache& cache, size_t pool_id);
+			// Возвращает в пул указанное кол-во блоков из кеша потока за одну блокировку.
+			void flush_thread_cache(thread_cache& cache, size_t pool_id, size_t count);
+			// Заполняет кеш потока мелкими блоками без заголовка за одну блокировку.
+			// Возвращает один блок сразу для использования или nullptr, если область исчерпана.
+			void* refill_small_cache(thread_cache& cache, size_t class_id);
+			// Возвращает в кучу мелких блоков указанное кол-во блоков из кеша потока за одну блокировку.
+			void flush_small_cache(thread_cache& cache, size_t class_id, size_t count);
+			// Освобождает мелкий блок без заголовка, указатель может указывать внутрь блока.
+			void free_small(const void* ptr);
+			// Возвращает занятый блок пула в кеш потока или в пул.
+			bool free_pool_block(block_base* block, size_t pool_id, size_t page_id);
+			// Освобождает блок пула, будит поток кеширования, если пул оставил пустую страницу про запас.
+			// Вызывать только под блокировкой.
+			bool release_pool_block(size_t pool_id, uint16_t page_id, uint32_t block_id);
+			// Возвращает истину, если какой-нибудь пул держит пустые страницы про запас.
+			// Без блокировки, значение приблизительное.
+			bool has_retained_pages() const;
+			// Занимает для потока свободную очередь удалённого освобождения.
+			void claim_remote_queue(thread_cache& cache);
+			// Переносит блоки, освобождённые другими потоками, в кеш потока.
+			// Возвращает истину, если что-то было перенесено.
+			bool drain_remote_queue(thread_cache& cache);
+			// Просит поток пополнения заполнить кеш пула, если тот опустел ниже порога.
+			void check_pool_watermark(pool_base* pool, size_t pool_id);
+			// Будит поток пополнения для указанного запроса.
+			void request_refill(uint64_t bit);
+			// Процедура потока пополнения кешей пулов.
+			void refill_thread_proc();
+			// Прибавляет к счётчику статистики текущего потока.
+			void count_stats(size_t class_id, size_t counter, uint64_t value = 1);
 		private:
 			// Блок памяти, если запрашивают 0 размер.
-			block8_t zero_size_request_block;
+			alignas(0x10) block8_t zero_size_request_block;
+			// Карта адресов памяти, выданной менеджером.
+			page_map address_map;
+			// Куча мелких блоков без заголовка.
+			small_heap small_blocks;
+			// Куча больших блоков с кешем участков.
+			large_heap large_blocks;
 			// Массив пулов.
-			void** pools;
+			pool_base** pools;
+			// Политика удержания пустых страниц пулов, меняется под блокировкой.
+			size_t retain_pages;
+			size_t retain_bytes;
+			uint64_t retain_idle_ms;
 			// Блокировщик для работы с множеством потоков.
 			voltek::core::_internal::simple_lock lock;
 			// События для потока кеширования, чтобы можно выйти
 			void* event_close;
 			void* event_close_w;
+			// Событие для потока кеширования, что есть работа (автосброс).
+			void* event_refill;
+			// Запросы к потоку кеширования, бит на пул, старший бит - разбор очередей без владельца.
+			std::atomic<uint64_t> refill_mask;
+			// Приоритет и привязка к ядрам потока кеширования.
+			std::atomic<int> refill_priority;
+			std::atomic<uint64_t> refill_affinity;
 			// Поток для кеширования
 			std::thread* thread;
 		};
@@ -13,6 +13,8 @@
 #define __VMM_PAGE_CONFIG_NORMAL_SIZE voltek::core::bits_regions
 #define __VMM_PAGE_CONFIG_SMALL_SIZE voltek::core::bits
 #define __VMM_PAGE_CONFIG_LOW_SIZE __VMM_PAGE_CONFIG_SMALL_SIZE
+// Шаг, которым страница выделяет память под блоки по мере их выдачи.
+#define __VMM_PAGE_CONFIG_COMMIT_SIZE 64ull * 1024
 
 namespace voltek
 {
@@ -27,14 +29,15 @@ namespace voltek
 		{
 		public:
 			// Конструктор по умолчанию.
-			page_t() : _blocks(nullptr), _size(0), _user_data(0)
+			page_t() : _blocks(nullptr), _size(0), _committed(0), _user_data(0)
 			{}
 			// Конструктор.
 			// Внимание размер будет округлён до кратности 256.
 #ifdef MAPPER_USE
-			page_t(size_t new_size, voltek::core::mapper* mapper) : _blocks(nullptr), _size(0), _user_data(0), _mapper(mapper)
+			page_t(size_t new_size, voltek::core::mapper* mapper) : _blocks(nullptr), _size(0), _committed(0), _user_data(0),
+				_mapper(mapper)
 #else
-			page_t(size_t new_size) : _blocks(nullptr), _size(0), _user_data(0)
+			page_t(size_t new_size) : _blocks(nullptr), _size(0), _committed(0), _user_data(0)
 #endif
 			{
 				set_size(new_size);
@@ -47,13 +50,14 @@ namespace voltek
 				{
 #ifdef MAPPER_USE
 					if (!_mapper->block_free(_blocks))
-						voltek::core::_internal::aligned_free(_blocks);
+						voltek::core::_internal::virtual_free(_blocks, _size * sizeof(_type));
 #else
-					voltek::core::_internal::aligned_free(_blocks);
+					voltek::core::_internal::virtual_free(_blocks, _size * sizeof(_type));
 #endif
 
 					_blocks = nullptr;
 					_size = 0;
+					_committed = 0;
 				}
 			}
 			// Задаёт размер страницы.
@@ -72,14 +76,21 @@ namespace voltek
 
 #ifdef MAPPER_USE
 				_blocks = (_type*)_mapper->block_alloc();
-				if (!_blocks) _blocks = voltek::core::_internal::aligned_talloc<_type>(new_size, 0x10);
+				if (!_blocks) _blocks = (_type*)voltek::core::_internal::virtual_alloc(new_size * sizeof(_type));
+				// Память карты выделена целиком.
+				_committed = new_size * sizeof(_type);
 #else
-				_blocks = voltek::core::_internal::aligned_talloc<_type>(new_size, 0x10);
+				// Адреса берутся у системы, чтобы страница целиком занимала свои 64 кб участки
+				// адресного пространства и могла быть отмечена в карте страниц.
+				// Память выделяется по мере выдачи блоков, см. commit_block.
+				_blocks = (_type*)voltek::core::_internal::virtual_reserve(new_size * sizeof(_type));
+				_committed = 0;
 #endif
 
 				if (!_blocks)
 				{
 					map.clear();
+					_committed = 0;
 					_vassert(!_blocks);
 				}
 				else
@@ -110,8 +121,54 @@ namespace voltek
 			// Возвращает истину, в случае, нахождения первого попавшегося свободного блока.
 			// Его индекс будет передан в "index".
 			inline bool get_first_free_block_index(size_t& index) { return map.find_first_set_bit(index); }
+			// Занимает до "count" свободных блоков за один проход по битовой карте.
+			// Их индексы передаются в "indices", возвращает кол-во занятых блоков.
+			inline size_t take_free_blocks(size_t* indices, size_t count) { return map.take_set_bits(indices, count); }
 			// Возвращает кол-во допустимых блоков.
 			inline size_t count() const { return _size; }
+			// Возвращает указатель на память блоков, константа.
+			inline const void* c_data() const { return _blocks; }
+			// Возвращает размер памяти блоков в байтах.
+			inline size_t data_size() const { return _size * sizeof(_type); }
+			// Возвращает размер выделенной памяти блоков в байтах.
+			inline size_t committed_size() const { return _committed; }
+			// Возвращает истину, если память блока за указанным индексом выделена.
+			inline bool is_block_committed(size_t index) const { return ((index + 1) * sizeof(_type)) <= _committed; }
+			// Выделяет память страницы до блока за указанным индексом включительно, шагом
+			// __VMM_PAGE_CONFIG_COMMIT_SIZE. Вернёт ложь, если система не дала память.
+			bool commit_block(size_t index)
+			{
+				size_t need = (index + 1) * sizeof(_type);
+				if (need <= _committed)
+					return true;
+
+				size_t step = __VMM_PAGE_CONFIG_COMMIT_SIZE;
+				need = (need + step - 1) & ~(step - 1);
+				if (need > data_size())
+					need = data_size();
+
+				if (!voltek::core::_internal::virtual_commit((char*)_blocks + _committed, need - _committed))
+					return false;
+
+				_committed = need;
+				return true;
+			}
+			// Отдаёт системе память блоков, страница остаётся, память вернётся через commit_block.
+			// Только для страницы, все блоки которой свободны. Возвращает кол-во отданных байт.
+			size_t decommit()
+			{
+#ifdef MAPPER_USE
+				// Память принадлежит карте.
+				return 0;
+#else
+				if (!_committed || !voltek::core::_internal::virtual_decommit(_blocks, _committed))
+					return 0;
+
+				size_t released = _committed;
+				_committed = 0;
+				return released;
+#endif
+			}
 			// Возвращает кол-во свободных блоков.
 			inline size_t free_count() const { return map.get_sets_count(); }
 			// Возвращает кол-во знятых блоков.
@@ -133,13 +190,13 @@ namespace voltek
 			{ 
 #ifndef VMMDLL_EXPORTS
 				voltek::core::_internal::memory_to_file(filename, (void*)_blocks, 
-					voltek::core::_internal::aligned_msize(_blocks), _size >> 3);
+					_committed, _size >> 3);
 #endif // !VMMDLL_EXPORTS
 			}
 		private:
 			// Конструктор копий - НЕДОСТУПЕН.
 			// Страница одна и уникальна.
-			page_t(const page_t& page) : _blocks(nullptr), _size(0), _user_data(0)
+			page_t(const page_t& page) : _blocks(nullptr), _size(0), _committed(0), _user_data(0)
 			{}
 			// Оператор присвоения - НЕДОСТУПЕН.
 			// Страница одна и уникальна.
@@ -150,6 +207,8 @@ namespace voltek
 			_type* _blocks;
 			// Кол-во доступных блоков.
 			size_t _size;
+			// Выделено памяти блоков в байтах, от начала страницы.
+			size_t _committed;
 			// Дополнительная информация.
 			uintptr_t _user_data;
 			// Битовая карта.
@@ -248,6 +307,15 @@ namespace voltek
 				index = ((size_t)(addr - _blocks)) / sizeof(_type);
 				return true;
 			}
+			// Занимает до "count" свободных блоков.
+			// Их индексы передаются в "indices", возвращает кол-во занятых блоков.
+			inline size_t take_free_blocks(size_t* indices, size_t count)
+			{
+				size_t taken = 0;
+				while ((taken < count) && get_first_free_block_index(indices[taken]))
+					taken++;
+				return taken;
+			}
 			// Возвращает кол-во допустимых блоков.
 			inline size_t count() const { return _size; }
 			// Возвращает кол-во свободных блоков.
@@ -0,0 +1,77 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#include "vmmpagemap.h"
+#include "valloc.h"
+#include "vassert.h"
+#include <string.h>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		page_map::page_map() : _root(nullptr)
+		{
+			// Память системы обнулена, все листы пусты.
+			_root = (std::atomic<leaf_t*>*)voltek::core::_internal::virtual_alloc(
+				sizeof(std::atomic<leaf_t*>) << PAGE_MAP_ROOT_BITS);
+			_vassert(_root);
+		}
+
+		page_map::~page_map()
+		{
+			if (_root)
+			{
+				for (size_t i = 0; i < (1ull << PAGE_MAP_ROOT_BITS); i++)
+					voltek::core::_internal::virtual_free(_root[i].load(std::memory_order_relaxed), sizeof(leaf_t));
+
+				voltek::core::_internal::virtual_free(_root, sizeof(std::atomic<leaf_t*>) << PAGE_MAP_ROOT_BITS);
+				_root = nullptr;
+			}
+		}
+
+		bool page_map::set(const void* ptr, size_t size, page_map_entry entry)
+		{
+			if (!_root || !size)
+				return false;
+
+			uintptr_t granule = (uintptr_t)ptr >> PAGE_MAP_GRANULE_SHIFT;
+			uintptr_t granule_end = ((uintptr_t)ptr + size - 1) >> PAGE_MAP_GRANULE_SHIFT;
+			if (granule_end >> (PAGE_MAP_ROOT_BITS + PAGE_MAP_LEAF_BITS))
+				return false;
+
+			uint32_t value = 0;
+			memcpy(&value, &entry, sizeof(value));
+
+			for (; granule <= granule_end; granule++)
+			{
+				std::atomic<leaf_t*>& slot = _root[granule >> PAGE_MAP_LEAF_BITS];
+				leaf_t* leaf = slot.load(std::memory_order_acquire);
+				if (!leaf)
+				{
+					// Убирать нечего.
+					if (!value)
+					{
+						granule |= (1ull << PAGE_MAP_LEAF_BITS) - 1;
+						continue;
+					}
+
+					leaf_t* new_leaf = (leaf_t*)voltek::core::_internal::virtual_alloc(sizeof(leaf_t));
+					if (!new_leaf)
+						return false;
+
+					// Лист мог выделить другой поток.
+					if (slot.compare_exchange_strong(leaf, new_leaf, std::memory_order_acq_rel))
+						leaf = new_leaf;
+					else
+						voltek::core::_internal::virtual_free(new_leaf, sizeof(leaf_t));
+				}
+
+				leaf->entries[granule & ((1ull << PAGE_MAP_LEAF_BITS) - 1)].store(value, std::memory_order_relaxed);
+			}
+
+			return true;
+		}
+	}
+}
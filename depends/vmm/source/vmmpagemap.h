@@ -0,0 +1,96 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#pragma once
+
+#include "vbase.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		// Память не принадлежит менеджеру.
+		constexpr static uint8_t PAGE_MAP_NONE = 0;
+		// Память страницы пула.
+		constexpr static uint8_t PAGE_MAP_POOL = 1;
+		// Память обычного блока.
+		constexpr static uint8_t PAGE_MAP_DEFAULT = 2;
+
+		// Размер участка адресного пространства, который описывает одна запись карты.
+		// Совпадает с гранулярностью резервирования памяти Windows.
+		constexpr static size_t PAGE_MAP_GRANULE_SHIFT = 16;
+		// Значащие биты адреса пользовательского пространства x64.
+		constexpr static size_t PAGE_MAP_ADDRESS_BITS = 47;
+		// Биты номера записи в листе карты.
+		constexpr static size_t PAGE_MAP_LEAF_BITS = 16;
+		// Биты номера листа в корне карты.
+		constexpr static size_t PAGE_MAP_ROOT_BITS = PAGE_MAP_ADDRESS_BITS - PAGE_MAP_GRANULE_SHIFT - PAGE_MAP_LEAF_BITS;
+
+		// Запись карты: кому принадлежит участок памяти.
+		struct page_map_entry
+		{
+			// Вид памяти.
+			uint8_t kind;
+			// Номер пула, если память страницы пула.
+			uint8_t pool_id;
+			// Номер страницы в пуле, если память страницы пула.
+			uint16_t page_id;
+		};
+
+		static_assert(sizeof(page_map_entry) == sizeof(uint32_t), "sizeof(page_map_entry) == sizeof(uint32_t)");
+
+		// Двухуровневая карта адресного пространства.
+		// Вся память менеджера (страницы пулов и обычные блоки) берётся у системы участками,
+		// выровненными на 64 кб, и отмечается в карте. Поэтому принадлежность указателя,
+		// а также пул и страница, определяются без обращения к самой памяти, чужие указатели
+		// не трогаются вовсе. Листы выделяются по мере надобности и не освобождаются.
+		// Чтение без блокировки, запись участков, которые не пересекаются, из любого потока.
+		class page_map : public voltek::core::base
+		{
+		public:
+			// Конструктор по умолчанию.
+			page_map();
+			// Деструктор.
+			virtual ~page_map();
+			// Возвращает запись карты для указателя.
+			inline page_map_entry lookup(const void* ptr) const
+			{
+				uintptr_t granule = (uintptr_t)ptr >> PAGE_MAP_GRANULE_SHIFT;
+				if (!_root || (granule >> (PAGE_MAP_ROOT_BITS + PAGE_MAP_LEAF_BITS)))
+					return {};
+
+				leaf_t* leaf = _root[granule >> PAGE_MAP_LEAF_BITS].load(std::memory_order_acquire);
+				if (!leaf)
+					return {};
+
+				uint32_t value = leaf->entries[granule & ((1ull << PAGE_MAP_LEAF_BITS) - 1)].load(std::memory_order_relaxed);
+				page_map_entry entry;
+				memcpy(&entry, &value, sizeof(entry));
+				return entry;
+			}
+			// Отмечает участок памяти в карте, начало участка должно быть выровнено на 64 кб.
+			// Вернёт ложь, если не удалось выделить память под лист.
+			bool set(const void* ptr, size_t size, page_map_entry entry);
+			// Убирает участок памяти из карты.
+			inline void clear(const void* ptr, size_t size) { set(ptr, size, {}); }
+		private:
+			// Конструктор копий - НЕДОСТУПЕН.
+			page_map(const page_map& ob) = delete;
+			// Оператор присвоения - НЕДОСТУПЕН.
+			page_map& operator=(const page_map& ob) = delete;
+		private:
+			// Лист карты.
+			struct leaf_t
+			{
+				std::atomic<uint32_t> entries[1ull << PAGE_MAP_LEAF_BITS];
+			};
+			// Корень карты, указатели на листы.
+			std::atomic<leaf_t*>* _root;
+		};
+	}
+}
@@ -4,35 +4,177 @@
 
 #pragma once
 
+#include "vmmblock.h"
 #include "vmmpage.h"
-#include <stack>
+#include "vmmpagemap.h"
+#include <atomic>
 
-#define __VMM_POOL_CONFIG_BIG_SIZE 256ull * 1024
-#define __VMM_POOL_CONFIG_LARGE_SIZE 128ull * 1024
 #define __VMM_POOL_CONFIG_NORMAL_SIZE 64ull * 1024
-#define __VMM_POOL_CONFIG_SMALL_SIZE 4ull * 1024
-#define __VMM_POOL_CONFIG_LOW_SIZE 2ull * 1024
+// Размер страницы пула в байтах, кол-во блоков в странице выводится из него.
+#define __VMM_POOL_CONFIG_PAGE_BYTES 4ull * 1024 * 1024
 #define __VMM_POOL_CONFIG_CACHE_SIZE 8ull * 1024
+#define __VMM_POOL_CONFIG_RETAIN_MAX 16
 
 namespace voltek
 {
 	namespace memory_manager
 	{
+		// Счётчики страниц пула.
+		struct pool_page_stats
+		{
+			// Создано страниц.
+			uint64_t pages_created;
+			// Удалено страниц.
+			uint64_t pages_destroyed;
+			// Пустых страниц оставлено про запас.
+			uint64_t pages_retained;
+			// Память пустых страниц, оставленных про запас.
+			uint64_t retained_bytes;
+			// Память страниц, что сейчас есть у пула (включая те, что про запас).
+			uint64_t committed_bytes;
+		};
+
+		// Кол-во блоков в странице пула, чтобы страница занимала около __VMM_POOL_CONFIG_PAGE_BYTES.
+		// Карта с регионами делит страницу на 16 равных частей и нужна лишь от 65536 блоков,
+		// для неё кол-во округляется до кратности 256.
+		template<size_t _block_size>
+		constexpr static size_t get_pool_page_blocks()
+		{
+			constexpr size_t blocks = (__VMM_POOL_CONFIG_PAGE_BYTES) / _block_size;
+			return (blocks >= 65536) ? (blocks & ~(size_t)255) : blocks;
+		}
+
+		// Общий интерфейс пула страниц памяти.
+		// Позволяет менеджеру работать с любым пулом, не зная тип его блоков.
+		class pool_base : public voltek::core::base
+		{
+		public:
+			// Деструктор.
+			virtual ~pool_base() = default;
+			// Возвращает свободный блок или nullptr, если память кончилась.
+			// Передаёт номер страницы и номер блока, они понадобятся для освобождения.
+			// Заголовок блока не заполняется.
+			virtual block_base* get_free_block_base(uint16_t& page_id, uint32_t& block_id) = 0;
+			// Занимает до "count" свободных блоков за одну блокировку и передаёт их в "blocks".
+			// Номер страницы и номер блока пишутся в заголовок блока.
+			// Возвращает кол-во блоков, меньше "count", если память кончилась.
+			virtual size_t get_free_blocks_base(block_base** blocks, size_t count) = 0;
+			// Возвращает блок из кеша пула или nullptr, если кеш пуст.
+			// Блокировка не требуется.
+			virtual block_base* pop_cached_block_base(uint16_t& page_id, uint32_t& block_id) = 0;
+			// Освобождает блок по номеру страницы и номеру блока.
+			// Возвращает истину, если всё успешно освободилось.
+			virtual bool release_block_base(uint16_t page_id, uint32_t block_id) = 0;
+			// Добавляет один свободный блок в кеш пула.
+			virtual bool push_free_block_to_cache() = 0;
+			// Возвращает приблизительное кол-во блоков в кеше пула.
+			virtual size_t cached_count() const = 0;
+			// Задаёт, сколько пустых страниц (не больше, чем на указанное кол-во байт) пул держит про запас.
+			virtual void set_retention(size_t pages, size_t bytes) = 0;
+			// Удаляет пустые страницы, что простояли про запас дольше idle_ms.
+			// Если force, то удаляет все пустые страницы про запас.
+			virtual void trim(uint64_t now_ms, uint64_t idle_ms, bool force) = 0;
+			// Возвращает кол-во пустых страниц про запас.
+			virtual size_t retained_count() const = 0;
+			// Возвращает блоки кеша пула в страницы и удаляет пустые страницы, у первой только
+			// отдаёт память, пока не освободится budget байт.
+			// Возвращает кол-во байт, что действительно отдано системе.
+			virtual size_t release_free_pages(size_t budget) = 0;
+			// Прибавляет счётчики страниц пула к указанным.
+			virtual void add_stats(pool_page_stats& stats) const = 0;
+			// Вывод дампа битовой карты пула в файл.
+			virtual void dump_map(const char* filename) const = 0;
+			// Вывод дампа памяти массива страниц в файл.
+			virtual void dump(const char* filename) const = 0;
+		};
+
+		// Lock-free стек свободных блоков пула.
+		// Ссылка на следующий блок хранится в полезных данных свободного блока, а номер
+		// страницы и номер блока - в его заголовке, поэтому стек не требует памяти.
+		// Вершина хранится вместе со счётчиком изменений (старшие 16 бит указателя
+		// в x64 не используются), что исключает проблему ABA.
+		// Снимать блоки можно из любого потока, добавлять - только под блокировкой пула.
+		class block_stack
+		{
+		public:
+			// Конструктор по умолчанию.
+			constexpr block_stack() : head(0), _size(0), _poppers(0)
+			{}
+			// Добавляет блок на вершину стека.
+			inline void push(block_base* block)
+			{
+				uint64_t old_head = head.load(std::memory_order_relaxed);
+				uint64_t new_head;
+				do
+				{
+					set_next(block, get_ptr(old_head));
+					new_head = make_head(block, get_tag(old_head) + 1);
+				} while (!head.compare_exchange_weak(old_head, new_head, std::memory_order_release,
+					std::memory_order_relaxed));
+				_size.fetch_add(1, std::memory_order_relaxed);
+			}
+			// Снимает блок с вершины стека, возвращает nullptr, если стек пуст.
+			inline block_base* pop()
+			{
+				// Пока счётчик не ноль, пул не удаляет страницы, поэтому чтение ссылки
+				// из уже снятого кем-то блока безопасно.
+				_poppers.fetch_add(1, std::memory_order_seq_cst);
+				uint64_t old_head = head.load(std::memory_order_acquire);
+				block_base* block;
+				while ((block = get_ptr(old_head)) != nullptr)
+				{
+					uint64_t new_head = make_head(get_next(block), get_tag(old_head) + 1);
+					if (head.compare_exchange_weak(old_head, new_head, std::memory_order_acq_rel,
+						std::memory_order_acquire))
+						break;
+				}
+				_poppers.fetch_sub(1, std::memory_order_release);
+				if (block) _size.fetch_sub(1, std::memory_order_relaxed);
+				return block;
+			}
+			// Возвращает приблизительное кол-во блоков в стеке.
+			inline size_t size() const { return _size.load(std::memory_order_relaxed); }
+			// Возвращает истину, если кто-то прямо сейчас снимает блок.
+			inline bool is_popping() const { return _poppers.load(std::memory_order_seq_cst) != 0; }
+		private:
+			// Конструктор копий - НЕДОСТУПЕН.
+			block_stack(const block_stack& ob) = delete;
+			// Оператор присвоения - НЕДОСТУПЕН.
+			block_stack& operator=(const block_stack& ob) = delete;
+
+			inline static block_base* get_ptr(uint64_t value) { return (block_base*)(value & 0xFFFFFFFFFFFFull); }
+			inline static uint64_t get_tag(uint64_t value) { return value >> 48; }
+			inline static uint64_t make_head(block_base* block, uint64_t tag) { return (uint64_t)block | (tag << 48); }
+			inline static block_base* get_next(block_base* block) { return *((block_base**)get_ptr_from_block_handle(block)); }
+			inline static void set_next(block_base* block, block_base* next) { *((block_base**)get_ptr_from_block_handle(block)) = next; }
+		private:
+			std::atomic<uint64_t> head;
+			std::atomic<size_t> _size;
+			std::atomic<size_t> _poppers;
+		};
+
 		// Шаблонный класс пула страниц памяти.
 		template<typename _type, typename _page, size_t _blocks_in_page = __VMM_POOL_CONFIG_NORMAL_SIZE>
-		class pool_t : public voltek::core::base
+		class pool_t : public pool_base
 		{
 		public:
+			// Тип блока.
+			using blockobj_t = _type;
 			// Тип страницы.
 			using pageobj_t = _page;
 			// Тип указателя на страницу.
 			using pageptr_t = pageobj_t*;
 			// Конструктор по умолчанию.
-			pool_t() : _pages(nullptr), _current(nullptr), _count(0)
+			pool_t() : _pages(nullptr), _current(nullptr), _count(0), _pool_id(0), _address_map(nullptr),
+				_retain_pages(0), _retain_bytes(0), _retained_count(0), _pages_created(0), _pages_destroyed(0),
+				_committed_bytes(0)
 			{}
 			// Конструктор.
 			// Внимание кол-во допустимых страниц будет округлено до кратности 256.
-			pool_t(size_t count) : _pages(nullptr), _current(nullptr), _count(0)
+			// Страницы отмечаются в карте адресов под указанным номером пула.
+			pool_t(size_t count, uint8_t pool_id, page_map* address_map) : _pages(nullptr), _current(nullptr),
+				_count(0), _pool_id(pool_id), _address_map(address_map), _retain_pages(0), _retain_bytes(0),
+				_retained_count(0), _pages_created(0), _pages_destroyed(0), _committed_bytes(0)
 			{
 				set_size(count);
 			}
@@ -122,9 +264,9 @@ namespace voltek
 			// Возвращает страницу за указанным индексом.
 			inline pageptr_t& operator[](size_t index) { return at(index); }
 			// Вывод дампа битовой карты страницы в файл.
-			inline void dump_map(const char* filename) const { map.dump(filename); }
+			virtual void dump_map(const char* filename) const { map.dump(filename); }
 			// Вывод дампа памяти массива страниц в файл.
-			void dump(const char* filename) const
+			virtual void dump(const char* filename) const
 			{
 #ifndef VMMDLL_EXPORTS
 				voltek::core::_internal::memory_to_file(filename, (void*)_pages,
@@ -137,68 +279,36 @@ namespace voltek
 			// Блок указывается как занятый в последствии.
 			bool get_free_block(_type*& block, pageptr_t& page, size_t& index_block)
 			{
-				if (!free_stack_blocks.empty())
+				block_base* cached_block = free_stack_blocks.pop();
+				if (cached_block)
 				{
-					// Получить из стека
-					auto& item = free_stack_blocks.top();
 					// Передаём индекс блока
-					index_block = item.second;
+					index_block = cached_block->block_id;
 					// Передаём страницу
-					page = item.first;
-					// Получаем блок по текущему индексу
-					block = &(page->at(index_block));
-					// Удалить из стека
-					free_stack_blocks.pop();
+					page = _pages[cached_block->page_id];
+					// Блок уже помечен как занятый
+					block = (_type*)cached_block;
 
 					return true;
 				}
 
-				if (!_current)
-				{
-				find_free_page_label:
-					// Поиск свободной страницы
-
-					size_t index = 0;
-					if (!get_first_free_page_index(index))
-					{
-						_vassert_msg(true, "No free page");
-						return false;
-					}
-
-					// Если страницы за таким индексом не существует, надо создать.
-					if (!_pages[index])
-					{
-						// Объём одной страницы _blocks_in_page
-#ifdef MAPPER_USE
-						_current = new pageobj_t(_blocks_in_page, _mapper);
-#else
-						_current = new pageobj_t(_blocks_in_page);
-#endif
-						if (!_current)
-						{
-							_vassert_msg(true, "Failed new free page");
-							return false;
-						}
-						// Привязываем индекс, как дополнитульную информацию.
-						_current->set_user_data((uintptr_t)index);
-
-						_pages[index] = _current;
-					}
-					else
-						_current = _pages[index];
-				}
-
+				return get_free_page_block(block, page, index_block);
+			}
+			// Занимает свободный блок в страницах, минуя кеш.
+			bool get_free_page_block(_type*& block, pageptr_t& page, size_t& index_block)
+			{
 				index_block = 0;
 				// Если страница закончилась, то надо искать новую.
-				if (!_current->get_first_free_block_index(index_block))
+				while (!_current || !_current->get_first_free_block_index(index_block))
 				{
-					// Получаем индекс страницы и занимаем её.
-					set_page_busy((size_t)_current->get_user_data());
-					_current = nullptr;
-
-					goto find_free_page_label;
+					if (!next_free_page())
+						return false;
 				}
 
+				// Память страницы выделяется по мере выдачи блоков.
+				if (!commit_block(_current, index_block))
+					return false;
+
 				// Получаем блок по текущему индексу
 				block = &(_current->at(index_block));
 				// Передаём страницу
@@ -222,24 +332,21 @@ namespace voltek
 					set_page_free(index_page);
 
 					// Если страница пуста и она не первая, освободить память.
-					if (page->is_all_blocks_free() && (index_page > 0))
+					// Блоки в кеше помечены занятыми, поэтому пустая страница в кеше не упоминается.
+					// Однако пока кто-то снимает блок с кеша, он может читать память этой страницы,
+					// в таком случае страница остаётся и будет использована позже.
+					// Страница, оставленная про запас, удаляется через trim после простоя.
+					if (page->is_all_blocks_free() && (index_page > 0) && !free_stack_blocks.is_popping())
 					{
-						if (_current == page)
-							_current = nullptr;
-
-						// Очистить весь стэк
-						free_stack_blocks = {};
-
-						delete page;
-
-						_pages[index_page] = nullptr;
+						if (!retain_page(index_page))
+							destroy_page(page, index_page);
 					}
 					else if (free_stack_blocks.size() < __VMM_POOL_CONFIG_CACHE_SIZE)
 					{
 						// Занять индекс блока, более он не доступен.
 						page->set_block_busy(index_block);
 						// добавить в стэк
-						free_stack_blocks.push(std::make_pair(page, (uint32_t)index_block));
+						push_block_to_stack(page, index_block);
 					}
 
 					return true;
@@ -248,7 +355,198 @@ namespace voltek
 				return false;
 			}
 
-			bool push_free_block_to_cache()
+			// Возвращает свободный блок или nullptr, если память кончилась.
+			// Передаёт номер страницы и номер блока, они понадобятся для освобождения.
+			virtual block_base* get_free_block_base(uint16_t& page_id, uint32_t& block_id)
+			{
+				pageptr_t page = nullptr;
+				_type* block = nullptr;
+				size_t index_block = 0;
+
+				if (!get_free_block(block, page, index_block))
+					return nullptr;
+
+				page_id = (uint16_t)page->get_user_data();
+				block_id = (uint32_t)index_block;
+				return block;
+			}
+			// Занимает до "count" свободных блоков и передаёт их в "blocks".
+			// Сначала берутся блоки из кеша пула, остальное нарезается из страниц
+			// за один проход по битовой карте страницы.
+			// Номер страницы и номер блока пишутся в заголовок блока.
+			// Возвращает кол-во блоков, меньше "count", если память кончилась.
+			virtual size_t get_free_blocks_base(block_base** blocks, size_t count)
+			{
+				size_t taken = 0;
+
+				for (; taken < count; taken++)
+				{
+					// Номер страницы и номер блока уже в заголовке.
+					blocks[taken] = free_stack_blocks.pop();
+					if (!blocks[taken]) break;
+				}
+
+				size_t indices[64];
+				while (taken < count)
+				{
+					if (!_current && !next_free_page())
+						break;
+
+					size_t need = count - taken;
+					size_t found = _current->take_free_blocks(indices, need < 64 ? need : 64);
+					if (!found)
+					{
+						// Страница закончилась.
+						if (!next_free_page()) break;
+						continue;
+					}
+
+					// Память страницы выделяется по мере выдачи блоков.
+					size_t last = 0;
+					for (size_t i = 0; i < found; i++)
+						if (indices[i] > last) last = indices[i];
+
+					if (!commit_block(_current, last))
+					{
+						for (size_t i = 0; i < found; i++)
+							_current->set_block_free(indices[i]);
+						break;
+					}
+
+					uint16_t page_id = (uint16_t)_current->get_user_data();
+					for (size_t i = 0; i < found; i++)
+					{
+						block_base* block = &(_current->at(indices[i]));
+						block->page_id = page_id;
+						block->block_id = (uint32_t)indices[i];
+						blocks[taken++] = block;
+					}
+				}
+
+				return taken;
+			}
+			// Возвращает блок из кеша пула или nullptr, если кеш пуст.
+			// Блокировка не требуется.
+			virtual block_base* pop_cached_block_base(uint16_t& page_id, uint32_t& block_id)
+			{
+				block_base* block = free_stack_blocks.pop();
+				if (block)
+				{
+					page_id = block->page_id;
+					block_id = block->block_id;
+				}
+				return block;
+			}
+			// Освобождает блок по номеру страницы и номеру блока.
+			virtual bool release_block_base(uint16_t page_id, uint32_t block_id)
+			{
+				if (page_id >= _count)
+					return false;
+
+				return release_block(_pages[page_id], block_id);
+			}
+			// Возвращает приблизительное кол-во блоков в кеше пула.
+			virtual size_t cached_count() const { return free_stack_blocks.size(); }
+			// Задаёт, сколько пустых страниц (не больше, чем на указанное кол-во байт) пул держит про запас.
+			virtual void set_retention(size_t pages, size_t bytes)
+			{
+				_retain_pages = pages < __VMM_POOL_CONFIG_RETAIN_MAX ? pages : __VMM_POOL_CONFIG_RETAIN_MAX;
+				_retain_bytes = bytes;
+			}
+			// Удаляет пустые страницы, что простояли про запас дольше idle_ms.
+			// Время простоя отсчитывается с вызова trim, который первым застал страницу пустой.
+			virtual void trim(uint64_t now_ms, uint64_t idle_ms, bool force)
+			{
+				size_t count = 0;
+				for (size_t i = 0; i < _retained_count; i++)
+				{
+					retained_page_t retained = _retained[i];
+					pageptr_t page = _pages[retained.index];
+
+					// Страница снова в деле.
+					if (!page || !page->is_all_blocks_free())
+						continue;
+
+					if (!retained.since)
+						retained.since = now_ms;
+
+					// Лимит мог уменьшиться, лишнее удаляется сразу.
+					if ((force || (count >= _retain_pages) || ((now_ms - retained.since) >= idle_ms)) &&
+						!free_stack_blocks.is_popping())
+					{
+						destroy_page(page, retained.index);
+						continue;
+					}
+
+					_retained[count++] = retained;
+				}
+
+				_retained_count = count;
+			}
+			// Возвращает кол-во пустых страниц про запас.
+			virtual size_t retained_count() const { return _retained_count; }
+			// Возвращает блоки кеша пула в страницы и удаляет пустые страницы, у первой только
+			// отдаёт память, пока не освободится budget байт.
+			// Возвращает кол-во байт, что действительно отдано системе.
+			virtual size_t release_free_pages(size_t budget)
+			{
+				// Блоки в кеше помечены занятыми, пока они там, их страница не опустеет.
+				block_base* cached_block;
+				while ((cached_block = free_stack_blocks.pop()) != nullptr)
+				{
+					pageptr_t page = _pages[cached_block->page_id];
+					if (page && page->set_block_free(cached_block->block_id))
+						set_page_free(cached_block->page_id);
+				}
+
+				size_t released = 0;
+				for (size_t i = 1; (i < _count) && (released < budget); i++)
+				{
+					pageptr_t page = _pages[i];
+					if (!page || !page->is_all_blocks_free())
+						continue;
+
+					// Кто-то снимает блок с кеша и может читать память страницы.
+					if (free_stack_blocks.is_popping())
+						break;
+
+					released += destroy_page(page, i);
+				}
+
+				// Первая страница не удаляется, но её память можно отдать. Память вернётся,
+				// когда страница снова начнёт выдавать блоки.
+				pageptr_t first = _pages[0];
+				if (first && (released < budget) && first->is_all_blocks_free() && !free_stack_blocks.is_popping())
+				{
+					size_t bytes = first->decommit();
+					_committed_bytes -= bytes;
+					released += bytes;
+				}
+
+				// Забываем удалённые страницы про запас.
+				size_t count = 0;
+				for (size_t i = 0; i < _retained_count; i++)
+					if (_pages[_retained[i].index])
+						_retained[count++] = _retained[i];
+				_retained_count = count;
+
+				return released;
+			}
+			// Прибавляет счётчики страниц пула к указанным.
+			virtual void add_stats(pool_page_stats& stats) const
+			{
+				stats.pages_created += _pages_created;
+				stats.pages_destroyed += _pages_destroyed;
+				stats.pages_retained += _retained_count;
+				for (size_t i = 0; i < _retained_count; i++)
+				{
+					const pageptr_t page = _pages[_retained[i].index];
+					if (page) stats.retained_bytes += page->committed_size();
+				}
+				stats.committed_bytes += _committed_bytes;
+			}
+			// Добавляет один свободный блок в кеш пула.
+			virtual bool push_free_block_to_cache()
 			{
 				if (free_stack_blocks.size() < __VMM_POOL_CONFIG_CACHE_SIZE)
 				{
@@ -256,12 +554,11 @@ namespace voltek
 					_type* block = nullptr;
 					size_t index_block = 0;
 
-					if (get_free_block(block, page, index_block))
+					// Блок из кеша вернулся бы туда же и кеш бы не пополнился.
+					if (get_free_page_block(block, page, index_block))
 					{
-						// Занять индекс блока, более он не доступен.
-						page->set_block_busy(index_block);
-						// добавить в стэк
-						free_stack_blocks.push(std::make_pair(page, (uint32_t)index_block));
+						// добавить в стэк, индекс блока уже занят
+						push_block_to_stack(page, index_block);
 						return true;
 					}
 				}
@@ -271,12 +568,142 @@ namespace voltek
 		private:
 			// Конструктор копий - НЕДОСТУПЕН.
 			// Пул один и уникален.
-			pool_t(const pool_t& ob) : _pages(nullptr), _current(nullptr), _count(0)
+			pool_t(const pool_t& ob) : _pages(nullptr), _current(nullptr), _count(0), _pool_id(0), _address_map(nullptr),
+				_retain_pages(0), _retain_bytes(0), _retained_count(0), _pages_created(0), _pages_destroyed(0),
+				_committed_bytes(0)
 			{}
 			// Оператор присвоения - НЕДОСТУПЕН.
 			// Пул один и уникален.
 			pool_t& operator=(const pool_t& ob)
 			{}
+			// Добавляет занятый блок в кеш, номер страницы и номер блока пишутся в его заголовок.
+			inline void push_block_to_stack(pageptr_t page, size_t index_block)
+			{
+				block_base* block = &(page->at(index_block));
+				block->page_id = (uint16_t)page->get_user_data();
+				block->block_id = (uint32_t)index_block;
+				free_stack_blocks.push(block);
+			}
+			// Оставляет пустую страницу про запас, если позволяет политика удержания.
+			// Возвращает ложь, если страницу надо удалить.
+			bool retain_page(size_t index_page)
+			{
+				if (!_retain_pages)
+					return false;
+
+				// Страница уже про запас, она опустела вновь, простой начинается заново.
+				for (size_t i = 0; i < _retained_count; i++)
+				{
+					if (_retained[i].index == index_page)
+					{
+						_retained[i].since = 0;
+						return true;
+					}
+				}
+
+				// Забываем страницы, что снова в деле.
+				size_t count = 0;
+				for (size_t i = 0; i < _retained_count; i++)
+				{
+					pageptr_t page = _pages[_retained[i].index];
+					if (page && page->is_all_blocks_free())
+						_retained[count++] = _retained[i];
+				}
+				_retained_count = count;
+
+				if ((_retained_count >= _retain_pages) || (((_retained_count + 1) * page_bytes) > _retain_bytes))
+					return false;
+
+				_retained[_retained_count++] = { (uint32_t)index_page, 0 };
+				return true;
+			}
+			// Выделяет память страницы до блока за указанным индексом и учитывает её в счётчике пула.
+			inline bool commit_block(pageptr_t page, size_t index_block)
+			{
+				if (page->is_block_committed(index_block))
+					return true;
+
+				size_t before = page->committed_size();
+				if (!page->commit_block(index_block))
+					return false;
+
+				_committed_bytes += page->committed_size() - before;
+				return true;
+			}
+			// Удаляет пустую страницу. Возвращает кол-во байт выделенной памяти, что она занимала.
+			size_t destroy_page(pageptr_t page, size_t index_page)
+			{
+				if (_current == page)
+					_current = nullptr;
+
+				if (_address_map)
+					_address_map->clear(page->c_data(), page->data_size());
+
+				size_t committed = page->committed_size();
+				_committed_bytes -= committed;
+
+				delete page;
+
+				_pages[index_page] = nullptr;
+				_pages_destroyed++;
+
+				return committed;
+			}
+			// Делает текущей первую свободную страницу, при надобности создаёт её.
+			// Прежняя текущая страница закончилась, она помечается занятой.
+			// Возвращает ложь, если свободных страниц нет или не удалось создать страницу.
+			bool next_free_page()
+			{
+				if (_current)
+				{
+					// Получаем индекс страницы и занимаем её.
+					set_page_busy((size_t)_current->get_user_data());
+					_current = nullptr;
+				}
+
+				// Поиск свободной страницы
+				size_t index = 0;
+				if (!get_first_free_page_index(index))
+				{
+					_vassert_msg(true, "No free page");
+					return false;
+				}
+
+				// Если страницы за таким индексом не существует, надо создать.
+				if (!_pages[index])
+				{
+					// Объём одной страницы _blocks_in_page
+#ifdef MAPPER_USE
+					_current = new pageobj_t(_blocks_in_page, _mapper);
+#else
+					_current = new pageobj_t(_blocks_in_page);
+#endif
+					if (!_current)
+					{
+						_vassert_msg(true, "Failed new free page");
+						return false;
+					}
+					// Привязываем индекс, как дополнитульную информацию.
+					_current->set_user_data((uintptr_t)index);
+
+					// Без отметки в карте блоки страницы не распознать, такая страница не нужна.
+					if (_address_map && !_address_map->set(_current->c_data(), _current->data_size(),
+						{ PAGE_MAP_POOL, _pool_id, (uint16_t)index }))
+					{
+						delete _current;
+						_current = nullptr;
+						_vassert_msg(true, "Failed mark page");
+						return false;
+					}
+
+					_pages[index] = _current;
+					_pages_created++;
+				}
+				else
+					_current = _pages[index];
+
+				return true;
+			}
 		private:
 			// Страницы, массив указателей, необязательно инициализированы.
 			// Но сам массив должен.
@@ -286,11 +713,36 @@ namespace voltek
 			// Кол-во доступных страниц.
 			size_t _count;
 			// Стек свободных блоков
-			std::stack<std::pair<pageptr_t, uint32_t>> free_stack_blocks;
+			block_stack free_stack_blocks;
 			// Дополнительная информация.
 			uintptr_t _user_data;
 			// Битовая карта.
 			voltek::core::bits_regions map;
+			// Номер пула в менеджере.
+			uint8_t _pool_id;
+			// Карта адресов менеджера.
+			page_map* _address_map;
+			// Пустая страница про запас.
+			struct retained_page_t
+			{
+				// Номер страницы.
+				uint32_t index;
+				// Время в мс, когда trim впервые застал её пустой, 0 - ещё не застал.
+				uint64_t since;
+			};
+			// Размер памяти одной страницы.
+			constexpr static size_t page_bytes = sizeof(_type) * _blocks_in_page;
+			// Сколько пустых страниц и байт держать про запас.
+			size_t _retain_pages;
+			size_t _retain_bytes;
+			// Пустые страницы про запас.
+			retained_page_t _retained[__VMM_POOL_CONFIG_RETAIN_MAX];
+			size_t _retained_count;
+			// Счётчики страниц.
+			uint64_t _pages_created;
+			uint64_t _pages_destroyed;
+			// Выделено памяти всеми страницами в байтах.
+			size_t _committed_bytes;
 #ifdef MAPPER_USE
 			// Карта памяти.
 			voltek::core::mapper* _mapper;
@@ -0,0 +1,98 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <bit>
+#include <utility>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		// Лестница размеров блоков пулов.
+		// До 64 байт шаг 16 байт (16, 32, 48, 64), дальше по 4 размера на каждую степень двойки:
+		// 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 640, ... , 131072.
+		// Все размеры кратны 16, поэтому полезные данные любого блока выровнены на 16 байт.
+		// Потеря на округлении размера не превышает 25%, раньше доходила до 75% (1100 байт -> 4096).
+
+		// Кол-во размеров до 64 байт включительно.
+		constexpr static size_t POOL_SMALL_CLASSES = 4;
+		// Кол-во размеров на одну степень двойки.
+		constexpr static size_t POOL_CLASSES_PER_POW2 = 4;
+		// Наибольший размер блока пула, всё что больше, выделяется простым способом.
+		constexpr static size_t POOL_MAX_BLOCK_SIZE = 131072;
+		// Кол-во пулов.
+		constexpr static size_t POOL_MAX = POOL_SMALL_CLASSES +
+			POOL_CLASSES_PER_POW2 * (std::bit_width(POOL_MAX_BLOCK_SIZE) - std::bit_width(64ull));
+
+		// Возвращает размер полезных данных блока пула по его номеру.
+		constexpr static size_t get_pool_class_size(size_t pool_id)
+		{
+			if (pool_id < POOL_SMALL_CLASSES)
+				return (pool_id + 1) << 4;
+
+			size_t group = (pool_id - POOL_SMALL_CLASSES) / POOL_CLASSES_PER_POW2;
+			size_t step = (pool_id - POOL_SMALL_CLASSES) % POOL_CLASSES_PER_POW2 + 1;
+			size_t base = 64ull << group;
+			return base + step * (base / POOL_CLASSES_PER_POW2);
+		}
+
+		// Возвращает номер пула, который подходит для указанного размера, вычислением.
+		// Размер должен быть от 1 до POOL_MAX_BLOCK_SIZE.
+		constexpr static size_t calc_pool_id_from_size(size_t size)
+		{
+			if (size <= 64)
+				return (size - 1) >> 4;
+
+			// Номер старшего бита определяет степень двойки, два следующих бита - четверть в ней.
+			size_t value = size - 1;
+			size_t msb = std::bit_width(value) - 1;
+			return POOL_SMALL_CLASSES + (msb - 6) * POOL_CLASSES_PER_POW2 + ((value >> (msb - 2)) & 3);
+		}
+
+		// Размеры до этого значения ищутся в таблице по 16-байтным долям.
+		constexpr static size_t POOL_LOOKUP_MAX_SIZE = 1024;
+
+		template<size_t... _index>
+		constexpr static std::array<size_t, sizeof...(_index)> make_pool_data_size(std::index_sequence<_index...>)
+		{
+			return { get_pool_class_size(_index)... };
+		}
+
+		template<size_t... _index>
+		constexpr static std::array<uint8_t, sizeof...(_index)> make_pool_lookup(std::index_sequence<_index...>)
+		{
+			// Индекс 0 соответствует размеру 1..16.
+			return { (uint8_t)calc_pool_id_from_size((_index + 1) << 4)... };
+		}
+
+		// Размер полезных данных, на который рассчитан пул.
+		constexpr static std::array<size_t, POOL_MAX> pool_data_size =
+			make_pool_data_size(std::make_index_sequence<POOL_MAX>{});
+		// Таблица номеров пулов для малых размеров.
+		constexpr static std::array<uint8_t, (POOL_LOOKUP_MAX_SIZE >> 4)> pool_lookup =
+			make_pool_lookup(std::make_index_sequence<(POOL_LOOKUP_MAX_SIZE >> 4)>{});
+
+		// Возвращает номер пула, который подходит для указанного размера.
+		// Размер должен быть от 1 до POOL_MAX_BLOCK_SIZE.
+		inline static size_t get_pool_id_from_size(size_t size)
+		{
+			if (size <= POOL_LOOKUP_MAX_SIZE)
+				return pool_lookup[(size - 1) >> 4];
+
+			return calc_pool_id_from_size(size);
+		}
+
+		static_assert(POOL_MAX == 48, "POOL_MAX == 48");
+		static_assert(get_pool_class_size(POOL_MAX - 1) == POOL_MAX_BLOCK_SIZE, "last class is POOL_MAX_BLOCK_SIZE");
+		static_assert(get_pool_class_size(4) == 80 && get_pool_class_size(19) == 1024 &&
+			get_pool_class_size(20) == 1280, "size class ladder");
+		static_assert(calc_pool_id_from_size(1100) == 20 && calc_pool_id_from_size(1024) == 19 &&
+			calc_pool_id_from_size(1025) == 20 && calc_pool_id_from_size(65) == 4, "size class lookup");
+	}
+}
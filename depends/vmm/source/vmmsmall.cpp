@@ -0,0 +1,244 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#include "vmmsmall.h"
+#include "vassert.h"
+#include "vplatform.h"
+#include <string.h>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		static_assert(SMALL_HEAP_CLASSES < SMALL_SEGMENT_UNUSED, "class id must fit in uint8_t");
+		static_assert(pool_data_size[SMALL_HEAP_CLASSES - 1] <= SMALL_SEGMENT_SIZE, "block must fit in segment");
+		static_assert(SMALL_SEGMENT_MAX <= 0x10000, "segment index must fit in uint16_t");
+		static_assert((SMALL_SEGMENT_SIZE / pool_data_size[0]) < 0x10000, "block count must fit in uint16_t");
+
+#if !defined(NDEBUG)
+		// Отладка: размер карты освобождённых блоков.
+		constexpr static size_t SMALL_DEBUG_MAP_SIZE = SMALL_ARENA_SIZE >> (SMALL_DEBUG_GRANULE_SHIFT + 3);
+#endif
+
+		small_heap::small_heap() : _base(0), _size(0), _large_size(0), _segment_count(0), _class_segments{}, _free{}, _bump{},
+			_bump_end{}, _segment_used{}, _released_count(0)
+#if !defined(NDEBUG)
+			, _debug_freed(nullptr)
+#endif
+		{
+			memset(_segment_class, SMALL_SEGMENT_UNUSED, sizeof(_segment_class));
+
+			void* base = voltek::core::platform::page_reserve(SMALL_ARENA_SIZE);
+			if (!base)
+			{
+				_vassert(!base);
+				return;
+			}
+
+			_base = (uintptr_t)base;
+			_size = SMALL_ARENA_SIZE;
+
+#if !defined(NDEBUG)
+			// Память карты выделяется системой при первом обращении.
+			_debug_freed = (std::atomic<uint64_t>*)voltek::core::platform::page_reserve_commit(SMALL_DEBUG_MAP_SIZE);
+#endif
+		}
+
+		small_heap::~small_heap()
+		{
+			if (_base)
+			{
+				// Большие страницы и остаток области - разные участки.
+				if (_large_size)
+				{
+					voltek::core::platform::page_release((void*)_base, _large_size);
+					if (_large_size < _size)
+						voltek::core::platform::page_release((void*)(_base + _large_size), _size - _large_size);
+				}
+				else
+					voltek::core::platform::page_release((void*)_base, _size);
+
+				_base = 0;
+				_size = 0;
+				_large_size = 0;
+			}
+
+#if !defined(NDEBUG)
+			if (_debug_freed)
+			{
+				voltek::core::platform::page_release(_debug_freed, SMALL_DEBUG_MAP_SIZE);
+				_debug_freed = nullptr;
+			}
+#endif
+		}
+
+		bool small_heap::set_large_pages(size_t bytes)
+		{
+			namespace platform = voltek::core::platform;
+
+			if (!_size || _segment_count || _large_size || !bytes)
+				return false;
+
+			size_t page = platform::large_page_size();
+			if (!page || (page > SMALL_ARENA_SIZE))
+			{
+				platform::page_advise_large((void*)_base, _size);
+				return false;
+			}
+
+			size_t large = ((bytes + page - 1) / page) * page;
+			if (large > SMALL_ARENA_SIZE)
+				large = SMALL_ARENA_SIZE;
+
+			// Большие страницы требуют адрес, выровненный на их размер. Ищем свободное место
+			// с запасом, отпускаем его и сразу занимаем выровненную часть.
+			// Между этими вызовами место может занять другой поток, тогда остаёмся как есть.
+			void* probe = platform::page_reserve(SMALL_ARENA_SIZE + page);
+			if (!probe)
+				return false;
+			uintptr_t base = (((uintptr_t)probe + page - 1) / page) * page;
+			platform::page_release(probe, SMALL_ARENA_SIZE + page);
+
+			if (!platform::page_commit_large_at((void*)base, large))
+			{
+				platform::page_advise_large((void*)_base, _size);
+				return false;
+			}
+
+			if ((large < SMALL_ARENA_SIZE) && !platform::page_reserve_at((void*)(base + large), SMALL_ARENA_SIZE - large))
+			{
+				platform::page_release((void*)base, large);
+				platform::page_advise_large((void*)_base, _size);
+				return false;
+			}
+
+			platform::page_release((void*)_base, _size);
+
+			_base = base;
+			_size = SMALL_ARENA_SIZE;
+			_large_size = large;
+			return true;
+		}
+
+		bool small_heap::new_segment(size_t class_id)
+		{
+			size_t index;
+			if (_released_count)
+				index = _released[_released_count - 1];
+			else if (_segment_count < (_size >> SMALL_SEGMENT_SHIFT))
+				index = _segment_count;
+			else
+				return false;
+
+			// Сегменты на больших страницах уже выделены.
+			uintptr_t segment = _base + (index << SMALL_SEGMENT_SHIFT);
+			if ((segment >= _base + _large_size) &&
+				!voltek::core::platform::page_commit((void*)segment, SMALL_SEGMENT_SIZE))
+				return false;
+
+			if (index == _segment_count)
+				_segment_count++;
+			else
+				_released_count--;
+
+			_segment_class[index] = (uint8_t)class_id;
+			_segment_used[index] = 0;
+			_class_segments[class_id]++;
+
+#if !defined(NDEBUG)
+			// Отметки блоков прежнего размера не годятся.
+			if (_debug_freed)
+			{
+				constexpr size_t words = SMALL_SEGMENT_SIZE >> (SMALL_DEBUG_GRANULE_SHIFT + 6);
+				for (size_t i = 0; i < words; i++)
+					_debug_freed[index * words + i].store(0, std::memory_order_relaxed);
+			}
+#endif
+
+			// Хвост сегмента, в который не влезает целый блок, не используется.
+			size_t block_size = pool_data_size[class_id];
+			_bump[class_id] = segment;
+			_bump_end[class_id] = segment + (SMALL_SEGMENT_SIZE / block_size) * block_size;
+			return true;
+		}
+
+		void* small_heap::pop(size_t class_id)
+		{
+			void* ptr = _free[class_id];
+			if (ptr)
+			{
+				_free[class_id] = get_next(ptr);
+				_segment_used[get_segment_index(ptr)]++;
+				return ptr;
+			}
+
+			// Список пуст, нарезаем сегмент.
+			if ((_bump[class_id] == _bump_end[class_id]) && !new_segment(class_id))
+				return nullptr;
+
+			ptr = (void*)_bump[class_id];
+			_bump[class_id] += pool_data_size[class_id];
+			_segment_used[get_segment_index(ptr)]++;
+			return ptr;
+		}
+
+		void small_heap::push(size_t class_id, void* ptr)
+		{
+			set_next(ptr, _free[class_id]);
+			_free[class_id] = ptr;
+			_segment_used[get_segment_index(ptr)]--;
+		}
+
+		size_t small_heap::release_empty_segments(size_t budget)
+		{
+			// Отбираем пустые сегменты, пока их память ещё доступна.
+			size_t first = _released_count;
+			size_t released = 0;
+			for (size_t i = (_large_size >> SMALL_SEGMENT_SHIFT); (i < _segment_count) && (released < budget); i++)
+			{
+				size_t class_id = _segment_class[i];
+				if ((class_id == SMALL_SEGMENT_UNUSED) || _segment_used[i])
+					continue;
+
+				// Ненарезанный остаток сегмента пропадает вместе с ним.
+				uintptr_t segment = _base + (i << SMALL_SEGMENT_SHIFT);
+				if ((_bump[class_id] >= segment) && (_bump[class_id] < segment + SMALL_SEGMENT_SIZE))
+					_bump[class_id] = _bump_end[class_id] = 0;
+
+				_segment_class[i] = SMALL_SEGMENT_RELEASING;
+				_class_segments[class_id]--;
+				_released[_released_count++] = (uint16_t)i;
+				released += SMALL_SEGMENT_SIZE;
+			}
+
+			if (!released)
+				return 0;
+
+			// Забываем блоки отобранных сегментов.
+			for (size_t class_id = 0; class_id < SMALL_HEAP_CLASSES; class_id++)
+			{
+				void** link = &_free[class_id];
+				while (*link)
+				{
+					if (_segment_class[get_segment_index(*link)] == SMALL_SEGMENT_RELEASING)
+						*link = get_next(*link);
+					else
+						link = (void**)*link;
+				}
+			}
+
+			for (size_t i = first; i < _released_count; i++)
+			{
+				// Не отданный системе сегмент всё равно займётся заново, его память просто останется.
+				void* segment = (void*)(_base + ((size_t)_released[i] << SMALL_SEGMENT_SHIFT));
+				if (!voltek::core::platform::page_decommit(segment, SMALL_SEGMENT_SIZE))
+					released -= SMALL_SEGMENT_SIZE;
+
+				_segment_class[_released[i]] = SMALL_SEGMENT_UNUSED;
+			}
+
+			return released;
+		}
+	}
+}
@@ -0,0 +1,169 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#pragma once
+
+#include "vbase.h"
+#include "vmmsizeclass.h"
+#include "vassert.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		// Кол-во размеров, блоки которых выделяются без заголовка (16, 32, 48, 64 байт).
+		constexpr static size_t SMALL_HEAP_CLASSES = POOL_SMALL_CLASSES;
+		// Размер сегмента, все блоки сегмента одного размера.
+		constexpr static size_t SMALL_SEGMENT_SHIFT = 16;
+		constexpr static size_t SMALL_SEGMENT_SIZE = 1ull << SMALL_SEGMENT_SHIFT;
+		// Размер резервируемой под мелкие блоки области.
+		constexpr static size_t SMALL_ARENA_SIZE = 1ull << 30;
+		// Кол-во сегментов в области.
+		constexpr static size_t SMALL_SEGMENT_MAX = SMALL_ARENA_SIZE >> SMALL_SEGMENT_SHIFT;
+		// Сегмент ещё не отдан ни одному размеру.
+		constexpr static uint8_t SMALL_SEGMENT_UNUSED = 0xFF;
+		// Сегмент отбирается для возврата системе, только внутри release_empty_segments.
+		constexpr static uint8_t SMALL_SEGMENT_RELEASING = 0xFE;
+		// Шаг, с которым блоки отмечаются в отладочной карте освобождённых блоков.
+		constexpr static size_t SMALL_DEBUG_GRANULE_SHIFT = 4;
+
+		// Куча мелких блоков без заголовка.
+		// Под неё резервируется непрерывная область, которая нарезается на сегменты по 64 кб,
+		// каждый сегмент отдаётся одному размеру блоков. Размер блока хранится не в блоке,
+		// а в таблице сегментов, и находится по адресу, поэтому блок 16 байт занимает 16 байт.
+		// Принадлежность указателя, размер и начало блока вычисляются за O(1).
+		// Свободные блоки связаны в список через свои первые 8 байт.
+		// Сегмент, все блоки которого свободны, можно вернуть системе через release_empty_segments,
+		// его место займёт следующий новый сегмент. При исчерпании области блоки берутся из пулов.
+		// В отладочной сборке куча помнит освобождённые блоки и ловит двойное освобождение.
+		class small_heap : public voltek::core::base
+		{
+		public:
+			// Конструктор по умолчанию.
+			// Резервирует область, память сегментов выделяется по мере надобности.
+			small_heap();
+			// Деструктор.
+			virtual ~small_heap();
+			// Возвращает истину, если область не зарезервирована.
+			inline bool empty() const { return !_size; }
+			// Возвращает истину, если указатель принадлежит куче мелких блоков.
+			inline bool contains(const void* ptr) const
+			{
+				return ((uintptr_t)ptr - _base) < _size;
+			}
+			// Возвращает номер размера блока по указателю, указатель должен принадлежать куче.
+			inline size_t get_class_id(const void* ptr) const
+			{
+				return _segment_class[((uintptr_t)ptr - _base) >> SMALL_SEGMENT_SHIFT];
+			}
+			// Возвращает начало блока по любому указателю внутрь него.
+			inline void* get_block_start(const void* ptr) const
+			{
+				uintptr_t segment = _base + ((((uintptr_t)ptr - _base) >> SMALL_SEGMENT_SHIFT) << SMALL_SEGMENT_SHIFT);
+				size_t block_size = pool_data_size[get_class_id(ptr)];
+				return (void*)(segment + (((uintptr_t)ptr - segment) / block_size) * block_size);
+			}
+			// Возвращает размер памяти от указателя до конца блока.
+			inline size_t get_usable_size(const void* ptr) const
+			{
+				return pool_data_size[get_class_id(ptr)] - ((const char*)ptr - (const char*)get_block_start(ptr));
+			}
+			// Возвращает свободный блок указанного размера или nullptr, если область исчерпана.
+			// Вызывать только под блокировкой.
+			void* pop(size_t class_id);
+			// Возвращает блок в список свободных.
+			// Вызывать только под блокировкой.
+			void push(size_t class_id, void* ptr);
+			// Возвращает следующий блок из свободного блока.
+			inline static void* get_next(void* ptr) { return *((void**)ptr); }
+			// Записывает следующий блок в свободный блок.
+			inline static void set_next(void* ptr, void* next) { *((void**)ptr) = next; }
+			// Возвращает кол-во сегментов, отданных указанному размеру.
+			// Без блокировки, значение приблизительное.
+			inline size_t get_segment_count(size_t class_id) const { return _class_segments[class_id]; }
+			// Возвращает системе сегменты, все блоки которых свободны, пока не освободится budget байт.
+			// Сегменты на больших страницах остаются. Возвращает кол-во освобождённых байт.
+			// Работает долго, проходит по спискам свободных блоков.
+			// Вызывать только под блокировкой.
+			size_t release_empty_segments(size_t budget);
+			// Отладка: отмечает блок выданным пользователю.
+			// Можно из любого потока.
+			inline void debug_set_allocated(const void* ptr)
+			{
+#if !defined(NDEBUG)
+				if (!_debug_freed) return;
+				size_t index = ((uintptr_t)ptr - _base) >> SMALL_DEBUG_GRANULE_SHIFT;
+				_debug_freed[index >> 6].fetch_and(~(1ull << (index & 63)), std::memory_order_relaxed);
+#else
+				(void)ptr;
+#endif
+			}
+			// Отладка: отмечает блок освобождённым, блок, уже отмеченный так, освобождён дважды.
+			// Можно из любого потока.
+			inline void debug_set_freed(const void* ptr)
+			{
+#if !defined(NDEBUG)
+				if (!_debug_freed) return;
+				size_t index = ((uintptr_t)ptr - _base) >> SMALL_DEBUG_GRANULE_SHIFT;
+				uint64_t bit = 1ull << (index & 63);
+				_vassert_msg(!(_debug_freed[index >> 6].fetch_or(bit, std::memory_order_relaxed) & bit),
+					"Double free of a small block");
+#else
+				(void)ptr;
+#endif
+			}
+			// Переносит область на большие страницы, первые bytes байт выделяются ими сразу.
+			// Можно только пока не занят ни один сегмент. Если больших страниц нет, то область
+			// остаётся прежней, а системе лишь советуется держать её на больших страницах (где умеет).
+			// Вернёт ложь, если большие страницы не выделены.
+			// Вызывать только под блокировкой.
+			bool set_large_pages(size_t bytes);
+			// Возвращает объём области, выделенной большими страницами.
+			inline size_t get_large_page_bytes() const { return _large_size; }
+		private:
+			// Конструктор копий - НЕДОСТУПЕН.
+			small_heap(const small_heap& ob) = delete;
+			// Оператор присвоения - НЕДОСТУПЕН.
+			small_heap& operator=(const small_heap& ob) = delete;
+			// Выделяет память нового сегмента для указанного размера.
+			// Сначала занимает место сегментов, возвращённых системе.
+			bool new_segment(size_t class_id);
+			// Возвращает номер сегмента по указателю внутрь него.
+			inline size_t get_segment_index(const void* ptr) const
+			{
+				return ((uintptr_t)ptr - _base) >> SMALL_SEGMENT_SHIFT;
+			}
+		private:
+			// Начало области.
+			uintptr_t _base;
+			// Размер области, 0 если резерв не удался.
+			size_t _size;
+			// Начальная часть области, выделенная большими страницами, 0 если их нет.
+			size_t _large_size;
+			// Кол-во сегментов, когда-либо занятых с начала области.
+			size_t _segment_count;
+			// Кол-во сегментов каждого размера.
+			size_t _class_segments[SMALL_HEAP_CLASSES];
+			// Списки свободных блоков.
+			void* _free[SMALL_HEAP_CLASSES];
+			// Ещё не нарезанная часть текущего сегмента для каждого размера.
+			uintptr_t _bump[SMALL_HEAP_CLASSES];
+			uintptr_t _bump_end[SMALL_HEAP_CLASSES];
+			// Номер размера для каждого сегмента.
+			uint8_t _segment_class[SMALL_SEGMENT_MAX];
+			// Кол-во блоков каждого сегмента вне списка свободных (у пользователя или в кеше потока).
+			uint16_t _segment_used[SMALL_SEGMENT_MAX];
+			// Номера сегментов, возвращённых системе, их место занимается первым.
+			uint16_t _released[SMALL_SEGMENT_MAX];
+			size_t _released_count;
+#if !defined(NDEBUG)
+			// Отладка: бит на каждые 16 байт области, 1 - блок освобождён.
+			std::atomic<uint64_t>* _debug_freed;
+#endif
+		};
+	}
+}
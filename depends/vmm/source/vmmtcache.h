@@ -0,0 +1,246 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#pragma once
+
+#include "vmmblock.h"
+#include "vmmsmall.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace voltek
+{
+	namespace memory_manager
+	{
+		// Кол-во пулов, для которых заводятся списки в кеше потока.
+		// Охватывает размеры до 8192 байт включительно, большие блоки в кеше держать накладно.
+		constexpr static size_t TCACHE_POOL_MAX = 32;
+		// Сколько байт берётся из пула или возвращается в пул за одну блокировку.
+		constexpr static size_t TCACHE_BATCH_BYTES = 16 * 1024;
+		// Наибольшее кол-во блоков, передаваемых за одну блокировку.
+		constexpr static size_t TCACHE_BATCH_MAX = 32;
+
+		// Возвращает кол-во блоков, передаваемых за одну блокировку, для блока указанного размера.
+		constexpr static size_t get_tcache_batch(size_t block_size)
+		{
+			return (TCACHE_BATCH_BYTES / block_size) > TCACHE_BATCH_MAX ? TCACHE_BATCH_MAX :
+				((TCACHE_BATCH_BYTES / block_size) ? (TCACHE_BATCH_BYTES / block_size) : 1);
+		}
+
+		// Кол-во очередей удалённого освобождения, номер 0 зарезервирован и означает "нет владельца".
+		// Номер владельца хранится в заголовке блока в 8 битах.
+		constexpr static size_t TCACHE_OWNER_MAX = 256;
+
+		// Кол-во классов размера в статистике: пулы по лестнице размеров и последним - большие блоки.
+		constexpr static size_t STATS_CLASS_MAX = POOL_MAX + 1;
+		// Класс размера больших блоков в статистике.
+		constexpr static size_t STATS_LARGE_CLASS = POOL_MAX;
+		// Счётчики статистики одного класса размера.
+		// Выделено блоков.
+		constexpr static size_t STATS_ALLOCS = 0;
+		// Освобождено блоков.
+		constexpr static size_t STATS_FREES = 1;
+		// Блоков, за которыми пришлось идти в пул под блокировкой, кеши были пусты.
+		constexpr static size_t STATS_CACHE_MISSES = 2;
+		// Пополнений кеша пачкой блоков.
+		constexpr static size_t STATS_REFILLS = 3;
+		constexpr static size_t STATS_COUNTER_MAX = 4;
+
+		// Возвращает следующий блок из полезных данных свободного блока.
+		inline static block_base* get_cache_next_block(block_base* block)
+		{
+			return *((block_base**)get_ptr_from_block_handle(block));
+		}
+
+		// Записывает следующий блок в полезные данные свободного блока.
+		inline static void set_cache_next_block(block_base* block, block_base* next)
+		{
+			*((block_base**)get_ptr_from_block_handle(block)) = next;
+		}
+
+		// Очередь удалённого освобождения.
+		// Блок, освобождаемый не тем потоком, что его выделил, добавляется в очередь владельца
+		// одной атомарной операцией, без блокировки. Владелец забирает всю очередь разом,
+		// когда его кеш пустеет. Писателей много, читатель один, поэтому проблемы ABA нет.
+		class alignas(64) remote_queue
+		{
+		public:
+			// Очередь никому не принадлежит.
+			constexpr static uint32_t state_free = 0;
+			// Очередь принадлежит потоку.
+			constexpr static uint32_t state_owned = 1;
+			// Очередь без владельца разбирается фоновым потоком.
+			constexpr static uint32_t state_draining = 2;
+
+			// Конструктор по умолчанию.
+			constexpr remote_queue() : head(nullptr), state(state_free)
+			{}
+			// Добавляет блок в очередь, вызывается из любого потока.
+			inline void push(block_base* block)
+			{
+				block->flags |= flag_block_cached;
+				block_base* old_head = head.load(std::memory_order_relaxed);
+				do
+				{
+					set_cache_next_block(block, old_head);
+				} while (!head.compare_exchange_weak(old_head, block, std::memory_order_release,
+					std::memory_order_relaxed));
+			}
+			// Забирает все блоки разом, возвращает начало списка или nullptr.
+			inline block_base* take_all()
+			{
+				if (!head.load(std::memory_order_relaxed))
+					return nullptr;
+
+				return head.exchange(nullptr, std::memory_order_acquire);
+			}
+			// Пытается занять свободную очередь, возвращает истину, если удалось.
+			inline bool acquire(uint32_t new_state)
+			{
+				uint32_t expected = state_free;
+				return state.compare_exchange_strong(expected, new_state, std::memory_order_acq_rel);
+			}
+			// Освобождает очередь.
+			inline void release() { state.store(state_free, std::memory_order_release); }
+			// Возвращает истину, если очередь никому не принадлежит.
+			inline bool is_free() const { return state.load(std::memory_order_acquire) == state_free; }
+		private:
+			// Конструктор копий - НЕДОСТУПЕН.
+			remote_queue(const remote_queue& ob) = delete;
+			// Оператор присвоения - НЕДОСТУПЕН.
+			remote_queue& operator=(const remote_queue& ob) = delete;
+		private:
+			std::atomic<block_base*> head;
+			std::atomic<uint32_t> state;
+		};
+
+		// Счётчики статистики потока.
+		// Набор закреплён за очередью удалённого освобождения потока, поэтому писатель у него
+		// один и счётчик увеличивается без атомарного сложения, это почти бесплатно.
+		// Набор 0 общий для потоков, которым очереди не хватило, там сложение атомарное.
+		// Набор не обнуляется при смене владельца, сумма всех наборов только растёт.
+		class alignas(64) thread_stats
+		{
+		public:
+			// Конструктор по умолчанию.
+			constexpr thread_stats() : counters{}
+			{}
+			// Прибавляет к счётчику, shared - набор общий для нескольких потоков.
+			inline void add(size_t class_id, size_t counter, uint64_t value, bool shared)
+			{
+				std::atomic<uint64_t>& c = counters[class_id][counter];
+				if (shared)
+					c.fetch_add(value, std::memory_order_relaxed);
+				else
+					c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+			}
+			// Возвращает значение счётчика, вызывается из любого потока.
+			inline uint64_t get(size_t class_id, size_t counter) const
+			{
+				return counters[class_id][counter].load(std::memory_order_relaxed);
+			}
+		private:
+			// Конструктор копий - НЕДОСТУПЕН.
+			thread_stats(const thread_stats& ob) = delete;
+			// Оператор присвоения - НЕДОСТУПЕН.
+			thread_stats& operator=(const thread_stats& ob) = delete;
+		private:
+			std::atomic<uint64_t> counters[STATS_CLASS_MAX][STATS_COUNTER_MAX];
+		};
+
+		// Кеш свободных блоков потока.
+		// Каждый поток держит у себя по односвязному списку на пул, ссылка на следующий
+		// блок хранится в полезных данных свободного блока, поэтому памяти кеш не требует.
+		// Пока блок лежит в кеше, для пула он занят, а его заголовок (пул, страница, номер)
+		// остаётся заполненным, так что вернуть блок в пул можно в любой момент.
+		// Доступ только из своего потока, блокировка не нужна.
+		class thread_cache
+		{
+		public:
+			// Конструктор по умолчанию.
+			constexpr thread_cache() : bins{}, small_bins{}, owner_id(0), owner_claimed(false)
+			{}
+			// Деструктор.
+			// Возвращает все блоки в пулы, поток завершается.
+			~thread_cache();
+			// Возвращает блок из кеша или nullptr, если кеш указанного пула пуст.
+			inline block_base* pop(size_t pool_id)
+			{
+				bin_t& bin = bins[pool_id];
+				block_base* block = bin.head;
+				if (block)
+				{
+					bin.head = get_cache_next_block(block);
+					bin.count--;
+					block->flags &= ~flag_block_cached;
+				}
+				return block;
+			}
+			// Добавляет блок в кеш.
+			inline void push(size_t pool_id, block_base* block)
+			{
+				bin_t& bin = bins[pool_id];
+				block->flags |= flag_block_cached;
+				set_cache_next_block(block, bin.head);
+				bin.head = block;
+				bin.count++;
+			}
+			// Возвращает кол-во блоков в кеше указанного пула.
+			inline size_t count(size_t pool_id) const { return bins[pool_id].count; }
+			// Возвращает мелкий блок без заголовка из кеша или nullptr, если кеш пуст.
+			inline void* pop_small(size_t class_id)
+			{
+				small_bin_t& bin = small_bins[class_id];
+				void* ptr = bin.head;
+				if (ptr)
+				{
+					bin.head = small_heap::get_next(ptr);
+					bin.count--;
+				}
+				return ptr;
+			}
+			// Добавляет мелкий блок без заголовка в кеш.
+			inline void push_small(size_t class_id, void* ptr)
+			{
+				small_bin_t& bin = small_bins[class_id];
+				small_heap::set_next(ptr, bin.head);
+				bin.head = ptr;
+				bin.count++;
+			}
+			// Возвращает кол-во мелких блоков в кеше указанного размера.
+			inline size_t count_small(size_t class_id) const { return small_bins[class_id].count; }
+			// Возвращает номер очереди удалённого освобождения этого потока или 0.
+			inline uint8_t get_owner_id() const { return owner_id; }
+			// Возвращает истину, если поток уже пытался занять очередь.
+			inline bool is_owner_claimed() const { return owner_claimed; }
+			// Устанавливает номер очереди удалённого освобождения этого потока.
+			inline void set_owner_id(uint8_t id) { owner_id = id; owner_claimed = true; }
+		private:
+			// Конструктор копий - НЕДОСТУПЕН.
+			thread_cache(const thread_cache& ob) = delete;
+			// Оператор присвоения - НЕДОСТУПЕН.
+			thread_cache& operator=(const thread_cache& ob) = delete;
+		private:
+			// Список свободных блоков одного пула.
+			struct bin_t
+			{
+				block_base* head;
+				size_t count;
+			} bins[TCACHE_POOL_MAX];
+			// Список свободных мелких блоков одного размера.
+			// Мелкие блоки не помнят владельца, поэтому освобождённый блок
+			// всегда попадает в кеш освобождающего потока.
+			struct small_bin_t
+			{
+				void* head;
+				size_t count;
+			} small_bins[SMALL_HEAP_CLASSES];
+			// Номер очереди удалённого освобождения этого потока.
+			uint8_t owner_id;
+			// Поток уже пытался занять очередь.
+			bool owner_claimed;
+		};
+	}
+}
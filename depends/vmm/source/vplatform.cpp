@@ -0,0 +1,427 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#include "vplatform.h"
+#include "valloc.h"
+
+#if (defined(_WIN32) || defined(_WIN64))
+#	pragma warning (disable : 6250)
+#	pragma warning (disable : 28160)
+#	include <windows.h>
+#else
+#	include <stdio.h>
+#	include <sys/mman.h>
+#	include <sys/resource.h>
+#	include <unistd.h>
+#	include <time.h>
+#	include <pthread.h>
+#	include <atomic>
+#	include <new>
+#	if defined(__linux__)
+#		include <sched.h>
+#		include <linux/futex.h>
+#		include <sys/syscall.h>
+#	endif
+#	ifndef MAP_FIXED_NOREPLACE
+#		define MAP_FIXED_NOREPLACE 0x100000
+#	endif
+#endif
+
+namespace voltek
+{
+	namespace core
+	{
+		namespace platform
+		{
+#if (defined(_WIN32) || defined(_WIN64))
+			void* page_reserve(size_t size)
+			{
+				return VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE);
+			}
+
+			void* page_reserve_commit(size_t size)
+			{
+				return VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			}
+
+			bool page_commit(void* ptr, size_t size)
+			{
+				return VirtualAlloc((LPVOID)ptr, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+			}
+
+			bool page_decommit(void* ptr, size_t size)
+			{
+				return VirtualFree((LPVOID)ptr, (SIZE_T)size, MEM_DECOMMIT) != FALSE;
+			}
+
+			void page_release(void* ptr, size_t size)
+			{
+				// Система помнит размер сама.
+				(void)size;
+				VirtualFree((LPVOID)ptr, 0, MEM_RELEASE);
+			}
+
+			bool page_reserve_at(void* ptr, size_t size)
+			{
+				return VirtualAlloc((LPVOID)ptr, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE) == ptr;
+			}
+
+			// Включает привилегию, без которой память большими страницами не выделить.
+			static bool enable_lock_memory_privilege()
+			{
+				HANDLE token = nullptr;
+				if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+					return false;
+
+				TOKEN_PRIVILEGES privileges = {};
+				privileges.PrivilegeCount = 1;
+				privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+				bool success = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+					AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+					// Успех без ошибки, иначе привилегии у пользователя нет (ERROR_NOT_ALL_ASSIGNED).
+					(GetLastError() == ERROR_SUCCESS);
+
+				CloseHandle(token);
+				return success;
+			}
+
+			size_t large_page_size()
+			{
+				static const size_t size = enable_lock_memory_privilege() ? (size_t)GetLargePageMinimum() : 0;
+				return size;
+			}
+
+			bool page_commit_large_at(void* ptr, size_t size)
+			{
+				return VirtualAlloc((LPVOID)ptr, (SIZE_T)size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+					PAGE_READWRITE) == ptr;
+			}
+
+			bool page_advise_large(void* ptr, size_t size)
+			{
+				(void)ptr;
+				(void)size;
+				return false;
+			}
+
+			void* event_create(bool manual_reset)
+			{
+				return (void*)CreateEventA(nullptr, manual_reset, false, nullptr);
+			}
+
+			void event_destroy(void* event)
+			{
+				if (event) CloseHandle((HANDLE)event);
+			}
+
+			void event_set(void* event)
+			{
+				SetEvent((HANDLE)event);
+			}
+
+			void event_reset(void* event)
+			{
+				ResetEvent((HANDLE)event);
+			}
+
+			size_t event_wait(void* const* events, size_t count, uint32_t timeout_ms)
+			{
+				DWORD wait = WaitForMultipleObjects((DWORD)count, (const HANDLE*)events, false,
+					(timeout_ms == WAIT_INFINITE) ? INFINITE : (DWORD)timeout_ms);
+				if ((wait >= WAIT_OBJECT_0) && (wait < (WAIT_OBJECT_0 + count)))
+					return (size_t)(wait - WAIT_OBJECT_0);
+				return WAIT_TIMEOUT_INDEX;
+			}
+
+			uint64_t tick_count_ms()
+			{
+				return GetTickCount64();
+			}
+
+			void thread_set_priority(int priority)
+			{
+				SetThreadPriority(GetCurrentThread(), priority);
+			}
+
+			void thread_set_affinity(uint64_t affinity_mask)
+			{
+				SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)affinity_mask);
+			}
+#else
+			// Округляет вверх до кратности.
+			inline static size_t round_up(size_t size, size_t alignment)
+			{
+				return (size + alignment - 1) & ~(alignment - 1);
+			}
+
+			// Возвращает размер страницы системы.
+			inline static size_t page_size()
+			{
+				static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+				return size;
+			}
+
+			// Резервирует участок, выровненный на RESERVE_GRANULARITY, как у Windows.
+			// Берётся с запасом, лишнее по краям сразу возвращается.
+			static void* map_aligned(size_t size, int protection)
+			{
+				size = round_up(size, page_size());
+
+				size_t full_size = size + RESERVE_GRANULARITY;
+				char* ptr = (char*)mmap(nullptr, full_size, protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+				if (ptr == (char*)MAP_FAILED)
+					return nullptr;
+
+				char* aligned = (char*)round_up((uintptr_t)ptr, RESERVE_GRANULARITY);
+				if (aligned != ptr)
+					munmap(ptr, aligned - ptr);
+
+				char* tail = aligned + size;
+				if (tail != (ptr + full_size))
+					munmap(tail, (ptr + full_size) - tail);
+
+				return aligned;
+			}
+
+			void* page_reserve(size_t size)
+			{
+				// Доступа нет, пока память не выделят, как и у Windows.
+				return map_aligned(size, PROT_NONE);
+			}
+
+			void* page_reserve_commit(size_t size)
+			{
+				return map_aligned(size, PROT_READ | PROT_WRITE);
+			}
+
+			bool page_commit(void* ptr, size_t size)
+			{
+				// Страницы отдаются системой при первом обращении и обнулены.
+				return !mprotect(ptr, round_up(size, page_size()), PROT_READ | PROT_WRITE);
+			}
+
+			bool page_decommit(void* ptr, size_t size)
+			{
+				size = round_up(size, page_size());
+
+				// После MADV_DONTNEED анонимная память при обращении снова будет обнулена.
+				if (madvise(ptr, size, MADV_DONTNEED))
+					return false;
+
+				return !mprotect(ptr, size, PROT_NONE);
+			}
+
+			void page_release(void* ptr, size_t size)
+			{
+				if (ptr) munmap(ptr, round_up(size, page_size()));
+			}
+
+			// Отображает память строго по адресу, не затирая чужое.
+			static bool map_at(void* ptr, size_t size, int protection, int flags)
+			{
+				void* result = mmap(ptr, size, protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | flags, -1, 0);
+				if (result == MAP_FAILED)
+					return false;
+
+				// Старые ядра не знают MAP_FIXED_NOREPLACE и считают адрес подсказкой.
+				if (result != ptr)
+				{
+					munmap(result, size);
+					return false;
+				}
+
+				return true;
+			}
+
+			bool page_reserve_at(void* ptr, size_t size)
+			{
+				return map_at(ptr, round_up(size, page_size()), PROT_NONE, MAP_NORESERVE);
+			}
+
+			size_t large_page_size()
+			{
+#if defined(__linux__)
+				// Размер по умолчанию из /proc/meminfo, есть ли свободные страницы, покажет mmap.
+				static const size_t size = []() -> size_t
+				{
+					size_t kb = 0;
+					FILE* f = fopen("/proc/meminfo", "r");
+					if (!f)
+						return 0;
+
+					char line[128];
+					while (fgets(line, sizeof(line), f))
+						if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+							break;
+
+					fclose(f);
+					return kb * 1024;
+				}();
+				return size;
+#else
+				return 0;
+#endif
+			}
+
+			bool page_commit_large_at(void* ptr, size_t size)
+			{
+#if defined(__linux__)
+				return map_at(ptr, size, PROT_READ | PROT_WRITE, MAP_HUGETLB);
+#else
+				(void)ptr;
+				(void)size;
+				return false;
+#endif
+			}
+
+			bool page_advise_large(void* ptr, size_t size)
+			{
+#if defined(MADV_HUGEPAGE)
+				return !madvise(ptr, round_up(size, page_size()), MADV_HUGEPAGE);
+#else
+				(void)ptr;
+				(void)size;
+				return false;
+#endif
+			}
+
+			// Событие.
+			// Каждая смена состояния событий увеличивает общий счётчик, ожидающие спят на нём.
+			// Так один futex обслуживает ожидание любого числа событий сразу.
+			struct event_t
+			{
+				std::atomic<uint32_t> state;
+				bool manual_reset;
+			};
+
+			// Счётчик смен состояния всех событий.
+			static std::atomic<uint32_t> event_epoch{ 0 };
+
+			// Спит, пока счётчик равен value, или время не выйдет.
+			static void epoch_wait(uint32_t value, uint32_t timeout_ms)
+			{
+#if defined(__linux__)
+				struct timespec timeout = {};
+				timeout.tv_sec = (time_t)(timeout_ms / 1000);
+				timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+				syscall(SYS_futex, (uint32_t*)&event_epoch, FUTEX_WAIT_PRIVATE, value,
+					(timeout_ms == WAIT_INFINITE) ? nullptr : &timeout, nullptr, 0);
+#else
+				// Без futex просто спим понемногу.
+				(void)value;
+				struct timespec timeout = { 0, 1000000 };
+				if (timeout_ms == 0)
+					return;
+				nanosleep(&timeout, nullptr);
+#endif
+			}
+
+			// Будит всех, кто ждёт события.
+			static void epoch_wake()
+			{
+				event_epoch.fetch_add(1, std::memory_order_release);
+#if defined(__linux__)
+				syscall(SYS_futex, (uint32_t*)&event_epoch, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+			}
+
+			// Забирает взведённое событие, вернёт ложь, если оно не взведено.
+			static bool event_try_take(event_t* event)
+			{
+				if (event->manual_reset)
+					return event->state.load(std::memory_order_acquire) != 0;
+
+				uint32_t expected = 1;
+				return event->state.compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+			}
+
+			void* event_create(bool manual_reset)
+			{
+				event_t* event = (event_t*)_internal::aligned_malloc(sizeof(event_t), 0x10);
+				if (!event)
+					return nullptr;
+
+				new(&event->state) std::atomic<uint32_t>(0);
+				event->manual_reset = manual_reset;
+				return event;
+			}
+
+			void event_destroy(void* event)
+			{
+				_internal::aligned_free(event);
+			}
+
+			void event_set(void* event)
+			{
+				((event_t*)event)->state.store(1, std::memory_order_release);
+				epoch_wake();
+			}
+
+			void event_reset(void* event)
+			{
+				((event_t*)event)->state.store(0, std::memory_order_release);
+			}
+
+			size_t event_wait(void* const* events, size_t count, uint32_t timeout_ms)
+			{
+				uint64_t deadline = (timeout_ms == WAIT_INFINITE) ? 0 : tick_count_ms() + timeout_ms;
+
+				while (true)
+				{
+					// Счётчик читается до проверки событий, тогда смена состояния после проверки
+					// изменит его и futex не уснёт.
+					uint32_t epoch = event_epoch.load(std::memory_order_acquire);
+
+					for (size_t i = 0; i < count; i++)
+						if (event_try_take((event_t*)events[i]))
+							return i;
+
+					uint32_t wait_ms = WAIT_INFINITE;
+					if (timeout_ms != WAIT_INFINITE)
+					{
+						uint64_t now = tick_count_ms();
+						if (now >= deadline)
+							return WAIT_TIMEOUT_INDEX;
+						wait_ms = (uint32_t)(deadline - now);
+					}
+
+					epoch_wait(epoch, wait_ms);
+				}
+			}
+
+			uint64_t tick_count_ms()
+			{
+				struct timespec now = {};
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+			}
+
+			void thread_set_priority(int priority)
+			{
+#if defined(__linux__)
+				// Шкала Windows переводится в nice, поднять приоритет без прав не выйдет, это не ошибка.
+				setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), -priority * 5);
+#else
+				(void)priority;
+#endif
+			}
+
+			void thread_set_affinity(uint64_t affinity_mask)
+			{
+#if defined(__linux__)
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				for (size_t i = 0; i < 64; i++)
+					if (affinity_mask & (1ull << i))
+						CPU_SET(i, &set);
+				pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+				(void)affinity_mask;
+#endif
+			}
+#endif
+		}
+	}
+}
@@ -0,0 +1,76 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace voltek
+{
+	namespace core
+	{
+		// Прослойка над системой: страницы памяти, события, время и потоки.
+		// Для Windows используется VirtualAlloc и объекты ядра, для остальных mmap, madvise и futex.
+		namespace platform
+		{
+			// Гранулярность резервирования адресного пространства, как у Windows.
+			// Начало любого резервированного участка выровнено на неё.
+			constexpr static size_t RESERVE_GRANULARITY = 64 * 1024;
+			// Ждать бесконечно.
+			constexpr static uint32_t WAIT_INFINITE = 0xFFFFFFFF;
+			// Вернёт event_wait, если время вышло.
+			constexpr static size_t WAIT_TIMEOUT_INDEX = ~(size_t)0;
+			// Приоритет потока по умолчанию.
+			// Приоритеты заданы по шкале Windows: от -2 (самый низкий) до 2 (самый высокий).
+			constexpr static int THREAD_PRIORITY_DEFAULT = 0;
+
+			// Резервирует адресное пространство без выделения памяти, вернёт nullptr при ошибке.
+			void* page_reserve(size_t size);
+			// Резервирует адресное пространство и сразу выделяет память, память обнулена.
+			void* page_reserve_commit(size_t size);
+			// Выделяет память в резервированном участке, новая память обнулена.
+			bool page_commit(void* ptr, size_t size);
+			// Освобождает память в резервированном участке, адреса остаются за участком.
+			bool page_decommit(void* ptr, size_t size);
+			// Возвращает участок системе целиком. Размер тот же, что был при резервировании.
+			void page_release(void* ptr, size_t size);
+			// Резервирует адресное пространство по указанному адресу, вернёт ложь, если адрес занят.
+			bool page_reserve_at(void* ptr, size_t size);
+
+			// Возвращает размер большой страницы или 0, если большие страницы недоступны.
+			// Для Windows при первом вызове включается привилегия SeLockMemoryPrivilege,
+			// без неё (её выдаёт администратор) большие страницы недоступны.
+			size_t large_page_size();
+			// Резервирует и выделяет память большими страницами по указанному адресу.
+			// Адрес и размер кратны large_page_size(). Память обнулена и не вытесняется на диск.
+			// Вернёт ложь, если адрес занят или система не нашла столько больших страниц.
+			bool page_commit_large_at(void* ptr, size_t size);
+			// Просит систему держать участок на больших страницах, когда получится (transparent huge pages).
+			// Лишь совет, вернёт ложь, если система так не умеет.
+			bool page_advise_large(void* ptr, size_t size);
+
+			// Создаёт событие, вернёт nullptr при ошибке.
+			// Событие с ручным сбросом остаётся взведённым, пока его не сбросят, иначе сбрасывается
+			// первым дождавшимся потоком.
+			void* event_create(bool manual_reset);
+			// Удаляет событие.
+			void event_destroy(void* event);
+			// Взводит событие.
+			void event_set(void* event);
+			// Сбрасывает событие.
+			void event_reset(void* event);
+			// Ждёт любое из событий не дольше указанного кол-ва мс.
+			// Вернёт номер взведённого события или WAIT_TIMEOUT_INDEX.
+			size_t event_wait(void* const* events, size_t count, uint32_t timeout_ms);
+
+			// Возвращает время в мс от произвольной точки, не убывает.
+			uint64_t tick_count_ms();
+			// Задаёт приоритет текущего потока.
+			void thread_set_priority(int priority);
+			// Привязывает текущий поток к ядрам по маске.
+			void thread_set_affinity(uint64_t affinity_mask);
+		}
+	}
+}
@@ -0,0 +1,396 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+// Замер поиска по битовым картам (bits и bits_regions) с картой-сводкой: поиск первого
+// взведённого бита (свободного блока или страницы) на пустой, полной и фрагментированной
+// карте. Для сравнения тот же поиск делается прежним сканером, что был в vbits.cpp до
+// сводки: при 2048 битах и больше 256 байт за шаг инструкциями AVX2 (без AVX2 по 128 байт
+// SSE4.1), на меньших картах перебором 32 битных слов. Прежняя bits_regions делила карту
+// на 16 областей и сканировала первую непустую из них, здесь она повторена так же.
+//
+// Сборка:
+//   g++ -std=c++20 -O2 -DVOLTEK_LIB_BUILD -DNDEBUG -I../include -I../source vmmbits.cpp ../source/*.cpp -pthread -o vmmbits
+//
+// Запуск:
+//   vmmbits
+//
+// Карты:
+//   empty      все биты взведены (всё свободно), находится первый бит;
+//   full       взведён лишь последний бит (свободен один блок в конце);
+//   none       ни одного бита (всё занято), поиск неудачен;
+//   fragmented взведён каждый FRAGMENT_RATIO-й бит вразброс; найденный бит снимается,
+//              а взамен взводится случайный, как при выдаче и возврате блоков пула.
+// Прежний сканер читает карту по 32 слова за шаг, поэтому сравнение делается лишь на картах
+// (и областях) кратных 2048 битам, иначе он читал бы за концом памяти карты.
+
+#include "vbits.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <immintrin.h>
+
+#include <random>
+#include <vector>
+
+namespace voltek
+{
+	namespace core
+	{
+		void initialize();
+	}
+
+	namespace bitsbench
+	{
+		using namespace voltek::core;
+
+		// Поисков в одном замере.
+		constexpr static size_t SEARCHES = 1024 * 1024;
+		// Доля взведённых бит фрагментированной карты, один из скольких.
+		constexpr static size_t FRAGMENT_RATIO = 100;
+
+		static double get_seconds()
+		{
+			struct timespec ts = {};
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+		}
+
+		static const bool use_avx2 = __builtin_cpu_supports("avx2");
+		static const bool use_sse41 = __builtin_cpu_supports("sse4.1");
+
+		// Прежний find_first_set_bit_avx2, сравнивает по 2048 бит за итерацию.
+		__attribute__((target("avx2")))
+		static bool legacy_find_first_set_bit_avx2(const bits& map, size_t& index)
+		{
+			const uint64_t* u64p = (const uint64_t*)map.c_data();
+			size_t cnt = (map.count() >> 6) << 6;
+			size_t end_cnt = cnt >> 6;
+			__m256i zero = _mm256_setzero_si256();
+
+			for (size_t i = 0; end_cnt > i; i += 32)
+			{
+				__m256i mask1 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i]), zero);
+				__m256i mask2 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i + 4]), zero);
+				__m256i mask3 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i + 8]), zero);
+				__m256i mask4 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i + 12]), zero);
+
+				int mask = _mm256_movemask_pd(_mm256_castsi256_pd(mask1));
+				mask |= _mm256_movemask_pd(_mm256_castsi256_pd(mask2)) << 4;
+				mask |= _mm256_movemask_pd(_mm256_castsi256_pd(mask3)) << 8;
+				mask |= _mm256_movemask_pd(_mm256_castsi256_pd(mask4)) << 12;
+
+				// Вторая половина читается, лишь когда в первой пусто, как и было.
+				if (mask == 65535)
+				{
+					__m256i mask5 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i + 16]), zero);
+					__m256i mask6 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i + 20]), zero);
+					__m256i mask7 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i + 24]), zero);
+					__m256i mask8 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&u64p[i + 28]), zero);
+
+					mask |= _mm256_movemask_pd(_mm256_castsi256_pd(mask5)) << 16;
+					mask |= _mm256_movemask_pd(_mm256_castsi256_pd(mask6)) << 20;
+					mask |= _mm256_movemask_pd(_mm256_castsi256_pd(mask7)) << 24;
+					mask |= _mm256_movemask_pd(_mm256_castsi256_pd(mask8)) << 28;
+				}
+
+				mask = ~mask;
+				if (!mask) continue;
+
+				size_t array_index = i + (size_t)__builtin_ctz((unsigned int)mask);
+				index = (array_index << 6) + (size_t)__builtin_ctzll(u64p[array_index]);
+				_mm256_zeroupper();
+				return true;
+			}
+
+			for (size_t i = cnt; i < map.count(); i++)
+				if (map.is_set(i))
+				{
+					index = i;
+					return true;
+				}
+
+			return false;
+		}
+
+		// Прежний find_first_set_bit_sse41, сравнивает по 1024 бит за итерацию.
+		__attribute__((target("sse4.1")))
+		static bool legacy_find_first_set_bit_sse41(const bits& map, size_t& index)
+		{
+			const uint64_t* u64p = (const uint64_t*)map.c_data();
+			size_t cnt = (map.count() >> 6) << 6;
+			size_t end_cnt = cnt >> 6;
+			__m128i zero = _mm_setzero_si128();
+
+			for (size_t i = 0; end_cnt > i; i += 16)
+			{
+				__m128i mask1 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i]), zero);
+				__m128i mask2 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i + 2]), zero);
+				__m128i mask3 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i + 4]), zero);
+				__m128i mask4 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i + 6]), zero);
+
+				int mask = _mm_movemask_pd(_mm_castsi128_pd(mask1));
+				mask |= _mm_movemask_pd(_mm_castsi128_pd(mask2)) << 2;
+				mask |= _mm_movemask_pd(_mm_castsi128_pd(mask3)) << 4;
+				mask |= _mm_movemask_pd(_mm_castsi128_pd(mask4)) << 6;
+
+				if (mask == 255)
+				{
+					__m128i mask5 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i + 8]), zero);
+					__m128i mask6 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i + 10]), zero);
+					__m128i mask7 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i + 12]), zero);
+					__m128i mask8 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&u64p[i + 14]), zero);
+
+					mask |= _mm_movemask_pd(_mm_castsi128_pd(mask5)) << 8;
+					mask |= _mm_movemask_pd(_mm_castsi128_pd(mask6)) << 10;
+					mask |= _mm_movemask_pd(_mm_castsi128_pd(mask7)) << 12;
+					mask |= _mm_movemask_pd(_mm_castsi128_pd(mask8)) << 14;
+				}
+
+				mask = ~mask & 65535;
+				if (!mask) continue;
+
+				size_t array_index = i + (size_t)__builtin_ctz((unsigned int)mask);
+				index = (array_index << 6) + (size_t)__builtin_ctzll(u64p[array_index]);
+				return true;
+			}
+
+			for (size_t i = cnt; i < map.count(); i++)
+				if (map.is_set(i))
+				{
+					index = i;
+					return true;
+				}
+
+			return false;
+		}
+
+		// Прежний bits::find_first_set_bit с тем же выбором сканера.
+		static bool legacy_find_first_set_bit(const bits& map, size_t& index)
+		{
+			if (map.is_all_unsets())
+				return false;
+
+			if (map.count() >= 2048)
+			{
+				if (use_avx2)
+					return legacy_find_first_set_bit_avx2(map, index);
+				if (use_sse41)
+					return legacy_find_first_set_bit_sse41(map, index);
+			}
+
+			const char* data = map.c_data();
+			size_t cnt = (map.count() >> 5) << 5;
+			for (size_t i = 0; i < cnt; i += 32)
+			{
+				uint32_t word;
+				memcpy(&word, data + (i >> 3), sizeof(word));
+				if (word)
+				{
+					index = i + (size_t)__builtin_ctz(word);
+					return true;
+				}
+			}
+
+			for (size_t i = cnt; i < map.count(); i++)
+				if (map.is_set(i))
+				{
+					index = i;
+					return true;
+				}
+
+			return false;
+		}
+
+		// Прежняя bits_regions: 16 областей со своими картами и маска непустых областей.
+		class legacy_regions
+		{
+			size_t _count;
+			size_t _distance;
+			uint16_t _region_map;
+			bits _region_bits[16];
+		public:
+			legacy_regions(size_t count) : _count(count), _distance(count >> 4), _region_map(0)
+			{
+				for (auto& it : _region_bits)
+					it.resize(_distance);
+			}
+
+			inline size_t count() const { return _count; }
+
+			void all_set()
+			{
+				for (auto& it : _region_bits)
+					it.all_set();
+				_region_map = 0xFFFF;
+			}
+
+			void all_unset()
+			{
+				for (auto& it : _region_bits)
+					it.all_unset();
+				_region_map = 0;
+			}
+
+			bool set(size_t bit_index)
+			{
+				size_t region_id = bit_index / _distance;
+				bool ret = _region_bits[region_id].set(bit_index - region_id * _distance);
+				if (ret)
+					_region_map |= (uint16_t)(1u << region_id);
+				return ret;
+			}
+
+			bool unset(size_t bit_index)
+			{
+				size_t region_id = bit_index / _distance;
+				bool ret = _region_bits[region_id].unset(bit_index - region_id * _distance);
+				if (ret && _region_bits[region_id].is_all_unsets())
+					_region_map &= (uint16_t)~(1u << region_id);
+				return ret;
+			}
+
+			bool find_first_set_bit(size_t& index) const
+			{
+				if (!_region_map)
+					return false;
+
+				size_t region_id = (size_t)__builtin_ctz(_region_map);
+				bool ret = legacy_find_first_set_bit(_region_bits[region_id], index);
+				if (ret) index += region_id * _distance;
+				return ret;
+			}
+		};
+
+		template<typename _map>
+		struct finder_t
+		{
+			static bool find(const _map& map, size_t& index) { return map.find_first_set_bit(index); }
+		};
+
+		struct legacy_finder_t
+		{
+			static bool find(const bits& map, size_t& index) { return legacy_find_first_set_bit(map, index); }
+		};
+
+		enum class map_kind_t { empty, full, none, fragmented };
+
+		static const char* map_kind_name[] = { "empty", "full", "none", "fragmented" };
+
+		template<typename _map>
+		static void fill(_map& map, map_kind_t kind, std::mt19937_64& random)
+		{
+			switch (kind)
+			{
+			case map_kind_t::empty:
+				map.all_set();
+				break;
+			case map_kind_t::full:
+				map.all_unset();
+				map.set(map.count() - 1);
+				break;
+			case map_kind_t::none:
+				map.all_unset();
+				break;
+			case map_kind_t::fragmented:
+				map.all_unset();
+				for (size_t i = 0; i < map.count() / FRAGMENT_RATIO; i++)
+					map.set(random() % map.count());
+				break;
+			}
+		}
+
+		// Возвращает наносекунд на поиск (на поиск и обмен бита для fragmented).
+		template<typename _map, typename _finder>
+		static double run(_map& map, map_kind_t kind)
+		{
+			std::mt19937_64 random(1);
+			fill(map, kind, random);
+
+			// Случайные биты взамен найденных берутся заранее, чтобы не замерять генератор.
+			std::vector<size_t> replace;
+			if (kind == map_kind_t::fragmented)
+			{
+				replace.resize(SEARCHES);
+				for (auto& it : replace)
+					it = random() % map.count();
+			}
+
+			size_t found = 0;
+			double start = get_seconds();
+
+			for (size_t i = 0; i < SEARCHES; i++)
+			{
+				size_t index = 0;
+				if (!_finder::find(map, index))
+					continue;
+
+				found += index;
+				if (kind == map_kind_t::fragmented)
+				{
+					map.unset(index);
+					map.set(replace[i]);
+				}
+			}
+
+			double seconds = get_seconds() - start;
+			// Чтобы компилятор не выбросил поиск.
+			if (found == (size_t)-1)
+				printf("\n");
+
+			return seconds / (double)SEARCHES * 1e9;
+		}
+
+		// Прежняя карта того же вида.
+		template<typename _map> struct legacy_map_t;
+		template<> struct legacy_map_t<bits> { typedef bits map; typedef legacy_finder_t finder; constexpr static size_t parts = 1; };
+		template<> struct legacy_map_t<bits_regions> { typedef legacy_regions map; typedef finder_t<legacy_regions> finder; constexpr static size_t parts = 16; };
+
+		template<typename _map>
+		static void run_map(const char* name, size_t count)
+		{
+			typedef legacy_map_t<_map> legacy_t;
+			// Прежний сканер читает по 2048 бит за шаг, на прочих картах он вышел бы за память.
+			bool with_legacy = !(count % (2048 * legacy_t::parts));
+
+			for (size_t kind = 0; kind <= (size_t)map_kind_t::fragmented; kind++)
+			{
+				_map map(count);
+				double summary = run<_map, finder_t<_map>>(map, (map_kind_t)kind);
+
+				if (with_legacy)
+				{
+					typename legacy_t::map legacy(count);
+					double scan = run<typename legacy_t::map, typename legacy_t::finder>(legacy, (map_kind_t)kind);
+					printf("%-13s %8zu %-11s %10.1f %10.1f %9.1fx\n", name, count, map_kind_name[kind], summary, scan,
+						summary > 0.0 ? scan / summary : 0.0);
+				}
+				else
+					printf("%-13s %8zu %-11s %10.1f %10s %10s\n", name, count, map_kind_name[kind], summary, "-", "-");
+			}
+		}
+	}
+}
+
+int main()
+{
+	using namespace voltek;
+	using namespace voltek::bitsbench;
+
+	core::initialize();
+
+	printf("%zu searches, ns per search, prior scanner: %s\n", SEARCHES,
+		use_avx2 ? "avx2" : (use_sse41 ? "sse4.1" : "32 bit words"));
+	printf("%-13s %8s %-11s %10s %10s %10s\n", "map", "bits", "kind", "summary", "prior", "speedup");
+
+	// Карта страниц пула и карты блоков страниц пулов.
+	run_map<bits>("bits", 65536);
+	run_map<bits>("bits", 1024 * 1024);
+	run_map<bits_regions>("bits_regions", 65536);
+	run_map<bits_regions>("bits_regions", 262144);
+
+	return 0;
+}
@@ -0,0 +1,313 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+// Сравнение размеров страниц пулов: прежняя лестница с постоянным кол-вом блоков в странице
+// (256к блоков до 32 байт, 128к до 128, 64к до 4096, 4к до 32768, 2к дальше) против страниц
+// в __VMM_POOL_CONFIG_PAGE_BYTES байт, кол-во блоков которых выводится из размера блока.
+// Для каждого класса размера пул нагружается одинаково, выводятся выделенная память пулов,
+// RSS и доля памяти, что не занята блоками (фрагментация).
+//
+// Сборка:
+//   g++ -std=c++20 -O2 -DVOLTEK_LIB_BUILD -DNDEBUG -I../include -I../source vmmpagesize.cpp ../source/*.cpp -pthread -o vmmpagesize
+//
+// Запуск:
+//   vmmpagesize [Мб на класс размера, по умолчанию 4]
+//
+// Нагрузка на каждый класс: выделяется столько блоков, чтобы занять указанный объём (не меньше
+// 64 блоков), каждый блок трогается, затем в случайном порядке освобождаются три блока из
+// четырёх, после чего пул отдаёт пустые страницы системе (как при scalable_trim).
+// Страницы выделяют память по мере выдачи блоков, поэтому прежняя лестница здесь уже не тратит
+// память целой страницы сразу. Сколько бы она потратила, показывает строка "first pages".
+
+#include "vmmpool.h"
+#include "vmmsizeclass.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace voltek
+{
+	namespace core
+	{
+		void initialize();
+	}
+
+	namespace pagesize
+	{
+		using namespace voltek::memory_manager;
+
+		// Сколько страниц может быть у пула, как у менеджера.
+		constexpr static size_t POOL_PAGES = 64 * 1024;
+		// Меньше скольких блоков класс не нагружается.
+		constexpr static size_t MIN_BLOCKS = 64;
+		// Шаг, с которым трогается память блока.
+		constexpr static size_t TOUCH_STEP = 4096;
+
+		// Кол-во блоков в странице по прежней лестнице.
+		template<size_t _data_size>
+		constexpr static size_t get_ladder_page_blocks()
+		{
+			if constexpr (_data_size <= 32) return 256 * 1024;
+			else if constexpr (_data_size <= 128) return 128 * 1024;
+			else if constexpr (_data_size <= 4096) return 64 * 1024;
+			else if constexpr (_data_size <= 32768) return 4 * 1024;
+			else return 2 * 1024;
+		}
+
+		// Пул одного класса размера в одном из вариантов.
+		struct pool_info_t
+		{
+			pool_base* pool;
+			size_t block_size;
+			size_t blocks_in_page;
+		};
+
+		typedef pool_info_t (*create_pool_func_t)();
+
+		template<size_t _pool_id, bool _ladder>
+		static pool_info_t create_pool()
+		{
+			constexpr size_t data_size = pool_data_size[_pool_id];
+			typedef block_base_t<(int)data_size> block_t;
+			constexpr size_t blocks_in_page = _ladder ? get_ladder_page_blocks<data_size>() :
+				get_pool_page_blocks<sizeof(block_t)>();
+
+			// Вид карты блоков выбирается так же, как выбирал бы менеджер в каждом варианте.
+			pool_base* pool;
+			if constexpr (_ladder ? (data_size <= 4096) : (blocks_in_page >= 65536))
+				pool = new pool_t<block_t, page_t<block_t>, blocks_in_page>(POOL_PAGES, (uint8_t)_pool_id, nullptr);
+			else
+				pool = new pool_t<block_t, page_t<block_t, __VMM_PAGE_CONFIG_SMALL_SIZE>, blocks_in_page>(POOL_PAGES,
+					(uint8_t)_pool_id, nullptr);
+
+			return { pool, sizeof(block_t), blocks_in_page };
+		}
+
+		template<bool _ladder, size_t... _index>
+		constexpr static std::array<create_pool_func_t, sizeof...(_index)> make_create_table(std::index_sequence<_index...>)
+		{
+			return { &create_pool<_index, _ladder>... };
+		}
+
+		static const std::array<create_pool_func_t, POOL_MAX> create_ladder_table =
+			make_create_table<true>(std::make_index_sequence<POOL_MAX>{});
+		static const std::array<create_pool_func_t, POOL_MAX> create_bytes_table =
+			make_create_table<false>(std::make_index_sequence<POOL_MAX>{});
+
+		// Замер в одной точке нагрузки.
+		struct sample_t
+		{
+			// Запрошено байт живыми блоками.
+			size_t live_bytes;
+			// Выделено памяти страницами пулов.
+			size_t committed_bytes;
+			// Прирост RSS с начала прогона.
+			size_t rss;
+		};
+
+		// Итоги одного варианта.
+		struct result_t
+		{
+			const char* name;
+			// Сумма размеров первых страниц всех пулов, столько выделялось сразу до ленивого выделения.
+			size_t first_pages_bytes;
+			uint64_t pages_created;
+			sample_t peak;
+			sample_t fragmented;
+			sample_t trimmed;
+		};
+
+		// Возвращает текущий RSS в байтах.
+		static size_t get_rss()
+		{
+			size_t pages = 0, resident = 0;
+			FILE* f = fopen("/proc/self/statm", "r");
+			if (!f)
+				return 0;
+			if (fscanf(f, "%zu %zu", &pages, &resident) != 2)
+				resident = 0;
+			fclose(f);
+			return resident * (size_t)sysconf(_SC_PAGESIZE);
+		}
+
+		static void touch(void* ptr, size_t size)
+		{
+			volatile char* p = (volatile char*)ptr;
+			for (size_t i = 0; i < size; i += TOUCH_STEP)
+				p[i] = 1;
+			p[size - 1] = 1;
+		}
+
+		static size_t get_committed(pool_base* const* pools)
+		{
+			pool_page_stats stats = {};
+			for (size_t i = 0; i < POOL_MAX; i++)
+				pools[i]->add_stats(stats);
+			return (size_t)stats.committed_bytes;
+		}
+
+		static void take_sample(sample_t& sample, pool_base* const* pools, size_t live_bytes, size_t rss_base)
+		{
+			size_t rss = get_rss();
+			sample.live_bytes = live_bytes;
+			sample.committed_bytes = get_committed(pools);
+			sample.rss = (rss > rss_base) ? rss - rss_base : 0;
+		}
+
+		// Живой блок.
+		struct block_t
+		{
+			uint16_t page_id;
+			uint32_t block_id;
+			uint8_t pool_id;
+		};
+
+		static void run(const std::array<create_pool_func_t, POOL_MAX>& table, size_t class_bytes, result_t& result)
+		{
+			size_t rss_base = get_rss();
+
+			pool_base* pools[POOL_MAX];
+			std::vector<block_t> blocks;
+
+			for (size_t i = 0; i < POOL_MAX; i++)
+			{
+				pool_info_t info = table[i]();
+				pools[i] = info.pool;
+				result.first_pages_bytes += info.block_size * info.blocks_in_page;
+			}
+
+			// Все классы нагружаются вперемешку, как в игре.
+			std::vector<uint8_t> order;
+			for (size_t i = 0; i < POOL_MAX; i++)
+				order.insert(order.end(), std::max(MIN_BLOCKS, class_bytes / pool_data_size[i]), (uint8_t)i);
+
+			std::mt19937_64 random(1);
+			std::shuffle(order.begin(), order.end(), random);
+
+			size_t live_bytes = 0;
+			for (uint8_t pool_id : order)
+			{
+				block_t block = { 0, 0, pool_id };
+				block_base* ptr = pools[pool_id]->get_free_block_base(block.page_id, block.block_id);
+				if (!ptr)
+					continue;
+
+				touch(ptr, sizeof(block_base) + pool_data_size[pool_id]);
+				blocks.push_back(block);
+				live_bytes += pool_data_size[pool_id];
+			}
+
+			take_sample(result.peak, pools, live_bytes, rss_base);
+
+			// Три блока из четырёх освобождаются в случайном порядке.
+			std::shuffle(blocks.begin(), blocks.end(), random);
+			size_t keep = blocks.size() / 4;
+			for (size_t i = keep; i < blocks.size(); i++)
+			{
+				pools[blocks[i].pool_id]->release_block_base(blocks[i].page_id, blocks[i].block_id);
+				live_bytes -= pool_data_size[blocks[i].pool_id];
+			}
+			blocks.resize(keep);
+
+			take_sample(result.fragmented, pools, live_bytes, rss_base);
+
+			for (size_t i = 0; i < POOL_MAX; i++)
+				pools[i]->release_free_pages(~(size_t)0);
+
+			take_sample(result.trimmed, pools, live_bytes, rss_base);
+
+			pool_page_stats stats = {};
+			for (size_t i = 0; i < POOL_MAX; i++)
+				pools[i]->add_stats(stats);
+			result.pages_created = stats.pages_created;
+
+			// Пул не удаляет свои страницы, перед удалением пула они отдаются системе.
+			// Адреса первых страниц остаются за процессом до выхода.
+			for (auto& block : blocks)
+				pools[block.pool_id]->release_block_base(block.page_id, block.block_id);
+			for (size_t i = 0; i < POOL_MAX; i++)
+			{
+				pools[i]->release_free_pages(~(size_t)0);
+				delete pools[i];
+			}
+		}
+
+		// Доля памяти, что не занята запрошенными байтами.
+		static double get_fragmentation(size_t bytes, size_t live_bytes)
+		{
+			return (bytes > live_bytes) ? (double)(bytes - live_bytes) / (double)bytes * 100.0 : 0.0;
+		}
+
+		static void print_sample(const char* name, const sample_t& sample)
+		{
+			constexpr double MB = 1024.0 * 1024.0;
+			printf("  %-11s live %8.1f Mb, committed %8.1f Mb (%5.1f%%), rss %8.1f Mb (%5.1f%%)\n", name,
+				(double)sample.live_bytes / MB, (double)sample.committed_bytes / MB,
+				get_fragmentation(sample.committed_bytes, sample.live_bytes), (double)sample.rss / MB,
+				get_fragmentation(sample.rss, sample.live_bytes));
+		}
+
+		static void print_result(const result_t& result)
+		{
+			constexpr double MB = 1024.0 * 1024.0;
+			printf("%s: first pages %.1f Mb, pages created %llu\n", result.name,
+				(double)result.first_pages_bytes / MB, (unsigned long long)result.pages_created);
+			print_sample("peak", result.peak);
+			print_sample("fragmented", result.fragmented);
+			print_sample("trimmed", result.trimmed);
+		}
+
+		// Таблица страниц обоих вариантов по классам размера.
+		template<size_t... _index>
+		static void print_classes(std::index_sequence<_index...>)
+		{
+			constexpr double MB = 1024.0 * 1024.0;
+			printf("%8s %10s %10s %10s %10s\n", "block", "ladder", "page Mb", "bytes", "page Mb");
+			((printf("%8zu %10zu %10.2f %10zu %10.2f\n", pool_data_size[_index],
+				get_ladder_page_blocks<pool_data_size[_index]>(),
+				(double)(sizeof(block_base_t<(int)pool_data_size[_index]>) *
+					get_ladder_page_blocks<pool_data_size[_index]>()) / MB,
+				get_pool_page_blocks<sizeof(block_base_t<(int)pool_data_size[_index]>)>(),
+				(double)(sizeof(block_base_t<(int)pool_data_size[_index]>) *
+					get_pool_page_blocks<sizeof(block_base_t<(int)pool_data_size[_index]>)>()) / MB)), ...);
+			printf("\n");
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace voltek;
+	using namespace voltek::pagesize;
+
+	size_t class_mb = (argc > 1) ? (size_t)strtoull(argv[1], nullptr, 10) : 4;
+	if (!class_mb)
+	{
+		fprintf(stderr, "usage: %s [Mb per size class]\n", argv[0]);
+		return 1;
+	}
+
+	core::initialize();
+
+	print_classes(std::make_index_sequence<POOL_MAX>{});
+
+	result_t ladder = {};
+	ladder.name = "ladder";
+	run(create_ladder_table, class_mb << 20, ladder);
+	print_result(ladder);
+
+	result_t bytes = {};
+	bytes.name = "bytes";
+	run(create_bytes_table, class_mb << 20, bytes);
+	print_result(bytes);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+// Замер прослойки над системой (vplatform.h): резервирование, выделение и освобождение
+// страниц, а также пробуждение потока событием. В Linux так меряется ветка mmap, madvise и
+// futex, в Windows та же сборка меряет VirtualAlloc и объекты ядра.
+//
+// Сборка:
+//   g++ -std=c++20 -O2 -DVOLTEK_LIB_BUILD -DNDEBUG -I../include -I../source vmmplatform.cpp ../source/*.cpp -pthread -o vmmplatform
+//
+// Запуск:
+//   vmmplatform
+//
+// Замеры:
+//   reserve/release   резервирование и возврат участка RESERVE_SIZE байт;
+//   commit/decommit   выделение и освобождение COMMIT_SIZE байт внутри участка, без касания;
+//   commit+touch      то же, но каждая страница трогается, как при выдаче блоков пула;
+//   event ping-pong   два потока по очереди взводят события друг друга, время круга.
+// Остальные замеры менеджера (vmmthreads, vmmbits, vmmpagesize, vmmreplay) собираются так же.
+
+#include "vplatform.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <thread>
+
+namespace voltek
+{
+	namespace platformbench
+	{
+		using namespace voltek::core;
+
+		// Размер резервируемого участка, как у страницы пула.
+		constexpr static size_t RESERVE_SIZE = 4 * 1024 * 1024;
+		// Шаг выделения, как у страницы пула (__VMM_PAGE_CONFIG_COMMIT_SIZE).
+		constexpr static size_t COMMIT_SIZE = 64 * 1024;
+		// Повторов замеров страниц.
+		constexpr static size_t PAGE_ROUNDS = 64 * 1024;
+		// Кругов событий.
+		constexpr static size_t EVENT_ROUNDS = 100000;
+
+		static double get_seconds()
+		{
+			struct timespec ts = {};
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+		}
+
+		static void print_result(const char* name, double seconds, size_t rounds)
+		{
+			printf("%-17s %10.2f us\n", name, seconds / (double)rounds * 1e6);
+		}
+
+		static bool run_reserve()
+		{
+			double start = get_seconds();
+			for (size_t i = 0; i < PAGE_ROUNDS; i++)
+			{
+				void* ptr = platform::page_reserve(RESERVE_SIZE);
+				if (!ptr)
+					return false;
+				platform::page_release(ptr, RESERVE_SIZE);
+			}
+			print_result("reserve/release", get_seconds() - start, PAGE_ROUNDS);
+			return true;
+		}
+
+		static bool run_commit(bool touch)
+		{
+			void* base = platform::page_reserve(RESERVE_SIZE);
+			if (!base)
+				return false;
+
+			size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+			size_t steps = RESERVE_SIZE / COMMIT_SIZE;
+			bool result = true;
+
+			double start = get_seconds();
+			for (size_t i = 0; i < PAGE_ROUNDS; i++)
+			{
+				char* ptr = (char*)base + (i % steps) * COMMIT_SIZE;
+				if (!platform::page_commit(ptr, COMMIT_SIZE))
+				{
+					result = false;
+					break;
+				}
+
+				if (touch)
+					for (size_t offset = 0; offset < COMMIT_SIZE; offset += page_size)
+						((volatile char*)ptr)[offset] = 1;
+
+				platform::page_decommit(ptr, COMMIT_SIZE);
+			}
+			double seconds = get_seconds() - start;
+
+			platform::page_release(base, RESERVE_SIZE);
+			if (result)
+				print_result(touch ? "commit+touch" : "commit/decommit", seconds, PAGE_ROUNDS);
+			return result;
+		}
+
+		static bool run_events()
+		{
+			void* ping = platform::event_create(false);
+			void* pong = platform::event_create(false);
+			if (!ping || !pong)
+			{
+				if (ping) platform::event_destroy(ping);
+				if (pong) platform::event_destroy(pong);
+				return false;
+			}
+
+			std::thread partner([ping, pong]()
+			{
+				for (size_t i = 0; i < EVENT_ROUNDS; i++)
+				{
+					platform::event_wait(&ping, 1, platform::WAIT_INFINITE);
+					platform::event_set(pong);
+				}
+			});
+
+			double start = get_seconds();
+			for (size_t i = 0; i < EVENT_ROUNDS; i++)
+			{
+				platform::event_set(ping);
+				platform::event_wait(&pong, 1, platform::WAIT_INFINITE);
+			}
+			double seconds = get_seconds() - start;
+
+			partner.join();
+			platform::event_destroy(ping);
+			platform::event_destroy(pong);
+
+			print_result("event ping-pong", seconds, EVENT_ROUNDS);
+			return true;
+		}
+	}
+}
+
+int main()
+{
+	using namespace voltek::platformbench;
+
+	printf("reserve %zu Kb, commit %zu Kb, time per operation\n", RESERVE_SIZE / 1024, COMMIT_SIZE / 1024);
+
+	if (!run_reserve() || !run_commit(false) || !run_commit(true) || !run_events())
+	{
+		fprintf(stderr, "platform call failed\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,411 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+// Проигрыватель трассы выделений памяти (см. Voltek.MemoryTrace.h).
+// Трасса записывается X-Cell в игре (uMemoryTraceSize), а проигрывается здесь, в Linux,
+// с любым менеджером памяти, чтобы сравнить их на одной и той же нагрузке.
+//
+// Сборка:
+//   g++ -std=c++20 -O2 -I../include vmmreplay.cpp -o vmmreplay
+// С менеджером vmm:
+//   g++ -std=c++20 -O2 -DREPLAY_WITH_VMM=1 -DVOLTEK_LIB_BUILD -DNDEBUG -I../include -I../source vmmreplay.cpp
+//     ../source/*.cpp -pthread -o vmmreplay
+// (одной строкой)
+//
+// Запуск:
+//   vmmreplay <трасса> [system|vmm]
+// Другие менеджеры (jemalloc, mimalloc, tcmalloc) проигрываются через system:
+//   LD_PRELOAD=libmimalloc.so vmmreplay x-cell-memory.trace system
+//
+// Трасса проигрывается в одном потоке в порядке времени записей. Указатели трассы служат
+// лишь номерами блоков. Каждая выделенная страница трогается, иначе система не выделит
+// под неё память и RSS ничего не покажет.
+
+#include <Voltek.MemoryTrace.h>
+#if REPLAY_WITH_VMM
+#	include <Voltek.MemoryManager.h>
+#endif
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace voltek
+{
+	namespace replay
+	{
+		// Через сколько операций замеряется RSS.
+		constexpr static size_t RSS_SAMPLE_PERIOD = 65536;
+		// Шаг, с которым трогается память нового блока.
+		constexpr static size_t TOUCH_STEP = 4096;
+
+		// Менеджер памяти, на котором проигрывается трасса.
+		struct backend_t
+		{
+			const char* name;
+			void* (*alloc)(size_t size, size_t alignment);
+			void* (*realloc)(void* ptr, size_t size, size_t alignment);
+			void (*free)(void* ptr);
+		};
+
+		// Живой блок.
+		struct block_t
+		{
+			void* ptr;
+			size_t size;
+		};
+
+		// Итоги.
+		struct result_t
+		{
+			uint64_t ops;
+			uint64_t allocs;
+			uint64_t frees;
+			uint64_t reallocs;
+			// Освобождения блоков, выделенных до начала трассы.
+			uint64_t unmatched;
+			// Выделения поверх ещё живого блока (потерянное освобождение).
+			uint64_t conflicts;
+			// Отказы менеджера.
+			uint64_t failures;
+			double seconds;
+			// Запрошено байт живыми блоками: сейчас и в пике.
+			size_t live_bytes;
+			size_t peak_live_bytes;
+			// RSS в момент пика живых байт и в конце.
+			size_t rss_at_peak;
+			size_t rss_end;
+		};
+
+		static void* system_alloc(size_t size, size_t alignment)
+		{
+			if (!alignment)
+				return malloc(size);
+
+			void* ptr = nullptr;
+			return posix_memalign(&ptr, std::max(alignment, sizeof(void*)), size) ? nullptr : ptr;
+		}
+
+		static void* system_realloc(void* ptr, size_t size, size_t alignment)
+		{
+			if (!alignment)
+				return realloc(ptr, size);
+
+			// У posix_memalign нет realloc, копируем сами.
+			void* new_ptr = system_alloc(size, alignment);
+			if (new_ptr && ptr)
+			{
+				memcpy(new_ptr, ptr, std::min(size, malloc_usable_size(ptr)));
+				free(ptr);
+			}
+			return new_ptr;
+		}
+
+		static void system_free(void* ptr)
+		{
+			free(ptr);
+		}
+
+#if REPLAY_WITH_VMM
+		static void* vmm_alloc(size_t size, size_t alignment)
+		{
+			return alignment ? scalable_aligned_alloc(size, alignment) : scalable_alloc(size);
+		}
+
+		static void* vmm_realloc(void* ptr, size_t size, size_t alignment)
+		{
+			return alignment ? scalable_aligned_realloc(ptr, size, alignment) : scalable_realloc(ptr, size);
+		}
+
+		static void vmm_free(void* ptr)
+		{
+			scalable_free(ptr);
+		}
+#endif
+
+		static const backend_t backends[] =
+		{
+			{ "system", &system_alloc, &system_realloc, &system_free },
+#if REPLAY_WITH_VMM
+			{ "vmm", &vmm_alloc, &vmm_realloc, &vmm_free },
+#endif
+		};
+
+		// Возвращает текущий RSS в байтах.
+		static size_t get_rss()
+		{
+			size_t pages = 0, resident = 0;
+			FILE* f = fopen("/proc/self/statm", "r");
+			if (!f)
+				return 0;
+			if (fscanf(f, "%zu %zu", &pages, &resident) != 2)
+				resident = 0;
+			fclose(f);
+			return resident * (size_t)sysconf(_SC_PAGESIZE);
+		}
+
+		// Возвращает пиковый RSS процесса в байтах.
+		static size_t get_peak_rss()
+		{
+			struct rusage usage = {};
+			getrusage(RUSAGE_SELF, &usage);
+			return (size_t)usage.ru_maxrss * 1024;
+		}
+
+		static double get_seconds()
+		{
+			struct timespec ts = {};
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+		}
+
+		static void touch(void* ptr, size_t from, size_t size)
+		{
+			volatile char* p = (volatile char*)ptr;
+			for (size_t i = from; i < size; i += TOUCH_STEP)
+				p[i] = 1;
+			if (size > from)
+				p[size - 1] = 1;
+		}
+
+		// Загружает трассу, вернёт ложь, если файл не трасса.
+		static bool load(const char* file_name, memory_trace_header& header, std::vector<memory_trace_record>& records)
+		{
+			FILE* f = fopen(file_name, "rb");
+			if (!f)
+			{
+				fprintf(stderr, "can't open \"%s\"\n", file_name);
+				return false;
+			}
+
+			if ((fread(&header, sizeof(header), 1, f) != 1) || (header.magic != MEMORY_TRACE_MAGIC) ||
+				(header.version != MEMORY_TRACE_VERSION) || (header.record_size != sizeof(memory_trace_record)))
+			{
+				fprintf(stderr, "\"%s\" is not a memory trace\n", file_name);
+				fclose(f);
+				return false;
+			}
+
+			memory_trace_record buffer[4096];
+			size_t count;
+			while ((count = fread(buffer, sizeof(memory_trace_record), 4096, f)) > 0)
+				records.insert(records.end(), buffer, buffer + count);
+
+			fclose(f);
+
+			// Буферы потоков пишутся в файл в произвольном порядке.
+			std::stable_sort(records.begin(), records.end(),
+				[](const memory_trace_record& a, const memory_trace_record& b) { return a.time < b.time; });
+			return true;
+		}
+
+		static void run(const backend_t& backend, const std::vector<memory_trace_record>& records, result_t& result)
+		{
+			std::unordered_map<uint64_t, block_t> live;
+			live.reserve(records.size() / 2 + 1);
+
+			double start = get_seconds();
+
+			for (auto& record : records)
+			{
+				uint8_t kind = record.op & 0xF;
+				size_t alignment = record.align_shift ? (1ull << record.align_shift) : 0;
+
+				switch (kind)
+				{
+				case MEMORY_TRACE_ALLOC:
+				{
+					auto it = live.find(record.block);
+					if (it != live.end())
+					{
+						result.conflicts++;
+						result.live_bytes -= it->second.size;
+						backend.free(it->second.ptr);
+						live.erase(it);
+					}
+
+					void* ptr = backend.alloc(record.size, alignment);
+					if (!ptr)
+					{
+						result.failures++;
+						break;
+					}
+
+					touch(ptr, 0, record.size);
+					live.emplace(record.block, block_t{ ptr, record.size });
+					result.live_bytes += record.size;
+					result.allocs++;
+					break;
+				}
+				case MEMORY_TRACE_FREE:
+				{
+					auto it = live.find(record.block);
+					if (it == live.end())
+					{
+						result.unmatched++;
+						break;
+					}
+
+					result.live_bytes -= it->second.size;
+					backend.free(it->second.ptr);
+					live.erase(it);
+					result.frees++;
+					break;
+				}
+				case MEMORY_TRACE_REALLOC:
+				{
+					void* old_ptr = nullptr;
+					size_t old_size = 0;
+
+					auto it = live.find(record.prev);
+					if (it != live.end())
+					{
+						old_ptr = it->second.ptr;
+						old_size = it->second.size;
+						live.erase(it);
+					}
+					else if (record.prev)
+						// Блок выделен до начала трассы, проигрываем как выделение.
+						result.unmatched++;
+
+					it = live.find(record.block);
+					if (it != live.end())
+					{
+						result.conflicts++;
+						result.live_bytes -= it->second.size;
+						backend.free(it->second.ptr);
+						live.erase(it);
+					}
+
+					void* ptr = backend.realloc(old_ptr, record.size, alignment);
+					if (!ptr)
+					{
+						result.failures++;
+						if (old_ptr)
+							live.emplace(record.prev, block_t{ old_ptr, old_size });
+						break;
+					}
+
+					touch(ptr, old_size, record.size);
+					live.emplace(record.block, block_t{ ptr, record.size });
+					result.live_bytes += record.size;
+					result.live_bytes -= old_size;
+					result.reallocs++;
+					break;
+				}
+				default:
+					continue;
+				}
+
+				result.ops++;
+
+				if (result.live_bytes > result.peak_live_bytes)
+					result.peak_live_bytes = result.live_bytes;
+
+				if (!(result.ops % RSS_SAMPLE_PERIOD))
+				{
+					// Замер RSS дорог, поэтому пик ловится лишь с точностью до периода.
+					size_t rss = get_rss();
+					if (result.live_bytes >= result.peak_live_bytes)
+						result.rss_at_peak = rss;
+				}
+			}
+
+			result.seconds = get_seconds() - start;
+			result.rss_end = get_rss();
+			if (!result.rss_at_peak)
+				result.rss_at_peak = result.rss_end;
+
+			for (auto& it : live)
+				backend.free(it.second.ptr);
+		}
+
+		// Доля RSS, что не занята запрошенными байтами.
+		static double get_fragmentation(size_t rss, size_t live_bytes)
+		{
+			return (rss > live_bytes) ? (double)(rss - live_bytes) / (double)rss * 100.0 : 0.0;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace voltek;
+	using namespace voltek::replay;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <trace> [backend]\nbackends:", argv[0]);
+		for (auto& it : backends)
+			fprintf(stderr, " %s", it.name);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+
+	const backend_t* backend = &backends[0];
+	if (argc > 2)
+	{
+		backend = nullptr;
+		for (auto& it : backends)
+			if (!strcmp(it.name, argv[2]))
+				backend = &it;
+
+		if (!backend)
+		{
+			fprintf(stderr, "unknown backend \"%s\"\n", argv[2]);
+			return 1;
+		}
+	}
+
+	memory_trace_header header = {};
+	std::vector<memory_trace_record> records;
+	if (!load(argv[1], header, records))
+		return 1;
+
+	double duration = (records.empty() || !header.frequency) ? 0.0 :
+		(double)(records.back().time - records.front().time) / (double)header.frequency;
+	printf("trace: %zu records, %.1f s of game time\n", records.size(), duration);
+
+#if REPLAY_WITH_VMM
+	scalable_memory_manager_initialize();
+#endif
+
+	result_t result = {};
+	// RSS до проигрывания: сама трасса и таблица блоков.
+	size_t rss_base = get_rss();
+	run(*backend, records, result);
+
+	constexpr double MB = 1024.0 * 1024.0;
+	size_t rss_at_peak = (result.rss_at_peak > rss_base) ? result.rss_at_peak - rss_base : 0;
+	size_t rss_end = (result.rss_end > rss_base) ? result.rss_end - rss_base : 0;
+
+	printf("backend: %s\n", backend->name);
+	printf("ops: %llu (alloc %llu, free %llu, realloc %llu), unmatched %llu, conflicts %llu, failures %llu\n",
+		(unsigned long long)result.ops, (unsigned long long)result.allocs, (unsigned long long)result.frees,
+		(unsigned long long)result.reallocs, (unsigned long long)result.unmatched,
+		(unsigned long long)result.conflicts, (unsigned long long)result.failures);
+	printf("time: %.3f s, %.2f Mops/s\n", result.seconds,
+		result.seconds > 0.0 ? (double)result.ops / result.seconds / 1e6 : 0.0);
+	printf("peak rss: %.1f Mb (process)\n", (double)get_peak_rss() / MB);
+	printf("at peak: live %.1f Mb, rss %.1f Mb, fragmentation %.1f%%\n",
+		(double)result.peak_live_bytes / MB, (double)rss_at_peak / MB,
+		get_fragmentation(rss_at_peak, result.peak_live_bytes));
+	printf("at end: live %.1f Mb, rss %.1f Mb, fragmentation %.1f%%\n",
+		(double)result.live_bytes / MB, (double)rss_end / MB,
+		get_fragmentation(rss_end, result.live_bytes));
+
+#if REPLAY_WITH_VMM
+	scalable_memory_manager_shutdown();
+#endif
+
+	return 0;
+}
@@ -0,0 +1,368 @@
+﻿// Copyright © 2023 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/lgpl-3.0.html
+
+// Замер масштабирования менеджера памяти по потокам: от 1 до N потоков выделяют и освобождают
+// блоки. С кэшами потоков частый путь не берёт общую блокировку, и число операций в секунду
+// должно расти вместе с числом потоков.
+//
+// Сборка:
+//   g++ -std=c++20 -O2 -DVOLTEK_LIB_BUILD -DNDEBUG -I../include -I../source vmmthreads.cpp ../source/*.cpp -pthread -o vmmthreads
+//
+// Запуск:
+//   vmmthreads [потоков, по умолчанию по числу ядер] [vmm|system] [local|remote]
+//
+// Режимы:
+//   local   каждый поток делает OPS_PER_THREAD операций над WORKING_SET ячейками: пустая
+//           ячейка получает новый блок, занятая освобождается. Блок всегда освобождает тот
+//           поток, что его выделил;
+//   remote  потоки идут парами: производитель выделяет OPS_PER_THREAD блоков и передаёт их
+//           через кольцо в RING_SIZE ячеек потребителю, тот их освобождает. Так каждое
+//           освобождение чужое и идёт через очередь возврата потока-владельца.
+// Потоки: 1, 2, 4 ... до N, и само N (в remote лишь чётные, от 2). Размеры блоков в основном
+// до 256 байт, изредка до 8 Кб, как у мелких объектов игры. Все потоки стартуют разом, время
+// берётся от старта до завершения последнего. Перед замерами один прогон на всех потоках
+// отбрасывается, чтобы первый замер не платил за выделение страниц.
+// Столбец scaling что-то говорит лишь при ядре на каждый поток: на одном ядре потоки идут по
+// очереди, и он показывает только цену переключений, а в remote ещё и ожидание кольца.
+
+#include <Voltek.MemoryManager.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace voltek
+{
+	namespace threads
+	{
+		// Операций на поток в одном замере.
+		constexpr static size_t OPS_PER_THREAD = 4 * 1024 * 1024;
+		// Ячеек рабочего набора потока.
+		constexpr static size_t WORKING_SET = 1024;
+		// Ячеек кольца между производителем и потребителем пары.
+		constexpr static size_t RING_SIZE = 1024;
+
+		enum class run_mode_t { local, remote };
+
+		static const char* mode_names[] = { "local", "remote" };
+
+		// Менеджер памяти, что замеряется.
+		struct backend_t
+		{
+			const char* name;
+			void* (*alloc)(size_t size);
+			void (*free)(void* ptr);
+		};
+
+		static void* system_alloc(size_t size)
+		{
+			return malloc(size);
+		}
+
+		static void system_free(void* ptr)
+		{
+			free(ptr);
+		}
+
+		static void* vmm_alloc(size_t size)
+		{
+			return scalable_alloc(size);
+		}
+
+		static void vmm_free(void* ptr)
+		{
+			scalable_free(ptr);
+		}
+
+		static const backend_t backends[] =
+		{
+			{ "vmm", &vmm_alloc, &vmm_free },
+			{ "system", &system_alloc, &system_free },
+		};
+
+		static double get_seconds()
+		{
+			struct timespec ts = {};
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+		}
+
+		// Быстрый генератор, чтобы он не стоил больше самого выделения.
+		static inline uint64_t next_random(uint64_t& state)
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+
+		// Размер блока: 7 из 8 до 256 байт, остальные до 8 Кб.
+		static inline size_t get_block_size(uint64_t random)
+		{
+			return (random & 7) ? 8 + ((random >> 8) & 255) : 8 + ((random >> 8) & 8191);
+		}
+
+		// Кольцо одного производителя и одного потребителя. Индексы растут без конца,
+		// ячейка берётся по остатку; каждый индекс пишет лишь одна сторона.
+		struct ring_t
+		{
+			alignas(64) std::atomic<size_t> head;
+			alignas(64) std::atomic<size_t> tail;
+			// Производитель закончил, после опустошения кольца потребитель выходит.
+			std::atomic<bool> done;
+			void* slots[RING_SIZE];
+		};
+
+		struct shared_t
+		{
+			const backend_t* backend;
+			// Кольца пар в режиме remote.
+			ring_t* rings;
+			// Сколько потоков готово, старт по достижении числа потоков.
+			std::atomic<size_t> ready;
+			std::atomic<bool> start;
+			// Отказы менеджера.
+			std::atomic<uint64_t> failures;
+		};
+
+		static void wait_start(shared_t& shared)
+		{
+			shared.ready.fetch_add(1);
+			while (!shared.start.load(std::memory_order_acquire))
+				std::this_thread::yield();
+		}
+
+		static void local_worker(shared_t& shared, size_t thread_id)
+		{
+			const backend_t& backend = *shared.backend;
+			void* slots[WORKING_SET] = {};
+			uint64_t state = 0x9E3779B97F4A7C15ull * (thread_id + 1);
+			uint64_t failures = 0;
+
+			wait_start(shared);
+
+			for (size_t i = 0; i < OPS_PER_THREAD; i++)
+			{
+				uint64_t random = next_random(state);
+				void*& slot = slots[random % WORKING_SET];
+				if (slot)
+				{
+					backend.free(slot);
+					slot = nullptr;
+				}
+				else
+				{
+					size_t size = get_block_size(random >> 16);
+					slot = backend.alloc(size);
+					if (slot)
+						*(volatile char*)slot = 1;
+					else
+						failures++;
+				}
+			}
+
+			for (auto& slot : slots)
+				if (slot)
+					backend.free(slot);
+
+			shared.failures.fetch_add(failures);
+		}
+
+		static void producer(shared_t& shared, ring_t& ring, size_t thread_id)
+		{
+			const backend_t& backend = *shared.backend;
+			uint64_t state = 0x9E3779B97F4A7C15ull * (thread_id + 1);
+			uint64_t failures = 0;
+
+			wait_start(shared);
+
+			size_t head = 0;
+			for (size_t i = 0; i < OPS_PER_THREAD; i++)
+			{
+				void* ptr = backend.alloc(get_block_size(next_random(state)));
+				if (!ptr)
+				{
+					failures++;
+					continue;
+				}
+				*(volatile char*)ptr = 1;
+
+				while (head - ring.tail.load(std::memory_order_acquire) == RING_SIZE)
+					std::this_thread::yield();
+
+				ring.slots[head % RING_SIZE] = ptr;
+				ring.head.store(++head, std::memory_order_release);
+			}
+
+			ring.done.store(true, std::memory_order_release);
+			shared.failures.fetch_add(failures);
+		}
+
+		static void consumer(shared_t& shared, ring_t& ring)
+		{
+			const backend_t& backend = *shared.backend;
+
+			wait_start(shared);
+
+			size_t tail = 0;
+			while (true)
+			{
+				// Флаг читается до индекса, иначе можно выйти, не забрав последние блоки.
+				bool done = ring.done.load(std::memory_order_acquire);
+				if (tail == ring.head.load(std::memory_order_acquire))
+				{
+					if (done)
+						break;
+
+					std::this_thread::yield();
+					continue;
+				}
+
+				backend.free(ring.slots[tail % RING_SIZE]);
+				ring.tail.store(++tail, std::memory_order_release);
+			}
+		}
+
+		// Возвращает время замера в секундах.
+		static double run(const backend_t& backend, run_mode_t mode, size_t thread_count, uint64_t& failures)
+		{
+			shared_t shared;
+			shared.backend = &backend;
+			shared.rings = nullptr;
+			shared.ready = 0;
+			shared.start = false;
+			shared.failures = 0;
+
+			std::vector<std::thread> threads;
+			threads.reserve(thread_count);
+			if (mode == run_mode_t::remote)
+			{
+				shared.rings = new ring_t[thread_count >> 1];
+				for (size_t i = 0; i < (thread_count >> 1); i++)
+				{
+					ring_t& ring = shared.rings[i];
+					ring.head = 0;
+					ring.tail = 0;
+					ring.done = false;
+					threads.emplace_back(producer, std::ref(shared), std::ref(ring), i << 1);
+					threads.emplace_back(consumer, std::ref(shared), std::ref(ring));
+				}
+			}
+			else
+			{
+				for (size_t i = 0; i < thread_count; i++)
+					threads.emplace_back(local_worker, std::ref(shared), i);
+			}
+
+			while (shared.ready.load() < thread_count)
+				std::this_thread::yield();
+
+			double start = get_seconds();
+			shared.start.store(true, std::memory_order_release);
+
+			for (auto& thread : threads)
+				thread.join();
+
+			double seconds = get_seconds() - start;
+			delete[] shared.rings;
+
+			failures = shared.failures.load();
+			return seconds;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace voltek;
+	using namespace voltek::threads;
+
+	size_t max_threads = (argc > 1) ? (size_t)strtoull(argv[1], nullptr, 10) :
+		(size_t)std::thread::hardware_concurrency();
+	if (!max_threads)
+	{
+		fprintf(stderr, "usage: %s [threads] [backend] [mode]\nbackends:", argv[0]);
+		for (auto& it : backends)
+			fprintf(stderr, " %s", it.name);
+		fprintf(stderr, "\nmodes:");
+		for (auto& it : mode_names)
+			fprintf(stderr, " %s", it);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+
+	const backend_t* backend = &backends[0];
+	if (argc > 2)
+	{
+		backend = nullptr;
+		for (auto& it : backends)
+			if (!strcmp(it.name, argv[2]))
+				backend = &it;
+
+		if (!backend)
+		{
+			fprintf(stderr, "unknown backend \"%s\"\n", argv[2]);
+			return 1;
+		}
+	}
+
+	run_mode_t mode = run_mode_t::local;
+	if (argc > 3)
+	{
+		if (!strcmp(argv[3], mode_names[(size_t)run_mode_t::remote]))
+			mode = run_mode_t::remote;
+		else if (strcmp(argv[3], mode_names[(size_t)run_mode_t::local]))
+		{
+			fprintf(stderr, "unknown mode \"%s\"\n", argv[3]);
+			return 1;
+		}
+	}
+
+	// Пары не делятся, в remote потоков чётное число.
+	size_t first_count = 1;
+	if (mode == run_mode_t::remote)
+	{
+		max_threads = (max_threads < 2) ? 2 : max_threads & ~(size_t)1;
+		first_count = 2;
+	}
+
+	scalable_memory_manager_initialize();
+
+	std::vector<size_t> counts;
+	for (size_t count = first_count; count < max_threads; count <<= 1)
+		counts.push_back(count);
+	counts.push_back(max_threads);
+
+	printf("backend: %s, mode: %s, %zu ops per thread, working set %zu, ring %zu, %u cores\n", backend->name,
+		mode_names[(size_t)mode], OPS_PER_THREAD, WORKING_SET, RING_SIZE, std::thread::hardware_concurrency());
+	printf("%8s %10s %12s %12s %10s\n", "threads", "time s", "Mops/s", "per thread", "scaling");
+
+	uint64_t warmup_failures = 0;
+	run(*backend, mode, max_threads, warmup_failures);
+
+	double single = 0.0;
+	for (size_t count : counts)
+	{
+		uint64_t failures = 0;
+		double seconds = run(*backend, mode, count, failures);
+		double mops = (double)(OPS_PER_THREAD * count) / seconds / 1e6;
+		if (count == first_count)
+			single = mops;
+
+		printf("%8zu %10.3f %12.2f %12.2f %9.2fx", count, seconds, mops, mops / (double)count,
+			single > 0.0 ? mops / single : 0.0);
+		if (failures)
+			printf(" (failures %llu)", (unsigned long long)failures);
+		printf("\n");
+	}
+
+	scalable_memory_manager_shutdown();
+
+	return 0;
+}
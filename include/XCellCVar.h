@@ -56,6 +56,32 @@ namespace XCell
 	// Limit 2Gb(2048) installed programmatically, number must be a multiple of 8. If you don't have even that much memory, 
 	// it's worth thinking about your MCM menu.
 	extern std::shared_ptr<Setting> CVarScaleformHeapSize;
+	// How many free pages BSScaleformSysMemMapper commits ahead of the requested ones in the same call, ignored without a decommit delay.
+	extern std::shared_ptr<Setting> CVarScaleformCommitAhead;
+	// How long (in seconds) a freed BSScaleformSysMemMapper page stays committed for reuse, 0 decommits it at once and turns commit-ahead off.
+	// When the system runs low on memory, idle pages are decommitted earlier.
+	extern std::shared_ptr<Setting> CVarScaleformDecommitDelay;
+	// Priority of the memory manager thread that refills the pool caches (THREAD_PRIORITY_* value, from -2 to 2).
+	// The thread sleeps and only wakes up when a cache runs low.
+	extern std::shared_ptr<Setting> CVarMemoryRefillPriority;
+	// Mask of processor cores for the memory manager refill thread, 0 means any core.
+	extern std::shared_ptr<Setting> CVarMemoryRefillAffinity;
+	// How many empty pages each memory manager pool keeps in reserve instead of freeing them at once.
+	extern std::shared_ptr<Setting> CVarMemoryRetainPages;
+	// Upper limit (in MB) for the empty pages one pool keeps in reserve.
+	extern std::shared_ptr<Setting> CVarMemoryRetainSize;
+	// How long (in ms) an empty page stays in reserve before it is returned to the system.
+	extern std::shared_ptr<Setting> CVarMemoryRetainIdle;
+	// How often (in seconds) the memory manager statistics are written to the log, 0 turns it off.
+	extern std::shared_ptr<Setting> CVarMemoryStatsInterval;
+	// Upper limit (in MB) for the allocation trace file, 0 turns the trace off.
+	extern std::shared_ptr<Setting> CVarMemoryTraceSize;
+	// Mean interval (in KB of allocations) between samples of the allocation profiler, 0 turns it off.
+	extern std::shared_ptr<Setting> CVarMemoryProfileRate;
+	// How much memory (in MB) for the smallest blocks is allocated on large pages up front, 0 turns it off.
+	extern std::shared_ptr<Setting> CVarMemoryLargePages;
+	// Returns free memory of the memory manager to the system when a loading screen opens.
+	extern std::shared_ptr<Setting> CVarMemoryTrimOnLoading;
 	// Replaces the old 12 redistributable with a 22 one.Made into a separate option, as I'm tired of fake reports.
 	// If this option is enabled, the reports will include an X-Cell in case of errors in your mods related to copying or comparing memory.
 	extern std::shared_ptr<Setting> CVarUseNewRedistributable;
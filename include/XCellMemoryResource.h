@@ -0,0 +1,45 @@
+﻿// Copyright © 2024-2025 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/gpl-3.0.html
+
+#pragma once
+
+#include <memory_resource>
+
+namespace XCell
+{
+	// Memory resource for X-Cell's own node-based containers, blocks go to the size class pools of vmm
+	// (thread caches, sized pages) instead of one node per CRT allocation. Until the memory manager is
+	// started by the bMemory patch blocks come from the CRT, a release tells them apart, so a container
+	// created early keeps working after the switch.
+	class PoolResource : public std::pmr::memory_resource
+	{
+		PoolResource(const PoolResource&) = delete;
+		PoolResource(PoolResource&&) = delete;
+		PoolResource& operator=(const PoolResource&) = delete;
+		PoolResource& operator=(PoolResource&&) = delete;
+	public:
+		PoolResource() noexcept(true) = default;
+		virtual ~PoolResource() noexcept(true) = default;
+
+		[[nodiscard]] static PoolResource* GetSingletonPtr() noexcept(true);
+	protected:
+		virtual void* do_allocate(std::size_t nBytes, std::size_t nAlignment);
+		virtual void do_deallocate(void* lpBlock, std::size_t nBytes, std::size_t nAlignment);
+		virtual bool do_is_equal(const std::pmr::memory_resource& Other) const noexcept(true);
+	};
+
+	// Monotonic arena for data that is built once and dropped as a whole (parsed INI files, settings).
+	// Chunks come from PoolResource and grow geometrically, releasing a single block does nothing,
+	// everything is returned when the arena is destroyed. Not thread-safe, just like the containers on it.
+	class ArenaResource : public std::pmr::monotonic_buffer_resource
+	{
+		ArenaResource(const ArenaResource&) = delete;
+		ArenaResource& operator=(const ArenaResource&) = delete;
+	public:
+		constexpr static std::size_t DEFAULT_CHUNK_SIZE = 4096;
+
+		explicit ArenaResource(std::size_t nChunkSize = DEFAULT_CHUNK_SIZE) noexcept(true);
+		virtual ~ArenaResource() noexcept(true) = default;
+	};
+}
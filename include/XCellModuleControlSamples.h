@@ -13,6 +13,7 @@
 // XCell
 #include "XCellModule.h"
 #include "XCellRelocator.h"
+#include "XCellMemoryResource.h"
 
 #include <unordered_map>
 #include <unordered_set>
@@ -26,8 +27,8 @@ namespace XCell
 		ID3D11Device* Device;
 		ID3D11DeviceContext* DeviceContext;
 		UInt64 _OldFunctions[6];
-		unordered_set<ID3D11SamplerState*> PassThroughSamplers;
-		unordered_map<ID3D11SamplerState*, ComPtr<ID3D11SamplerState>> MappedSamplers;
+		pmr::unordered_set<ID3D11SamplerState*> PassThroughSamplers;
+		pmr::unordered_map<ID3D11SamplerState*, ComPtr<ID3D11SamplerState>> MappedSamplers;
 	public:
 		static constexpr auto SourceName = "Module Control Samples";
 
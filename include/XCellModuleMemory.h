@@ -22,6 +22,8 @@ namespace XCell
 
 		ModuleMemory(const ModuleMemory&) = delete;
 		ModuleMemory& operator=(const ModuleMemory&) = delete;
+
+		virtual HRESULT Listener();
 	protected:
 		virtual HRESULT InstallImpl();
 		virtual HRESULT ShutdownImpl();
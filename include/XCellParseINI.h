@@ -10,6 +10,7 @@
 #include <memory>
 
 #include "XCellObject.h"
+#include "XCellMemoryResource.h"
 
 namespace XCell
 {
@@ -31,9 +32,10 @@ namespace XCell
 
 	class SectionINI : public Object
 	{
-		unordered_map<UInt32, shared_ptr<OptionINI>> _options;
+		pmr::unordered_map<UInt32, shared_ptr<OptionINI>> _options;
 	public:
-		SectionINI(const char* Name);
+		// Options and their nodes are allocated from Resource
+		SectionINI(const char* Name, pmr::memory_resource* Resource = PoolResource::GetSingletonPtr());
 
 		[[nodiscard]] virtual bool Contains(const char* Name) const noexcept(true);
 		virtual OptionINI& At(const char* Name) noexcept(true);
@@ -44,10 +46,10 @@ namespace XCell
 		inline OptionINI& operator[](const char* Name) noexcept(true) { return At(Name); }
 
 		/// need for STL
-		inline unordered_map<UInt32, shared_ptr<OptionINI>>::iterator begin() noexcept(true) { return _options.begin(); }
-		inline unordered_map<UInt32, shared_ptr<OptionINI>>::iterator end() noexcept(true) { return _options.end(); }
-		inline unordered_map<UInt32, shared_ptr<OptionINI>>::const_iterator cbegin() const noexcept(true) { return _options.cbegin(); }
-		inline unordered_map<UInt32, shared_ptr<OptionINI>>::const_iterator cend() const noexcept(true) { return _options.cend(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<OptionINI>>::iterator begin() noexcept(true) { return _options.begin(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<OptionINI>>::iterator end() noexcept(true) { return _options.end(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<OptionINI>>::const_iterator cbegin() const noexcept(true) { return _options.cbegin(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<OptionINI>>::const_iterator cend() const noexcept(true) { return _options.cend(); }
 
 		SectionINI(const SectionINI&) = delete;
 		SectionINI& operator=(const SectionINI&) = delete;
@@ -56,9 +58,11 @@ namespace XCell
 	class DataINI
 	{
 		bool _need_save;
-		unordered_map<UInt32, shared_ptr<SectionINI>> _items;
+		// Holds the sections, options and nodes of the maps, everything goes away with the data
+		ArenaResource _arena;
+		pmr::unordered_map<UInt32, shared_ptr<SectionINI>> _items;
 	public:
-		DataINI() = default;
+		DataINI();
 		virtual ~DataINI() = default;
 
 		virtual bool Contains(const char* Name) const noexcept(true);
@@ -72,10 +76,10 @@ namespace XCell
 		inline void SetChanged(bool Changed) noexcept(true) { _need_save = Changed; }
 
 		/// need for STL
-		inline unordered_map<UInt32, shared_ptr<SectionINI>>::iterator begin() noexcept(true) { return _items.begin(); }
-		inline unordered_map<UInt32, shared_ptr<SectionINI>>::iterator end() noexcept(true) { return _items.end(); }
-		inline unordered_map<UInt32, shared_ptr<SectionINI>>::const_iterator cbegin() const noexcept(true) { return _items.cbegin(); }
-		inline unordered_map<UInt32, shared_ptr<SectionINI>>::const_iterator cend() const noexcept(true) { return _items.cend(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<SectionINI>>::iterator begin() noexcept(true) { return _items.begin(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<SectionINI>>::iterator end() noexcept(true) { return _items.end(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<SectionINI>>::const_iterator cbegin() const noexcept(true) { return _items.cbegin(); }
+		inline pmr::unordered_map<UInt32, shared_ptr<SectionINI>>::const_iterator cend() const noexcept(true) { return _items.cend(); }
 
 		DataINI(const DataINI&) = delete;
 		DataINI& operator=(const DataINI&) = delete;
@@ -84,7 +88,7 @@ namespace XCell
 	class ParseINI : public DataINI
 	{
 		ICriticalSection _section;
-		unordered_map<UInt32, shared_ptr<SectionINI>> _items;
+		pmr::unordered_map<UInt32, shared_ptr<SectionINI>> _items;
 	public:
 		ParseINI();
 
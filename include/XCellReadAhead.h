@@ -0,0 +1,67 @@
+﻿// Copyright © 2024-2025 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/gpl-3.0.html
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+namespace XCell
+{
+	// Where a read-ahead buffer takes its bytes, a file handle of the system
+	class ReadAheadSource
+	{
+	public:
+		virtual ~ReadAheadSource() = default;
+
+		// Reads up to Size bytes at the file pointer, returns the number of bytes read, 0 at the end of the file, -1 on error
+		virtual int32_t Read(void* Buf, int32_t Size) = 0;
+		// Moves the file pointer to Position from the start of the file, a negative Position is an error
+		virtual bool SetPointer(int64_t Position) = 0;
+	};
+
+	// Read-ahead buffer of a file, the file is read in pieces of SIZE bytes, so small reads, seeks
+	// and the position inside the piece don't call the system. The file pointer of the system stays
+	// at the end of the piece. It knows nothing of handles, every call gets the source to read from.
+	class ReadAheadBuffer
+	{
+		std::unique_ptr<char[]> _buffer;
+		// Start of the piece in the file
+		int64_t _pos;
+		int32_t _size;
+		int32_t _offset;
+
+		int32_t Fill(ReadAheadSource& Source);
+	public:
+		typedef void(*ReadEvent)(void* Buf, int64_t Size);
+
+		constexpr static int32_t SIZE = 64 * 1024;
+
+		ReadAheadBuffer();
+
+		ReadAheadBuffer(const ReadAheadBuffer& Rhs) = delete;
+		ReadAheadBuffer& operator=(const ReadAheadBuffer& Rhs) = delete;
+
+		// Forgets the piece, the file pointer is at the start; the memory is kept only if Enable
+		void Reset(bool Enable);
+
+		// Appends the bytes up to the end of the line to Line, the '\n' is consumed but not appended.
+		// OnRead, if set, gets every piece of the line as it is consumed.
+		// Returns the number of bytes consumed, 0 at the end of the file, -1 on error.
+		int32_t ReadLine(ReadAheadSource& Source, std::string& Line, ReadEvent OnRead = nullptr);
+		// Returns the number of bytes read, -1 if nothing was read because of an error
+		int32_t Read(ReadAheadSource& Source, void* Buf, int32_t Size);
+		// Moves to Position from the start of the file, returns it or -1 on error
+		int64_t Seek(ReadAheadSource& Source, int64_t Position);
+		// Puts the file pointer where the reader stopped before a write
+		bool PrepareWrite(ReadAheadSource& Source);
+		// Moves the position past Size bytes written by the caller
+		inline void Advance(int64_t Size) noexcept { _pos += Size; }
+
+		[[nodiscard]] inline bool IsEnabled() const noexcept { return (bool)_buffer; }
+		[[nodiscard]] inline int64_t GetPosition() const noexcept { return _pos + _offset; }
+	};
+}
@@ -8,10 +8,12 @@
 #include <ICriticalSection.h>
 
 #include <unordered_map>
+#include <map>
 #include <memory>
 
 // XCell
 #include "XCellObject.h"
+#include "XCellMemoryResource.h"
 
 namespace XCell
 {
@@ -136,9 +138,11 @@ namespace XCell
 	{
 	protected:
 		ICriticalSection _lock;
-		std::map<UInt32, std::shared_ptr<Setting>> _collection;
+		// Settings are added once at startup and live as long as the collection
+		ArenaResource _arena;
+		std::pmr::map<UInt32, std::shared_ptr<Setting>> _collection;
 	public:
-		CollectionSettings() = default;
+		CollectionSettings() : _collection(&_arena) {}
 		virtual ~CollectionSettings() = default;
 
 		virtual bool Add(const std::shared_ptr<Setting>& Setting);
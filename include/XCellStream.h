@@ -6,6 +6,10 @@
 
 #include <ICriticalSection.h>
 
+#include <memory>
+
+#include "XCellReadAhead.h"
+
 namespace XCell
 {
 	enum StreamOffset
@@ -66,7 +70,19 @@ namespace XCell
 	{
 		void* _handle;
 		string _FileName;
+		// Read-ahead buffer over the handle. Only for cached files, unbuffered ones need aligned reads.
+		ReadAheadBuffer _readAhead;
+		// Size of a file opened for reading only, it can't change under us, otherwise -1
+		int64_t _size;
+
+		void OpenReadAhead(FileStreamMode Mode, bool Cache);
+	protected:
+		// Appends the bytes up to the end of the line to Line, the '\n' is consumed but not appended.
+		// Returns the number of bytes consumed, 0 at the end of the file, -1 on error.
+		int32_t ReadLine(std::string& Line) const;
 	public:
+		constexpr static int32_t READ_AHEAD_SIZE = ReadAheadBuffer::SIZE;
+
 		FileStream();
 		explicit FileStream(const char* FileName, FileStreamMode Mode, bool Cache = true);
 		explicit FileStream(const wchar_t* FileName, FileStreamMode Mode, bool Cache = true);
@@ -80,6 +96,8 @@ namespace XCell
 		virtual int32_t WriteBuf(const void* Buf, int32_t Size);
 		virtual int64_t Seek(int64_t Offset, StreamOffset Flag) const;
 
+		[[nodiscard]] virtual int64_t GetSize() const noexcept;
+
 		virtual bool Open(const char* FileName, FileStreamMode Mode, bool Cache = true);
 		virtual bool Open(const wchar_t* FileName, FileStreamMode Mode, bool Cache = true);
 		virtual bool Open(const string& FileName, FileStreamMode Mode, bool Cache = true);
@@ -26,6 +26,18 @@ namespace XCell
 
 	std::shared_ptr<Setting> CVarScaleformPageSize = std::make_shared<Setting>("uScaleformPageSize:Additional", (uint32_t)256ul);
 	std::shared_ptr<Setting> CVarScaleformHeapSize = std::make_shared<Setting>("uScaleformHeapSize:Additional", (uint32_t)512ul);
+	std::shared_ptr<Setting> CVarScaleformCommitAhead = std::make_shared<Setting>("uScaleformCommitAhead:Additional", (uint32_t)4ul);
+	std::shared_ptr<Setting> CVarScaleformDecommitDelay = std::make_shared<Setting>("uScaleformDecommitDelay:Additional", (uint32_t)5ul);
+	std::shared_ptr<Setting> CVarMemoryRefillPriority = std::make_shared<Setting>("iMemoryRefillPriority:Additional", (int32_t)0);
+	std::shared_ptr<Setting> CVarMemoryRefillAffinity = std::make_shared<Setting>("uMemoryRefillAffinity:Additional", (uint32_t)0ul);
+	std::shared_ptr<Setting> CVarMemoryRetainPages = std::make_shared<Setting>("uMemoryRetainPages:Additional", (uint32_t)2ul);
+	std::shared_ptr<Setting> CVarMemoryRetainSize = std::make_shared<Setting>("uMemoryRetainSize:Additional", (uint32_t)128ul);
+	std::shared_ptr<Setting> CVarMemoryRetainIdle = std::make_shared<Setting>("uMemoryRetainIdle:Additional", (uint32_t)3000ul);
+	std::shared_ptr<Setting> CVarMemoryStatsInterval = std::make_shared<Setting>("uMemoryStatsInterval:Additional", (uint32_t)0ul);
+	std::shared_ptr<Setting> CVarMemoryTraceSize = std::make_shared<Setting>("uMemoryTraceSize:Additional", (uint32_t)0ul);
+	std::shared_ptr<Setting> CVarMemoryProfileRate = std::make_shared<Setting>("uMemoryProfileRate:Additional", (uint32_t)0ul);
+	std::shared_ptr<Setting> CVarMemoryLargePages = std::make_shared<Setting>("uMemoryLargePages:Additional", (uint32_t)0ul);
+	std::shared_ptr<Setting> CVarMemoryTrimOnLoading = std::make_shared<Setting>("bMemoryTrimOnLoading:Additional", true);
 	std::shared_ptr<Setting> CVarUseNewRedistributable = std::make_shared<Setting>("bUseNewRedistributable:Additional", false);
 	std::shared_ptr<Setting> CVarOutputRTTI = std::make_shared<Setting>("bOutputRTTI:Additional", false);
 	std::shared_ptr<Setting> CVarUseIORandomAccess = std::make_shared<Setting>("bUseIORandomAccess:Additional", false);
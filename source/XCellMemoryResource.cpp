@@ -0,0 +1,47 @@
+﻿// Copyright © 2024-2025 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/gpl-3.0.html
+
+#include <Voltek.MemoryManager.h>
+
+#include "XCellMemoryResource.h"
+
+namespace XCell
+{
+	// PoolResource
+
+	PoolResource* PoolResource::GetSingletonPtr() noexcept(true)
+	{
+		// Global containers are created before anything else, the resource must be ready by then
+		static PoolResource Instance;
+		return &Instance;
+	}
+
+	void* PoolResource::do_allocate(std::size_t nBytes, std::size_t nAlignment)
+	{
+		if (auto lpBlock = voltek::scalable_aligned_alloc(nBytes, nAlignment); lpBlock)
+			return lpBlock;
+
+		// The memory manager isn't running (or is out of memory)
+		return std::pmr::new_delete_resource()->allocate(nBytes, nAlignment);
+	}
+
+	void PoolResource::do_deallocate(void* lpBlock, std::size_t nBytes, std::size_t nAlignment)
+	{
+		// A pointer the memory manager doesn't own is refused, it came from the CRT
+		if (!voltek::scalable_free(lpBlock))
+			std::pmr::new_delete_resource()->deallocate(lpBlock, nBytes, nAlignment);
+	}
+
+	bool PoolResource::do_is_equal(const std::pmr::memory_resource& Other) const noexcept(true)
+	{
+		// Every instance serves the same pools
+		return dynamic_cast<const PoolResource*>(&Other) != nullptr;
+	}
+
+	// ArenaResource
+
+	ArenaResource::ArenaResource(std::size_t nChunkSize) noexcept(true) :
+		std::pmr::monotonic_buffer_resource(nChunkSize, PoolResource::GetSingletonPtr())
+	{}
+}
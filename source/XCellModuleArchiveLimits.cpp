@@ -10,6 +10,7 @@
 #include "XCellPlugin.h"
 #include "XCellCVar.h"
 #include "XCellStringUtils.h"
+#include "XCellMemoryResource.h"
 
 #include <memory>
 #include <unordered_map>
@@ -165,7 +166,7 @@ namespace XCell
 			inline void Regen(const char* path) noexcept(true) { BSResource::ID::GenerateID_Orig(this, path); }
 		};
 
-		using Storage = std::unordered_map<ID, std::uint16_t, ID::Hash>;
+		using Storage = std::pmr::unordered_map<ID, std::uint16_t, ID::Hash>;
 
 		enum class StorageType : std::uint8_t
 		{
@@ -174,7 +175,11 @@ namespace XCell
 			kTotal
 		};
 
-		Storage Storages[static_cast<std::uint8_t>(StorageType::kTotal)];
+		Storage Storages[static_cast<std::uint8_t>(StorageType::kTotal)] =
+		{
+			Storage(PoolResource::GetSingletonPtr()),
+			Storage(PoolResource::GetSingletonPtr())
+		};
 		BSReadWriteLock StorageLocks[static_cast<std::uint8_t>(StorageType::kTotal)];
 
 		static void PushArchiveIndex(const ID& id, std::uint32_t archIdx, StorageType archType) noexcept(true)
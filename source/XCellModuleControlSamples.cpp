@@ -190,7 +190,8 @@ namespace XCell
 
 	ModuleControlSamples::ModuleControlSamples(void* Context) :
 		Module(Context, SourceName, XCELL_MODULE_QUERY_DIRECTX_INIT | XCELL_MODULE_QUERY_PAPYRUS_INIT),
-		Device(nullptr), DeviceContext(nullptr)
+		Device(nullptr), DeviceContext(nullptr), PassThroughSamplers(PoolResource::GetSingletonPtr()),
+		MappedSamplers(PoolResource::GetSingletonPtr())
 	{
 		gModuleControlSamples = this;
 		InitializeDirectXLinker.OnListener = (EventInitializeDirectXSourceLink::EventFunctionType)(&ModuleControlSamples::DXListener);
@@ -3,21 +3,31 @@
 // License: https://www.gnu.org/licenses/gpl-3.0.html
 
 #include <Voltek.MemoryManager.h>
+#include <Voltek.MemoryTrace.h>
+
+#include <f4se/GameMenus.h>
 
 #include "XCellTableID.h"
 #include "XCellModuleMemory.h"
 #include "XCellPlugin.h"
 #include "XCellCVar.h"
 #include "XCellAssertion.h"
+#include "XCellStringUtils.h"
+#include "XCellVersion.h"
 
 #include <xbyak/xbyak.h>
 #include <common/ISingleton.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
 #include <tuple>
 
 namespace XCell
 {
 	constexpr auto MEM_GB = 1073741824;
+	constexpr auto MEM_MB = 1048576;
 
 	namespace detail
 	{
@@ -62,13 +72,17 @@ namespace XCell
 			~ProxyHeap() noexcept(true) = default;
 
 			[[nodiscard]] void* malloc(std::size_t nSize) const noexcept(true);
+			[[nodiscard]] void* calloc(std::size_t nCount, std::size_t nSize) const noexcept(true);
 			[[nodiscard]] void* aligned_malloc(std::size_t nSize, std::size_t nAlignment) const noexcept(true);
+			void aligned_malloc_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize, std::size_t nAlignment) const noexcept(true);
 
 			[[nodiscard]] void* realloc(void* lpBlock, std::size_t nNewSize) const noexcept(true);
 			[[nodiscard]] void* aligned_realloc(void* lpBlock, std::size_t nNewSize, std::size_t nAlignment) const noexcept(true);
 
 			void free(void* lpBlock) const noexcept(true);
 			void aligned_free(void* lpBlock) const noexcept(true);
+			void aligned_free_sized(void* lpBlock, std::size_t nSize) const noexcept(true);
+			void aligned_free_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize) const noexcept(true);
 
 			[[nodiscard]] std::size_t msize(void* lpBlock) const noexcept(true);
 			[[nodiscard]] std::size_t aligned_msize(void* lpBlock, std::size_t nAlignment) const noexcept(true);
@@ -79,11 +93,22 @@ namespace XCell
 			return CheckPtr(::malloc(nSize), nSize);
 		}
 
+		void* ProxyHeap::calloc(std::size_t nCount, std::size_t nSize) const noexcept(true)
+		{
+			return CheckPtr(::calloc(nCount, nSize), nCount * nSize);
+		}
+
 		void* ProxyHeap::aligned_malloc(std::size_t nSize, std::size_t nAlignment) const noexcept(true)
 		{
 			return CheckPtr(_aligned_malloc(nSize, nAlignment), nSize);
 		}
 
+		void ProxyHeap::aligned_malloc_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize, std::size_t nAlignment) const noexcept(true)
+		{
+			for (std::size_t i = 0; i < nCount; i++)
+				lpBlocks[i] = aligned_malloc(nSize, nAlignment);
+		}
+
 		void* ProxyHeap::realloc(void* lpBlock, std::size_t nNewSize) const noexcept(true)
 		{
 			return CheckPtr(lpBlock ? ::realloc(lpBlock, nNewSize) : ::malloc(nNewSize), nNewSize);
@@ -106,6 +131,18 @@ namespace XCell
 				::_aligned_free(lpBlock);
 		}
 
+		void ProxyHeap::aligned_free_sized(void* lpBlock, std::size_t nSize) const noexcept(true)
+		{
+			UNREFERENCED_PARAMETER(nSize);
+			aligned_free(lpBlock);
+		}
+
+		void ProxyHeap::aligned_free_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize) const noexcept(true)
+		{
+			for (std::size_t i = 0; i < nCount; i++)
+				aligned_free_sized(lpBlocks[i], nSize);
+		}
+
 		std::size_t ProxyHeap::msize(void* lpBlock) const noexcept(true)
 		{
 			return lpBlock ? ::_msize(lpBlock) : 0;
@@ -129,13 +166,17 @@ namespace XCell
 			~ProxyVoltekHeap() noexcept(true) = default;
 
 			[[nodiscard]] void* malloc(std::size_t nSize) const noexcept(true);
+			[[nodiscard]] void* calloc(std::size_t nCount, std::size_t nSize) const noexcept(true);
 			[[nodiscard]] void* aligned_malloc(std::size_t nSize, std::size_t nAlignment) const noexcept(true);
+			void aligned_malloc_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize, std::size_t nAlignment) const noexcept(true);
 
 			[[nodiscard]] void* realloc(void* lpBlock, std::size_t nNewSize) const noexcept(true);
 			[[nodiscard]] void* aligned_realloc(void* lpBlock, std::size_t nNewSize, std::size_t nAlignment) const noexcept(true);
 
 			void free(void* lpBlock) const noexcept(true);
 			void aligned_free(void* lpBlock) const noexcept(true);
+			void aligned_free_sized(void* lpBlock, std::size_t nSize) const noexcept(true);
+			void aligned_free_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize) const noexcept(true);
 
 			[[nodiscard]] std::size_t msize(void* lpBlock) const noexcept(true);
 			[[nodiscard]] std::size_t aligned_msize(void* lpBlock, std::size_t nAlignment) const noexcept(true);
@@ -151,11 +192,23 @@ namespace XCell
 			return CheckPtr(voltek::scalable_alloc(nSize), nSize);
 		}
 
+		void* ProxyVoltekHeap::calloc(std::size_t nCount, std::size_t nSize) const noexcept(true)
+		{
+			// Large blocks fresh from the system are already zeroed, vmm doesn't touch them again
+			return CheckPtr(voltek::scalable_calloc(nCount, nSize), nCount * nSize);
+		}
+
 		void* ProxyVoltekHeap::aligned_malloc(std::size_t nSize, std::size_t nAlignment) const noexcept(true)
 		{
-			UNREFERENCED_PARAMETER(nAlignment);
+			return CheckPtr(voltek::scalable_aligned_alloc(nSize, nAlignment), nSize);
+		}
 
-			return CheckPtr(voltek::scalable_alloc(nSize), nSize);
+		void ProxyVoltekHeap::aligned_malloc_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize, std::size_t nAlignment) const noexcept(true)
+		{
+			// vmm blocks are always 16-byte aligned, so the whole run can come from one page
+			std::size_t nAllocated = (nAlignment <= 16) ? voltek::scalable_alloc_batch(lpBlocks, nCount, nSize) : 0;
+			for (; nAllocated < nCount; nAllocated++)
+				lpBlocks[nAllocated] = aligned_malloc(nSize, nAlignment);
 		}
 
 		void* ProxyVoltekHeap::realloc(void* lpBlock, std::size_t nNewSize) const noexcept(true)
@@ -165,9 +218,7 @@ namespace XCell
 
 		void* ProxyVoltekHeap::aligned_realloc(void* lpBlock, std::size_t nNewSize, std::size_t nAlignment) const noexcept(true)
 		{
-			UNREFERENCED_PARAMETER(nAlignment);
-
-			return CheckPtr(voltek::scalable_realloc(lpBlock, nNewSize), nNewSize);
+			return CheckPtr(voltek::scalable_aligned_realloc(lpBlock, nNewSize, nAlignment), nNewSize);
 		}
 
 		void ProxyVoltekHeap::free(void* lpBlock) const noexcept(true)
@@ -180,6 +231,16 @@ namespace XCell
 			voltek::scalable_free(lpBlock);
 		}
 
+		void ProxyVoltekHeap::aligned_free_sized(void* lpBlock, std::size_t nSize) const noexcept(true)
+		{
+			voltek::scalable_free_sized(lpBlock, nSize);
+		}
+
+		void ProxyVoltekHeap::aligned_free_batch(void** lpBlocks, std::size_t nCount, std::size_t nSize) const noexcept(true)
+		{
+			voltek::scalable_free_batch(lpBlocks, nCount, nSize);
+		}
+
 		std::size_t ProxyVoltekHeap::msize(void* lpBlock) const noexcept(true)
 		{
 			return voltek::scalable_msize(lpBlock);
@@ -190,39 +251,552 @@ namespace XCell
 			return voltek::scalable_msize(lpBlock);
 		}
 
+		// Optional recorder of every allocation that passes the hooks, for offline replay (see vmm tools).
+		// Each thread fills its own buffer without locks, a full buffer is pushed onto a lock-free list
+		// and a background thread writes it out. Buffers come straight from VirtualAlloc, so the recorder
+		// never calls back into the heap it is tracing. Records still sitting in the buffer of a live
+		// thread when the game exits are lost.
+		class MemoryTrace
+		{
+			MemoryTrace(const MemoryTrace&) = delete;
+			MemoryTrace(MemoryTrace&&) = delete;
+			MemoryTrace& operator=(const MemoryTrace&) = delete;
+			MemoryTrace& operator=(MemoryTrace&&) = delete;
+
+			MemoryTrace() = default;
+			~MemoryTrace() = default;
+
+			constexpr static std::size_t BUFFER_RECORDS = 16384;
+			constexpr static DWORD FLUSH_PERIOD = 250;
+
+			struct Buffer
+			{
+				Buffer* Next;
+				std::size_t Count;
+				voltek::memory_trace_record Records[BUFFER_RECORDS];
+			};
+
+			struct ThreadBuffer
+			{
+				Buffer* Current{ nullptr };
+				std::uint16_t Id{ 0 };
+
+				~ThreadBuffer() noexcept(true)
+				{
+					if (Current)
+					{
+						Submit(Current);
+						Current = nullptr;
+					}
+				}
+			};
+
+			inline static thread_local ThreadBuffer Local;
+			inline static std::atomic<Buffer*> Full{ nullptr };
+			inline static std::atomic<std::uint16_t> NextThreadId{ 0 };
+			inline static std::atomic<bool> Enabled{ false };
+			inline static HANDLE File{ INVALID_HANDLE_VALUE };
+			inline static std::uint64_t Limit{ 0 };
+			inline static std::uint64_t Written{ 0 };
+
+			static void Submit(Buffer* lpBuffer) noexcept(true)
+			{
+				// Many writers, the only reader takes the whole list at once, so there is no ABA
+				auto lpHead = Full.load(std::memory_order_relaxed);
+				do
+				{
+					lpBuffer->Next = lpHead;
+				} while (!Full.compare_exchange_weak(lpHead, lpBuffer, std::memory_order_release, std::memory_order_relaxed));
+			}
+
+			[[nodiscard]] static Buffer* Renew(ThreadBuffer& Thread) noexcept(true)
+			{
+				if (Thread.Current)
+				{
+					Submit(Thread.Current);
+					Thread.Current = nullptr;
+				}
+
+				if (!Thread.Id)
+					Thread.Id = NextThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
+
+				Thread.Current = (Buffer*)VirtualAlloc(nullptr, sizeof(Buffer), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+				return Thread.Current;
+			}
+
+			static void Record(std::uint8_t nKind, std::uint8_t nSource, const void* lpBlock, const void* lpPrev,
+				std::size_t nSize, std::size_t nAlignment) noexcept(true)
+			{
+				auto& Thread = Local;
+				auto lpBuffer = Thread.Current;
+				if (!lpBuffer || (lpBuffer->Count == BUFFER_RECORDS))
+				{
+					lpBuffer = Renew(Thread);
+					if (!lpBuffer)
+						return;
+				}
+
+				LARGE_INTEGER Time;
+				QueryPerformanceCounter(&Time);
+
+				auto& Entry = lpBuffer->Records[lpBuffer->Count++];
+				Entry.time = (std::uint64_t)Time.QuadPart;
+				Entry.block = (std::uint64_t)lpBlock;
+				Entry.prev = (std::uint64_t)lpPrev;
+				Entry.size = (std::uint32_t)std::min<std::size_t>(nSize, UINT32_MAX);
+				Entry.thread = Thread.Id;
+				Entry.op = voltek::make_memory_trace_op(nKind, nSource);
+				Entry.align_shift = nAlignment ? (std::uint8_t)std::countr_zero(nAlignment) : 0;
+			}
+
+			static DWORD WINAPI ThreadProc(LPVOID Parameter)
+			{
+				UNREFERENCED_PARAMETER(Parameter);
+
+				while (true)
+				{
+					Sleep(FLUSH_PERIOD);
+
+					auto lpBuffer = Full.exchange(nullptr, std::memory_order_acquire);
+					while (lpBuffer)
+					{
+						auto lpNext = lpBuffer->Next;
+
+						if (File != INVALID_HANDLE_VALUE)
+						{
+							DWORD nBytes = (DWORD)(lpBuffer->Count * sizeof(voltek::memory_trace_record)), nWritten = 0;
+							WriteFile(File, lpBuffer->Records, nBytes, &nWritten, nullptr);
+							Written += nWritten;
+
+							if (Written >= Limit)
+							{
+								Enabled.store(false, std::memory_order_relaxed);
+								CloseHandle(File);
+								File = INVALID_HANDLE_VALUE;
+
+								_MESSAGE("memory: trace is full (%llu records)", Written / sizeof(voltek::memory_trace_record));
+							}
+						}
+
+						VirtualFree(lpBuffer, 0, MEM_RELEASE);
+						lpBuffer = lpNext;
+					}
+				}
+
+				return 0;
+			}
+		public:
+			[[nodiscard]] inline static bool IsEnabled() noexcept(true)
+			{
+				return Enabled.load(std::memory_order_relaxed);
+			}
+
+			// The pointer is recorded once the block is ours
+			inline static void Alloc(std::uint8_t nSource, const void* lpBlock, std::size_t nSize, std::size_t nAlignment = 0) noexcept(true)
+			{
+				if (IsEnabled() && lpBlock)
+					Record(voltek::MEMORY_TRACE_ALLOC, nSource, lpBlock, nullptr, nSize, nAlignment);
+			}
+
+			// The pointer is recorded before the block is given back, another thread may get the same address right after
+			inline static void Free(std::uint8_t nSource, const void* lpBlock) noexcept(true)
+			{
+				if (IsEnabled() && lpBlock)
+					Record(voltek::MEMORY_TRACE_FREE, nSource, lpBlock, nullptr, 0, 0);
+			}
+
+			inline static void Realloc(std::uint8_t nSource, const void* lpBlock, const void* lpPrev, std::size_t nSize,
+				std::size_t nAlignment = 0) noexcept(true)
+			{
+				if (!IsEnabled())
+					return;
+
+				// A null result records nothing: vmm keeps the old block on a failed or zero-size realloc,
+				// so a free here would make the replay release a block that is still live. Backends that
+				// do free on zero size (CRT) leave the block live in the trace; the replayer counts the
+				// reuse of its address as a conflict instead of freeing twice.
+				if (lpBlock)
+					Record(voltek::MEMORY_TRACE_REALLOC, nSource, lpBlock, lpPrev, nSize, nAlignment);
+			}
+
+			// Starts recording into FileName until nLimit bytes of records are written
+			static bool Install(const char* FileName, std::uint64_t nLimit) noexcept(true)
+			{
+				if (!nLimit)
+					return false;
+
+				File = CreateFileA(FileName, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (File == INVALID_HANDLE_VALUE)
+				{
+					_MESSAGE("Failed to create a \"%s\" file for memory trace.", FileName);
+					return false;
+				}
+
+				LARGE_INTEGER Frequency;
+				QueryPerformanceFrequency(&Frequency);
+
+				voltek::memory_trace_header Header = {};
+				Header.magic = voltek::MEMORY_TRACE_MAGIC;
+				Header.version = voltek::MEMORY_TRACE_VERSION;
+				Header.record_size = sizeof(voltek::memory_trace_record);
+				Header.frequency = (std::uint64_t)Frequency.QuadPart;
+
+				DWORD nWritten = 0;
+				WriteFile(File, &Header, sizeof(Header), &nWritten, nullptr);
+
+				Limit = nLimit;
+				Written = 0;
+
+				HANDLE Thread = CreateThread(nullptr, 0, &ThreadProc, nullptr, 0, nullptr);
+				if (!Thread)
+				{
+					CloseHandle(File);
+					File = INVALID_HANDLE_VALUE;
+					return false;
+				}
+
+				CloseHandle(Thread);
+				Enabled.store(true, std::memory_order_relaxed);
+
+				_MESSAGE("memory: trace to \"%s\" (limit: %llu Mb)", FileName, nLimit / MEM_MB);
+				return true;
+			}
+		};
+
+		// Optional sampling profiler of the allocation hooks, answers "who allocates so much".
+		// Each thread counts allocated bytes down from a random interval (exponential, the mean is the
+		// sampling rate), only the allocation that crosses it is recorded, so a hook pays for a relaxed
+		// load when the profiler is off and a thread local subtraction when it is on. A sample is keyed by
+		// the return address of the hook and a few frames above it, the estimate of the bytes and calls
+		// behind it is unbiased for the size. A background thread rewrites a text summary with the busiest
+		// call sites as module+RVA. The table lives outside the heap and never shrinks, sites that don't
+		// fit are only counted.
+		class MemoryProfiler
+		{
+			MemoryProfiler(const MemoryProfiler&) = delete;
+			MemoryProfiler(MemoryProfiler&&) = delete;
+			MemoryProfiler& operator=(const MemoryProfiler&) = delete;
+			MemoryProfiler& operator=(MemoryProfiler&&) = delete;
+
+			MemoryProfiler() = default;
+			~MemoryProfiler() = default;
+
+			constexpr static std::size_t STACK_DEPTH = 4;
+			constexpr static std::size_t CAPTURE_DEPTH = 12;
+			constexpr static std::size_t TABLE_SIZE = 8192;
+			constexpr static std::size_t TABLE_LIMIT = TABLE_SIZE - (TABLE_SIZE / 4);
+			constexpr static std::size_t TOP_SITES = 64;
+			constexpr static DWORD DUMP_PERIOD = 10000;
+
+			struct Site
+			{
+				// Frames[0] is the return address of the hook, nullptr marks a free slot
+				const void* Frames[STACK_DEPTH];
+				std::uint64_t Source;
+				std::uint64_t Samples;
+				double Bytes;
+				double Count;
+			};
+
+			struct ThreadState
+			{
+				std::int64_t Countdown{ 0 };
+				std::uint64_t Seed{ 0 };
+			};
+
+			inline static thread_local ThreadState Local;
+			inline static std::atomic<bool> Enabled{ false };
+			inline static double Rate{ 0.0 };
+			inline static SRWLOCK Lock = SRWLOCK_INIT;
+			inline static Site* Sites{ nullptr };
+			inline static std::size_t Used{ 0 };
+			inline static std::uint64_t Dropped{ 0 };
+			inline static char FileName[MAX_PATH]{};
+
+			[[nodiscard]] static std::int64_t NextInterval(ThreadState& State) noexcept(true)
+			{
+				// xorshift64*, U lies in (0, 1]
+				State.Seed ^= State.Seed >> 12;
+				State.Seed ^= State.Seed << 25;
+				State.Seed ^= State.Seed >> 27;
+				auto U = (double)(((State.Seed * 0x2545F4914F6CDD1Dull) >> 11) + 1) * (1.0 / 9007199254740992.0);
+				return std::max<std::int64_t>(1, (std::int64_t)(-std::log(U) * Rate));
+			}
+
+			[[nodiscard]] static std::size_t Hash(const void* const* lpFrames, std::uint64_t nSource) noexcept(true)
+			{
+				std::uint64_t Value = nSource;
+				for (std::size_t i = 0; i < STACK_DEPTH; i++)
+					Value = (Value ^ (std::uint64_t)lpFrames[i]) * 0x9E3779B97F4A7C15ull;
+				return (std::size_t)(Value >> 32) & (TABLE_SIZE - 1);
+			}
+
+			static void Record(std::uint8_t nSource, const void* lpCaller, std::size_t nSize) noexcept(true)
+			{
+				const void* Frames[STACK_DEPTH] = { lpCaller };
+
+				// The frames of the hook itself are skipped by looking for its return address, inlining
+				// makes a fixed skip count unreliable
+				void* Captured[CAPTURE_DEPTH];
+				auto nCaptured = RtlCaptureStackBackTrace(0, CAPTURE_DEPTH, Captured, nullptr);
+				for (std::size_t i = 0; i < nCaptured; i++)
+				{
+					if (Captured[i] != lpCaller)
+						continue;
+
+					for (std::size_t j = 1; (j < STACK_DEPTH) && ((i + j) < nCaptured); j++)
+						Frames[j] = Captured[i + j];
+					break;
+				}
+
+				// An allocation of nSize bytes is sampled with the chance 1 - exp(-nSize / Rate)
+				auto Chance = 1.0 - std::exp(-(double)nSize / Rate);
+				auto Weight = (Chance > 0.0) ? 1.0 / Chance : 1.0;
+
+				AcquireSRWLockExclusive(&Lock);
+
+				for (auto Index = Hash(Frames, nSource);; Index = (Index + 1) & (TABLE_SIZE - 1))
+				{
+					auto& Entry = Sites[Index];
+					if (!Entry.Frames[0])
+					{
+						if (Used >= TABLE_LIMIT)
+						{
+							Dropped++;
+							break;
+						}
+
+						memcpy(Entry.Frames, Frames, sizeof(Frames));
+						Entry.Source = nSource;
+						Used++;
+					}
+					else if (memcmp(Entry.Frames, Frames, sizeof(Frames)) || (Entry.Source != nSource))
+						continue;
+
+					Entry.Samples++;
+					Entry.Bytes += (double)nSize * Weight;
+					Entry.Count += Weight;
+					break;
+				}
+
+				ReleaseSRWLockExclusive(&Lock);
+			}
+
+			static void Sample(std::uint8_t nSource, const void* lpCaller, std::size_t nSize) noexcept(true)
+			{
+				auto& State = Local;
+				State.Countdown -= (std::int64_t)nSize;
+				if (State.Countdown > 0)
+					return;
+
+				if (!State.Seed)
+				{
+					// The first allocation of a thread only starts the countdown
+					State.Seed = ((std::uint64_t)GetCurrentThreadId() << 32) ^ __rdtsc() ^ (std::uint64_t)&State;
+					State.Seed |= 1;
+					State.Countdown = NextInterval(State) - (std::int64_t)nSize;
+					if (State.Countdown > 0)
+						return;
+				}
+
+				do
+				{
+					State.Countdown += NextInterval(State);
+				} while (State.Countdown <= 0);
+
+				Record(nSource, lpCaller, nSize);
+			}
+
+			static int FormatAddress(char* lpBuffer, std::size_t nBufferSize, const void* lpAddress) noexcept(true)
+			{
+				HMODULE Module = nullptr;
+				char ModuleName[MAX_PATH];
+
+				if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+						(LPCSTR)lpAddress, &Module) && GetModuleFileNameA(Module, ModuleName, MAX_PATH))
+				{
+					auto lpName = strrchr(ModuleName, '\\');
+					return _snprintf_s(lpBuffer, nBufferSize, _TRUNCATE, "%s+0x%llX", lpName ? lpName + 1 : ModuleName,
+						(std::uint64_t)lpAddress - (std::uint64_t)Module);
+				}
+
+				return _snprintf_s(lpBuffer, nBufferSize, _TRUNCATE, "0x%llX", (std::uint64_t)lpAddress);
+			}
+
+			static void Dump(const Site* lpSnapshot, const double* lpLastBytes, std::uint32_t* lpOrder, std::size_t nUsed,
+				std::uint64_t nDropped, double Seconds) noexcept(true)
+			{
+				HANDLE File = CreateFileA(FileName, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (File == INVALID_HANDLE_VALUE)
+					return;
+
+				std::size_t nSites = 0;
+				for (std::uint32_t i = 0; i < TABLE_SIZE; i++)
+					if (lpSnapshot[i].Frames[0])
+						lpOrder[nSites++] = i;
+
+				// The busiest sites since the last dump go first, storms stand out over the long-running totals
+				std::sort(lpOrder, lpOrder + nSites, [lpSnapshot, lpLastBytes](std::uint32_t a, std::uint32_t b) {
+					auto RecentA = lpSnapshot[a].Bytes - lpLastBytes[a];
+					auto RecentB = lpSnapshot[b].Bytes - lpLastBytes[b];
+					return (RecentA != RecentB) ? RecentA > RecentB : lpSnapshot[a].Bytes > lpSnapshot[b].Bytes;
+				});
+
+				char Line[1024];
+				DWORD nWritten = 0;
+				auto nLength = _snprintf_s(Line, sizeof(Line), _TRUNCATE,
+					"memory profile: sampling every %.0f Kb, %zu call sites, %llu samples lost to a full table\n"
+					"    recent Kb/s      total Mb        allocs  source  call site <- callers\n",
+					Rate / 1024.0, nUsed, nDropped);
+				WriteFile(File, Line, (DWORD)std::max(0, nLength), &nWritten, nullptr);
+
+				for (std::size_t i = 0; i < std::min(nSites, TOP_SITES); i++)
+				{
+					auto& Entry = lpSnapshot[lpOrder[i]];
+					nLength = _snprintf_s(Line, sizeof(Line), _TRUNCATE, "%15.1f %13.1f %13.0f  %-6s  ",
+						(Entry.Bytes - lpLastBytes[lpOrder[i]]) / 1024.0 / Seconds, Entry.Bytes / MEM_MB, Entry.Count,
+						(Entry.Source == voltek::MEMORY_TRACE_SOURCE_GAME) ? "game" : "crt");
+
+					for (std::size_t j = 0; (j < STACK_DEPTH) && Entry.Frames[j] && (nLength >= 0); j++)
+					{
+						if (j)
+						{
+							auto nArrow = _snprintf_s(Line + nLength, sizeof(Line) - nLength, _TRUNCATE, " <- ");
+							if (nArrow < 0)
+								break;
+							nLength += nArrow;
+						}
+
+						auto nFrame = FormatAddress(Line + nLength, sizeof(Line) - nLength, Entry.Frames[j]);
+						if (nFrame < 0)
+							break;
+						nLength += nFrame;
+					}
+
+					nLength = (int)strnlen(Line, sizeof(Line) - 2);
+					Line[nLength++] = '\n';
+					WriteFile(File, Line, (DWORD)nLength, &nWritten, nullptr);
+				}
+
+				CloseHandle(File);
+			}
+
+			static DWORD WINAPI ThreadProc(LPVOID Parameter)
+			{
+				UNREFERENCED_PARAMETER(Parameter);
+
+				// Working copies come straight from VirtualAlloc, like the table
+				auto lpSnapshot = (Site*)VirtualAlloc(nullptr, sizeof(Site) * TABLE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+				auto lpLastBytes = (double*)VirtualAlloc(nullptr, sizeof(double) * TABLE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+				auto lpOrder = (std::uint32_t*)VirtualAlloc(nullptr, sizeof(std::uint32_t) * TABLE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+				if (!lpSnapshot || !lpLastBytes || !lpOrder)
+					return 0;
+
+				while (true)
+				{
+					Sleep(DUMP_PERIOD);
+
+					AcquireSRWLockShared(&Lock);
+					memcpy(lpSnapshot, Sites, sizeof(Site) * TABLE_SIZE);
+					auto nUsed = Used;
+					auto nDropped = Dropped;
+					ReleaseSRWLockShared(&Lock);
+
+					// Slots never move, so the previous totals are found by index
+					Dump(lpSnapshot, lpLastBytes, lpOrder, nUsed, nDropped, DUMP_PERIOD / 1000.0);
+
+					for (std::size_t i = 0; i < TABLE_SIZE; i++)
+						lpLastBytes[i] = lpSnapshot[i].Bytes;
+				}
+
+				return 0;
+			}
+		public:
+			[[nodiscard]] inline static bool IsEnabled() noexcept(true)
+			{
+				return Enabled.load(std::memory_order_relaxed);
+			}
+
+			// lpCaller is the return address of the hook (_ReturnAddress()), the code that asked for memory
+			inline static void Alloc(std::uint8_t nSource, const void* lpCaller, const void* lpBlock, std::size_t nSize) noexcept(true)
+			{
+				if (IsEnabled() && lpBlock)
+					Sample(nSource, lpCaller, nSize);
+			}
+
+			// Samples one allocation every nRate bytes on average and writes the summary into lpFileName
+			static bool Install(const char* lpFileName, std::size_t nRate) noexcept(true)
+			{
+				if (!nRate)
+					return false;
+
+				Sites = (Site*)VirtualAlloc(nullptr, sizeof(Site) * TABLE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+				if (!Sites)
+					return false;
+
+				strcpy_s(FileName, lpFileName);
+				Rate = (double)nRate;
+
+				HANDLE Thread = CreateThread(nullptr, 0, &ThreadProc, nullptr, 0, nullptr);
+				if (!Thread)
+				{
+					VirtualFree(Sites, 0, MEM_RELEASE);
+					Sites = nullptr;
+					return false;
+				}
+
+				CloseHandle(Thread);
+				Enabled.store(true, std::memory_order_relaxed);
+
+				_MESSAGE("memory: profile to \"%s\" (sampling every %llu Kb)", lpFileName, (std::uint64_t)nRate / 1024);
+				return true;
+			}
+		};
+
 		template<typename Heap = detail::ProxyHeap>
 		struct StdStuff
 		{
 			[[nodiscard]] static void* calloc(std::size_t nCount, std::size_t nSize) noexcept(true)
 			{
-				auto totalSize = nCount * nSize;
-				auto ptr = Heap::GetSingletonPtr()->malloc(totalSize);
-				if (ptr) memset(ptr, 0, totalSize);
+				auto ptr = Heap::GetSingletonPtr()->calloc(nCount, nSize);
+				MemoryTrace::Alloc(voltek::MEMORY_TRACE_SOURCE_CRT, ptr, nCount * nSize);
+				MemoryProfiler::Alloc(voltek::MEMORY_TRACE_SOURCE_CRT, _ReturnAddress(), ptr, nCount * nSize);
 				return ptr;
 			}
 
 			[[nodiscard]] static void* malloc(std::size_t nSize) noexcept(true)
 			{
-				return Heap::GetSingletonPtr()->malloc(nSize);
+				auto ptr = Heap::GetSingletonPtr()->malloc(nSize);
+				MemoryTrace::Alloc(voltek::MEMORY_TRACE_SOURCE_CRT, ptr, nSize);
+				MemoryProfiler::Alloc(voltek::MEMORY_TRACE_SOURCE_CRT, _ReturnAddress(), ptr, nSize);
+				return ptr;
 			}
 
 			[[nodiscard]] static void* aligned_malloc(std::size_t nSize, size_t alignment) noexcept(true)
 			{
-				return Heap::GetSingletonPtr()->aligned_malloc(nSize, alignment);
+				auto ptr = Heap::GetSingletonPtr()->aligned_malloc(nSize, alignment);
+				MemoryTrace::Alloc(voltek::MEMORY_TRACE_SOURCE_CRT, ptr, nSize, alignment);
+				MemoryProfiler::Alloc(voltek::MEMORY_TRACE_SOURCE_CRT, _ReturnAddress(), ptr, nSize);
+				return ptr;
 			}
 
 			[[nodiscard]] static void* realloc(void* lpBlock, std::size_t nNewSize) noexcept(true)
 			{
-				return Heap::GetSingletonPtr()->realloc(lpBlock, nNewSize);
+				auto ptr = Heap::GetSingletonPtr()->realloc(lpBlock, nNewSize);
+				MemoryTrace::Realloc(voltek::MEMORY_TRACE_SOURCE_CRT, ptr, lpBlock, nNewSize);
+				MemoryProfiler::Alloc(voltek::MEMORY_TRACE_SOURCE_CRT, _ReturnAddress(), ptr, nNewSize);
+				return ptr;
 			}
 
 			static void free(void* block) noexcept(true)
 			{
+				MemoryTrace::Free(voltek::MEMORY_TRACE_SOURCE_CRT, block);
 				Heap::GetSingletonPtr()->free(block);
 			}
 
 			static void aligned_free(void* block) noexcept(true)
 			{
+				MemoryTrace::Free(voltek::MEMORY_TRACE_SOURCE_CRT, block);
 				Heap::GetSingletonPtr()->aligned_free(block);
 			}
 
@@ -231,6 +805,216 @@ namespace XCell
 				return Heap::GetSingletonPtr()->msize(block);
 			}
 		};
+
+		// Per-thread bump/stack arena behind the ScrapHeap hooks.
+		// Scratch memory is carved from chunks by moving a top pointer, a free only marks the
+		// block, and the top falls back over every marked block at the end of the chunk, so
+		// LIFO frees are O(1) and out-of-order frees are reclaimed once the blocks above them go.
+		// Requests too large for a chunk are served by the general heap behind the same header,
+		// so a free tells the two apart and finds the chunk without any search.
+		template<typename Heap = detail::ProxyHeap>
+		class ScrapArena
+		{
+			ScrapArena(const ScrapArena&) = delete;
+			ScrapArena(ScrapArena&&) = delete;
+			ScrapArena& operator=(const ScrapArena&) = delete;
+			ScrapArena& operator=(ScrapArena&&) = delete;
+
+			constexpr static std::size_t CHUNK_SIZE = 256 * 1024;
+			constexpr static std::size_t LARGE_SIZE = CHUNK_SIZE / 4;
+
+			struct Chunk
+			{
+				Chunk* Prev;
+				char* Top;
+				char* End;
+				// Offset of the topmost block's data, 0 if the chunk is empty
+				std::uint32_t Last;
+				// Live blocks plus one reference of the owner thread, the last one out frees the chunk
+				std::atomic<std::uint32_t> Refs;
+			};
+
+			struct alignas(16) BlockHeader
+			{
+				// Set by the freeing thread (release), read by the owner in Collapse (acquire)
+				std::atomic<std::uint32_t> Freed;
+				// Offset of the data from its chunk, 0 for a block of the general heap
+				std::uint32_t Offset;
+				// Offset of the top before this block was carved,
+				// for a block of the general heap the distance back to the start of its memory
+				std::uint32_t Start;
+				// Offset of the previous block's data, 0 if it is the first one
+				std::uint32_t Prev;
+			};
+
+			static_assert(sizeof(BlockHeader) == 16);
+
+			constexpr static std::size_t CHUNK_HEADER_SIZE = (sizeof(Chunk) + 15) & ~(std::size_t)15;
+
+			[[nodiscard]] inline static BlockHeader* GetHeader(const void* lpBlock) noexcept(true)
+			{
+				return (BlockHeader*)((char*)lpBlock - sizeof(BlockHeader));
+			}
+
+			// Drops a reference, the chunk goes back to the heap with the last one
+			static void Unref(Chunk* lpChunk) noexcept(true)
+			{
+				if (lpChunk->Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					Heap::GetSingletonPtr()->aligned_free(lpChunk);
+			}
+
+			// The header sits in the alignment slack in front of the data
+			[[nodiscard]] static void* AllocateLarge(std::size_t nSize, std::size_t nAlignment) noexcept(true)
+			{
+				auto lpMemory = (char*)Heap::GetSingletonPtr()->aligned_malloc(nSize + nAlignment, nAlignment);
+				if (!lpMemory)
+					return nullptr;
+
+				auto lpData = lpMemory + nAlignment;
+				auto lpHeader = GetHeader(lpData);
+				new (&lpHeader->Freed) std::atomic<std::uint32_t>(0);
+				lpHeader->Offset = 0;
+				lpHeader->Start = (std::uint32_t)nAlignment;
+				lpHeader->Prev = 0;
+				return lpData;
+			}
+
+			[[nodiscard]] Chunk* NewChunk() noexcept(true)
+			{
+				Chunk* lpChunk = m_Spare;
+				if (lpChunk)
+					m_Spare = nullptr;
+				else
+				{
+					lpChunk = (Chunk*)Heap::GetSingletonPtr()->aligned_malloc(CHUNK_SIZE, 16);
+					if (!lpChunk)
+						return nullptr;
+
+					lpChunk->End = (char*)lpChunk + CHUNK_SIZE;
+					new (&lpChunk->Refs) std::atomic<std::uint32_t>(1);
+				}
+
+				lpChunk->Prev = m_Current;
+				lpChunk->Top = (char*)lpChunk + CHUNK_HEADER_SIZE;
+				lpChunk->Last = 0;
+				return lpChunk;
+			}
+
+			// Moves the top down over the freed blocks at the end of the current chunk.
+			// An emptied chunk is kept as a spare, so the arena resets to its first chunk
+			// once the outermost scratch scope is gone.
+			void Collapse() noexcept(true)
+			{
+				while (m_Current)
+				{
+					while (m_Current->Last)
+					{
+						auto lpHeader = GetHeader((char*)m_Current + m_Current->Last);
+						if (!lpHeader->Freed.load(std::memory_order_acquire))
+							return;
+
+						m_Current->Top = (char*)m_Current + lpHeader->Start;
+						m_Current->Last = lpHeader->Prev;
+					}
+
+					if (!m_Current->Prev)
+						return;
+
+					auto lpEmpty = m_Current;
+					m_Current = lpEmpty->Prev;
+
+					if (m_Spare)
+						Unref(m_Spare);
+					m_Spare = lpEmpty;
+				}
+			}
+		public:
+			ScrapArena() noexcept(true) = default;
+
+			// Runs on thread detach. A chunk whose blocks are all freed goes back to the heap
+			// right away, one still holding blocks of other threads goes with its last free.
+			~ScrapArena() noexcept(true)
+			{
+				while (m_Current)
+				{
+					auto lpChunk = m_Current;
+					m_Current = lpChunk->Prev;
+					Unref(lpChunk);
+				}
+
+				if (m_Spare)
+				{
+					Unref(m_Spare);
+					m_Spare = nullptr;
+				}
+			}
+
+			[[nodiscard]] void* Allocate(std::size_t nSize, std::size_t nAlignment) noexcept(true)
+			{
+				if (nAlignment < 16)
+					nAlignment = 16;
+
+				if ((nSize > LARGE_SIZE) || (nAlignment > LARGE_SIZE))
+					return AllocateLarge(nSize, nAlignment);
+
+				for (;;)
+				{
+					if (m_Current)
+					{
+						char* lpStart = m_Current->Top;
+						char* lpData = (char*)(((std::uintptr_t)lpStart + sizeof(BlockHeader) + nAlignment - 1) &
+							~((std::uintptr_t)nAlignment - 1));
+						char* lpEnd = lpData + ((nSize + 15) & ~(std::size_t)15);
+
+						if (lpEnd <= m_Current->End)
+						{
+							auto lpHeader = GetHeader(lpData);
+							new (&lpHeader->Freed) std::atomic<std::uint32_t>(0);
+							lpHeader->Offset = (std::uint32_t)(lpData - (char*)m_Current);
+							lpHeader->Start = (std::uint32_t)(lpStart - (char*)m_Current);
+							lpHeader->Prev = m_Current->Last;
+
+							m_Current->Last = lpHeader->Offset;
+							m_Current->Top = lpEnd;
+							m_Current->Refs.fetch_add(1, std::memory_order_relaxed);
+							return lpData;
+						}
+					}
+
+					auto lpChunk = NewChunk();
+					if (!lpChunk)
+						return AllocateLarge(nSize, nAlignment);
+
+					m_Current = lpChunk;
+				}
+			}
+
+			void Deallocate(void* lpBlock) noexcept(true)
+			{
+				// Every block handed out has a header, it names the chunk or the general heap
+				auto lpHeader = GetHeader(lpBlock);
+				if (!lpHeader->Offset)
+				{
+					Heap::GetSingletonPtr()->aligned_free((char*)lpBlock - lpHeader->Start);
+					return;
+				}
+
+				auto lpChunk = (Chunk*)((char*)lpBlock - lpHeader->Offset);
+				lpHeader->Freed.store(1, std::memory_order_release);
+
+				// A block of an older chunk or of another thread is reclaimed when its owner's top gets there
+				if (lpChunk == m_Current)
+				{
+					lpChunk->Refs.fetch_sub(1, std::memory_order_relaxed);
+					Collapse();
+				}
+				else
+					Unref(lpChunk);
+			}
+		private:
+			Chunk* m_Current{ nullptr };
+			Chunk* m_Spare{ nullptr };
+		};
 	}
 
 	template<typename Heap = detail::ProxyHeap>
@@ -243,19 +1027,28 @@ namespace XCell
 
 		MemoryManager() = default;
 		~MemoryManager() = default;
-	public:
-		inline static const std::uint64_t EMPTY_POINTER{ 0 };
 
-		[[nodiscard]] static void* Alloc(MemoryManager* lpSelf, std::size_t nSize, std::uint32_t nAlignment, bool bAligned) noexcept(true)
+		// lpCaller goes to the profiler, Realloc of an empty block is an allocation by whoever called Realloc
+		[[nodiscard]] static void* AllocFrom(const void* lpCaller, std::size_t nSize, std::uint32_t nAlignment, bool bAligned) noexcept(true)
 		{
-			UNREFERENCED_PARAMETER(lpSelf);
-
 			if (!nSize)
 				return (void*)(&EMPTY_POINTER);
 
-			return bAligned ? 
+			auto lpBlock = bAligned ? 
 				Heap::GetSingletonPtr()->aligned_malloc(nSize, nAlignment) :
 				Heap::GetSingletonPtr()->malloc(nSize);
+			detail::MemoryTrace::Alloc(voltek::MEMORY_TRACE_SOURCE_GAME, lpBlock, nSize, bAligned ? nAlignment : 0);
+			detail::MemoryProfiler::Alloc(voltek::MEMORY_TRACE_SOURCE_GAME, lpCaller, lpBlock, nSize);
+			return lpBlock;
+		}
+	public:
+		inline static const std::uint64_t EMPTY_POINTER{ 0 };
+
+		[[nodiscard]] static void* Alloc(MemoryManager* lpSelf, std::size_t nSize, std::uint32_t nAlignment, bool bAligned) noexcept(true)
+		{
+			UNREFERENCED_PARAMETER(lpSelf);
+
+			return AllocFrom(_ReturnAddress(), nSize, nAlignment, bAligned);
 		}
 
 		[[nodiscard]] static void* Realloc(MemoryManager* lpSelf, void* lpBlock, std::size_t nSize, std::uint32_t nAlignment, bool bAligned) noexcept(true)
@@ -263,11 +1056,14 @@ namespace XCell
 			UNREFERENCED_PARAMETER(lpSelf);
 
 			if (lpBlock == (const void*)(&EMPTY_POINTER))
-				return Alloc(lpSelf, nSize, nAlignment, bAligned);
+				return AllocFrom(_ReturnAddress(), nSize, nAlignment, bAligned);
 
-			return bAligned ?
+			auto lpNewBlock = bAligned ?
 				Heap::GetSingletonPtr()->aligned_realloc(lpBlock, nSize, nAlignment) :
 				Heap::GetSingletonPtr()->realloc(lpBlock, nSize);
+			detail::MemoryTrace::Realloc(voltek::MEMORY_TRACE_SOURCE_GAME, lpNewBlock, lpBlock, nSize, bAligned ? nAlignment : 0);
+			detail::MemoryProfiler::Alloc(voltek::MEMORY_TRACE_SOURCE_GAME, _ReturnAddress(), lpNewBlock, nSize);
+			return lpNewBlock;
 		}
 
 		static void Dealloc(MemoryManager* lpSelf, void* lpBlock, bool bAligned) noexcept(true)
@@ -277,6 +1073,8 @@ namespace XCell
 			if (lpBlock == (const void*)(&EMPTY_POINTER))
 				return;
 
+			detail::MemoryTrace::Free(voltek::MEMORY_TRACE_SOURCE_GAME, lpBlock);
+
 			if (bAligned)
 				Heap::GetSingletonPtr()->aligned_free(lpBlock);		
 			else
@@ -414,6 +1212,9 @@ namespace XCell
 		ScrapHeap() = default;
 		~ScrapHeap() = default;
 
+		// Every thread scratches in its own arena, so the game's scrap traffic never reaches the heap pools
+		inline static thread_local detail::ScrapArena<Heap> Arena;
+
 		static void WriteStubs()
 		{
 			// Remove stuff
@@ -449,17 +1250,20 @@ namespace XCell
 			if (!nSize)
 				return (void*)(&EMPTY_POINTER);
 
-			return Heap::GetSingletonPtr()->aligned_malloc(nSize, nAlignment);
+			auto lpBlock = Arena.Allocate(nSize, nAlignment);
+			detail::MemoryTrace::Alloc(voltek::MEMORY_TRACE_SOURCE_SCRAP, lpBlock, nSize, nAlignment);
+			return lpBlock;
 		}
 
 		inline static void Deallocate(ScrapHeap* lpSelf, void* lpBlock) noexcept(true)
 		{
 			UNREFERENCED_PARAMETER(lpSelf);
 
-			if (lpBlock == (const void*)(&EMPTY_POINTER))
+			if (!lpBlock || (lpBlock == (const void*)(&EMPTY_POINTER)))
 				return;
 
-			Heap::GetSingletonPtr()->aligned_free(lpBlock);
+			detail::MemoryTrace::Free(voltek::MEMORY_TRACE_SOURCE_SCRAP, lpBlock);
+			Arena.Deallocate(lpBlock);
 		}
 
 		static void Install()
@@ -495,7 +1299,8 @@ namespace XCell
 
 		virtual void blockFree(void* p, std::size_t numBytes)
 		{
-			Heap::GetSingletonPtr()->aligned_free(p);
+			// Havok always passes the size it allocated, so the block goes straight back to its size class
+			Heap::GetSingletonPtr()->aligned_free_sized(p, numBytes);
 		}
 
 		[[nodiscard]] virtual void* bufAlloc(std::size_t& reqNumBytesInOut)
@@ -518,14 +1323,12 @@ namespace XCell
 
 		virtual void blockAllocBatch(void** ptrsOut, std::size_t numPtrs, std::size_t blockSize)
 		{
-			for (long i = 0; i < numPtrs; i++)
-				ptrsOut[i] = blockAlloc(blockSize);
+			Heap::GetSingletonPtr()->aligned_malloc_batch(ptrsOut, numPtrs, blockSize, 16);
 		}
 
 		virtual void blockFreeBatch(void** ptrsIn, std::size_t numPtrs, std::size_t blockSize)
 		{
-			for (long i = 0; i < numPtrs; i++)
-				blockFree(ptrsIn[i], blockSize);
+			Heap::GetSingletonPtr()->aligned_free_batch(ptrsIn, numPtrs, blockSize);
 		}
 
 		virtual void getMemoryStatistics(class MemoryStatistics& u)
@@ -577,9 +1380,105 @@ namespace XCell
 
 	class BSScaleformSysMemMapper
 	{
+		// Pages of one reserved heap, a freed page stays committed until it has been idle long enough
+		struct Region
+		{
+			std::uintptr_t Base;
+			std::size_t Pages;
+			std::uint8_t* State;
+			DWORD* FreeTime;
+		};
+
+		constexpr static std::uint8_t STATE_COMMITTED = 1 << 0;
+		constexpr static std::uint8_t STATE_USED = 1 << 1;
+		// Never written since the commit, no need to clear it
+		constexpr static std::uint8_t STATE_ZERO = 1 << 2;
+		constexpr static std::size_t REGIONS_MAX = 4;
+		constexpr static DWORD SWEEP_PERIOD = 1000;
+
+		inline static Region Regions[REGIONS_MAX];
+		inline static SRWLOCK Lock = SRWLOCK_INIT;
+		inline static HANDLE LowMemory = nullptr;
+		inline static DWORD LastSweep = 0;
+		inline static std::size_t IdlePages = 0;
+
+		[[nodiscard]] static Region* Find(std::uintptr_t Address, std::size_t Size) noexcept(true)
+		{
+			for (auto& R : Regions)
+			{
+				if (!R.Base || (Address < R.Base))
+					continue;
+
+				auto Offset = Address - R.Base;
+				if ((Offset + Size) > (R.Pages * PAGE_SIZE))
+					continue;
+
+				// Requests not made of whole pages go straight to the system
+				return ((Offset % PAGE_SIZE) || (Size % PAGE_SIZE)) ? nullptr : &R;
+			}
+
+			return nullptr;
+		}
+
+		static void Decommit(Region& R, std::size_t First, std::size_t Count) noexcept(true)
+		{
+			VirtualFree((LPVOID)(R.Base + First * PAGE_SIZE), (SIZE_T)Count * PAGE_SIZE, MEM_DECOMMIT);
+			Stats.Decommits.fetch_add(1, std::memory_order_relaxed);
+
+			for (std::size_t i = First; i < (First + Count); i++)
+				R.State[i] = 0;
+			IdlePages -= Count;
+		}
+
+		// Decommits idle pages in runs, so that neighbouring pages cost one call
+		static void Sweep(DWORD Now, bool Force) noexcept(true)
+		{
+			if (!IdlePages || (!Force && ((Now - LastSweep) < SWEEP_PERIOD)))
+				return;
+
+			LastSweep = Now;
+
+			BOOL Low = FALSE;
+			if (!Force && LowMemory && QueryMemoryResourceNotification(LowMemory, &Low) && Low)
+				Force = true;
+
+			for (auto& R : Regions)
+			{
+				std::size_t Run = 0;
+				for (std::size_t i = 0; i <= R.Pages; i++)
+				{
+					if ((i < R.Pages) && ((R.State[i] & (STATE_COMMITTED | STATE_USED)) == STATE_COMMITTED) &&
+						(Force || ((Now - R.FreeTime[i]) >= DECOMMIT_DELAY)))
+					{
+						Run++;
+						continue;
+					}
+
+					if (Run)
+					{
+						Decommit(R, i - Run, Run);
+						Run = 0;
+					}
+				}
+			}
+		}
 	public:
 		inline static UInt32 PAGE_SIZE;
 		inline static UInt32 HEAP_SIZE;
+		// Pages committed ahead of a request
+		inline static UInt32 COMMIT_AHEAD;
+		// How long (in ms) a freed page stays committed
+		inline static UInt32 DECOMMIT_DELAY;
+
+		struct Counters
+		{
+			std::atomic<std::uint64_t> Allocs;
+			std::atomic<std::uint64_t> Frees;
+			std::atomic<std::uint64_t> Commits;
+			std::atomic<std::uint64_t> Decommits;
+		};
+
+		inline static Counters Stats;
 
 		static uint32_t get_page_size(BSScaleformSysMemMapper* _this)
 		{
@@ -588,28 +1487,297 @@ namespace XCell
 
 		static void* init(BSScaleformSysMemMapper* _this, size_t size)
 		{
-			return VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE);
+			auto Address = VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE);
+			if (!Address)
+				return nullptr;
+
+			AcquireSRWLockExclusive(&Lock);
+
+			// Without a free slot the heap works with the system directly
+			for (auto& R : Regions)
+			{
+				if (R.Base)
+					continue;
+
+				std::size_t Pages = size / PAGE_SIZE;
+				auto Meta = (std::uint8_t*)VirtualAlloc(NULL, (SIZE_T)Pages * (sizeof(DWORD) + 1), MEM_RESERVE | MEM_COMMIT,
+					PAGE_READWRITE);
+				if (Meta)
+				{
+					R.FreeTime = (DWORD*)Meta;
+					R.State = Meta + Pages * sizeof(DWORD);
+					R.Pages = Pages;
+					R.Base = (std::uintptr_t)Address;
+				}
+
+				break;
+			}
+
+			ReleaseSRWLockExclusive(&Lock);
+			return Address;
 		}
 
 		static bool release(BSScaleformSysMemMapper* _this, void* address)
 		{
+			AcquireSRWLockExclusive(&Lock);
+
+			for (auto& R : Regions)
+			{
+				if (R.Base != (std::uintptr_t)address)
+					continue;
+
+				for (std::size_t i = 0; i < R.Pages; i++)
+					if ((R.State[i] & (STATE_COMMITTED | STATE_USED)) == STATE_COMMITTED)
+						IdlePages--;
+
+				VirtualFree((LPVOID)R.FreeTime, 0, MEM_RELEASE);
+				R = {};
+				break;
+			}
+
+			ReleaseSRWLockExclusive(&Lock);
+
 			return VirtualFree((LPVOID)address, (SIZE_T)HEAP_SIZE, MEM_RELEASE);
 		}
 
 		static void* alloc(BSScaleformSysMemMapper* _this, void* address, size_t size)
 		{
-			return VirtualAlloc((LPVOID)address, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE);
+			Stats.Allocs.fetch_add(1, std::memory_order_relaxed);
+			AcquireSRWLockExclusive(&Lock);
+
+			auto R = Find((std::uintptr_t)address, size);
+			if (!R)
+			{
+				ReleaseSRWLockExclusive(&Lock);
+				Stats.Commits.fetch_add(1, std::memory_order_relaxed);
+				return VirtualAlloc((LPVOID)address, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE);
+			}
+
+			auto Now = GetTickCount();
+			std::size_t First = ((std::uintptr_t)address - R->Base) / PAGE_SIZE;
+			std::size_t Count = size / PAGE_SIZE;
+
+			bool NeedCommit = false;
+			for (std::size_t i = First; i < (First + Count); i++)
+				if (!(R->State[i] & STATE_COMMITTED))
+					NeedCommit = true;
+
+			if (NeedCommit)
+			{
+				// The pages right after the request are likely the next ones to be asked for
+				std::size_t End = First + Count;
+				while (((End - First - Count) < COMMIT_AHEAD) && (End < R->Pages) && !(R->State[End] & STATE_COMMITTED))
+					End++;
+
+				if (!VirtualAlloc((LPVOID)address, (SIZE_T)(End - First) * PAGE_SIZE, MEM_COMMIT, PAGE_READWRITE))
+				{
+					End = First + Count;
+					if (!VirtualAlloc((LPVOID)address, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE))
+					{
+						ReleaseSRWLockExclusive(&Lock);
+						return nullptr;
+					}
+				}
+
+				Stats.Commits.fetch_add(1, std::memory_order_relaxed);
+
+				for (std::size_t i = First + Count; i < End; i++)
+				{
+					R->State[i] = STATE_COMMITTED | STATE_ZERO;
+					R->FreeTime[i] = Now;
+				}
+				IdlePages += End - First - Count;
+			}
+
+			for (std::size_t i = First; i < (First + Count); i++)
+			{
+				// The reused page must look like a fresh commit
+				if ((R->State[i] & (STATE_COMMITTED | STATE_ZERO)) == STATE_COMMITTED)
+					memset((void*)(R->Base + i * PAGE_SIZE), 0, PAGE_SIZE);
+
+				if (R->State[i] & STATE_COMMITTED)
+					IdlePages--;
+
+				R->State[i] = STATE_COMMITTED | STATE_USED;
+			}
+
+			Sweep(Now, false);
+			ReleaseSRWLockExclusive(&Lock);
+			return address;
 		}
 
 		static bool free(BSScaleformSysMemMapper* _this, void* address, size_t size)
 		{
-			return VirtualFree((LPVOID)address, (SIZE_T)size, MEM_DECOMMIT);
+			Stats.Frees.fetch_add(1, std::memory_order_relaxed);
+			AcquireSRWLockExclusive(&Lock);
+
+			auto R = Find((std::uintptr_t)address, size);
+			if (!R || !DECOMMIT_DELAY)
+			{
+				if (R)
+				{
+					for (std::size_t i = ((std::uintptr_t)address - R->Base) / PAGE_SIZE, n = i + size / PAGE_SIZE; i < n; i++)
+						R->State[i] = 0;
+				}
+
+				ReleaseSRWLockExclusive(&Lock);
+				Stats.Decommits.fetch_add(1, std::memory_order_relaxed);
+				return VirtualFree((LPVOID)address, (SIZE_T)size, MEM_DECOMMIT);
+			}
+
+			auto Now = GetTickCount();
+			std::size_t First = ((std::uintptr_t)address - R->Base) / PAGE_SIZE;
+			std::size_t Count = size / PAGE_SIZE;
+
+			for (std::size_t i = First; i < (First + Count); i++)
+			{
+				R->State[i] = STATE_COMMITTED;
+				R->FreeTime[i] = Now;
+			}
+			IdlePages += Count;
+
+			Sweep(Now, false);
+			ReleaseSRWLockExclusive(&Lock);
+			return true;
+		}
+
+		// Decommits all idle pages at once
+		static void Trim() noexcept(true)
+		{
+			AcquireSRWLockExclusive(&Lock);
+			Sweep(GetTickCount(), true);
+			ReleaseSRWLockExclusive(&Lock);
+		}
+
+		static void Install(UInt32 CommitAhead, UInt32 DecommitDelay) noexcept(true)
+		{
+			// Without the delay pages are decommitted at once as vanilla does, pages committed ahead
+			// would stay committed while idle, so there is no commit-ahead either
+			COMMIT_AHEAD = DecommitDelay ? CommitAhead : 0;
+			DECOMMIT_DELAY = DecommitDelay * 1000;
+
+			if (DECOMMIT_DELAY)
+				LowMemory = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+		}
+	};
+
+	class MemoryStatsLog
+	{
+		inline static voltek::scalable_stats Last;
+		inline static voltek::scalable_stats Current;
+
+		static double HitRate(const voltek::scalable_class_stats& Now, const voltek::scalable_class_stats& Before)
+		{
+			auto Hits = Now.cache_hits - Before.cache_hits;
+			auto Misses = Now.cache_misses - Before.cache_misses;
+			return (Hits + Misses) ? (100.0 * Hits) / (Hits + Misses) : 100.0;
+		}
+
+		static void Write(UInt32 Interval)
+		{
+			auto& Now = Current.total;
+			auto& Before = Last.total;
+
+			_MESSAGE("memory: alloc %llu/s, free %llu/s, live %llu, hit %.1f%%, refill %llu/s, committed %.1f Mb, large %.1f Mb, large pages %.1f Mb",
+				(Now.allocs - Before.allocs) / Interval, (Now.frees - Before.frees) / Interval, Now.live_blocks,
+				HitRate(Now, Before), (Now.refills - Before.refills) / Interval,
+				(double)Now.committed_bytes / MEM_MB, (double)Current.large_bytes / MEM_MB,
+				(double)Current.large_page_bytes / MEM_MB);
+
+			// Only the size classes that hold memory or were used since the last line
+			for (std::size_t i = 0; i < voltek::SCALABLE_STATS_CLASSES; i++)
+			{
+				auto& Class = Current.classes[i];
+				auto& ClassBefore = Last.classes[i];
+
+				if (!Class.committed_pages && (Class.allocs == ClassBefore.allocs))
+					continue;
+
+				_MESSAGE("memory: [%llu] alloc %llu/s, live %llu, hit %.1f%%, refill %llu/s, pages %llu (%.1f Mb)",
+					Class.block_size, (Class.allocs - ClassBefore.allocs) / Interval, Class.live_blocks,
+					HitRate(Class, ClassBefore), (Class.refills - ClassBefore.refills) / Interval,
+					Class.committed_pages, (double)Class.committed_bytes / MEM_MB);
+			}
+
+			auto& Mapper = BSScaleformSysMemMapper::Stats;
+			auto Calls = Mapper.Allocs.load(std::memory_order_relaxed) + Mapper.Frees.load(std::memory_order_relaxed);
+			auto SysCalls = Mapper.Commits.load(std::memory_order_relaxed) + Mapper.Decommits.load(std::memory_order_relaxed);
+			_MESSAGE("memory: scaleform alloc %llu, free %llu, commit calls %llu, decommit calls %llu, saved %llu",
+				Mapper.Allocs.load(std::memory_order_relaxed), Mapper.Frees.load(std::memory_order_relaxed),
+				Mapper.Commits.load(std::memory_order_relaxed), Mapper.Decommits.load(std::memory_order_relaxed),
+				(Calls > SysCalls) ? Calls - SysCalls : 0);
+		}
+
+		static DWORD WINAPI ThreadProc(LPVOID Parameter)
+		{
+			auto Interval = (UInt32)(std::uintptr_t)Parameter;
+			voltek::scalable_get_stats(&Last);
+
+			while (true)
+			{
+				Sleep(Interval * 1000);
+
+				if (!voltek::scalable_get_stats(&Current))
+					continue;
+
+				Write(Interval);
+				Last = Current;
+			}
+
+			return 0;
+		}
+	public:
+		// Writes the vmm counters to the log every Interval seconds, a size class of 0 bytes is the large blocks
+		static void Install(UInt32 Interval)
+		{
+			if (!Interval)
+				return;
+
+			HANDLE Thread = CreateThread(nullptr, 0, &ThreadProc, (LPVOID)(std::uintptr_t)Interval, 0, nullptr);
+			if (Thread)
+				CloseHandle(Thread);
+		}
+	};
+
+	class MemoryTrimOnLoading : public BSTEventSink<MenuOpenCloseEvent>
+	{
+	public:
+		virtual EventResult ReceiveEvent(MenuOpenCloseEvent* Event, void* Dispatcher)
+		{
+			// The frame time doesn't matter behind a loading screen, and the new cell hasn't been loaded yet
+			if (Event && Event->isOpen && !_stricmp(Event->menuName.c_str(), "LoadingMenu"))
+			{
+				auto Released = voltek::scalable_trim(0);
+				BSScaleformSysMemMapper::Trim();
+				_MESSAGE("memory: loading screen, %.1f Mb returned to the system", (double)Released / MEM_MB);
+			}
+
+			return kEvent_Continue;
+		}
+
+		static void Install()
+		{
+			static MemoryTrimOnLoading Sink;
+
+			auto UI = *g_ui.GetPtr();
+			if (UI) UI->menuOpenCloseEventSource.AddEventSink(&Sink);
 		}
 	};
 
 	ModuleMemory::ModuleMemory(void* Context) :
-		Module(Context, SourceName, CVarMemory)
-	{}
+		Module(Context, SourceName, CVarMemory, XCELL_MODULE_QUERY_GAME_LOADED)
+	{
+		GameLoadedLinker.OnListener = (EventGameLoadedSourceLink::EventFunctionType)(&ModuleMemory::Listener);
+	}
+
+	HRESULT ModuleMemory::Listener()
+	{
+		// The UI exists only once the game has loaded
+		if (CVarMemoryTrimOnLoading->GetBool())
+			MemoryTrimOnLoading::Install();
+
+		return S_OK;
+	}
 
 	HRESULT ModuleMemory::InstallImpl()
 	{
@@ -630,6 +1798,22 @@ namespace XCell
 
 		// Init vmm
 		detail::ProxyVoltekHeap heap;
+		if (auto LargePages = CVarMemoryLargePages->GetUnsignedInt(); LargePages)
+		{
+			if (voltek::scalable_memory_manager_set_large_pages((std::size_t)LargePages * MEM_MB))
+				_MESSAGE("memory: small blocks on large pages, %u Mb", LargePages);
+			else
+				_MESSAGE("memory: large pages are unavailable (no SeLockMemoryPrivilege or not enough free large pages), small blocks stay on normal pages");
+		}
+		voltek::scalable_memory_manager_set_refill_thread(CVarMemoryRefillPriority->GetSignedInt(),
+			CVarMemoryRefillAffinity->GetUnsignedInt());
+		voltek::scalable_memory_manager_set_page_retention(CVarMemoryRetainPages->GetUnsignedInt(),
+			(std::size_t)CVarMemoryRetainSize->GetUnsignedInt() * 1024 * 1024, CVarMemoryRetainIdle->GetUnsignedInt());
+		MemoryStatsLog::Install(CVarMemoryStatsInterval->GetUnsignedInt());
+		detail::MemoryTrace::Install((Utils::GetApplicationPath() + "Data\\F4SE\\Plugins\\" MODNAME "-memory.trace").c_str(),
+			(std::uint64_t)CVarMemoryTraceSize->GetUnsignedInt() * MEM_MB);
+		detail::MemoryProfiler::Install((Utils::GetApplicationPath() + "Data\\F4SE\\Plugins\\" MODNAME "-memory-profile.txt").c_str(),
+			(std::size_t)CVarMemoryProfileRate->GetUnsignedInt() * 1024);
 
 		REL::Impl::DetourIAT(base, "API-MS-WIN-CRT-HEAP-L1-1-0.DLL", "realloc", (UInt64)&detail::StdStuff<detail::ProxyVoltekHeap>::realloc);
 		REL::Impl::DetourIAT(base, "API-MS-WIN-CRT-HEAP-L1-1-0.DLL", "calloc", (UInt64)&detail::StdStuff<detail::ProxyVoltekHeap>::calloc);
@@ -701,8 +1885,11 @@ namespace XCell
 		BSScaleformSysMemMapper::HEAP_SIZE = std::min(BSScaleformSysMemMapper::HEAP_SIZE, (UInt32)2 * 1024);
 		BSScaleformSysMemMapper::HEAP_SIZE = (BSScaleformSysMemMapper::HEAP_SIZE + 7) & ~7;
 
-		_MESSAGE("BSScaleformSysMemMapper (Page: %u Kb, Heap: %u Mb)",
-			BSScaleformSysMemMapper::PAGE_SIZE, BSScaleformSysMemMapper::HEAP_SIZE);
+		BSScaleformSysMemMapper::Install(CVarScaleformCommitAhead->GetUnsignedInt(), CVarScaleformDecommitDelay->GetUnsignedInt());
+
+		_MESSAGE("BSScaleformSysMemMapper (Page: %u Kb, Heap: %u Mb, Commit ahead: %u, Decommit delay: %u s)",
+			BSScaleformSysMemMapper::PAGE_SIZE, BSScaleformSysMemMapper::HEAP_SIZE, BSScaleformSysMemMapper::COMMIT_AHEAD,
+			BSScaleformSysMemMapper::DECOMMIT_DELAY / 1000);
 
 		BSScaleformSysMemMapper::PAGE_SIZE *= 1024;
 		BSScaleformSysMemMapper::HEAP_SIZE *= 1024 * 1024;
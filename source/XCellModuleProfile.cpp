@@ -8,6 +8,7 @@
 #include "XCellPlugin.h"
 #include "XCellCVar.h"
 #include "XCellParseINI.h"
+#include "XCellMemoryResource.h"
 #include "XCellStringUtils.h"
 
 #include <memory>
@@ -16,7 +17,7 @@
 
 namespace XCell
 {
-	std::map<UInt64, shared_ptr<ParseINI>> _cache_inifiles;
+	std::pmr::map<UInt64, shared_ptr<ParseINI>> _cache_inifiles(PoolResource::GetSingletonPtr());
 
 	static bool __stdcall GetINIFromCache(ParseINI** Data, LPCSTR FileName)
 	{
@@ -48,8 +48,8 @@ namespace XCell
 
 	// SectionINI
 
-	SectionINI::SectionINI(const char* Name) :
-		Object(Name)
+	SectionINI::SectionINI(const char* Name, pmr::memory_resource* Resource) :
+		Object(Name), _options(Resource)
 	{}
 
 	bool SectionINI::Contains(const char* Name) const noexcept(true)
@@ -63,7 +63,8 @@ namespace XCell
 		auto it = _options.find(hash);
 		if (it == _options.end())
 		{
-			auto pair = make_pair(hash, make_shared<OptionINI>(Name, ""));
+			auto pair = make_pair(hash, allocate_shared<OptionINI>(
+				pmr::polymorphic_allocator<OptionINI>(_options.get_allocator().resource()), Name, ""));
 			_options.insert(pair);
 			return *pair.second;
 		}
@@ -84,6 +85,10 @@ namespace XCell
 
 	// DataINI
 
+	DataINI::DataINI() :
+		_items(&_arena)
+	{}
+
 	bool DataINI::Contains(const char* Name) const noexcept(true)
 	{
 		return _items.find(Object(Name).NameHash) != _items.end();
@@ -95,7 +100,7 @@ namespace XCell
 		auto it = _items.find(hash);
 		if (it == _items.end())
 		{
-			auto pair = make_pair(hash, make_shared<SectionINI>(Name));
+			auto pair = make_pair(hash, allocate_shared<SectionINI>(pmr::polymorphic_allocator<SectionINI>(&_arena), Name, &_arena));
 			_items.insert(pair);
 			return *pair.second;
 		}
@@ -105,7 +110,7 @@ namespace XCell
 	// ParseINI
 
 	ParseINI::ParseINI() :
-		DataINI()
+		DataINI(), _items(PoolResource::GetSingletonPtr())
 	{}
 
 	bool ParseINI::Parse(const char* FileName)
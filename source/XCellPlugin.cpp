@@ -149,6 +149,18 @@ namespace XCell
 		// Additional
 		_settings.Add(CVarScaleformPageSize);
 		_settings.Add(CVarScaleformHeapSize);
+		_settings.Add(CVarScaleformCommitAhead);
+		_settings.Add(CVarScaleformDecommitDelay);
+		_settings.Add(CVarMemoryRefillPriority);
+		_settings.Add(CVarMemoryRefillAffinity);
+		_settings.Add(CVarMemoryRetainPages);
+		_settings.Add(CVarMemoryRetainSize);
+		_settings.Add(CVarMemoryRetainIdle);
+		_settings.Add(CVarMemoryStatsInterval);
+		_settings.Add(CVarMemoryTraceSize);
+		_settings.Add(CVarMemoryProfileRate);
+		_settings.Add(CVarMemoryLargePages);
+		_settings.Add(CVarMemoryTrimOnLoading);
 		_settings.Add(CVarUseNewRedistributable);
 		_settings.Add(CVarOutputRTTI);
 		_settings.Add(CVarUseIORandomAccess);
@@ -163,6 +175,12 @@ namespace XCell
 			return E_FAIL;
 
 		CVarDisplayScale->SetFloat(max(0.5f, min(1.0f, CVarDisplayScale->GetFloat())));
+		CVarMemoryRefillPriority->SetSignedInt(max(THREAD_PRIORITY_LOWEST, min(THREAD_PRIORITY_HIGHEST, CVarMemoryRefillPriority->GetSignedInt())));
+		CVarMemoryRetainPages->SetUnsignedInt(min(16u, CVarMemoryRetainPages->GetUnsignedInt()));
+		CVarMemoryRetainSize->SetUnsignedInt(min(4096u, CVarMemoryRetainSize->GetUnsignedInt()));
+		CVarMemoryLargePages->SetUnsignedInt(min(1024u, CVarMemoryLargePages->GetUnsignedInt()));
+		CVarScaleformCommitAhead->SetUnsignedInt(min(64u, CVarScaleformCommitAhead->GetUnsignedInt()));
+		CVarScaleformDecommitDelay->SetUnsignedInt(min(600u, CVarScaleformDecommitDelay->GetUnsignedInt()));
 
 		return S_OK;
 	}
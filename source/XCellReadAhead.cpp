@@ -0,0 +1,148 @@
+﻿// Copyright © 2024-2025 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/gpl-3.0.html
+
+#include <string.h>
+
+#include "XCellReadAhead.h"
+
+namespace XCell
+{
+	ReadAheadBuffer::ReadAheadBuffer() :
+		_pos(0), _size(0), _offset(0)
+	{}
+
+	void ReadAheadBuffer::Reset(bool Enable)
+	{
+		_pos = 0;
+		_size = 0;
+		_offset = 0;
+
+		if (!Enable)
+			_buffer.reset();
+		else if (!_buffer)
+			_buffer = std::make_unique<char[]>(SIZE);
+	}
+
+	int32_t ReadAheadBuffer::Fill(ReadAheadSource& Source)
+	{
+		// The file pointer is at the end of the old piece, the new one starts there
+		_pos += _size;
+		_size = 0;
+		_offset = 0;
+
+		auto readbytes = Source.Read(_buffer.get(), SIZE);
+		if (readbytes < 0)
+			return -1;
+
+		_size = readbytes;
+		return readbytes;
+	}
+
+	int32_t ReadAheadBuffer::ReadLine(ReadAheadSource& Source, std::string& Line, ReadEvent OnRead)
+	{
+		int32_t consumed = 0;
+
+		while (true)
+		{
+			if (_offset == _size)
+			{
+				auto ReadBytes = Fill(Source);
+				if (ReadBytes <= 0)
+					return consumed ? consumed : ReadBytes;
+			}
+
+			auto lpStart = _buffer.get() + _offset;
+			auto Available = _size - _offset;
+			auto lpEnd = (const char*)memchr(lpStart, '\n', Available);
+			auto Length = lpEnd ? (int32_t)(lpEnd - lpStart) : Available;
+			auto Step = lpEnd ? Length + 1 : Length;
+
+			Line.append(lpStart, (size_t)Length);
+			if (OnRead)
+				OnRead(lpStart, Step);
+
+			_offset += Step;
+			consumed += Step;
+
+			if (lpEnd)
+				return consumed;
+		}
+	}
+
+	int32_t ReadAheadBuffer::Read(ReadAheadSource& Source, void* Buf, int32_t Size)
+	{
+		int32_t readbytes = 0;
+
+		while (readbytes < Size)
+		{
+			if (_offset == _size)
+			{
+				if ((Size - readbytes) >= SIZE)
+				{
+					// Large reads go straight into the caller's memory
+					_pos += _size;
+					_size = 0;
+					_offset = 0;
+
+					auto directbytes = Source.Read((char*)Buf + readbytes, Size - readbytes);
+					if (directbytes < 0)
+						return readbytes ? readbytes : -1;
+
+					_pos += directbytes;
+					readbytes += directbytes;
+					break;
+				}
+
+				auto fillbytes = Fill(Source);
+				if (fillbytes < 0)
+					return readbytes ? readbytes : -1;
+
+				if (!fillbytes)
+					break;
+			}
+
+			auto copybytes = ((Size - readbytes) < (_size - _offset)) ? Size - readbytes : _size - _offset;
+			memcpy((char*)Buf + readbytes, _buffer.get() + _offset, copybytes);
+			_offset += copybytes;
+			readbytes += copybytes;
+		}
+
+		return readbytes;
+	}
+
+	int64_t ReadAheadBuffer::Seek(ReadAheadSource& Source, int64_t Position)
+	{
+		// Inside the piece only the position moves
+		if ((Position >= _pos) && (Position <= (_pos + _size)))
+		{
+			_offset = (int32_t)(Position - _pos);
+			return Position;
+		}
+
+		if (!Source.SetPointer(Position))
+			return -1;
+
+		_pos = Position;
+		_size = 0;
+		_offset = 0;
+
+		return Position;
+	}
+
+	bool ReadAheadBuffer::PrepareWrite(ReadAheadSource& Source)
+	{
+		if (!_size)
+			return true;
+
+		// The write goes where the reader stopped, not at the end of the piece
+		if ((_offset != _size) && !Source.SetPointer(_pos + _offset))
+			return false;
+
+		_pos += _offset;
+		_size = 0;
+		_offset = 0;
+
+		return true;
+	}
+}
@@ -109,24 +109,61 @@ namespace XCell
 
 	// FileStream
 
+	// Read-ahead source over the Win32 handle of the stream, a failed call aborts the stream
+	class FileReadAheadSource : public ReadAheadSource
+	{
+		HANDLE _handle;
+		CustomStream* _stream;
+	public:
+		FileReadAheadSource(void* Handle, const CustomStream* Stream) :
+			_handle((HANDLE)Handle), _stream(const_cast<CustomStream*>(Stream))
+		{}
+
+		virtual int32_t Read(void* Buf, int32_t Size)
+		{
+			int32_t readbytes = 0;
+			if (!ReadFile(_handle, Buf, Size, (LPDWORD)&readbytes, nullptr))
+			{
+				_stream->Abort();
+				return -1;
+			}
+
+			return readbytes;
+		}
+
+		virtual bool SetPointer(int64_t Position)
+		{
+			LARGE_INTEGER li{};
+			li.QuadPart = (LONGLONG)Position;
+
+			if ((Position < 0) || !SetFilePointerEx(_handle, li, nullptr, FILE_BEGIN))
+			{
+				_stream->Abort();
+				return false;
+			}
+
+			return true;
+		}
+	};
+
 	FileStream::FileStream() :
-		_handle(INVALID_HANDLE_VALUE)
+		_handle(INVALID_HANDLE_VALUE), _size(-1)
 	{}
 
 	FileStream::FileStream(const char* FileName, FileStreamMode Mode, bool Cache) :
-		_handle(INVALID_HANDLE_VALUE)
+		_handle(INVALID_HANDLE_VALUE), _size(-1)
 	{
 		Open(FileName, Mode, Cache);
 	}
 
 	FileStream::FileStream(const wchar_t* FileName, FileStreamMode Mode, bool Cache) :
-		_handle(INVALID_HANDLE_VALUE)
+		_handle(INVALID_HANDLE_VALUE), _size(-1)
 	{
 		Open(FileName, Mode, Cache);
 	}
 
 	FileStream::FileStream(const string& FileName, FileStreamMode Mode, bool Cache) :
-		_handle(INVALID_HANDLE_VALUE)
+		_handle(INVALID_HANDLE_VALUE), _size(-1)
 	{
 		Open(FileName.c_str(), Mode, Cache);
 	}
@@ -136,17 +173,81 @@ namespace XCell
 		Close();
 	}
 
+	void FileStream::OpenReadAhead(FileStreamMode Mode, bool Cache)
+	{
+		_size = -1;
+
+		if (Mode == FileStreamMode::kStreamOpenRead)
+		{
+			LARGE_INTEGER li{};
+			if (GetFileSizeEx((HANDLE)_handle, &li))
+				_size = (int64_t)li.QuadPart;
+		}
+
+		_readAhead.Reset(Cache);
+	}
+
+	int32_t FileStream::ReadLine(std::string& Line) const
+	{
+		IScopedCriticalSection Locker(&((const_cast<FileStream*>(this))->_lock));
+
+		int32_t consumed = 0;
+
+		if (!_readAhead.IsEnabled())
+		{
+			// No read-ahead, read a piece and step back behind the end of the line
+			constexpr static int32_t MAX = 256;
+			char szBuf[MAX];
+
+			do
+			{
+				auto ReadBytes = ReadBuf(szBuf, MAX);
+				if (ReadBytes <= 0)
+					return consumed ? consumed : ReadBytes;
+
+				auto lpEnd = (const char*)memchr(szBuf, '\n', ReadBytes);
+				auto Length = lpEnd ? (int32_t)(lpEnd - szBuf) : ReadBytes;
+				Line.append(szBuf, (size_t)Length);
+
+				if (lpEnd)
+				{
+					Seek((int64_t)(Length + 1) - ReadBytes, StreamOffset::kStreamCurrent);
+					return consumed + Length + 1;
+				}
+
+				consumed += ReadBytes;
+			} while (!Eof());
+
+			return consumed;
+		}
+
+		FileReadAheadSource Source(_handle, this);
+		return const_cast<FileStream*>(this)->_readAhead.ReadLine(Source, Line, OnReadBuf);
+	}
+
 	int32_t FileStream::ReadBuf(void* Buf, int32_t Size) const
 	{
 		IScopedCriticalSection Locker(&((const_cast<FileStream*>(this))->_lock));
 
 		int32_t readbytes = 0;
-		if (!ReadFile((HANDLE)_handle, Buf, Size, (LPDWORD)&readbytes, nullptr))
+
+		if (!_readAhead.IsEnabled())
 		{
-			const_cast<FileStream*>(this)->Abort();
-			return -1;
+			if (!ReadFile((HANDLE)_handle, Buf, Size, (LPDWORD)&readbytes, nullptr))
+			{
+				const_cast<FileStream*>(this)->Abort();
+				return -1;
+			}
+
+			DoReadBuf(Buf, readbytes);
+			return readbytes;
 		}
 
+		FileReadAheadSource Source(_handle, this);
+		readbytes = const_cast<FileStream*>(this)->_readAhead.Read(Source, Buf, Size);
+		if (readbytes < 0)
+			return -1;
+
 		DoReadBuf(Buf, readbytes);
 		return readbytes;
 	}
@@ -155,6 +256,10 @@ namespace XCell
 	{
 		IScopedCriticalSection Locker(&_lock);
 
+		FileReadAheadSource Source(_handle, this);
+		if (!_readAhead.PrepareWrite(Source))
+			return -1;
+
 		int32_t writebytes = 0;
 		if (!WriteFile((HANDLE)_handle, Buf, Size, (LPDWORD)&writebytes, nullptr))
 		{
@@ -162,6 +267,8 @@ namespace XCell
 			return -1;
 		}
 
+		_readAhead.Advance(writebytes);
+
 		DoWriteBuf(Buf, writebytes);
 		return writebytes;
 	}
@@ -170,6 +277,18 @@ namespace XCell
 	{
 		IScopedCriticalSection Locker(&((const_cast<FileStream*>(this))->_lock));
 
+		if (_readAhead.IsEnabled())
+		{
+			int64_t target = Offset;
+			if (Flag == StreamOffset::kStreamCurrent)
+				target += _readAhead.GetPosition();
+			else if (Flag == StreamOffset::kStreamEnd)
+				target += GetSize();
+
+			FileReadAheadSource Source(_handle, this);
+			return const_cast<FileStream*>(this)->_readAhead.Seek(Source, target);
+		}
+
 		int64_t pos = 0;
 		LARGE_INTEGER li{};
 		li.QuadPart = (LONGLONG)Offset;
@@ -183,6 +302,18 @@ namespace XCell
 		return pos;
 	}
 
+	int64_t FileStream::GetSize() const noexcept
+	{
+		if (_size >= 0)
+			return _size;
+
+		LARGE_INTEGER li{};
+		if (!GetFileSizeEx((HANDLE)_handle, &li))
+			return -1;
+
+		return (int64_t)li.QuadPart;
+	}
+
 	bool FileStream::Open(const char* FileName, FileStreamMode Mode, bool Cache)
 	{
 		if (_handle != INVALID_HANDLE_VALUE)
@@ -198,7 +329,10 @@ namespace XCell
 
 		bool bRet = _handle != INVALID_HANDLE_VALUE;
 		if (bRet)
+		{
 			_FileName = FileName;
+			OpenReadAhead(Mode, Cache);
+		}
 		else
 			_ERROR("Couldn't open file: \"%s\"", FileName);
 
@@ -220,7 +354,10 @@ namespace XCell
 
 		bool bRet = _handle != INVALID_HANDLE_VALUE;
 		if (bRet)
+		{
 			_FileName = Utils::WideToAnsi(FileName);
+			OpenReadAhead(Mode, Cache);
+		}
 		else
 			_ERROR("Couldn't open file: \"%s\"", Utils::WideToAnsi(FileName).c_str());
 
@@ -247,6 +384,8 @@ namespace XCell
 			CloseHandle((HANDLE)_handle);
 			_handle = INVALID_HANDLE_VALUE;
 			_FileName.clear();
+			_readAhead.Reset(false);
+			_size = -1;
 		}
 	}
 
@@ -273,29 +412,11 @@ namespace XCell
 		if (!Str)
 			return -1;
 
-		constexpr static size_t MAX = 250;
-
 		std::string sBuf;
 
-		do
-		{
-			char szBuf[MAX + 1];
-			auto ReadBytes = ReadBuf(szBuf, (int32_t)MAX);
-			szBuf[MAX] = 0;
-
-			if (ReadBytes <= 0)
-				return ReadBytes;
-
-			int32_t iL = 0;
-			for (; iL < ReadBytes; iL++)
-				if (szBuf[iL] == '\n')
-				{
-					Seek((int64_t)iL - ReadBytes, StreamOffset::kStreamCurrent);
-					break;
-				}
-			sBuf.append(szBuf, (size_t)iL);
-			if (MAX != iL) break;
-		} while (!Eof());
+		auto ReadBytes = ReadLine(sBuf);
+		if (ReadBytes <= 0)
+			return ReadBytes;
 
 		if (!sBuf.length())
 			return 0;
@@ -305,11 +426,11 @@ namespace XCell
 		if (*Str)
 		{
 			memcpy(*Str, sBuf.c_str(), l);
-			*Str[l] = 0;
+			(*Str)[l] = 0;
 			return l;
 		}
 
-		Seek(-((int64_t)l), StreamOffset::kStreamCurrent);
+		Seek(-((int64_t)ReadBytes), StreamOffset::kStreamCurrent);
 		return -1;
 	}
 
@@ -345,31 +466,22 @@ namespace XCell
 		}
 		else
 		{
-			do
+			if (SourceEncode == TextFileEncode::kTextEncode_UTF8)
 			{
-				char szBuf[MAX + 1];
-				auto ReadBytes = ReadBuf(szBuf, (int32_t)MAX);
-				szBuf[MAX] = 0;
-
+				// The whole line is converted at once, a piece boundary can't split a character
+				std::string sBuf;
+				auto ReadBytes = ReadLine(sBuf);
 				if (ReadBytes <= 0)
 					return ReadBytes;
 
-				int32_t iL = 0;
-				for (; iL < ReadBytes; iL++)
-					if (szBuf[iL] == '\n')
-					{
-						Seek((int64_t)(iL + 1) - ReadBytes, StreamOffset::kStreamCurrent);
-						break;
-					}
-				if (SourceEncode == TextFileEncode::kTextEncode_UTF8)
-				{
-					szBuf[iL] = 0;
-					Str.append(Utils::Utf8ToAnsi(szBuf));
-				}
-				else
-					Str.append(szBuf, (size_t)iL);
-				if (MAX != iL) break;
-			} while (!Eof());
+				Str = Utils::Utf8ToAnsi(sBuf);
+			}
+			else
+			{
+				auto ReadBytes = ReadLine(Str);
+				if (ReadBytes <= 0)
+					return ReadBytes;
+			}
 		}
 
 		return (int32_t)Str.length();
@@ -379,27 +491,9 @@ namespace XCell
 	{
 		Str.clear();
 
-		constexpr static size_t MAX = 250;
-
-		do
-		{
-			char szBuf[MAX + 1];
-			auto ReadBytes = ReadBuf(szBuf, (int32_t)MAX);
-			szBuf[MAX] = 0;
-
-			if (ReadBytes <= 0)
-				return ReadBytes;
-
-			int32_t iL = 0;
-			for (; iL < ReadBytes; iL++)
-				if (szBuf[iL] == '\n')
-				{
-					Seek((int64_t)(iL + 1) - ReadBytes, StreamOffset::kStreamCurrent);
-					break;
-				}
-			Str.append(szBuf, (size_t)iL);
-			if (MAX != iL) break;
-		} while (!Eof());
+		auto ReadBytes = ReadLine(Str);
+		if (ReadBytes <= 0)
+			return ReadBytes;
 
 		return (int32_t)Str.length();
 	}
@@ -0,0 +1,346 @@
+﻿// Copyright © 2024-2025 aka perchik71. All rights reserved.
+// Contacts: <email:timencevaleksej@gmail.com>
+// License: https://www.gnu.org/licenses/gpl-3.0.html
+
+// Benchmark of INI line reading: the old TextFileStream line reader against the FileStream
+// read-ahead buffer, both parsing the same large generated INI the way ParseINI::Parse does.
+//
+// FileStream keeps its handle on Win32, its read-ahead buffer doesn't: ReadAheadBuffer
+// (XCellReadAhead.cpp) reads through a ReadAheadSource, here one over POSIX read/lseek.
+//   old        the reader before the buffer, which is gone from the tree, so it is reproduced
+//              call for call: reads 250 bytes, looks for the newline and seeks back behind it;
+//              Eof(), which ParseINI asks after every line, costs three more seeks;
+//   read-ahead the ReadAheadBuffer of FileStream itself, lines are taken by its ReadLine and
+//              Eof() compares its position with the size taken at open, as FileStream does.
+// The UTF-8 to ANSI conversion of ParseINI is left out, it is the same for both readers.
+//
+// Build:
+//   g++ -std=c++20 -O2 -I../include XCellINIBench.cpp ../source/XCellReadAhead.cpp -o XCellINIBench
+//
+// Run:
+//   XCellINIBench [lines, default 200000] [file, default a temporary one]
+//
+// The file is read once before timing so both readers see it in the page cache.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "XCellReadAhead.h"
+
+namespace XCell
+{
+	namespace Bench
+	{
+		// Piece size of the old line reader
+		constexpr static int32_t OLD_PIECE_SIZE = 250;
+		// Options per section of the generated INI
+		constexpr static size_t OPTIONS_PER_SECTION = 40;
+
+		static double GetSeconds()
+		{
+			struct timespec ts = {};
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+		}
+
+		// A file opened for reading, counts its system calls
+		class File : public ReadAheadSource
+		{
+			int _handle;
+		public:
+			uint64_t Reads;
+			uint64_t Seeks;
+
+			File(const char* FileName) : _handle(open(FileName, O_RDONLY)), Reads(0), Seeks(0) {}
+			~File() { if (_handle >= 0) close(_handle); }
+
+			inline bool IsOpen() const { return _handle >= 0; }
+
+			virtual int32_t Read(void* Buf, int32_t Size)
+			{
+				Reads++;
+				return (int32_t)read(_handle, Buf, (size_t)Size);
+			}
+
+			virtual bool SetPointer(int64_t Position)
+			{
+				return (Position >= 0) && (Seek(Position, SEEK_SET) == Position);
+			}
+
+			int64_t Seek(int64_t Offset, int Whence)
+			{
+				Seeks++;
+				return (int64_t)lseek(_handle, (off_t)Offset, Whence);
+			}
+
+			// As CustomStream::Eof before the read-ahead buffer
+			bool Eof()
+			{
+				auto Safe = Seek(0, SEEK_CUR);
+				auto Size = Seek(0, SEEK_END);
+				Seek(Safe, SEEK_SET);
+				return Safe >= Size;
+			}
+		};
+
+		// TextFileStream::ReadStdStringLine before the read-ahead buffer
+		class OldReader
+		{
+			File& _file;
+		public:
+			OldReader(File& F) : _file(F) {}
+
+			int32_t ReadLine(std::string& Str)
+			{
+				Str.clear();
+
+				do
+				{
+					char szBuf[OLD_PIECE_SIZE + 1];
+					auto ReadBytes = _file.Read(szBuf, OLD_PIECE_SIZE);
+					szBuf[OLD_PIECE_SIZE] = 0;
+
+					if (ReadBytes <= 0)
+						return ReadBytes;
+
+					int32_t iL = 0;
+					for (; iL < ReadBytes; iL++)
+						if (szBuf[iL] == '\n')
+						{
+							_file.Seek((int64_t)(iL + 1) - ReadBytes, SEEK_CUR);
+							break;
+						}
+					Str.append(szBuf, (size_t)iL);
+					if (OLD_PIECE_SIZE != iL) break;
+				} while (!_file.Eof());
+
+				return (int32_t)Str.length();
+			}
+
+			inline bool Eof() { return _file.Eof(); }
+		};
+
+		// FileStream with the read-ahead buffer, as it is opened for reading
+		class ReadAheadReader
+		{
+			File& _file;
+			ReadAheadBuffer _buffer;
+			int64_t _size;
+		public:
+			ReadAheadReader(File& F) : _file(F), _size(0)
+			{
+				_size = _file.Seek(0, SEEK_END);
+				_file.Seek(0, SEEK_SET);
+				_buffer.Reset(true);
+			}
+
+			// As TextFileStream::ReadStdStringLine
+			int32_t ReadLine(std::string& Line)
+			{
+				Line.clear();
+				return _buffer.ReadLine(_file, Line);
+			}
+
+			// As CustomStream::Eof, the position is asked through Seek
+			inline bool Eof() { return _size == _buffer.Seek(_file, _buffer.GetPosition()); }
+		};
+
+		static void Trim(std::string& Str)
+		{
+			auto Start = Str.find_first_not_of(" \t\r\n");
+			if (Start == std::string::npos)
+			{
+				Str.clear();
+				return;
+			}
+
+			auto End = Str.find_last_not_of(" \t\r\n");
+			Str.assign(Str, Start, End - Start + 1);
+		}
+
+		typedef std::unordered_map<std::string, std::unordered_map<std::string, std::string>> Sections;
+
+		// As ParseINI::Parse
+		template<typename _Reader>
+		static size_t Parse(_Reader& Reader, Sections& Result)
+		{
+			std::string current_line;
+			std::string current_section;
+			size_t options = 0;
+
+			do
+			{
+				if (Reader.ReadLine(current_line) < 0)
+					break;
+
+				Trim(current_line);
+				if (current_line.empty())
+					continue;
+
+				switch (current_line[0])
+				{
+				case ';':
+				case '#':
+					break;
+				case '[':
+					current_section = current_line.substr(1, current_line.length() - 2);
+					break;
+				default:
+					auto sep = current_line.find_first_of("=:");
+					if (sep == std::string::npos) break;
+
+					auto name_option = current_line.substr(0, sep);
+					Trim(name_option);
+					auto value_option = current_line.substr(sep + 1);
+					Trim(value_option);
+
+					if (!current_section.empty() && !name_option.empty())
+					{
+						Result[current_section][name_option] = value_option;
+						options++;
+					}
+					break;
+				}
+			} while (!Reader.Eof());
+
+			return options;
+		}
+
+		// Writes an INI of the given number of lines with sections, comments and options of varied length
+		static bool Generate(const char* FileName, size_t Lines)
+		{
+			FILE* f = fopen(FileName, "wb");
+			if (!f)
+				return false;
+
+			uint64_t state = 0x9E3779B97F4A7C15ull;
+			size_t section = 0;
+			for (size_t i = 0; i < Lines; i++)
+			{
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+
+				if (!(i % (OPTIONS_PER_SECTION + 1)))
+					fprintf(f, "[Section%zu]\r\n", section++);
+				else if (!(state % 10))
+					fprintf(f, "; comment line %zu about the option below\r\n", i);
+				else
+				{
+					// Mostly short values, now and then a path or a list longer than a piece of the old reader
+					size_t ValueLength = (state & 15) ? 4 + (state >> 8) % 40 : 200 + (state >> 8) % 400;
+					fprintf(f, "sOption%zu = ", i);
+					for (size_t j = 0; j < ValueLength; j++)
+						fputc('a' + (int)((state >> (j & 31)) % 26), f);
+					fprintf(f, "\r\n");
+				}
+			}
+
+			return !fclose(f);
+		}
+
+		struct Result
+		{
+			double Seconds;
+			size_t Options;
+			uint64_t Reads;
+			uint64_t Seeks;
+		};
+
+		template<typename _Reader>
+		static bool Run(const char* FileName, Result& Out)
+		{
+			File F(FileName);
+			if (!F.IsOpen())
+				return false;
+
+			Sections Data;
+			_Reader* Reader = new _Reader(F);
+
+			double start = GetSeconds();
+			Out.Options = Parse(*Reader, Data);
+			Out.Seconds = GetSeconds() - start;
+			Out.Reads = F.Reads;
+			Out.Seeks = F.Seeks;
+
+			delete Reader;
+			return true;
+		}
+
+		static void PrintResult(const char* Name, const Result& R)
+		{
+			printf("%-11s %9.3f s %10zu %12llu %12llu\n", Name, R.Seconds, R.Options,
+				(unsigned long long)R.Reads, (unsigned long long)R.Seeks);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace XCell::Bench;
+
+	size_t Lines = (argc > 1) ? (size_t)strtoull(argv[1], nullptr, 10) : 200000;
+	if (!Lines)
+	{
+		fprintf(stderr, "usage: %s [lines] [file]\n", argv[0]);
+		return 1;
+	}
+
+	char FileName[] = "/tmp/xcell-ini-XXXXXX";
+	const char* Path = FileName;
+	bool Temporary = argc <= 2;
+	if (Temporary)
+	{
+		int fd = mkstemp(FileName);
+		if (fd < 0)
+		{
+			fprintf(stderr, "can't create a temporary file\n");
+			return 1;
+		}
+		close(fd);
+	}
+	else
+		Path = argv[2];
+
+	if (!Generate(Path, Lines))
+	{
+		fprintf(stderr, "can't write \"%s\"\n", Path);
+		return 1;
+	}
+
+	// Warm up the page cache
+	Result Warm = {};
+	Run<ReadAheadReader>(Path, Warm);
+
+	Result Old = {}, ReadAhead = {};
+	bool Done = Run<OldReader>(Path, Old) && Run<ReadAheadReader>(Path, ReadAhead);
+
+	if (Temporary)
+		unlink(Path);
+
+	if (!Done)
+	{
+		fprintf(stderr, "can't read \"%s\"\n", Path);
+		return 1;
+	}
+
+	printf("%zu lines\n", Lines);
+	printf("%-11s %11s %10s %12s %12s\n", "reader", "time", "options", "reads", "seeks");
+	PrintResult("old", Old);
+	PrintResult("read-ahead", ReadAhead);
+
+	if (Old.Options != ReadAhead.Options)
+	{
+		fprintf(stderr, "readers disagree: %zu and %zu options\n", Old.Options, ReadAhead.Options);
+		return 1;
+	}
+
+	return 0;
+}